@@ -0,0 +1,29 @@
+#!/bin/sh
+
+# A sample certificate validator, to be set as certificate_validator.
+#
+# freelan writes every certificate to validate, in PEM format, to the standard
+# input of the validator. Each certificate must be answered, in order, with a
+# line on the standard output: "OK" accepts the certificate, anything else
+# rejects it.
+#
+# This validator accepts the certificates signed by the certification authority
+# at CA_FILE.
+
+CA_FILE=${CA_FILE:-/etc/freelan/ca.crt}
+CERTIFICATE=""
+
+while IFS= read -r LINE; do
+	CERTIFICATE="${CERTIFICATE}${LINE}
+"
+
+	if [ "$LINE" = "-----END CERTIFICATE-----" ]; then
+		if printf '%s' "$CERTIFICATE" | openssl verify -CAfile "$CA_FILE" 2>/dev/null | grep -q ': OK$'; then
+			echo "OK"
+		else
+			echo "REJECTED"
+		fi
+
+		CERTIFICATE=""
+	fi
+done
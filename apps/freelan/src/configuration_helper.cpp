@@ -47,6 +47,7 @@
 #include "configuration_helper.hpp"
 
 #include <vector>
+#include <algorithm>
 
 #include <boost/asio.hpp>
 #include <boost/foreach.hpp>
@@ -136,6 +137,12 @@ po::options_description get_fscp_options()
 	("fscp.never_contact", po::value<std::vector<asiotap::ip_network_address> >()->multitoken()->zero_tokens()->default_value(std::vector<asiotap::ip_network_address>(), ""), "A network address to avoid when dynamically contacting hosts.")
 	("fscp.cipher_suite_capability", po::value<std::vector<fscp::cipher_suite_type> >()->multitoken()->zero_tokens()->default_value(fscp::get_default_cipher_suites(), ""), "A cipher suite to allow.")
 	("fscp.elliptic_curve_capability", po::value<std::vector<fscp::elliptic_curve_type> >()->multitoken()->zero_tokens()->default_value(fscp::get_default_elliptic_curves(), ""), "A elliptic curve to allow.")
+	("fscp.replay_window_size", po::value<unsigned int>()->default_value(static_cast<unsigned int>(fscp::DEFAULT_REPLAY_WINDOW_SIZE)), "The count of out-of-order messages to accept before dropping them as outdated, between 1 and 65536.")
+	("fscp.io_batch_size", po::value<unsigned int>()->default_value(static_cast<unsigned int>(fscp::DEFAULT_IO_BATCH_SIZE)), "The maximum count of datagrams to receive or send in a single system call.")
+	("fscp.socket_count", po::value<unsigned int>()->default_value(static_cast<unsigned int>(fscp::DEFAULT_SOCKET_COUNT)), "The count of sockets bound on the listen endpoint, each with its own receive loop.")
+	("fscp.segmentation_offload", po::value<bool>()->default_value(false, "no"), "Whether to let the kernel segment and coalesce the datagrams (UDP GSO/GRO).")
+	("fscp.handshake_thread_count", po::value<unsigned int>()->default_value(static_cast<unsigned int>(fscp::DEFAULT_HANDSHAKE_THREAD_COUNT)), "The count of threads that run the handshake cryptography, at most 64. 0 means one per hardware thread.")
+	("fscp.handshake_queue_size", po::value<unsigned int>()->default_value(static_cast<unsigned int>(fscp::DEFAULT_HANDSHAKE_QUEUE_SIZE)), "The maximum count of handshake cryptographic operations that can be pending at once.")
 	;
 
 	return result;
@@ -150,6 +157,7 @@ po::options_description get_security_options()
 	("security.signature_private_key_file", po::value<fs::path>(), "The private key file to use for signing.")
 	("security.certificate_validation_method", po::value<fl::security_configuration::certificate_validation_method_type>()->default_value(fl::security_configuration::CVM_DEFAULT), "The certificate validation method.")
 	("security.certificate_validation_script", po::value<fs::path>()->default_value(""), "The certificate validation script to use.")
+	("security.certificate_validator", po::value<fs::path>()->default_value(""), "The certificate validator process to use.")
 	("security.authority_certificate_file", po::value<std::vector<std::string> >()->multitoken()->zero_tokens()->default_value(std::vector<std::string>(), ""), "An authority certificate file to use.")
 	("security.certificate_revocation_validation_method", po::value<fl::security_configuration::certificate_revocation_validation_method_type>()->default_value(fl::security_configuration::CRVM_NONE), "The certificate revocation validation method.")
 	("security.certificate_revocation_list_file", po::value<std::vector<std::string> >()->multitoken()->zero_tokens()->default_value(std::vector<std::string>(), ""), "A certificate revocation list file to use.")
@@ -173,6 +181,7 @@ po::options_description get_tap_adapter_options()
 	("tap_adapter.name", po::value<std::string>(), "The name of the tap adapter to use or create.")
 	("tap_adapter.mtu", po::value<fl::mtu_type>()->default_value(fl::auto_mtu_type()), "The MTU of the tap adapter.")
 	("tap_adapter.metric", po::value<fl::metric_type>()->default_value(fl::auto_metric_type()), "The metric of the tap adapter.")
+	("tap_adapter.queue_count", po::value<unsigned int>()->default_value(1), "The count of queues to open on the tap adapter.")
 	("tap_adapter.ipv4_address_prefix_length", po::value<asiotap::ipv4_network_address>()->default_value(default_ipv4_network_address), "The tap adapter IPv4 address and prefix length.")
 	("tap_adapter.ipv6_address_prefix_length", po::value<asiotap::ipv6_network_address>()->default_value(default_ipv6_network_address), "The tap adapter IPv6 address and prefix length.")
 	("tap_adapter.remote_ipv4_address", po::value<asiotap::ipv4_network_address>(), "The tap adapter IPv4 remote address.")
@@ -195,6 +204,7 @@ po::options_description get_switch_options()
 	result.add_options()
 	("switch.routing_method", po::value<fl::switch_configuration::routing_method_type>()->default_value(fl::switch_configuration::RM_SWITCH), "The routing method for messages.")
 	("switch.relay_mode_enabled", po::value<bool>()->default_value(false, "no"), "Whether to enable the relay mode.")
+	("switch.mac_aging_time", po::value<millisecond_duration>()->default_value(300000), "The time after which a learned ethernet address is forgotten, in milliseconds.")
 	;
 
 	return result;
@@ -336,6 +346,24 @@ void setup_configuration(fl::configuration& configuration, const boost::filesyst
 	configuration.fscp.never_contact_list = vm["fscp.never_contact"].as<std::vector<asiotap::ip_network_address>>();
 	configuration.fscp.cipher_suite_capabilities = vm["fscp.cipher_suite_capability"].as<std::vector<fscp::cipher_suite_type>>();
 	configuration.fscp.elliptic_curve_capabilities = vm["fscp.elliptic_curve_capability"].as<std::vector<fscp::elliptic_curve_type>>();
+	configuration.fscp.replay_window_size = vm["fscp.replay_window_size"].as<unsigned int>();
+
+	if ((configuration.fscp.replay_window_size == 0) || (configuration.fscp.replay_window_size > fscp::MAX_REPLAY_WINDOW_SIZE))
+	{
+		throw po::validation_error(po::validation_error::invalid_option_value, "fscp.replay_window_size");
+	}
+
+	configuration.fscp.io_batch_size = vm["fscp.io_batch_size"].as<unsigned int>();
+	configuration.fscp.socket_count = vm["fscp.socket_count"].as<unsigned int>();
+	configuration.fscp.segmentation_offload = vm["fscp.segmentation_offload"].as<bool>();
+	configuration.fscp.handshake_thread_count = vm["fscp.handshake_thread_count"].as<unsigned int>();
+
+	if (configuration.fscp.handshake_thread_count > fscp::MAX_HANDSHAKE_THREAD_COUNT)
+	{
+		throw po::validation_error(po::validation_error::invalid_option_value, "fscp.handshake_thread_count");
+	}
+
+	configuration.fscp.handshake_queue_size = vm["fscp.handshake_queue_size"].as<unsigned int>();
 
 	// Security options
 	cert_type signature_certificate;
@@ -389,6 +417,7 @@ void setup_configuration(fl::configuration& configuration, const boost::filesyst
 
 	configuration.tap_adapter.mtu = vm["tap_adapter.mtu"].as<fl::mtu_type>();
 	configuration.tap_adapter.metric = vm["tap_adapter.metric"].as<fl::metric_type>();
+	configuration.tap_adapter.queue_count = std::max(vm["tap_adapter.queue_count"].as<unsigned int>(), 1u);
 	configuration.tap_adapter.ipv4_address_prefix_length = vm["tap_adapter.ipv4_address_prefix_length"].as<asiotap::ipv4_network_address>();
 	configuration.tap_adapter.ipv6_address_prefix_length = vm["tap_adapter.ipv6_address_prefix_length"].as<asiotap::ipv6_network_address>();
 
@@ -406,6 +435,7 @@ void setup_configuration(fl::configuration& configuration, const boost::filesyst
 	// Switch options
 	configuration.switch_.routing_method = vm["switch.routing_method"].as<fl::switch_configuration::routing_method_type>();
 	configuration.switch_.relay_mode_enabled = vm["switch.relay_mode_enabled"].as<bool>();
+	configuration.switch_.mac_aging_time = vm["switch.mac_aging_time"].as<millisecond_duration>().to_time_duration();
 
 	// Router
 	const auto local_ip_routes = vm["router.local_ip_route"].as<std::vector<asiotap::ip_route> >();
@@ -438,3 +468,10 @@ boost::filesystem::path get_certificate_validation_script(const boost::filesyste
 
 	return certificate_validation_script_file.empty() ? certificate_validation_script_file : fs::absolute(certificate_validation_script_file, root);
 }
+
+boost::filesystem::path get_certificate_validator(const boost::filesystem::path& root, const boost::program_options::variables_map& vm)
+{
+	fs::path certificate_validator_file = vm["security.certificate_validator"].as<fs::path>();
+
+	return certificate_validator_file.empty() ? certificate_validator_file : fs::absolute(certificate_validator_file, root);
+}
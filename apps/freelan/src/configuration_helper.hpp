@@ -121,4 +121,12 @@ boost::filesystem::path get_tap_adapter_down_script(const boost::filesystem::pat
  */
 boost::filesystem::path get_certificate_validation_script(const boost::filesystem::path& root, const boost::program_options::variables_map& vm);
 
+/**
+ * \brief Get the certificate validator.
+ * \param root The root directory for file operations.
+ * \param vm The variables map.
+ * \return The certificate validator.
+ */
+boost::filesystem::path get_certificate_validator(const boost::filesystem::path& root, const boost::program_options::variables_map& vm);
+
 #endif /* CONFIGURATION_HELPER_HPP */
@@ -54,6 +54,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread/thread.hpp>
 
 #include <cryptoplus/cryptoplus.hpp>
@@ -424,6 +425,13 @@ bool parse_options(int argc, char** argv, cli_configuration& configuration)
 		configuration.fl_configuration.security.certificate_validation_script = certificate_validation_script;
 	}
 
+	const fs::path certificate_validator = get_certificate_validator(execution_root_directory, vm);
+
+	if (!certificate_validator.empty())
+	{
+		configuration.fl_configuration.security.certificate_validator = certificate_validator;
+	}
+
 	configuration.debug = vm.count("debug") > 0;
 
 	return true;
@@ -466,6 +474,16 @@ void run(const cli_configuration& configuration, int& exit_signal)
 
 	const freelan::logger logger(log_func, log_level);
 
+#ifndef WINDOWS
+	// The validator must outlive the core, which holds a reference to it.
+	boost::scoped_ptr<certificate_validator> validator;
+
+	if (!configuration.fl_configuration.security.certificate_validator.empty())
+	{
+		validator.reset(new certificate_validator(io_service, configuration.fl_configuration.security.certificate_validator, logger));
+	}
+#endif
+
 	fl::core core(io_service, configuration.fl_configuration);
 
 	core.set_log_level(log_level);
@@ -486,6 +504,18 @@ void run(const cli_configuration& configuration, int& exit_signal)
 		core.set_certificate_validation_callback(boost::bind(&execute_certificate_validation_script, configuration.fl_configuration.security.certificate_validation_script, logger, _1));
 	}
 
+#ifndef WINDOWS
+	if (validator)
+	{
+		core.set_async_certificate_validation_callback(boost::bind(&certificate_validator::async_validate, validator.get(), _1, _2));
+	}
+#else
+	if (!configuration.fl_configuration.security.certificate_validator.empty())
+	{
+		logger(fl::LL_WARNING) << "The certificate validator is not supported on Windows: ignoring it.";
+	}
+#endif
+
 	core.open();
 
 	signals.async_wait(boost::bind(signal_handler, _1, _2, boost::ref(core), boost::ref(exit_signal)));
@@ -51,8 +51,19 @@
 #include <codecvt>
 #else
 #include <syslog.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 #endif
 
+#include <boost/make_shared.hpp>
+
+#include <cryptoplus/bio/bio_chain.hpp>
+
+#include <fscp/constants.hpp>
+
 #include <freelan/logger.hpp>
 
 #include "system.hpp"
@@ -185,3 +196,385 @@ bool execute_certificate_validation_script(const fs::path& script, const freelan
 		return false;
 	}
 }
+
+#ifndef WINDOWS
+const boost::posix_time::time_duration certificate_validator::VALIDATION_TIMEOUT = boost::posix_time::seconds(10);
+
+certificate_validator::certificate_validator(boost::asio::io_service& io_service, const fs::path& validator, const freelan::logger& logger) :
+	m_strand(io_service),
+	m_validator(validator),
+	m_logger(logger),
+	m_cache(fl::core::CERTIFICATE_CACHE_SIZE, fl::core::CERTIFICATE_CACHE_TTL, fl::core::CERTIFICATE_CACHE_NEGATIVE_TTL),
+	m_pid(-1),
+	m_process_generation(0),
+	m_socket(io_service),
+	m_read_buffer(),
+	m_read_in_progress(false),
+	m_write_queue(),
+	m_pending_validations(),
+	m_timeout_timer(io_service)
+{
+}
+
+certificate_validator::~certificate_validator()
+{
+	// The handlers may refer to objects that are already gone: they must not be called anymore.
+	m_pending_validations.clear();
+
+	stop();
+}
+
+void certificate_validator::async_validate(cert_type cert, handler_type handler)
+{
+	const freelan::certificate_cache::key_type hash = fscp::get_certificate_hash(cert);
+	const boost::optional<bool> verdict = m_cache.find(hash, boost::posix_time::second_clock::universal_time());
+
+	if (verdict)
+	{
+		handler(*verdict);
+
+		return;
+	}
+
+	m_strand.post(boost::bind(&certificate_validator::do_validate, this, cert, hash, handler));
+}
+
+void certificate_validator::do_validate(cert_type cert, const freelan::certificate_cache::key_type& hash, handler_type handler)
+{
+	// do_validate() is executed within the strand so this is safe.
+
+	// A host usually presents its certificate several times in a row: the presentations share a single validation.
+	for (auto&& pending_validation : m_pending_validations)
+	{
+		if (pending_validation.hash == hash)
+		{
+			pending_validation.handlers.push_back(handler);
+
+			return;
+		}
+	}
+
+	boost::shared_ptr<std::string> data;
+
+	try
+	{
+		cryptoplus::bio::bio_chain bio(::BIO_new(::BIO_s_mem()));
+		cert.write_certificate(bio.first());
+
+		char* buf = nullptr;
+		const size_t buf_len = bio.first().get_mem_data(buf);
+
+		data = boost::make_shared<std::string>(buf, buf_len);
+	}
+	catch (std::exception& ex)
+	{
+		m_logger(freelan::LL_WARNING) << "Unable to send the certificate to the certificate validator: " << ex.what();
+
+		handler(false);
+
+		return;
+	}
+
+	if ((m_pid < 0) && !start())
+	{
+		handler(false);
+
+		return;
+	}
+
+	m_pending_validations.push_back(pending_validation_type(hash, cert.not_after().to_ptime(), data));
+	m_pending_validations.back().handlers.push_back(handler);
+
+	push_write(data);
+
+	if (m_pending_validations.size() == 1)
+	{
+		async_wait_timeout();
+	}
+
+	async_read_verdict();
+}
+
+bool certificate_validator::start()
+{
+	// Nothing may be allocated between fork() and exec(), as other threads could hold the allocator lock.
+	const std::string validator = m_validator.string();
+
+	int fds[2];
+	int type = SOCK_STREAM;
+
+#ifdef SOCK_CLOEXEC
+	type |= SOCK_CLOEXEC;
+#endif
+
+	if (::socketpair(AF_UNIX, type, 0, fds) != 0)
+	{
+		m_logger(freelan::LL_ERROR) << "Unable to create the certificate validator socket: " << boost::system::error_code(errno, boost::system::system_category()).message();
+
+		return false;
+	}
+
+	const pid_t pid = ::fork();
+
+	if (pid < 0)
+	{
+		m_logger(freelan::LL_ERROR) << "Unable to start the certificate validator (" << m_validator << "): " << boost::system::error_code(errno, boost::system::system_category()).message();
+
+		::close(fds[0]);
+		::close(fds[1]);
+
+		return false;
+	}
+
+	if (pid == 0)
+	{
+		// The validator reads the certificates on its standard input and writes its verdicts on its standard output.
+		::close(fds[0]);
+		::dup2(fds[1], STDIN_FILENO);
+		::dup2(fds[1], STDOUT_FILENO);
+
+		if (fds[1] > STDOUT_FILENO)
+		{
+			::close(fds[1]);
+		}
+
+		::execl(validator.c_str(), validator.c_str(), static_cast<char*>(NULL));
+		::_exit(127);
+	}
+
+	::close(fds[1]);
+	::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+	boost::system::error_code ec;
+	m_socket.assign(boost::asio::local::stream_protocol(), fds[0], ec);
+
+	m_pid = pid;
+
+	if (ec)
+	{
+		m_logger(freelan::LL_ERROR) << "Unable to communicate with the certificate validator: " << ec.message();
+
+		::close(fds[0]);
+		stop();
+
+		return false;
+	}
+
+	m_logger(freelan::LL_INFORMATION) << "Certificate validator started (" << m_validator << ", PID " << m_pid << ").";
+
+	return true;
+}
+
+void certificate_validator::stop()
+{
+	if (m_pid > 0)
+	{
+		boost::system::error_code ec;
+		m_socket.close(ec);
+
+		::kill(m_pid, SIGKILL);
+		::waitpid(m_pid, NULL, 0);
+
+		m_pid = -1;
+	}
+
+	++m_process_generation;
+
+	m_read_buffer.consume(m_read_buffer.size());
+	m_read_in_progress = false;
+	m_write_queue = std::queue<boost::shared_ptr<std::string> >();
+	m_timeout_timer.cancel();
+
+	// Those verdicts are not cached: the next presentations will be validated again.
+	while (!m_pending_validations.empty())
+	{
+		const pending_validation_type pending_validation = m_pending_validations.front();
+		m_pending_validations.pop_front();
+
+		for (auto&& handler : pending_validation.handlers)
+		{
+			handler(false);
+		}
+	}
+}
+
+void certificate_validator::restart()
+{
+	// A validator that exited while idle is only noticed once a certificate is sent to it: the pending certificates are sent once more to a new process.
+	std::deque<pending_validation_type> pending_validations;
+	std::deque<pending_validation_type> retried_validations;
+
+	for (auto&& pending_validation : m_pending_validations)
+	{
+		if (pending_validation.retried)
+		{
+			retried_validations.push_back(pending_validation);
+		}
+		else
+		{
+			pending_validations.push_back(pending_validation);
+			pending_validations.back().retried = true;
+		}
+	}
+
+	// The certificates that were already sent twice are rejected by stop().
+	m_pending_validations.swap(retried_validations);
+
+	stop();
+
+	if (pending_validations.empty())
+	{
+		return;
+	}
+
+	if (!start())
+	{
+		for (auto&& pending_validation : pending_validations)
+		{
+			for (auto&& handler : pending_validation.handlers)
+			{
+				handler(false);
+			}
+		}
+
+		return;
+	}
+
+	m_pending_validations.swap(pending_validations);
+
+	for (auto&& pending_validation : m_pending_validations)
+	{
+		push_write(pending_validation.data);
+	}
+
+	async_wait_timeout();
+	async_read_verdict();
+}
+
+void certificate_validator::push_write(boost::shared_ptr<std::string> data)
+{
+	m_write_queue.push(data);
+
+	if (m_write_queue.size() == 1)
+	{
+		boost::asio::async_write(m_socket, boost::asio::buffer(*data), m_strand.wrap(boost::bind(&certificate_validator::handle_write, this, m_process_generation, boost::asio::placeholders::error)));
+	}
+}
+
+void certificate_validator::handle_write(unsigned int process_generation, const boost::system::error_code& ec)
+{
+	if (process_generation != m_process_generation)
+	{
+		// The validator was stopped: the write queue was already cleared.
+		return;
+	}
+
+	if (ec)
+	{
+		m_logger(freelan::LL_WARNING) << "Unable to send the certificate to the certificate validator: " << ec.message();
+
+		restart();
+
+		return;
+	}
+
+	m_write_queue.pop();
+
+	if (!m_write_queue.empty())
+	{
+		boost::asio::async_write(m_socket, boost::asio::buffer(*m_write_queue.front()), m_strand.wrap(boost::bind(&certificate_validator::handle_write, this, m_process_generation, boost::asio::placeholders::error)));
+	}
+}
+
+void certificate_validator::async_read_verdict()
+{
+	// We only read while verdicts are expected, so that an idle validator doesn't keep the io_service running.
+	if (m_read_in_progress || m_pending_validations.empty())
+	{
+		return;
+	}
+
+	m_read_in_progress = true;
+
+	boost::asio::async_read_until(m_socket, m_read_buffer, '\n', m_strand.wrap(boost::bind(&certificate_validator::handle_read_verdict, this, m_process_generation, boost::asio::placeholders::error)));
+}
+
+void certificate_validator::handle_read_verdict(unsigned int process_generation, const boost::system::error_code& ec)
+{
+	if (process_generation != m_process_generation)
+	{
+		// The validator was stopped: the pending validations were already rejected.
+		return;
+	}
+
+	m_read_in_progress = false;
+
+	if (ec)
+	{
+		m_logger(freelan::LL_WARNING) << "The certificate validator (" << m_validator << ") exited: " << ec.message();
+
+		restart();
+
+		return;
+	}
+
+	std::istream is(&m_read_buffer);
+	std::string line;
+	std::getline(is, line);
+
+	if (!line.empty() && (line[line.size() - 1] == '\r'))
+	{
+		line.resize(line.size() - 1);
+	}
+
+	complete_validation(line == "OK");
+
+	if (m_pending_validations.empty())
+	{
+		m_timeout_timer.cancel();
+	}
+	else
+	{
+		async_wait_timeout();
+
+		async_read_verdict();
+	}
+}
+
+void certificate_validator::async_wait_timeout()
+{
+	m_timeout_timer.expires_from_now(VALIDATION_TIMEOUT);
+	m_timeout_timer.async_wait(m_strand.wrap(boost::bind(&certificate_validator::handle_timeout, this, m_process_generation, boost::asio::placeholders::error)));
+}
+
+void certificate_validator::handle_timeout(unsigned int process_generation, const boost::system::error_code& ec)
+{
+	// The timer may have been rearmed after it expired but before this handler was invoked.
+	if ((process_generation != m_process_generation) || (ec == boost::asio::error::operation_aborted) || (m_pending_validations.empty()) || (m_timeout_timer.expires_at() > boost::asio::deadline_timer::traits_type::now()))
+	{
+		return;
+	}
+
+	m_logger(freelan::LL_WARNING) << "The certificate validator (" << m_validator << ") did not answer in time: restarting it.";
+
+	stop();
+}
+
+void certificate_validator::complete_validation(bool verdict)
+{
+	const pending_validation_type pending_validation = m_pending_validations.front();
+	m_pending_validations.pop_front();
+
+	m_cache.insert(pending_validation.hash, verdict, m_cache.generation(), boost::posix_time::second_clock::universal_time(), pending_validation.not_after);
+
+	if (m_logger.level() <= freelan::LL_DEBUG)
+	{
+		m_logger(freelan::LL_DEBUG) << "The certificate validator " << (verdict ? "accepted" : "rejected") << " certificate " << pending_validation.hash << ".";
+	}
+
+	for (auto&& handler : pending_validation.handlers)
+	{
+		handler(verdict);
+	}
+}
+#endif
@@ -53,9 +53,19 @@
 #include <freelan/os.hpp>
 #include <freelan/logger.hpp>
 #include <freelan/core.hpp>
+#include <freelan/certificate_cache.hpp>
 
 #include <asiotap/tap_adapter.hpp>
 
+#ifndef WINDOWS
+#include <sys/types.h>
+
+#include <deque>
+#include <queue>
+#include <string>
+#include <vector>
+#endif
+
 #ifndef WINDOWS
 /**
  * \brief Convert the specified log level to its syslog equivalent priority.
@@ -97,4 +107,99 @@ void execute_tap_adapter_down_script(const boost::filesystem::path& script, cons
  */
 bool execute_certificate_validation_script(const boost::filesystem::path& script, const freelan::logger& logger, freelan::security_configuration::cert_type cert);
 
+#ifndef WINDOWS
+/**
+ * \brief A long-lived certificate validation process.
+ *
+ * The process is started once and every certificate to validate is written in PEM format to its standard input. The process answers each certificate, in order, with a line on its standard output: "OK" accepts the certificate, anything else rejects it.
+ *
+ * Verdicts are cached, so that hosts that reconnect often are not validated again every time. If the process exits or doesn't answer in time, the pending certificates are rejected and the process is started again for the next certificate.
+ */
+class certificate_validator
+{
+	public:
+
+		/**
+		 * \brief The certificate type.
+		 */
+		typedef freelan::security_configuration::cert_type cert_type;
+
+		/**
+		 * \brief The validation result handler type.
+		 */
+		typedef freelan::core::certificate_validation_result_handler_type handler_type;
+
+		/**
+		 * \brief The time the validator has to answer a certificate.
+		 */
+		static const boost::posix_time::time_duration VALIDATION_TIMEOUT;
+
+		/**
+		 * \brief Create a certificate validator.
+		 * \param io_service The io_service to use.
+		 * \param validator The validator executable. It is only started when the first certificate must be validated.
+		 * \param logger The logger instance.
+		 */
+		certificate_validator(boost::asio::io_service& io_service, const boost::filesystem::path& validator, const freelan::logger& logger);
+
+		/**
+		 * \brief Destroy the certificate validator, terminating its process.
+		 */
+		~certificate_validator();
+
+		/**
+		 * \brief Validate a certificate.
+		 * \param cert The certificate.
+		 * \param handler The handler to call with the verdict. It is called immediately if the verdict is cached.
+		 */
+		void async_validate(cert_type cert, handler_type handler);
+
+	private:
+
+		struct pending_validation_type
+		{
+			pending_validation_type(const freelan::certificate_cache::key_type& _hash, const freelan::certificate_cache::time_type& _not_after, boost::shared_ptr<std::string> _data) :
+				hash(_hash),
+				not_after(_not_after),
+				data(_data),
+				retried(false),
+				handlers()
+			{}
+
+			freelan::certificate_cache::key_type hash;
+			freelan::certificate_cache::time_type not_after;
+			boost::shared_ptr<std::string> data;
+			bool retried;
+			std::vector<handler_type> handlers;
+		};
+
+		void do_validate(cert_type, const freelan::certificate_cache::key_type&, handler_type);
+		bool start();
+		void stop();
+		void restart();
+		void push_write(boost::shared_ptr<std::string>);
+		void handle_write(unsigned int, const boost::system::error_code&);
+		void async_read_verdict();
+		void handle_read_verdict(unsigned int, const boost::system::error_code&);
+		void async_wait_timeout();
+		void handle_timeout(unsigned int, const boost::system::error_code&);
+		void complete_validation(bool);
+
+		boost::asio::strand m_strand;
+		boost::filesystem::path m_validator;
+		freelan::logger m_logger;
+		freelan::certificate_cache m_cache;
+
+		// Only accessed within the strand. The handlers of a previous process are told apart by the process generation.
+		pid_t m_pid;
+		unsigned int m_process_generation;
+		boost::asio::local::stream_protocol::socket m_socket;
+		boost::asio::streambuf m_read_buffer;
+		bool m_read_in_progress;
+		std::queue<boost::shared_ptr<std::string> > m_write_queue;
+		std::deque<pending_validation_type> m_pending_validations;
+		boost::asio::deadline_timer m_timeout_timer;
+};
+#endif
+
 #endif /* TOOLS_HPP */
@@ -47,14 +47,18 @@
 
 #include <string>
 #include <map>
+#include <vector>
+#include <utility>
 #include <iostream>
 
 #include <boost/asio.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/weak_ptr.hpp>
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
 #include <boost/system/system_error.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "types/ip_route.hpp"
 
@@ -136,6 +140,13 @@ namespace asiotap
 					{
 					}
 
+					entry_type_impl(base_route_manager& route_manager, const route_type& _route, bool success) :
+						m_route_manager(route_manager),
+						m_route(_route),
+						m_success(success)
+					{
+					}
+
 					base_route_manager& m_route_manager;
 					route_type m_route;
 					bool m_success;
@@ -148,6 +159,11 @@ namespace asiotap
 			 */
 			typedef boost::shared_ptr<entry_type_impl> entry_type;
 
+			/**
+			 * \brief The route entries handler type.
+			 */
+			typedef boost::function<void (const std::vector<entry_type>&)> route_entries_handler_type;
+
 			/**
 			 * \brief The registration success handler type.
 			 */
@@ -168,6 +184,16 @@ namespace asiotap
 			 */
 			typedef boost::function<void(const route_type&, const boost::system::system_error&)> route_unregistration_failure_handler_type;
 
+			/**
+			 * \brief The system routes handler type.
+			 */
+			typedef boost::function<void (const std::map<boost::asio::ip::address, route_type>&)> system_routes_handler_type;
+
+			/**
+			 * \brief The network change handler type.
+			 */
+			typedef boost::function<void ()> network_change_handler_type;
+
 			explicit base_route_manager(boost::asio::io_service& io_service_) :
 				m_io_service(io_service_)
 			{
@@ -204,6 +230,27 @@ namespace asiotap
 				m_route_unregistration_failure_handler = handler;
 			}
 
+			/**
+			 * \brief Start monitoring the network changes.
+			 * \param handler The handler to call whenever a link, an address or a route changes on the system. Calls are serialized.
+			 *
+			 * On systems that provide no change notifications, nothing is monitored and the handler is never called.
+			 */
+			void start_network_monitoring(network_change_handler_type handler)
+			{
+				m_network_change_handler = handler;
+
+				static_cast<RouteManagerType*>(this)->start_monitoring();
+			}
+
+			/**
+			 * \brief Stop monitoring the network changes.
+			 */
+			void stop_network_monitoring()
+			{
+				static_cast<RouteManagerType*>(this)->stop_monitoring();
+			}
+
 			bool register_route(const route_type& route)
 			{
 				try
@@ -254,6 +301,8 @@ namespace asiotap
 
 			entry_type get_route_entry(const route_type& route)
 			{
+				boost::mutex::scoped_lock lock(m_entry_table_mutex);
+
 				entry_type entry = m_entry_table[route].lock();
 
 				if (!entry)
@@ -266,18 +315,330 @@ namespace asiotap
 				return entry;
 			}
 
+			/**
+			 * \brief Get route entries asynchronously.
+			 * \param routes The routes.
+			 * \param handler The handler to call with the entries, in the same order as routes.
+			 *
+			 * The missing routes are registered together, possibly in a single system call, and never from within the calling thread. A route that is already being registered by another call is not registered twice: both calls get the same entry once the registration completes.
+			 */
+			void async_get_route_entries(const std::vector<route_type>& routes, route_entries_handler_type handler)
+			{
+				const boost::shared_ptr<route_entries_request_type> request = boost::make_shared<route_entries_request_type>();
+				request->entries.resize(routes.size());
+				request->remaining = 0;
+				request->handler = handler;
+
+				std::vector<route_type> missing_routes;
+
+				{
+					boost::mutex::scoped_lock lock(m_entry_table_mutex);
+
+					for (size_t index = 0; index < routes.size(); ++index)
+					{
+						request->entries[index] = m_entry_table[routes[index]].lock();
+
+						if (!request->entries[index])
+						{
+							++request->remaining;
+
+							const typename pending_registration_table_type::iterator pending_registration = m_pending_registration_table.find(routes[index]);
+
+							// Only the first request for a route registers it: the others wait for its completion.
+							if (pending_registration == m_pending_registration_table.end())
+							{
+								missing_routes.push_back(routes[index]);
+							}
+
+							m_pending_registration_table[routes[index]].push_back(std::make_pair(request, index));
+						}
+					}
+				}
+
+				if (request->remaining == 0)
+				{
+					m_io_service.post([request]() {
+						request->handler(request->entries);
+					});
+				}
+				else if (!missing_routes.empty())
+				{
+					static_cast<RouteManagerType*>(this)->async_register_routes(missing_routes, [this, missing_routes](const std::vector<boost::system::error_code>& results) {
+						complete_route_registrations(missing_routes, results);
+					});
+				}
+			}
+
+			/**
+			 * \brief Get the routes the system uses to reach some hosts, asynchronously.
+			 * \param hosts The hosts.
+			 * \param handler The handler to call with the routes. The hosts the system has no route for are missing from the result.
+			 *
+			 * Where the system allows it, the routes registered by this route manager are ignored: the result tells how the hosts would be reached without them. The queries are never done from within the calling thread.
+			 */
+			void async_get_system_routes_for(const std::vector<boost::asio::ip::address>& hosts, system_routes_handler_type handler)
+			{
+				m_io_service.post([this, hosts, handler]() {
+					handler(static_cast<RouteManagerType*>(this)->get_system_routes_for(hosts));
+				});
+			}
+
+			/**
+			 * \brief Release route entries asynchronously.
+			 * \param entries The entries to release.
+			 *
+			 * The routes of the entries that are not referenced anywhere else are unregistered together, possibly in a single system call, and never from within the calling thread. The other entries are simply dropped.
+			 */
+			void async_release_route_entries(std::vector<entry_type> entries)
+			{
+				std::vector<route_type> routes;
+
+				for (auto&& entry : entries)
+				{
+					if (entry && (entry.use_count() == 1) && entry->m_success)
+					{
+						// The entry won't unregister its route upon destruction anymore.
+						entry->m_success = false;
+
+						routes.push_back(entry->m_route);
+					}
+				}
+
+				entries.clear();
+
+				if (!routes.empty())
+				{
+					static_cast<RouteManagerType*>(this)->async_unregister_routes(routes, [this, routes](const std::vector<boost::system::error_code>& results) {
+						for (size_t index = 0; index < routes.size(); ++index)
+						{
+							notify_route_unregistration(routes[index], results[index]);
+						}
+					});
+				}
+			}
+
 		protected:
 
 			typedef std::map<route_type, boost::weak_ptr<entry_type_impl>> entry_table_type;
 
+			/**
+			 * \brief The route results handler type.
+			 */
+			typedef boost::function<void (const std::vector<boost::system::error_code>&)> route_results_handler_type;
+
+			/**
+			 * \brief Register routes asynchronously.
+			 * \param routes The routes to register.
+			 * \param handler The handler to call with one error code per route.
+			 *
+			 * This default implementation registers the routes one by one from within the io_service. Implementations may hide it with a batched one.
+			 */
+			void async_register_routes(const std::vector<route_type>& routes, route_results_handler_type handler)
+			{
+				m_io_service.post([this, routes, handler]() {
+					std::vector<boost::system::error_code> results;
+
+					for (auto&& route : routes)
+					{
+						try
+						{
+							static_cast<RouteManagerType*>(this)->register_route(route);
+
+							results.push_back(boost::system::error_code());
+						}
+						catch (boost::system::system_error& ex)
+						{
+							results.push_back(ex.code());
+						}
+					}
+
+					handler(results);
+				});
+			}
+
+			/**
+			 * \brief Unregister routes asynchronously.
+			 * \param routes The routes to unregister.
+			 * \param handler The handler to call with one error code per route.
+			 *
+			 * This default implementation unregisters the routes one by one from within the io_service. Implementations may hide it with a batched one.
+			 */
+			void async_unregister_routes(const std::vector<route_type>& routes, route_results_handler_type handler)
+			{
+				m_io_service.post([this, routes, handler]() {
+					std::vector<boost::system::error_code> results;
+
+					for (auto&& route : routes)
+					{
+						try
+						{
+							static_cast<RouteManagerType*>(this)->unregister_route(route);
+
+							results.push_back(boost::system::error_code());
+						}
+						catch (boost::system::system_error& ex)
+						{
+							results.push_back(ex.code());
+						}
+					}
+
+					handler(results);
+				});
+			}
+
+			/**
+			 * \brief Get the routes the system uses to reach some hosts.
+			 * \param hosts The hosts.
+			 * \return The routes. The hosts the system has no route for are missing.
+			 *
+			 * This default implementation queries the routes one by one, including the ones registered by this route manager. Implementations may hide it with one that ignores them.
+			 */
+			std::map<boost::asio::ip::address, route_type> get_system_routes_for(const std::vector<boost::asio::ip::address>& hosts)
+			{
+				std::map<boost::asio::ip::address, route_type> result;
+
+				for (auto&& host : hosts)
+				{
+					try
+					{
+						result[host] = static_cast<RouteManagerType*>(this)->get_route_for(host);
+					}
+					catch (boost::system::system_error&)
+					{
+						// No route to the host.
+					}
+				}
+
+				return result;
+			}
+
+			/**
+			 * \brief Start monitoring the network changes.
+			 *
+			 * This default implementation does nothing. Implementations may hide it with one that calls notify_network_change() on every change.
+			 */
+			void start_monitoring()
+			{
+			}
+
+			/**
+			 * \brief Stop monitoring the network changes.
+			 */
+			void stop_monitoring()
+			{
+			}
+
+			/**
+			 * \brief Notify a network change.
+			 */
+			void notify_network_change()
+			{
+				if (m_network_change_handler)
+				{
+					m_network_change_handler();
+				}
+			}
+
 		private:
 
+			struct route_entries_request_type
+			{
+				std::vector<entry_type> entries;
+				size_t remaining;
+				route_entries_handler_type handler;
+			};
+
+			typedef std::vector<std::pair<boost::shared_ptr<route_entries_request_type>, size_t>> route_entries_waiter_list;
+			typedef std::map<route_type, route_entries_waiter_list> pending_registration_table_type;
+
+			void complete_route_registrations(const std::vector<route_type>& routes, const std::vector<boost::system::error_code>& results)
+			{
+				std::vector<boost::shared_ptr<route_entries_request_type>> completed_requests;
+
+				{
+					boost::mutex::scoped_lock lock(m_entry_table_mutex);
+
+					for (size_t index = 0; index < routes.size(); ++index)
+					{
+						entry_type entry = m_entry_table[routes[index]].lock();
+
+						// A synchronous call may have registered the same route in the meantime.
+						if (!entry)
+						{
+							entry = boost::shared_ptr<entry_type_impl>(new entry_type_impl(*this, routes[index], !results[index]));
+
+							m_entry_table[routes[index]] = entry;
+						}
+
+						const typename pending_registration_table_type::iterator pending_registration = m_pending_registration_table.find(routes[index]);
+
+						if (pending_registration != m_pending_registration_table.end())
+						{
+							for (auto&& waiter : pending_registration->second)
+							{
+								waiter.first->entries[waiter.second] = entry;
+
+								if (--waiter.first->remaining == 0)
+								{
+									completed_requests.push_back(waiter.first);
+								}
+							}
+
+							m_pending_registration_table.erase(pending_registration);
+						}
+					}
+				}
+
+				for (size_t index = 0; index < routes.size(); ++index)
+				{
+					notify_route_registration(routes[index], results[index]);
+				}
+
+				for (auto&& request : completed_requests)
+				{
+					request->handler(request->entries);
+				}
+			}
+
+			void notify_route_registration(const route_type& route, const boost::system::error_code& ec)
+			{
+				if (!ec)
+				{
+					if (m_route_registration_success_handler)
+					{
+						m_route_registration_success_handler(route);
+					}
+				}
+				else if (m_route_registration_failure_handler)
+				{
+					m_route_registration_failure_handler(route, boost::system::system_error(ec));
+				}
+			}
+
+			void notify_route_unregistration(const route_type& route, const boost::system::error_code& ec)
+			{
+				if (!ec)
+				{
+					if (m_route_unregistration_success_handler)
+					{
+						m_route_unregistration_success_handler(route);
+					}
+				}
+				else if (m_route_unregistration_failure_handler)
+				{
+					m_route_unregistration_failure_handler(route, boost::system::system_error(ec));
+				}
+			}
+
 			boost::asio::io_service& m_io_service;
+			boost::mutex m_entry_table_mutex;
 			entry_table_type m_entry_table;
+			pending_registration_table_type m_pending_registration_table;
 			route_registration_success_handler_type m_route_registration_success_handler;
 			route_registration_failure_handler_type m_route_registration_failure_handler;
 			route_unregistration_success_handler_type m_route_unregistration_success_handler;
 			route_unregistration_failure_handler_type m_route_unregistration_failure_handler;
+			network_change_handler_type m_network_change_handler;
 	};
 }
 
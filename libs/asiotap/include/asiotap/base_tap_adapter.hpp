@@ -49,6 +49,8 @@
 #include <boost/system/system_error.hpp>
 
 #include <iostream>
+#include <vector>
+#include <memory>
 
 #include "osi/ethernet_address.hpp"
 #include "tap_adapter_layer.hpp"
@@ -103,6 +105,30 @@ namespace asiotap
 				m_descriptor.async_write_some(buffers, handler);
 			}
 
+			/**
+			 * \brief Read some data from a queue of the tap adapter.
+			 * \param queue_index The index of the queue to read from. Must be lower than queue_count().
+			 * \param buffers The buffers into which the data will be read.
+			 * \param handler The handler to be called when the read operation completes.
+			 */
+			template <typename MutableBufferSequence, typename ReadHandler>
+			void async_read(size_t queue_index, const MutableBufferSequence& buffers, ReadHandler handler)
+			{
+				queue_descriptor(queue_index).async_read_some(buffers, handler);
+			}
+
+			/**
+			 * \brief Write some data to a queue of the tap adapter.
+			 * \param queue_index The index of the queue to write to. Must be lower than queue_count().
+			 * \param buffers One or more buffers to be written to the tap adapter.
+			 * \param handler The handler to be called when the write operation completes.
+			 */
+			template <typename ConstBufferSequence, typename WriteHandler>
+			void async_write(size_t queue_index, const ConstBufferSequence& buffers, WriteHandler handler)
+			{
+				queue_descriptor(queue_index).async_write_some(buffers, handler);
+			}
+
 			/**
 			 * \brief Read some data from the tap adapter.
 			 * \param buffers The buffers into which the data will be read.
@@ -155,6 +181,11 @@ namespace asiotap
 			void cancel()
 			{
 				m_descriptor.cancel();
+
+				for (auto&& queue : m_queue_descriptors)
+				{
+					queue->cancel();
+				}
 			}
 
 			/**
@@ -164,6 +195,11 @@ namespace asiotap
 			void cancel(boost::system::error_code& ec)
 			{
 				m_descriptor.cancel(ec);
+
+				for (auto&& queue : m_queue_descriptors)
+				{
+					queue->cancel(ec);
+				}
 			}
 
 			/**
@@ -211,6 +247,15 @@ namespace asiotap
 				return m_ethernet_address;
 			}
 
+			/**
+			 * \brief Get the count of queues of the tap adapter.
+			 * \return The count of queues. Each queue can be read from and written to independently.
+			 */
+			size_t queue_count() const
+			{
+				return 1 + m_queue_descriptors.size();
+			}
+
 			/**
 			 * \brief Get the tap adapter current state.
 			 * \return true if the tap adapter is open.
@@ -225,6 +270,7 @@ namespace asiotap
 			 */
 			void close()
 			{
+				m_queue_descriptors.clear();
 				m_descriptor.close();
 			}
 
@@ -234,6 +280,8 @@ namespace asiotap
 			 */
 			boost::system::error_code close(boost::system::error_code& ec)
 			{
+				m_queue_descriptors.clear();
+
 				return m_descriptor.close(ec);
 			}
 
@@ -244,7 +292,8 @@ namespace asiotap
 				m_layer(_layer),
 				m_name(),
 				m_mtu(),
-				m_ethernet_address()
+				m_ethernet_address(),
+				m_queue_descriptors()
 			{}
 
 			descriptor_type& descriptor()
@@ -252,6 +301,24 @@ namespace asiotap
 				return m_descriptor;
 			}
 
+			descriptor_type& queue_descriptor(size_t queue_index)
+			{
+				return (queue_index == 0) ? m_descriptor : *m_queue_descriptors[queue_index - 1];
+			}
+
+			template <typename NativeHandleType>
+			boost::system::error_code add_queue_descriptor(const NativeHandleType& native_handle, boost::system::error_code& ec)
+			{
+				std::unique_ptr<descriptor_type> queue(new descriptor_type(get_io_service()));
+
+				if (!queue->assign(native_handle, ec))
+				{
+					m_queue_descriptors.push_back(std::move(queue));
+				}
+
+				return ec;
+			}
+
 			void set_name(const std::string& _name)
 			{
 				m_name = _name;
@@ -274,6 +341,7 @@ namespace asiotap
 			std::string m_name;
 			size_t m_mtu;
 			osi::ethernet_address m_ethernet_address;
+			std::vector<std::unique_ptr<descriptor_type> > m_queue_descriptors;
 
 			friend std::ostream& operator<<(std::ostream& os, const base_tap_adapter& value)
 			{
@@ -0,0 +1,95 @@
+/*
+ * libasiotap - A portable TAP adapter extension for Boost::ASIO.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libasiotap.
+ *
+ * libasiotap is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libasiotap is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libasiotap in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file classifier.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief Stateless frame classifiers.
+ */
+
+#ifndef ASIOTAP_OSI_CLASSIFIER_HPP
+#define ASIOTAP_OSI_CLASSIFIER_HPP
+
+#include "ethernet_filter.hpp"
+#include "arp_filter.hpp"
+#include "ipv4_filter.hpp"
+#include "ipv6_filter.hpp"
+#include "udp_filter.hpp"
+#include "icmp_filter.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/optional.hpp>
+
+namespace asiotap
+{
+	namespace osi
+	{
+		/**
+		 * \brief The headers of a classified frame.
+		 *
+		 * Every header that could be parsed is set, the others are empty. The helpers refer to the classified buffer, which must outlive them.
+		 */
+		struct frame_headers
+		{
+			boost::optional<const_helper<ethernet_frame> > ethernet; /**< The Ethernet header. */
+			boost::optional<const_helper<arp_frame> > arp; /**< The ARP header. */
+			boost::optional<const_helper<ipv4_frame> > ipv4; /**< The IPv4 header. */
+			boost::optional<const_helper<ipv6_frame> > ipv6; /**< The IPv6 header. */
+			boost::optional<const_helper<udp_frame> > udp; /**< The UDP header. */
+			boost::optional<const_helper<icmp_frame> > icmp; /**< The ICMP header. */
+		};
+
+		/**
+		 * \brief Classify an Ethernet frame.
+		 * \param buf The buffer that holds the frame.
+		 * \return The parsed headers.
+		 *
+		 * Unlike the filters, the classifiers keep no state: they can be called concurrently from any thread, and never throw.
+		 */
+		frame_headers classify_ethernet_frame(boost::asio::const_buffer buf);
+
+		/**
+		 * \brief Classify an IP packet, as read from a TUN adapter.
+		 * \param buf The buffer that holds the packet.
+		 * \return The parsed headers. The ethernet and arp headers are always empty.
+		 */
+		frame_headers classify_ip_packet(boost::asio::const_buffer buf);
+	}
+}
+
+#endif /* ASIOTAP_OSI_CLASSIFIER_HPP */
@@ -225,6 +225,24 @@ namespace asiotap
 		template <typename OSIFrameType>
 		bool check_frame(const_helper<OSIFrameType> frame);
 
+		/**
+		 * \brief Parse a frame, without throwing.
+		 * \param buf The buffer to parse.
+		 * \return A helper to the frame, if buf holds a complete and valid frame of the specified type.
+		 *
+		 * Truncated or invalid frames cost a branch, not an exception.
+		 */
+		template <typename OSIFrameType>
+		boost::optional<const_helper<OSIFrameType> > try_parse(boost::asio::const_buffer buf);
+
+		/**
+		 * \brief Parse an encapsulated frame, without throwing.
+		 * \param parent The parent frame.
+		 * \return A helper to the frame, if the parent frame holds a complete and valid frame of the specified type.
+		 */
+		template <typename OSIFrameType, typename ParentOSIFrameType>
+		boost::optional<const_helper<OSIFrameType> > try_parse(const_helper<ParentOSIFrameType> parent);
+
 		template <typename OSIFrameType>
 		inline void _base_filter<OSIFrameType>::add_filter(frame_filter_callback callback)
 		{
@@ -252,27 +270,26 @@ namespace asiotap
 		template <typename OSIFrameType>
 		inline void _base_filter<OSIFrameType>::do_parse(boost::asio::const_buffer buf) const
 		{
-			try
-			{
-				const_helper<OSIFrameType> helper(buf);
+			const boost::optional<const_helper<OSIFrameType> > helper = try_parse<OSIFrameType>(buf);
 
-				if (check_frame(helper))
-				{
-					if (_base_filter<OSIFrameType>::filter_frame(helper))
-					{
-						_base_filter<OSIFrameType>::frame_handled(helper);
-					}
-				}
-			}
-			catch (std::logic_error&)
+			if (helper && _base_filter<OSIFrameType>::filter_frame(*helper))
 			{
+				_base_filter<OSIFrameType>::frame_handled(*helper);
 			}
 		}
 
 		template <typename OSIFrameType>
 		inline bool _base_filter<OSIFrameType>::filter_frame(const_helper<OSIFrameType> helper) const
 		{
-			return (std::find_if(m_filters.begin(), m_filters.end(), !boost::bind(&frame_filter_callback::operator(), _1, helper)) == m_filters.end());
+			for (auto&& filter : m_filters)
+			{
+				if (!filter(helper))
+				{
+					return false;
+				}
+			}
+
+			return true;
 		}
 
 		template <typename OSIFrameType>
@@ -280,7 +297,10 @@ namespace asiotap
 		{
 			m_last_helper = helper;
 
-			std::for_each(m_handlers.begin(), m_handlers.end(), boost::bind(&frame_handler_callback::operator(), _1, *m_last_helper));
+			for (auto&& handler : m_handlers)
+			{
+				handler(helper);
+			}
 		}
 
 		template <typename OSIFrameType, typename ParentFilterType>
@@ -307,33 +327,26 @@ namespace asiotap
 		{
 			_base_filter<OSIFrameType>::clear_last_helper();
 
-			if (frame_parent_match<OSIFrameType, typename ParentFilterType::frame_type>(parent_helper))
+			const boost::optional<const_helper<OSIFrameType> > helper = try_parse<OSIFrameType>(parent_helper);
+
+			if (helper && _base_filter<OSIFrameType>::filter_frame(*helper) && bridge_filter_frame(parent_helper, *helper))
 			{
-				try
-				{
-					const_helper<OSIFrameType> helper(parent_helper.payload());
-
-					if (check_frame(helper))
-					{
-						if (_base_filter<OSIFrameType>::filter_frame(helper))
-						{
-							if (bridge_filter_frame(parent_helper, helper))
-							{
-								_base_filter<OSIFrameType>::frame_handled(helper);
-							}
-						}
-					}
-				}
-				catch (std::logic_error&)
-				{
-				}
+				_base_filter<OSIFrameType>::frame_handled(*helper);
 			}
 		}
 
 		template <typename OSIFrameType, typename ParentFilterType>
 		inline bool _filter<OSIFrameType, ParentFilterType>::bridge_filter_frame(const_helper<typename ParentFilterType::frame_type> parent_helper, const_helper<OSIFrameType> helper) const
 		{
-			return (std::find_if(m_bridge_filters.begin(), m_bridge_filters.end(), !boost::bind(&frame_bridge_filter_callback::operator(), _1, parent_helper, helper)) == m_bridge_filters.end());
+			for (auto&& bridge_filter : m_bridge_filters)
+			{
+				if (!bridge_filter(parent_helper, helper))
+				{
+					return false;
+				}
+			}
+
+			return true;
 		}
 
 		template <typename OSIFrameType>
@@ -349,6 +362,36 @@ namespace asiotap
 		{
 			return check_frame(const_helper<OSIFrameType>(frame));
 		}
+
+		template <typename OSIFrameType>
+		inline boost::optional<const_helper<OSIFrameType> > try_parse(boost::asio::const_buffer buf)
+		{
+			// The helper constructor throws on truncated buffers: we check beforehand.
+			if (boost::asio::buffer_size(buf) < sizeof(OSIFrameType))
+			{
+				return boost::none;
+			}
+
+			const const_helper<OSIFrameType> helper(buf);
+
+			if (!check_frame(helper))
+			{
+				return boost::none;
+			}
+
+			return helper;
+		}
+
+		template <typename OSIFrameType, typename ParentOSIFrameType>
+		inline boost::optional<const_helper<OSIFrameType> > try_parse(const_helper<ParentOSIFrameType> parent)
+		{
+			if (!frame_parent_match<OSIFrameType, ParentOSIFrameType>(parent))
+			{
+				return boost::none;
+			}
+
+			return try_parse<OSIFrameType>(parent.payload());
+		}
 	}
 }
 
@@ -48,10 +48,13 @@
 #include "../base_route_manager.hpp"
 #include "../types/ip_network_address.hpp"
 
+#include <map>
 #include <string>
+#include <vector>
 
 #ifdef LINUX
 #include <netlinkplus/manager.hpp>
+#include <netlinkplus/monitor.hpp>
 #endif
 
 namespace asiotap
@@ -67,7 +70,8 @@ namespace asiotap
 				base_route_manager<posix_route_manager, posix_routing_table_entry>(io_service_)
 #else
 				base_route_manager<posix_route_manager, posix_routing_table_entry>(io_service_),
-				m_netlink_manager(io_service_)
+				m_netlink_manager(io_service_),
+				m_netlink_monitor(io_service_)
 #endif
 			{
 			}
@@ -88,12 +92,20 @@ namespace asiotap
 
 			void register_route(const route_type& route);
 			void unregister_route(const route_type& route);
+			void async_register_routes(const std::vector<route_type>& routes, route_results_handler_type handler);
+			void async_unregister_routes(const std::vector<route_type>& routes, route_results_handler_type handler);
+			std::map<boost::asio::ip::address, route_type> get_system_routes_for(const std::vector<boost::asio::ip::address>& hosts);
+			void start_monitoring();
+			void stop_monitoring();
 
 		friend class base_route_manager<posix_route_manager, posix_routing_table_entry>;
 
 #ifdef LINUX
 		private:
+			void async_set_routes(route_action action, const std::vector<route_type>& routes, route_results_handler_type handler);
+
 			netlinkplus::manager m_netlink_manager;
+			netlinkplus::monitor m_netlink_monitor;
 #endif
 	};
 }
@@ -124,6 +124,23 @@ namespace asiotap
 			 */
 			void open(const std::string& name = "");
 
+			/**
+			 * \brief Open the tap adapter with several queues.
+			 * \param name The name of the tap adapter to open. If name is empty, then the first available tap adapter is opened.
+			 * \param queue_count The count of queues to open.
+			 * \param ec The error code.
+			 *
+			 * On Linux, a queue_count greater than 1 creates the adapter with IFF_MULTI_QUEUE and opens one descriptor per queue: the kernel then spreads the flows among the queues so that they can be read in parallel. On other systems, only one queue is opened.
+			 */
+			void open(const std::string& name, size_t queue_count, boost::system::error_code& ec);
+
+			/**
+			 * \brief Open the tap adapter with several queues.
+			 * \param name The name of the tap adapter to open. If name is empty, then the first available tap adapter is opened.
+			 * \param queue_count The count of queues to open.
+			 */
+			void open(const std::string& name, size_t queue_count);
+
 			/**
 			 * \brief Close the associated descriptor.
 			 */
@@ -0,0 +1,115 @@
+/*
+ * libasiotap - A portable TAP adapter extension for Boost::ASIO.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libasiotap.
+ *
+ * libasiotap is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libasiotap is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libasiotap in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file classifier.cpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief Stateless frame classifiers.
+ */
+
+#include "osi/classifier.hpp"
+
+namespace asiotap
+{
+	namespace osi
+	{
+		namespace
+		{
+			template <typename ParentOSIFrameType>
+			void classify_transport(frame_headers& headers, const_helper<ParentOSIFrameType> parent)
+			{
+				headers.udp = try_parse<udp_frame>(parent);
+
+				if (!headers.udp)
+				{
+					headers.icmp = try_parse<icmp_frame>(parent);
+				}
+			}
+
+			void classify_network(frame_headers& headers, boost::asio::const_buffer buf)
+			{
+				// IPv4 is tried first as it is more likely.
+				headers.ipv4 = try_parse<ipv4_frame>(buf);
+
+				if (headers.ipv4)
+				{
+					classify_transport(headers, *headers.ipv4);
+				}
+				else
+				{
+					headers.ipv6 = try_parse<ipv6_frame>(buf);
+
+					if (headers.ipv6)
+					{
+						classify_transport(headers, *headers.ipv6);
+					}
+				}
+			}
+		}
+
+		frame_headers classify_ethernet_frame(boost::asio::const_buffer buf)
+		{
+			frame_headers headers;
+
+			headers.ethernet = try_parse<ethernet_frame>(buf);
+
+			if (headers.ethernet)
+			{
+				if (frame_parent_match<ipv4_frame>(*headers.ethernet) || frame_parent_match<ipv6_frame>(*headers.ethernet))
+				{
+					classify_network(headers, headers.ethernet->payload());
+				}
+				else
+				{
+					headers.arp = try_parse<arp_frame>(*headers.ethernet);
+				}
+			}
+
+			return headers;
+		}
+
+		frame_headers classify_ip_packet(boost::asio::const_buffer buf)
+		{
+			frame_headers headers;
+
+			classify_network(headers, buf);
+
+			return headers;
+		}
+	}
+}
@@ -269,4 +269,159 @@ namespace asiotap
 				set_route(route_action::remove, route_entry.interface, ina);
 		}
 	}
+
+	void posix_route_manager::async_register_routes(const std::vector<route_type>& routes, route_results_handler_type handler)
+	{
+#if defined(LINUX) && !defined(FREELAN_DISABLE_NETLINK)
+		async_set_routes(route_action::add, routes, handler);
+#else
+		base_route_manager<posix_route_manager, posix_routing_table_entry>::async_register_routes(routes, handler);
+#endif
+	}
+
+	void posix_route_manager::async_unregister_routes(const std::vector<route_type>& routes, route_results_handler_type handler)
+	{
+#if defined(LINUX) && !defined(FREELAN_DISABLE_NETLINK)
+		async_set_routes(route_action::remove, routes, handler);
+#else
+		base_route_manager<posix_route_manager, posix_routing_table_entry>::async_unregister_routes(routes, handler);
+#endif
+	}
+
+	std::map<boost::asio::ip::address, posix_route_manager::route_type> posix_route_manager::get_system_routes_for(const std::vector<boost::asio::ip::address>& hosts)
+	{
+#if defined(LINUX) && !defined(FREELAN_DISABLE_NETLINK)
+		// The kernel lookups follow the routing policy rules. When they match a host route we pinned ourselves, the table that holds it is searched without our routes instead: the tables the rules would fall back to are then not searched.
+		std::map<boost::asio::ip::address, route_type> result;
+		std::map<std::pair<unsigned char, unsigned char>, std::vector<netlinkplus::route_entry>> tables;
+
+		for (auto&& host : hosts)
+		{
+			try
+			{
+				const netlinkplus::route_entry matching_entry = m_netlink_manager.get_route_for(host, true);
+
+				if (matching_entry.protocol != netlinkplus::manager::ROUTE_PROTOCOL)
+				{
+					result[host] = get_route_for(host);
+
+					continue;
+				}
+
+				const unsigned char family = host.is_v4() ? AF_INET : AF_INET6;
+				const auto table_key = std::make_pair(family, matching_entry.table);
+				auto table = tables.find(table_key);
+
+				if (table == tables.end())
+				{
+					table = tables.insert(std::make_pair(table_key, m_netlink_manager.get_routes(family, matching_entry.table))).first;
+				}
+
+				const netlinkplus::route_entry* best_route = nullptr;
+
+				for (auto&& route : table->second)
+				{
+					if ((route.protocol == netlinkplus::manager::ROUTE_PROTOCOL) || (route.type != RTN_UNICAST))
+					{
+						continue;
+					}
+
+					// Default routes have no destination attribute.
+					if ((route.destination_length > 0) && !has_address(to_network_address(route.destination, route.destination_length), host))
+					{
+						continue;
+					}
+
+					if (!best_route || (route.destination_length > best_route->destination_length) || ((route.destination_length == best_route->destination_length) && (route.priority < best_route->priority)))
+					{
+						best_route = &route;
+					}
+				}
+
+				if (best_route)
+				{
+					const route_type route_entry = { best_route->output_interface.name(), to_ip_route(to_network_address(host), best_route->gateway), 0 };
+
+					result[host] = route_entry;
+				}
+			}
+			catch (boost::system::system_error&)
+			{
+				// No route to the host, the table can't be dumped or the interface is gone.
+			}
+		}
+
+		return result;
+#else
+		return base_route_manager<posix_route_manager, posix_routing_table_entry>::get_system_routes_for(hosts);
+#endif
+	}
+
+	void posix_route_manager::start_monitoring()
+	{
+#if defined(LINUX) && !defined(FREELAN_DISABLE_NETLINK)
+		m_netlink_monitor.start([this](const netlinkplus::network_change& change) {
+			// Our own route changes would only make us check the routes again, for nothing.
+			if ((change.type == netlinkplus::network_change::change_type::route) && (change.route_protocol == netlinkplus::manager::ROUTE_PROTOCOL))
+			{
+				return;
+			}
+
+			notify_network_change();
+		});
+#else
+		base_route_manager<posix_route_manager, posix_routing_table_entry>::start_monitoring();
+#endif
+	}
+
+	void posix_route_manager::stop_monitoring()
+	{
+#if defined(LINUX) && !defined(FREELAN_DISABLE_NETLINK)
+		m_netlink_monitor.stop();
+#else
+		base_route_manager<posix_route_manager, posix_routing_table_entry>::stop_monitoring();
+#endif
+	}
+
+#ifdef LINUX
+	void posix_route_manager::async_set_routes(route_action action, const std::vector<route_type>& routes, route_results_handler_type handler)
+	{
+		std::vector<boost::system::error_code> results(routes.size());
+		std::vector<netlinkplus::route_operation> operations;
+		std::vector<size_t> indexes;
+
+		for (size_t index = 0; index < routes.size(); ++index)
+		{
+			const auto ina = network_address(routes[index].route);
+
+			try
+			{
+				netlinkplus::route_operation operation;
+				operation.action = (action == route_action::add) ? netlinkplus::route_operation::action_type::add : netlinkplus::route_operation::action_type::remove;
+				operation.interface = netlinkplus::interface_entry(routes[index].interface);
+				operation.destination = ip_address(ina);
+				operation.destination_length = prefix_length(ina);
+				operation.gateway = gateway(routes[index].route);
+
+				operations.push_back(operation);
+				indexes.push_back(index);
+			}
+			catch (boost::system::system_error& ex)
+			{
+				// The interface does not exist: the other routes can still be set.
+				results[index] = ex.code();
+			}
+		}
+
+		// All the routes are sent to the kernel in as few netlink messages as possible.
+		m_netlink_manager.async_apply_routes(operations, [results, indexes, handler](const std::vector<boost::system::error_code>& operation_results) mutable {
+			for (size_t index = 0; index < indexes.size(); ++index)
+			{
+				results[indexes[index]] = operation_results[index];
+			}
+
+			handler(results);
+		});
+	}
+#endif
 }
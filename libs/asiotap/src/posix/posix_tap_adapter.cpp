@@ -227,6 +227,11 @@ namespace asiotap
 	}
 
 	void posix_tap_adapter::open(const std::string& _name, boost::system::error_code& ec)
+	{
+		open(_name, 1, ec);
+	}
+
+	void posix_tap_adapter::open(const std::string& _name, size_t queue_count, boost::system::error_code& ec)
 	{
 		ec = boost::system::error_code();
 
@@ -267,6 +272,16 @@ namespace asiotap
 		ifr.ifr_flags |= IFF_ONE_QUEUE;
 #endif
 
+#if defined(IFF_MULTI_QUEUE)
+		if (queue_count > 1)
+		{
+			ifr.ifr_flags |= IFF_MULTI_QUEUE;
+		}
+#else
+		// Multi-queue is not supported by the system headers: we only open one queue.
+		queue_count = 1;
+#endif
+
 		if (layer() == tap_adapter_layer::ethernet)
 		{
 			ifr.ifr_flags |= IFF_TAP;
@@ -289,6 +304,28 @@ namespace asiotap
 			return;
 		}
 
+		// Every additional queue is attached to the device that was just created, which now has a name.
+		std::vector<descriptor_handler> queues;
+
+		for (size_t i = 1; i < queue_count; ++i)
+		{
+			descriptor_handler queue = open_device(dev_name, ec);
+
+			if (!queue.valid())
+			{
+				return;
+			}
+
+			if (::ioctl(queue.native_handle(), TUNSETIFF, (void *)&ifr) < 0)
+			{
+				ec = boost::system::error_code(errno, boost::system::system_category());
+
+				return;
+			}
+
+			queues.push_back(std::move(queue));
+		}
+
 		descriptor_handler socket = open_socket(AF_INET, ec);
 
 		if (!socket.valid())
@@ -335,6 +372,9 @@ namespace asiotap
 
 #else /* *BSD and Mac OS X */
 
+		// Multi-queue tap adapters are Linux-specific.
+		static_cast<void>(queue_count);
+
 		const std::string dev_type = (layer() == tap_adapter_layer::ethernet) ? "tap" : "tun";
 		std::string interface_name = _name;
 
@@ -442,6 +482,16 @@ namespace asiotap
 		{
 			return;
 		}
+
+#if defined(LINUX)
+		for (auto&& queue : queues)
+		{
+			if (add_queue_descriptor(queue.release(), ec))
+			{
+				return;
+			}
+		}
+#endif
 	}
 
 	void posix_tap_adapter::open(const std::string& _name)
@@ -456,6 +506,18 @@ namespace asiotap
 		}
 	}
 
+	void posix_tap_adapter::open(const std::string& _name, size_t queue_count)
+	{
+		boost::system::error_code ec;
+
+		open(_name, queue_count, ec);
+
+		if (ec)
+		{
+			throw boost::system::system_error(ec);
+		}
+	}
+
 	void posix_tap_adapter::destroy_device()
 	{
 		boost::system::error_code ec;
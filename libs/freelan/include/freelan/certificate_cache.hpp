@@ -0,0 +1,181 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+
+/**
+ * \file certificate_cache.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A certificate validation verdict cache.
+ */
+
+#ifndef FREELAN_CERTIFICATE_CACHE_HPP
+#define FREELAN_CERTIFICATE_CACHE_HPP
+
+#include <fscp/constants.hpp>
+
+#include <boost/optional.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <list>
+#include <map>
+
+#include <stdint.h>
+
+namespace freelan
+{
+	/**
+	 * \brief A thread-safe cache of certificate validation verdicts.
+	 *
+	 * Verdicts are keyed by certificate hash and expire after a fixed time, never past the certificate expiration. Negative verdicts expire much sooner, so that a certificate rejected because of a transient failure gets another chance. When the cache is full, the least recently used verdict is evicted.
+	 *
+	 * Whenever the certificate authorities or the revocation lists change, the cache must be cleared. Verdicts computed before that are then discarded by insert().
+	 */
+	class certificate_cache
+	{
+		public:
+
+			/**
+			 * \brief The key type.
+			 */
+			typedef fscp::hash_type key_type;
+
+			/**
+			 * \brief The time type.
+			 */
+			typedef boost::posix_time::ptime time_type;
+
+			/**
+			 * \brief The duration type.
+			 */
+			typedef boost::posix_time::time_duration duration_type;
+
+			/**
+			 * \brief The generation type.
+			 */
+			typedef uint64_t generation_type;
+
+			/**
+			 * \brief Create a new certificate cache.
+			 * \param max_entries The maximum count of verdicts. A value of 0 disables the cache.
+			 * \param ttl The time a positive verdict remains valid.
+			 * \param negative_ttl The time a negative verdict remains valid. A null duration disables the caching of negative verdicts.
+			 */
+			certificate_cache(size_t max_entries, const duration_type& ttl, const duration_type& negative_ttl);
+
+			/**
+			 * \brief Get the current generation.
+			 * \return The current generation, to be given to insert() once the verdict is known.
+			 */
+			generation_type generation() const;
+
+			/**
+			 * \brief Find a verdict.
+			 * \param key The certificate hash.
+			 * \param now The current time.
+			 * \return The verdict, if one was cached and didn't expire.
+			 */
+			boost::optional<bool> find(const key_type& key, const time_type& now);
+
+			/**
+			 * \brief Insert a verdict.
+			 * \param key The certificate hash.
+			 * \param verdict The verdict.
+			 * \param generation The generation at the time the verdict computation started. If the cache was cleared since, the verdict is discarded.
+			 * \param now The current time.
+			 * \param not_after The expiration time of the certificate, if any. The verdict doesn't outlive it.
+			 */
+			void insert(const key_type& key, bool verdict, generation_type generation, const time_type& now, const time_type& not_after = time_type());
+
+			/**
+			 * \brief Get the time a positive verdict remains valid.
+			 * \return The time a positive verdict remains valid.
+			 */
+			const duration_type& ttl() const
+			{
+				return m_ttl;
+			}
+
+			/**
+			 * \brief Get the time a negative verdict remains valid.
+			 * \return The time a negative verdict remains valid.
+			 */
+			const duration_type& negative_ttl() const
+			{
+				return m_negative_ttl;
+			}
+
+			/**
+			 * \brief Remove all the verdicts.
+			 */
+			void clear();
+
+		private:
+
+			struct entry_type
+			{
+				entry_type(const key_type& _key, bool _verdict, const time_type& _expiration) :
+					key(_key),
+					verdict(_verdict),
+					expiration(_expiration)
+				{}
+
+				key_type key;
+				bool verdict;
+				time_type expiration;
+			};
+
+			// The most recently used entries are at the front.
+			typedef std::list<entry_type> entry_list_type;
+			typedef std::map<key_type, entry_list_type::iterator> entry_map_type;
+
+			void erase(entry_list_type::iterator);
+
+			size_t m_max_entries;
+			duration_type m_ttl;
+			duration_type m_negative_ttl;
+
+			mutable boost::mutex m_mutex;
+			generation_type m_generation;
+			entry_list_type m_entries;
+			entry_map_type m_entry_map;
+	};
+}
+
+#endif /* FREELAN_CERTIFICATE_CACHE_HPP */
@@ -258,6 +258,36 @@ namespace freelan
 		 * \brief The list of allowed elliptic curves.
 		 */
 		fscp::elliptic_curve_list_type elliptic_curve_capabilities;
+
+		/**
+		 * \brief The anti-replay window size.
+		 */
+		size_t replay_window_size;
+
+		/**
+		 * \brief The maximum count of datagrams to receive or send in a single system call.
+		 */
+		size_t io_batch_size;
+
+		/**
+		 * \brief The count of sockets bound on the listen endpoint.
+		 */
+		size_t socket_count;
+
+		/**
+		 * \brief Whether to use the UDP segmentation offload.
+		 */
+		bool segmentation_offload;
+
+		/**
+		 * \brief The count of threads that run the handshake cryptography. 0 means one per hardware thread.
+		 */
+		size_t handshake_thread_count;
+
+		/**
+		 * \brief The maximum count of handshake cryptographic operations that can be pending at once.
+		 */
+		size_t handshake_queue_size;
 	};
 
 	/**
@@ -324,6 +354,11 @@ namespace freelan
 		 */
 		boost::filesystem::path certificate_validation_script;
 
+		/**
+		 * \brief The certificate validator, a long-lived process that validates certificates sent to it.
+		 */
+		boost::filesystem::path certificate_validator;
+
 		/**
 		 * \brief The certificate authorities.
 		 */
@@ -389,6 +424,11 @@ namespace freelan
 		 */
 		metric_type metric;
 
+		/**
+		 * \brief The count of queues to open on the tap adapter.
+		 */
+		unsigned int queue_count;
+
 		/**
 		 * \brief The IPv4 tap adapter address.
 		 */
@@ -468,6 +508,11 @@ namespace freelan
 		 * \brief Whether to enable the relay mode.
 		 */
 		bool relay_mode_enabled;
+
+		/**
+		 * \brief The time after which a learned ethernet address that was not seen again is forgotten.
+		 */
+		boost::posix_time::time_duration mac_aging_time;
 	};
 
 	/**
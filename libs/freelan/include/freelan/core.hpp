@@ -49,10 +49,12 @@
 #include "os.hpp"
 #include "configuration.hpp"
 #include "logger.hpp"
+#include "log_queue.hpp"
 #include "switch.hpp"
 #include "router.hpp"
 #include "message.hpp"
 #include "routes_message.hpp"
+#include "certificate_cache.hpp"
 
 #include <fscp/fscp.hpp>
 
@@ -72,8 +74,11 @@
 #include <boost/weak_ptr.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
+#include <atomic>
+#include <map>
 #include <queue>
 #include <set>
+#include <vector>
 
 namespace freelan
 {
@@ -217,6 +222,18 @@ namespace freelan
 			 */
 			typedef boost::function<bool (cert_type)> certificate_validation_handler_type;
 
+			/**
+			 * \brief The certificate validation result handler type.
+			 */
+			typedef boost::function<void (bool)> certificate_validation_result_handler_type;
+
+			/**
+			 * \brief The asynchronous certificate validation callback type.
+			 *
+			 * The callback must call the result handler exactly once, from any thread.
+			 */
+			typedef boost::function<void (cert_type, certificate_validation_result_handler_type)> async_certificate_validation_handler_type;
+
 			/**
 			 * \brief The up callback type.
 			 */
@@ -239,6 +256,28 @@ namespace freelan
 			 */
 			static const boost::posix_time::time_duration ROUTES_REQUEST_PERIOD;
 
+			/**
+			 * \brief The delay between a network change and its handling.
+			 *
+			 * Changes usually come in bursts (an interface going down drops its addresses and routes): they are handled at once.
+			 */
+			static const boost::posix_time::time_duration NETWORK_CHANGE_DELAY;
+
+			/**
+			 * \brief The maximum count of certificate validation verdicts to keep.
+			 */
+			static const size_t CERTIFICATE_CACHE_SIZE;
+
+			/**
+			 * \brief The time a positive certificate validation verdict is kept.
+			 */
+			static const boost::posix_time::time_duration CERTIFICATE_CACHE_TTL;
+
+			/**
+			 * \brief The time a negative certificate validation verdict is kept.
+			 */
+			static const boost::posix_time::time_duration CERTIFICATE_CACHE_NEGATIVE_TTL;
+
 			/**
 			 * \brief The default service.
 			 */
@@ -257,11 +296,13 @@ namespace freelan
 			 * \brief Set the function to call when a log entry is emitted.
 			 * \param callback The callback.
 			 *
+			 * The callback is called from a dedicated thread, one entry at a time.
+			 *
 			 * \warning This method can only be called when the core is NOT running.
 			 */
 			void set_log_callback(log_handler_type callback)
 			{
-				m_logger.set_callback(callback);
+				m_log_queue.set_handler(callback);
 			}
 
 			/**
@@ -346,6 +387,16 @@ namespace freelan
 				m_certificate_validation_callback = callback;
 			}
 
+			/**
+			 * \brief Set the asynchronous certificate validation callback.
+			 * \param callback The callback. It is called once the certificate passed all the other checks and the presentation is only accepted once it reports a positive result.
+			 * \warning This method can only be called when the core is NOT running.
+			 */
+			void set_async_certificate_validation_callback(async_certificate_validation_handler_type callback)
+			{
+				m_async_certificate_validation_callback = callback;
+			}
+
 			/**
 			 * \brief Set the tap adapter up callback.
 			 * \param callback The callback.
@@ -381,14 +432,23 @@ namespace freelan
 
 			boost::asio::io_service& m_io_service;
 			const freelan::configuration m_configuration;
-			boost::asio::strand m_logger_strand;
+			log_queue m_log_queue;
 			freelan::logger m_logger;
 
-		private: /* Callbacks */
+			// The log statements that remote hosts can trigger at will have their own rate limiters.
+			log_rate_limiter m_hello_received_log_limiter;
+			log_rate_limiter m_banned_hello_log_limiter;
+			log_rate_limiter m_banned_presentation_log_limiter;
+			log_rate_limiter m_active_session_presentation_log_limiter;
+			log_rate_limiter m_invalid_presentation_log_limiter;
+			log_rate_limiter m_rejected_presentation_log_limiter;
+			log_rate_limiter m_malformed_data_log_limiter;
+			log_rate_limiter m_unhandled_data_log_limiter;
+			log_rate_limiter m_unhandled_message_log_limiter;
+			log_rate_limiter m_tap_adapter_write_log_limiter;
 
-			void do_handle_log(log_level, const std::string&, const boost::posix_time::ptime&);
+		private: /* Callbacks */
 
-			log_handler_type m_log_callback;
 			core_opened_handler_type m_core_opened_callback;
 			core_closed_handler_type m_core_closed_callback;
 			session_failed_handler_type m_session_failed_callback;
@@ -396,6 +456,7 @@ namespace freelan
 			session_established_handler_type m_session_established_callback;
 			session_lost_handler_type m_session_lost_callback;
 			certificate_validation_handler_type m_certificate_validation_callback;
+			async_certificate_validation_handler_type m_async_certificate_validation_callback;
 			tap_adapter_handler_type m_tap_adapter_up_callback;
 			tap_adapter_handler_type m_tap_adapter_down_callback;
 
@@ -432,6 +493,8 @@ namespace freelan
 			void do_handle_periodic_contact(const boost::system::error_code&);
 			void do_handle_periodic_dynamic_contact(const boost::system::error_code&);
 			void do_handle_periodic_routes_request(const boost::system::error_code&);
+			void do_handle_network_change();
+			void do_handle_network_change_delay(const boost::system::error_code&);
 			void do_handle_send_contact_request(const ep_type&, const boost::system::error_code&);
 			void do_handle_send_contact_request_to_all(const std::map<ep_type, boost::system::error_code>&);
 			void do_handle_introduce_to(const ep_type&, const boost::system::error_code&);
@@ -458,6 +521,8 @@ namespace freelan
 			boost::asio::deadline_timer m_contact_timer;
 			boost::asio::deadline_timer m_dynamic_contact_timer;
 			boost::asio::deadline_timer m_routes_request_timer;
+			boost::asio::deadline_timer m_network_change_timer;
+			std::atomic<bool> m_network_change_pending;
 
 		private: /* Certificate validation */
 
@@ -466,9 +531,22 @@ namespace freelan
 
 			bool certificate_validation_method(bool, cryptoplus::x509::store_context);
 			bool certificate_is_valid(cert_type);
+			void handle_async_certificate_validation(boost::weak_ptr<fscp::server>, const ep_type&, cert_type, const hash_type&, bool);
+			bool do_handle_validated_presentation(const ep_type&, cert_type, fscp::server::presentation_status_type, bool, const hash_type&, bool);
+			bool certificate_chain_is_valid(cert_type);
+
+			cryptoplus::x509::store create_ca_store() const;
+			cryptoplus::x509::store acquire_ca_store(certificate_cache::generation_type&);
+			void release_ca_store(cryptoplus::x509::store, certificate_cache::generation_type);
+			void reset_certificate_validation();
+
+			// Concurrent validations each get a store of their own, so that they don't have to be serialized.
+			std::vector<cryptoplus::x509::store> m_ca_stores;
+			boost::mutex m_ca_stores_mutex;
+			certificate_cache m_certificate_cache;
 
-			cryptoplus::x509::store m_ca_store;
-			boost::mutex m_ca_store_mutex;
+			// The hosts whose presentation is being validated asynchronously, with their certificate hash. Only accessed within the presentation strand.
+			std::map<ep_type, hash_type> m_pending_presentation_validations;
 
 		private: /* TAP adapter */
 
@@ -482,29 +560,60 @@ namespace freelan
 			typedef asiotap::osi::const_helper<asiotap::osi::dhcp_frame> dhcp_helper_type;
 			typedef asiotap::osi::proxy<asiotap::osi::arp_frame> arp_proxy_type;
 			typedef asiotap::osi::proxy<asiotap::osi::dhcp_frame> dhcp_proxy_type;
-			typedef fscp::memory_pool<65536, 8> tap_adapter_memory_pool;
+			typedef fscp::buffer_pool tap_adapter_memory_pool;
 			typedef fscp::memory_pool<2048, 2> proxy_memory_pool;
 
+			/**
+			 * \brief The read and write pipeline of a tap adapter queue.
+			 *
+			 * Each queue has its own strands so that queues are processed in parallel while the frames of a given queue stay ordered.
+			 */
+			struct tap_adapter_queue_type
+			{
+				tap_adapter_queue_type(boost::asio::io_service& io_service, size_t _index) :
+					index(_index),
+					strand(io_service),
+					read_strand(io_service),
+					write_queue(),
+					write_queue_strand(io_service)
+				{}
+
+				size_t index;
+				boost::asio::strand strand;
+				boost::asio::strand read_strand;
+				std::queue<void_handler_type> write_queue;
+				boost::asio::strand write_queue_strand;
+			};
+
+			typedef boost::shared_ptr<tap_adapter_queue_type> tap_adapter_queue_ptr;
+
 			void open_tap_adapter();
 			void close_tap_adapter();
 
 			void async_get_tap_addresses(ip_network_address_list_handler_type);
-			void async_read_tap();
+			void async_read_tap(tap_adapter_queue_ptr);
 
 			template <typename ConstBufferSequence, typename WriteHandler>
 			void async_write_tap(const ConstBufferSequence& data, WriteHandler handler)
 			{
-				void_handler_type write_handler = [this, data, handler](){ m_tap_adapter->async_write(data, handler); };
+				// Frames of the same flow always go through the same queue, so that they are written in order.
+				const tap_adapter_queue_ptr queue = get_tap_adapter_queue_for(*data.begin());
+
+				void_handler_type write_handler = [this, queue, data, handler](){ m_tap_adapter->async_write(queue->index, data, handler); };
 
-				m_tap_write_queue_strand.post(boost::bind(&core::push_tap_write, this, write_handler));
+				queue->write_queue_strand.post(boost::bind(&core::push_tap_write, this, queue, write_handler));
 			}
 
-			void push_tap_write(void_handler_type);
-			void pop_tap_write();
+			const tap_adapter_queue_ptr& get_tap_adapter_queue_for(boost::asio::const_buffer) const;
 
-			void do_read_tap();
+			void push_tap_write(tap_adapter_queue_ptr, void_handler_type);
+			void pop_tap_write(tap_adapter_queue_ptr);
 
-			void do_handle_tap_adapter_read(tap_adapter_memory_pool::shared_buffer_type, const boost::system::error_code&, size_t);
+			void do_read_tap(tap_adapter_queue_ptr);
+
+			void do_handle_tap_adapter_read(tap_adapter_queue_ptr, tap_adapter_memory_pool::shared_buffer_type, const boost::system::error_code&, size_t);
+			bool handle_proxy_candidate(boost::asio::const_buffer);
+			void write_tap_frame_to_switch(tap_adapter_memory_pool::shared_buffer_type, size_t);
 			void do_handle_tap_adapter_write(const boost::system::error_code&);
 			void do_handle_arp_frame(const arp_helper_type&);
 			void do_handle_dhcp_frame(const dhcp_helper_type&);
@@ -512,10 +621,9 @@ namespace freelan
 
 			boost::shared_ptr<asiotap::tap_adapter> m_tap_adapter;
 			boost::asio::strand m_tap_adapter_strand;
-			boost::asio::strand m_proxies_strand;
+			boost::mutex m_proxies_mutex;
 			tap_adapter_memory_pool m_tap_adapter_memory_pool;
-			std::queue<void_handler_type> m_tap_write_queue;
-			boost::asio::strand m_tap_write_queue_strand;
+			std::vector<tap_adapter_queue_ptr> m_tap_adapter_queues;
 
 			ethernet_filter_type m_ethernet_filter;
 			arp_filter_type m_arp_filter;
@@ -537,7 +645,9 @@ namespace freelan
 				client_router_info_type() :
 					version(),
 					system_route_entries(),
-					saved_system_route()
+					saved_system_route(),
+					system_routes_generation(0),
+					saved_system_route_generation(0)
 				{}
 
 				bool is_older_than(routes_message::version_type _version)
@@ -548,6 +658,10 @@ namespace freelan
 				boost::optional<routes_message::version_type> version;
 				std::vector<asiotap::route_manager::entry_type> system_route_entries;
 				asiotap::route_manager::entry_type saved_system_route;
+
+				// The routes are registered asynchronously: these tell whether a registration is still wanted when it completes.
+				uint64_t system_routes_generation;
+				uint64_t saved_system_route_generation;
 			};
 
 			typedef std::map<ep_type, client_router_info_type> client_router_info_map_type;
@@ -582,16 +696,35 @@ namespace freelan
 				m_router_strand.post(boost::bind(&core::do_clear_client_router_info, this, host, handler));
 			}
 
+			void async_renew_rerouted_sessions(const std::set<ep_type>& hosts)
+			{
+				m_router_strand.post(boost::bind(&core::do_renew_rerouted_sessions, this, hosts));
+			}
+
+			// The forwarding tables are immutable snapshots: the writes are done from the calling thread, without any strand.
 			template <typename WriteHandler>
 			void async_write_switch(const port_index_type& index, boost::asio::const_buffer data, WriteHandler handler)
 			{
-				m_router_strand.post(boost::bind(&core::do_write_switch, this, index, data, handler));
+				// The per-port results are of no interest: we don't pay for gathering them.
+				m_switch.async_forward(index, data, handler);
 			}
 
 			template <typename WriteHandler>
 			void async_write_router(const port_index_type& index, boost::asio::const_buffer data, WriteHandler handler)
 			{
-				m_router_strand.post(boost::bind(&core::do_write_router, this, index, data, handler));
+				m_router.async_write(index, data, handler);
+			}
+
+			template <typename WriteHandler>
+			void async_write_switch_in_place(const port_index_type& index, boost::asio::mutable_buffer buffer, size_t headroom, size_t data_len, WriteHandler handler)
+			{
+				m_switch.async_forward_in_place(index, buffer, headroom, data_len, handler);
+			}
+
+			template <typename WriteHandler>
+			void async_write_router_in_place(const port_index_type& index, boost::asio::mutable_buffer buffer, size_t headroom, size_t data_len, WriteHandler handler)
+			{
+				m_router.async_write_in_place(index, buffer, headroom, data_len, handler);
 			}
 
 			void do_register_switch_port(const ep_type&, void_handler_type);
@@ -599,9 +732,11 @@ namespace freelan
 			void do_unregister_switch_port(const ep_type&, void_handler_type);
 			void do_unregister_router_port(const ep_type&, void_handler_type);
 			void do_save_system_route(const ep_type&, const route_type&, void_handler_type);
+			void do_set_saved_system_route(const ep_type&, uint64_t, const std::vector<asiotap::route_manager::entry_type>&, void_handler_type);
+			void do_set_system_route_entries(const ep_type&, uint64_t, const std::vector<asiotap::route_manager::entry_type>&);
 			void do_clear_client_router_info(const ep_type&, void_handler_type);
-			void do_write_switch(const port_index_type&, boost::asio::const_buffer, switch_::multi_write_handler_type);
-			void do_write_router(const port_index_type&, boost::asio::const_buffer, router::port_type::write_handler_type);
+			void do_renew_rerouted_sessions(const std::set<ep_type>&);
+			void do_check_rerouted_sessions(const std::set<ep_type>&, const std::map<boost::asio::ip::address, route_type>&);
 
 			boost::asio::strand m_router_strand;
 
@@ -0,0 +1,174 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file log_queue.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A lock-free log queue.
+ */
+
+#ifndef FREELAN_LOG_QUEUE_HPP
+#define FREELAN_LOG_QUEUE_HPP
+
+#include "logger.hpp"
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+namespace freelan
+{
+	/**
+	 * \brief A bounded lock-free log queue, drained by a dedicated thread.
+	 *
+	 * Log entries are copied into preallocated records: pushing one never allocates, never locks and never waits. When the queue is full, entries are dropped and counted instead.
+	 *
+	 * The handler is only ever called from the drain thread, so its calls are serialized.
+	 */
+	class log_queue
+	{
+		public:
+
+			/**
+			 * \brief The log handler type.
+			 */
+			typedef logger::log_handler_type log_handler_type;
+
+			/**
+			 * \brief The timestamp type.
+			 */
+			typedef logger::timestamp_type timestamp_type;
+
+			/**
+			 * \brief The default count of records.
+			 */
+			static const size_t DEFAULT_CAPACITY = 512;
+
+			/**
+			 * \brief The maximum size of a message. Longer messages are truncated and end with TRUNCATION_MARKER.
+			 */
+			static const size_t MAX_MESSAGE_SIZE = 1024;
+
+			/**
+			 * \brief The marker that ends truncated messages.
+			 */
+			static const char TRUNCATION_MARKER[];
+
+			/**
+			 * \brief Create a log queue and start its drain thread.
+			 * \param capacity The count of records. Rounded up to a power of two.
+			 */
+			explicit log_queue(size_t capacity = DEFAULT_CAPACITY);
+
+			/**
+			 * \brief Emit the remaining entries and stop the drain thread.
+			 */
+			~log_queue();
+
+			log_queue(const log_queue&) = delete;
+			log_queue& operator=(const log_queue&) = delete;
+
+			/**
+			 * \brief Set the handler to emit the entries to.
+			 * \param handler The handler.
+			 *
+			 * The entries still queued are emitted to the new handler.
+			 */
+			void set_handler(log_handler_type handler)
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+
+				m_handler = handler;
+			}
+
+			/**
+			 * \brief Push a log entry.
+			 * \param level The log level.
+			 * \param msg The message.
+			 * \param timestamp The timestamp.
+			 * \return true if the entry was queued, false if it was dropped.
+			 *
+			 * This method is thread-safe and lock-free.
+			 */
+			bool push(log_level level, const std::string& msg, const timestamp_type& timestamp);
+
+			/**
+			 * \brief Get the count of entries dropped so far.
+			 * \return The count of dropped entries.
+			 */
+			uint64_t dropped() const
+			{
+				return m_total_dropped;
+			}
+
+		private:
+
+			struct record_type
+			{
+				std::atomic<size_t> sequence;
+				log_level level;
+				timestamp_type timestamp;
+				size_t size;
+				char data[MAX_MESSAGE_SIZE];
+			};
+
+			bool has_record() const;
+			void drain();
+			void emit(log_level level, const std::string& msg, const timestamp_type& timestamp);
+
+			const size_t m_mask;
+			std::unique_ptr<record_type[]> m_records;
+			std::atomic<size_t> m_enqueue_position;
+			size_t m_dequeue_position;
+			std::atomic<uint64_t> m_dropped;
+			std::atomic<uint64_t> m_total_dropped;
+			std::atomic<bool> m_waiting;
+			std::atomic<bool> m_stopping;
+			log_handler_type m_handler;
+			boost::mutex m_mutex;
+			boost::condition_variable m_condition;
+			boost::thread m_thread;
+	};
+}
+
+#endif /* FREELAN_LOG_QUEUE_HPP */
@@ -48,12 +48,15 @@
 
 #include <iostream>
 #include <sstream>
+#include <atomic>
+#include <chrono>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/function.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/variant.hpp>
+#include <boost/thread/tss.hpp>
 
 namespace freelan
 {
@@ -72,6 +75,75 @@ namespace freelan
 		LL_FATAL /**< \brief The fatal log level. */
 	};
 
+	/**
+	 * \brief A log rate limiter.
+	 *
+	 * Give one to every log statement that remote hosts can trigger at will: past the burst, its messages are counted instead of being formatted, and the count is reported along with the next message that gets through.
+	 */
+	class log_rate_limiter
+	{
+		public:
+
+			/**
+			 * \brief The default count of messages allowed per period.
+			 */
+			static const unsigned int DEFAULT_BURST = 10;
+
+			/**
+			 * \brief Create a log rate limiter.
+			 * \param burst The count of messages allowed per period.
+			 * \param period The period.
+			 */
+			explicit log_rate_limiter(unsigned int burst = DEFAULT_BURST, const boost::posix_time::time_duration& period = boost::posix_time::seconds(1)) :
+				m_burst(burst),
+				m_period(period.total_microseconds()),
+				m_period_start(0),
+				m_count(0),
+				m_suppressed(0)
+			{
+			}
+
+			log_rate_limiter(const log_rate_limiter&) = delete;
+			log_rate_limiter& operator=(const log_rate_limiter&) = delete;
+
+			/**
+			 * \brief Try to get the right to log a message.
+			 * \param suppressed The count of messages suppressed since the last one that got through. Only set on success.
+			 * \return true if the message may be logged.
+			 *
+			 * This method is thread-safe and lock-free. The limit is approximate when several threads hit a period boundary at once.
+			 */
+			bool acquire(uint64_t& suppressed)
+			{
+				const int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+				int64_t period_start = m_period_start.load(std::memory_order_relaxed);
+
+				if ((now - period_start >= m_period) && m_period_start.compare_exchange_strong(period_start, now, std::memory_order_relaxed))
+				{
+					m_count.store(0, std::memory_order_relaxed);
+				}
+
+				if (m_count.fetch_add(1, std::memory_order_relaxed) < m_burst)
+				{
+					suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+
+					return true;
+				}
+
+				m_suppressed.fetch_add(1, std::memory_order_relaxed);
+
+				return false;
+			}
+
+		private:
+
+			const unsigned int m_burst;
+			const int64_t m_period;
+			std::atomic<int64_t> m_period_start;
+			std::atomic<unsigned int> m_count;
+			std::atomic<uint64_t> m_suppressed;
+	};
+
 	/**
 	 * \brief A null logger stream.
 	 */
@@ -88,10 +160,28 @@ namespace freelan
 			 * \brief Create a string logger stream.
 			 * \param logger_ The logger to attach to.
 			 * \param level_ The level of the logger stream.
+			 * \param suppressed_ The count of similar messages that were suppressed, to report along with the message.
 			 */
-			string_logger_stream(const logger& logger_, log_level level_) :
+			string_logger_stream(const logger& logger_, log_level level_, uint64_t suppressed_ = 0) :
 				m_logger(logger_),
-				m_level(level_)
+				m_level(level_),
+				m_suppressed(suppressed_),
+				m_buffer(nullptr),
+				m_oss()
+			{}
+
+			/**
+			 * \brief Copy a string logger stream.
+			 * \param other The string logger stream to copy.
+			 *
+			 * Only the destination is copied: the copy starts with an empty message.
+			 */
+			string_logger_stream(const string_logger_stream& other) :
+				m_logger(other.m_logger),
+				m_level(other.m_level),
+				m_suppressed(other.m_suppressed),
+				m_buffer(nullptr),
+				m_oss()
 			{}
 
 			/**
@@ -106,20 +196,67 @@ namespace freelan
 			template <typename Type>
 			string_logger_stream& operator<<(const Type& value)
 			{
-				if (!m_oss)
+				stream() << value;
+
+				return *this;
+			}
+
+		private:
+
+			struct stream_buffer
+			{
+				stream_buffer() : stream(), busy(false) {}
+
+				std::ostringstream stream;
+				bool busy;
+			};
+
+			static stream_buffer& thread_buffer()
+			{
+				static boost::thread_specific_ptr<stream_buffer> buffer;
+
+				if (!buffer.get())
+				{
+					buffer.reset(new stream_buffer());
+				}
+
+				return *buffer;
+			}
+
+			std::ostream& stream()
+			{
+				if (m_buffer)
+				{
+					return m_buffer->stream;
+				}
+
+				if (m_oss)
+				{
+					return *m_oss;
+				}
+
+				stream_buffer& buffer = thread_buffer();
+
+				// A message formatted while another one is being written on the same thread gets its own stream.
+				if (buffer.busy)
 				{
 					m_oss = boost::make_shared<std::ostringstream>();
+
+					return *m_oss;
 				}
 
-				(*m_oss) << value;
+				buffer.busy = true;
+				buffer.stream.str(std::string());
+				buffer.stream.clear();
+				m_buffer = &buffer;
 
-				return *this;
+				return m_buffer->stream;
 			}
 
-		private:
-
 			const logger& m_logger;
 			log_level m_level;
+			uint64_t m_suppressed;
+			stream_buffer* m_buffer;
 			boost::shared_ptr<std::ostringstream> m_oss;
 	};
 
@@ -364,6 +501,28 @@ namespace freelan
 				}
 			}
 
+			/**
+			 * \brief Get a rate-limited logger stream.
+			 * \param level_ The log level.
+			 * \param limiter The rate limiter of the log statement.
+			 * \return The appropriate logger stream.
+			 *
+			 * When the limiter denies the message, a null stream is returned: nothing gets formatted.
+			 */
+			stream_type operator()(log_level level_, log_rate_limiter& limiter) const
+			{
+				uint64_t suppressed = 0;
+
+				if ((level_ >= m_level) && limiter.acquire(suppressed))
+				{
+					return logger_stream_impl(string_logger_stream(*this, level_, suppressed));
+				}
+				else
+				{
+					return logger_stream_impl(null_logger_stream());
+				}
+			}
+
 			/**
 			 * \brief Log the specified message.
 			 * \param level_ The log level.
@@ -386,11 +545,23 @@ namespace freelan
 
 	inline string_logger_stream::~string_logger_stream()
 	{
-		if (m_oss)
+		if (m_buffer || m_oss)
 		{
-			(*m_oss) << std::flush;
+			std::ostream& os = stream();
+
+			if (m_suppressed > 0)
+			{
+				os << " (" << m_suppressed << " similar message(s) suppressed)";
+			}
+
+			os << std::flush;
+
+			const std::string msg = m_buffer ? m_buffer->stream.str() : m_oss->str();
 
-			const std::string msg = (*m_oss).str();
+			if (m_buffer)
+			{
+				m_buffer->busy = false;
+			}
 
 			m_logger.log(m_level, msg);
 		}
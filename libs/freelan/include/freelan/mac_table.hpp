@@ -0,0 +1,427 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file mac_table.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A MAC address learning table.
+ */
+
+#ifndef MAC_TABLE_HPP
+#define MAC_TABLE_HPP
+
+#include <algorithm>
+#include <vector>
+#include <limits>
+#include <cstring>
+
+#include <boost/array.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace freelan
+{
+	/**
+	 * \brief The multiplier of the Fibonacci hash of the MAC tables: 2^64 divided by the golden ratio.
+	 */
+	const uint64_t MAC_TABLE_HASH_MULTIPLIER = 0x9E3779B97F4A7C15ULL;
+
+	/**
+	 * \brief Hash an ethernet address.
+	 * \param address The address. All its bytes are used.
+	 * \param bits The count of bits of the hash, between 1 and 63.
+	 * \param multiplier The odd multiplier to use. Hashes computed with the same multiplier share their high bits.
+	 * \return The hash, in [0, 2^bits).
+	 */
+	inline size_t hash_ethernet_address(const boost::array<uint8_t, 6>& address, unsigned int bits, uint64_t multiplier = MAC_TABLE_HASH_MULTIPLIER)
+	{
+		uint64_t key = 0;
+
+		std::memcpy(&key, address.data(), address.size());
+
+		// Fibonacci hashing: the high bits of the product are the well-mixed ones.
+		return static_cast<size_t>((key * multiplier) >> (64 - bits));
+	}
+
+	/**
+	 * \brief A fixed-capacity MAC address learning table.
+	 *
+	 * Entries live in an open-addressing hash table and are kept in least-recently-learned order, so that learning, looking up and evicting are all done in constant time and without any allocation once the table is constructed.
+	 *
+	 * Entries that were not learned again for longer than the aging time are expired.
+	 */
+	template <typename ValueType>
+	class mac_table
+	{
+		public:
+
+			/**
+			 * \brief The ethernet address type.
+			 */
+			typedef boost::array<uint8_t, 6> ethernet_address_type;
+
+			/**
+			 * \brief The value type.
+			 */
+			typedef ValueType value_type;
+
+			/**
+			 * \brief The time type.
+			 */
+			typedef boost::posix_time::ptime time_type;
+
+			/**
+			 * \brief The duration type.
+			 */
+			typedef boost::posix_time::time_duration duration_type;
+
+			/**
+			 * \brief Create a new MAC table.
+			 * \param _max_entries The maximum count of entries. If the table is full, the least recently learned entry is evicted.
+			 * \param _aging_time The aging time. A null or special aging time disables aging.
+			 */
+			mac_table(size_t _max_entries, const duration_type& _aging_time);
+
+			/**
+			 * \brief Get the maximum count of entries.
+			 * \return The maximum count of entries.
+			 */
+			size_t max_entries() const
+			{
+				return m_entries.size();
+			}
+
+			/**
+			 * \brief Get the count of entries.
+			 * \return The count of entries, including the ones that expired but were not purged yet.
+			 */
+			size_t size() const
+			{
+				return m_entries.size() - m_free_entries.size();
+			}
+
+			/**
+			 * \brief Get the aging time.
+			 * \return The aging time.
+			 */
+			const duration_type& aging_time() const
+			{
+				return m_aging_time;
+			}
+
+			/**
+			 * \brief Set the aging time.
+			 * \param _aging_time The aging time. A null or special aging time disables aging.
+			 */
+			void set_aging_time(const duration_type& _aging_time)
+			{
+				m_aging_time = _aging_time;
+			}
+
+			/**
+			 * \brief Learn an address.
+			 * \param address The address.
+			 * \param value The value to associate to the address.
+			 * \param now The current time.
+			 */
+			void learn(const ethernet_address_type& address, const value_type& value, const time_type& now);
+
+			/**
+			 * \brief Find the value associated to an address.
+			 * \param address The address.
+			 * \param now The current time.
+			 * \return The value, or NULL if the address is unknown or expired.
+			 */
+			const value_type* find(const ethernet_address_type& address, const time_type& now);
+
+			/**
+			 * \brief Forget an address.
+			 * \param address The address.
+			 * \return true if the address was known.
+			 */
+			bool erase(const ethernet_address_type& address);
+
+		private:
+
+			typedef uint32_t index_type;
+
+			static const index_type NO_INDEX = std::numeric_limits<index_type>::max();
+
+			struct entry_type
+			{
+				entry_type() :
+					address(),
+					value(),
+					last_seen(),
+					previous(NO_INDEX),
+					next(NO_INDEX)
+				{}
+
+				ethernet_address_type address;
+				value_type value;
+				time_type last_seen;
+				index_type previous;
+				index_type next;
+			};
+
+			size_t home_slot(const ethernet_address_type& address) const
+			{
+				return hash_ethernet_address(address, m_slot_bits);
+			}
+
+			size_t find_slot(const ethernet_address_type& address) const
+			{
+				size_t slot = home_slot(address);
+
+				while ((m_slots[slot] != NO_INDEX) && (m_entries[m_slots[slot]].address != address))
+				{
+					slot = (slot + 1) & (m_slots.size() - 1);
+				}
+
+				return slot;
+			}
+
+			bool is_expired(const entry_type& entry, const time_type& now) const
+			{
+				return !m_aging_time.is_special() && (m_aging_time > duration_type()) && (now - entry.last_seen > m_aging_time);
+			}
+
+			void erase_slot(size_t slot);
+			void unlink(index_type index);
+			void link_first(index_type index);
+
+			std::vector<entry_type> m_entries;
+			std::vector<index_type> m_free_entries;
+			std::vector<index_type> m_slots;
+			unsigned int m_slot_bits;
+			index_type m_first;
+			index_type m_last;
+			duration_type m_aging_time;
+	};
+
+	template <typename ValueType>
+	const typename mac_table<ValueType>::index_type mac_table<ValueType>::NO_INDEX;
+
+	template <typename ValueType>
+	mac_table<ValueType>::mac_table(size_t _max_entries, const duration_type& _aging_time) :
+		m_entries(std::max<size_t>(_max_entries, 1)),
+		m_free_entries(),
+		m_slots(),
+		m_slot_bits(1),
+		m_first(NO_INDEX),
+		m_last(NO_INDEX),
+		m_aging_time(_aging_time)
+	{
+		// Keeping the load factor under one half keeps the probe sequences short.
+		while ((static_cast<size_t>(1) << m_slot_bits) < m_entries.size() * 2)
+		{
+			++m_slot_bits;
+		}
+
+		m_slots.assign(static_cast<size_t>(1) << m_slot_bits, NO_INDEX);
+		m_free_entries.reserve(m_entries.size());
+
+		for (size_t index = m_entries.size(); index > 0; --index)
+		{
+			m_free_entries.push_back(static_cast<index_type>(index - 1));
+		}
+	}
+
+	template <typename ValueType>
+	void mac_table<ValueType>::learn(const ethernet_address_type& address, const value_type& value, const time_type& now)
+	{
+		size_t slot = find_slot(address);
+
+		if (m_slots[slot] != NO_INDEX)
+		{
+			const index_type index = m_slots[slot];
+			entry_type& entry = m_entries[index];
+
+			entry.value = value;
+			entry.last_seen = now;
+
+			unlink(index);
+			link_first(index);
+
+			return;
+		}
+
+		// The least recently learned entries are the first to expire.
+		while ((m_last != NO_INDEX) && is_expired(m_entries[m_last], now))
+		{
+			erase_slot(find_slot(m_entries[m_last].address));
+		}
+
+		if (m_free_entries.empty())
+		{
+			// The table is full: we evict the least recently learned entry.
+			erase_slot(find_slot(m_entries[m_last].address));
+		}
+
+		// Erasing may have shifted the slots.
+		slot = find_slot(address);
+
+		const index_type index = m_free_entries.back();
+		m_free_entries.pop_back();
+
+		entry_type& entry = m_entries[index];
+
+		entry.address = address;
+		entry.value = value;
+		entry.last_seen = now;
+
+		m_slots[slot] = index;
+		link_first(index);
+	}
+
+	template <typename ValueType>
+	const ValueType* mac_table<ValueType>::find(const ethernet_address_type& address, const time_type& now)
+	{
+		const size_t slot = find_slot(address);
+
+		if (m_slots[slot] == NO_INDEX)
+		{
+			return NULL;
+		}
+
+		const entry_type& entry = m_entries[m_slots[slot]];
+
+		if (is_expired(entry, now))
+		{
+			erase_slot(slot);
+
+			return NULL;
+		}
+
+		return &entry.value;
+	}
+
+	template <typename ValueType>
+	bool mac_table<ValueType>::erase(const ethernet_address_type& address)
+	{
+		const size_t slot = find_slot(address);
+
+		if (m_slots[slot] == NO_INDEX)
+		{
+			return false;
+		}
+
+		erase_slot(slot);
+
+		return true;
+	}
+
+	template <typename ValueType>
+	void mac_table<ValueType>::erase_slot(size_t slot)
+	{
+		const index_type index = m_slots[slot];
+
+		unlink(index);
+		m_entries[index].value = value_type();
+		m_free_entries.push_back(index);
+
+		// Backward-shift deletion: no tombstones are needed and the probe sequences stay as short as possible.
+		const size_t mask = m_slots.size() - 1;
+
+		for (size_t next = (slot + 1) & mask; m_slots[next] != NO_INDEX; next = (next + 1) & mask)
+		{
+			const size_t home = home_slot(m_entries[m_slots[next]].address);
+
+			// If the home slot of the entry lies cyclically in ]slot, next], it cannot move.
+			const bool in_place = (slot <= next) ? ((slot < home) && (home <= next)) : ((slot < home) || (home <= next));
+
+			if (!in_place)
+			{
+				m_slots[slot] = m_slots[next];
+				slot = next;
+			}
+		}
+
+		m_slots[slot] = NO_INDEX;
+	}
+
+	template <typename ValueType>
+	void mac_table<ValueType>::unlink(index_type index)
+	{
+		entry_type& entry = m_entries[index];
+
+		if (entry.previous != NO_INDEX)
+		{
+			m_entries[entry.previous].next = entry.next;
+		}
+		else
+		{
+			m_first = entry.next;
+		}
+
+		if (entry.next != NO_INDEX)
+		{
+			m_entries[entry.next].previous = entry.previous;
+		}
+		else
+		{
+			m_last = entry.previous;
+		}
+
+		entry.previous = NO_INDEX;
+		entry.next = NO_INDEX;
+	}
+
+	template <typename ValueType>
+	void mac_table<ValueType>::link_first(index_type index)
+	{
+		entry_type& entry = m_entries[index];
+
+		entry.previous = NO_INDEX;
+		entry.next = m_first;
+
+		if (m_first != NO_INDEX)
+		{
+			m_entries[m_first].previous = index;
+		}
+		else
+		{
+			m_last = index;
+		}
+
+		m_first = index;
+	}
+}
+
+#endif /* MAC_TABLE_HPP */
@@ -0,0 +1,375 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file route_trie.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A longest-prefix-match route trie.
+ */
+
+#ifndef ROUTE_TRIE_HPP
+#define ROUTE_TRIE_HPP
+
+#include <algorithm>
+#include <set>
+#include <memory>
+#include <tuple>
+
+#include <boost/optional.hpp>
+
+namespace freelan
+{
+	/**
+	 * \brief A path-compressed binary trie that maps network prefixes to values.
+	 *
+	 * Lookups walk at most one node per distinct prefix length on the path of the address, whatever the count of prefixes. Prefixes can be inserted and erased one by one.
+	 *
+	 * Copies share their nodes, which are never modified once linked: inserting or erasing a prefix copies only the nodes on its path. A copy can therefore be changed while the original is being read from other threads.
+	 */
+	template <typename AddressType, typename ValueType>
+	class route_trie
+	{
+		public:
+
+			/**
+			 * \brief The address type.
+			 */
+			typedef AddressType address_type;
+
+			/**
+			 * \brief The value type.
+			 */
+			typedef ValueType value_type;
+
+			/**
+			 * \brief The length of an address, in bits.
+			 */
+			static const unsigned int address_length = std::tuple_size<typename address_type::bytes_type>::value * 8;
+
+			/**
+			 * \brief Create an empty trie.
+			 */
+			route_trie() : m_root() {}
+
+			/**
+			 * \brief Insert a value for a prefix.
+			 * \param prefix The prefix. Bits beyond prefix_length are ignored.
+			 * \param prefix_length The prefix length.
+			 * \param value The value to insert. A prefix may hold several values.
+			 */
+			void insert(const address_type& prefix, unsigned int prefix_length, const value_type& value);
+
+			/**
+			 * \brief Erase a value for a prefix.
+			 * \param prefix The prefix. Bits beyond prefix_length are ignored.
+			 * \param prefix_length The prefix length.
+			 * \param value The value to erase.
+			 * \return true if the value was found and erased.
+			 */
+			bool erase(const address_type& prefix, unsigned int prefix_length, const value_type& value);
+
+			/**
+			 * \brief Find the first value of the longest prefix that contains an address and that satisfies a predicate.
+			 * \param address The address.
+			 * \param predicate The predicate. If it rejects all the values of a prefix, shorter prefixes are tried.
+			 * \return The value, if one was found.
+			 *
+			 * The values of a given prefix are tried in ascending order.
+			 */
+			template <typename Predicate>
+			boost::optional<value_type> find(const address_type& address, Predicate predicate) const;
+
+			/**
+			 * \brief Remove all the prefixes.
+			 */
+			void clear()
+			{
+				m_root.reset();
+			}
+
+		private:
+
+			typedef typename address_type::bytes_type bytes_type;
+
+			struct node_type
+			{
+				node_type(const bytes_type& _prefix, unsigned int _prefix_length) :
+					prefix(mask(_prefix, _prefix_length)),
+					prefix_length(_prefix_length),
+					values(),
+					children()
+				{}
+
+				bytes_type prefix;
+				unsigned int prefix_length;
+				std::set<value_type> values;
+				std::shared_ptr<const node_type> children[2];
+			};
+
+			typedef std::shared_ptr<const node_type> node_ptr;
+
+			static unsigned int bit(const bytes_type& bytes, unsigned int index)
+			{
+				return (bytes[index / 8] >> (7 - (index % 8))) & 0x01;
+			}
+
+			static bytes_type mask(bytes_type bytes, unsigned int prefix_length)
+			{
+				for (unsigned int i = 0; i < bytes.size(); ++i)
+				{
+					if (prefix_length >= 8)
+					{
+						prefix_length -= 8;
+					}
+					else
+					{
+						bytes[i] &= static_cast<unsigned char>(0xFF << (8 - prefix_length));
+						prefix_length = 0;
+					}
+				}
+
+				return bytes;
+			}
+
+			static unsigned int common_prefix_length(const bytes_type& lhs, const bytes_type& rhs, unsigned int max_length)
+			{
+				unsigned int result = 0;
+
+				for (unsigned int i = 0; (i < lhs.size()) && (result < max_length); ++i)
+				{
+					const unsigned int diff = lhs[i] ^ rhs[i];
+
+					if (diff == 0)
+					{
+						result += 8;
+					}
+					else
+					{
+						for (unsigned int b = 0x80; (b & diff) == 0; b >>= 1)
+						{
+							++result;
+						}
+
+						break;
+					}
+				}
+
+				return std::min(result, max_length);
+			}
+
+			static node_ptr insert(const node_ptr& node, const bytes_type& prefix, unsigned int prefix_length, const value_type& value);
+			static bool erase(const node_ptr& node, const bytes_type& prefix, unsigned int prefix_length, const value_type& value, node_ptr& result);
+
+			node_ptr m_root;
+	};
+
+	template <typename AddressType, typename ValueType>
+	const unsigned int route_trie<AddressType, ValueType>::address_length;
+
+	template <typename AddressType, typename ValueType>
+	void route_trie<AddressType, ValueType>::insert(const address_type& address, unsigned int prefix_length, const value_type& value)
+	{
+		prefix_length = std::min(prefix_length, address_length);
+
+		m_root = insert(m_root, mask(address.to_bytes(), prefix_length), prefix_length, value);
+	}
+
+	template <typename AddressType, typename ValueType>
+	typename route_trie<AddressType, ValueType>::node_ptr route_trie<AddressType, ValueType>::insert(const node_ptr& node, const bytes_type& prefix, unsigned int prefix_length, const value_type& value)
+	{
+		if (!node)
+		{
+			const std::shared_ptr<node_type> leaf = std::make_shared<node_type>(prefix, prefix_length);
+			leaf->values.insert(value);
+
+			return leaf;
+		}
+
+		const unsigned int common = common_prefix_length(node->prefix, prefix, std::min(node->prefix_length, prefix_length));
+
+		if (common == node->prefix_length)
+		{
+			const std::shared_ptr<node_type> copy = std::make_shared<node_type>(*node);
+
+			if (prefix_length == node->prefix_length)
+			{
+				copy->values.insert(value);
+			}
+			else
+			{
+				// The node is an ancestor of the prefix: we go down.
+				const unsigned int side = bit(prefix, node->prefix_length);
+
+				copy->children[side] = insert(node->children[side], prefix, prefix_length, value);
+			}
+
+			return copy;
+		}
+
+		// The prefix diverges from the node, or is an ancestor of it: we split the edge. The node itself is shared as is.
+		const std::shared_ptr<node_type> parent = std::make_shared<node_type>(prefix, common);
+		const unsigned int node_side = bit(node->prefix, common);
+
+		parent->children[node_side] = node;
+
+		if (common == prefix_length)
+		{
+			parent->values.insert(value);
+		}
+		else
+		{
+			const std::shared_ptr<node_type> leaf = std::make_shared<node_type>(prefix, prefix_length);
+			leaf->values.insert(value);
+
+			parent->children[1 - node_side] = leaf;
+		}
+
+		return parent;
+	}
+
+	template <typename AddressType, typename ValueType>
+	bool route_trie<AddressType, ValueType>::erase(const address_type& address, unsigned int prefix_length, const value_type& value)
+	{
+		prefix_length = std::min(prefix_length, address_length);
+
+		return erase(m_root, mask(address.to_bytes(), prefix_length), prefix_length, value, m_root);
+	}
+
+	template <typename AddressType, typename ValueType>
+	bool route_trie<AddressType, ValueType>::erase(const node_ptr& node, const bytes_type& prefix, unsigned int prefix_length, const value_type& value, node_ptr& result)
+	{
+		if (!node)
+		{
+			return false;
+		}
+
+		if ((node->prefix_length > prefix_length) || (common_prefix_length(node->prefix, prefix, node->prefix_length) != node->prefix_length))
+		{
+			return false;
+		}
+
+		std::shared_ptr<node_type> copy;
+
+		if (node->prefix_length == prefix_length)
+		{
+			if (node->values.count(value) == 0)
+			{
+				return false;
+			}
+
+			copy = std::make_shared<node_type>(*node);
+			copy->values.erase(value);
+		}
+		else
+		{
+			const unsigned int side = bit(prefix, node->prefix_length);
+			node_ptr child;
+
+			if (!erase(node->children[side], prefix, prefix_length, value, child))
+			{
+				return false;
+			}
+
+			copy = std::make_shared<node_type>(*node);
+			copy->children[side] = child;
+		}
+
+		// A node without values is only kept if it is needed to branch.
+		if (copy->values.empty() && !copy->children[0])
+		{
+			result = copy->children[1];
+		}
+		else if (copy->values.empty() && !copy->children[1])
+		{
+			result = copy->children[0];
+		}
+		else
+		{
+			result = copy;
+		}
+
+		return true;
+	}
+
+	template <typename AddressType, typename ValueType>
+	template <typename Predicate>
+	boost::optional<ValueType> route_trie<AddressType, ValueType>::find(const address_type& address, Predicate predicate) const
+	{
+		const bytes_type bytes = address.to_bytes();
+
+		// The nodes that hold values on the path, from the shortest prefix to the longest one.
+		const node_type* matches[address_length + 1];
+		unsigned int match_count = 0;
+
+		for (const node_type* node = m_root.get(); node; )
+		{
+			if (common_prefix_length(node->prefix, bytes, node->prefix_length) != node->prefix_length)
+			{
+				break;
+			}
+
+			if (!node->values.empty())
+			{
+				matches[match_count++] = node;
+			}
+
+			if (node->prefix_length == address_length)
+			{
+				break;
+			}
+
+			node = node->children[bit(bytes, node->prefix_length)].get();
+		}
+
+		while (match_count > 0)
+		{
+			for (auto&& value : matches[--match_count]->values)
+			{
+				if (predicate(value))
+				{
+					return value;
+				}
+			}
+		}
+
+		return boost::none;
+	}
+}
+
+#endif /* ROUTE_TRIE_HPP */
@@ -54,9 +54,10 @@
 #include <boost/array.hpp>
 #include <boost/optional.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 
-#include <asiotap/osi/ipv4_filter.hpp>
-#include <asiotap/osi/ipv6_filter.hpp>
+#include <asiotap/osi/classifier.hpp>
 #include <asiotap/osi/ipv4_frame.hpp>
 #include <asiotap/osi/ipv6_frame.hpp>
 #include <asiotap/types/ip_network_address.hpp>
@@ -64,11 +65,14 @@
 #include "configuration.hpp"
 #include "port_index.hpp"
 #include "routes_message.hpp"
+#include "route_trie.hpp"
 
 namespace freelan
 {
 	/**
 	 * \brief A class that represents a router.
+	 *
+	 * The ports and their routes are changed from a single thread at a time, while data can be written from any thread: every change publishes a new immutable forwarding table that the writers share.
 	 */
 	class router
 	{
@@ -96,13 +100,22 @@ namespace freelan
 					 */
 					typedef boost::function<void (boost::asio::const_buffer data, write_handler_type handler)> write_function_type;
 
+					/**
+					 * \brief An in-place write function type.
+					 *
+					 * The data starts at the headroom the port was registered for and the whole buffer may be overwritten.
+					 */
+					typedef boost::function<void (boost::asio::mutable_buffer buffer, size_t data_len, write_handler_type handler)> in_place_write_function_type;
+
 					/**
 					 * \brief Create a new default port.
 					 */
 					port_type() :
 						m_write_function(),
+						m_in_place_write_function(),
 						m_local_routes(),
 						m_group(),
+						m_index(),
 						m_router(NULL)
 					{}
 
@@ -113,8 +126,25 @@ namespace freelan
 					 */
 					port_type(write_function_type write_function, port_group_type _group) :
 						m_write_function(write_function),
+						m_in_place_write_function(),
 						m_local_routes(),
 						m_group(_group),
+						m_index(),
+						m_router(NULL)
+					{}
+
+					/**
+					 * \brief Create a new port that can write data in place.
+					 * \param write_function The write function to use.
+					 * \param in_place_write_function The write function to use when the data can be overwritten.
+					 * \param _group The group this port belongs to.
+					 */
+					port_type(write_function_type write_function, in_place_write_function_type in_place_write_function, port_group_type _group) :
+						m_write_function(write_function),
+						m_in_place_write_function(in_place_write_function),
+						m_local_routes(),
+						m_group(_group),
+						m_index(),
 						m_router(NULL)
 					{}
 
@@ -124,8 +154,10 @@ namespace freelan
 					 */
 					port_type(const port_type& other) :
 						m_write_function(other.m_write_function),
+						m_in_place_write_function(other.m_in_place_write_function),
 						m_local_routes(other.m_local_routes),
 						m_group(other.m_group),
+						m_index(),
 						m_router(NULL)
 					{}
 
@@ -147,6 +179,7 @@ namespace freelan
 						dissociate_from_router();
 
 						m_write_function = other.m_write_function;
+						m_in_place_write_function = other.m_in_place_write_function;
 						m_local_routes = other.m_local_routes;
 						m_group = other.m_group;
 
@@ -163,6 +196,27 @@ namespace freelan
 						m_write_function(data, handler);
 					}
 
+					/**
+					 * \brief Write data to the port, allowing the port to overwrite it.
+					 * \param buffer The buffer that holds the data, after the headroom.
+					 * \param headroom The headroom.
+					 * \param data_len The data length.
+					 * \param handler The handler to call when the write is complete.
+					 *
+					 * If the port has no in-place write function, a regular write is done.
+					 */
+					void async_write_in_place(boost::asio::mutable_buffer buffer, size_t headroom, size_t data_len, write_handler_type handler) const
+					{
+						if (m_in_place_write_function)
+						{
+							m_in_place_write_function(buffer, data_len, handler);
+						}
+						else
+						{
+							m_write_function(boost::asio::buffer(buffer + headroom, data_len), handler);
+						}
+					}
+
 					const asiotap::ip_route_set& local_routes() const
 					{
 						return m_local_routes;
@@ -170,11 +224,12 @@ namespace freelan
 
 					void set_local_routes(const asiotap::ip_route_set& _local_routes)
 					{
-						m_local_routes = _local_routes;
+						asiotap::ip_route_set previous_local_routes = _local_routes;
+						std::swap(m_local_routes, previous_local_routes);
 
 						if (m_router)
 						{
-							m_router->invalidate_routes();
+							m_router->publish_forwarding_table(m_index, previous_local_routes, m_local_routes, false);
 						}
 					}
 
@@ -185,31 +240,24 @@ namespace freelan
 
 				private:
 
-					void associate_to_router(router* _router)
+					void associate_to_router(router* _router, const port_index_type& index)
 					{
 						m_router = _router;
-
-						if (m_router)
-						{
-							m_router->invalidate_routes();
-						}
+						m_index = index;
 					}
 
 					void dissociate_from_router()
 					{
-						if (m_router)
-						{
-							m_router->invalidate_routes();
-
-							m_router = NULL;
-						}
+						m_router = NULL;
 					}
 
 					friend class router;
 
 					write_function_type m_write_function;
+					in_place_write_function_type m_in_place_write_function;
 					asiotap::ip_route_set m_local_routes;
 					port_group_type m_group;
+					port_index_type m_index;
 					router* m_router;
 			};
 
@@ -223,17 +271,11 @@ namespace freelan
 			 * \param configuration The router configuration.
 			 */
 			router(const router_configuration& configuration) :
-				m_configuration(configuration)
+				m_configuration(configuration),
+				m_ports(),
+				m_forwarding_table(boost::make_shared<forwarding_table_type>())
 			{}
 
-			/**
-			 * \brief Invalidate the routes cache.
-			 */
-			void invalidate_routes()
-			{
-				m_routes = boost::none;
-			}
-
 			/**
 			 * \brief Register a router port.
 			 * \param index The index of the port.
@@ -241,10 +283,15 @@ namespace freelan
 			 */
 			void register_port(port_index_type index, port_type port)
 			{
+				const port_list_type::const_iterator previous_port_entry = m_ports.find(index);
+				const asiotap::ip_route_set previous_local_routes = (previous_port_entry != m_ports.end()) ? previous_port_entry->second.local_routes() : asiotap::ip_route_set();
+
 				port_type& local_port = (m_ports[index] = port);
 
-				// This takes care of automatically clearing the route cache whenever needed.
-				local_port.associate_to_router(this);
+				// This takes care of automatically updating the routes whenever needed.
+				local_port.associate_to_router(this, index);
+
+				publish_forwarding_table(index, previous_local_routes, local_port.local_routes(), true);
 			}
 
 			/**
@@ -255,7 +302,16 @@ namespace freelan
 			 */
 			void unregister_port(port_index_type index)
 			{
-				m_ports.erase(index);
+				const port_list_type::iterator port_entry = m_ports.find(index);
+
+				if (port_entry != m_ports.end())
+				{
+					const asiotap::ip_route_set previous_local_routes = port_entry->second.local_routes();
+
+					m_ports.erase(port_entry);
+
+					publish_forwarding_table(index, previous_local_routes, asiotap::ip_route_set(), true);
+				}
 			}
 
 			/**
@@ -291,26 +347,60 @@ namespace freelan
 			 * \param data The data to write.
 			 * \param handler The handler to call when the write is complete.
 			 */
-			void async_write(port_index_type index, boost::asio::const_buffer data, port_type::write_handler_type handler);
+			void async_write(port_index_type index, boost::asio::const_buffer data, port_type::write_handler_type handler) const;
+
+			/**
+			 * \brief Receive data trough the specified port, allowing it to be overwritten.
+			 * \param index The port from which the data comes.
+			 * \param buffer The buffer that holds the data, after the headroom.
+			 * \param headroom The headroom.
+			 * \param data_len The data length.
+			 * \param handler The handler to call when the write is complete.
+			 *
+			 * As a routed frame always has a single target, the data is written in place to avoid a copy.
+			 */
+			void async_write_in_place(port_index_type index, boost::asio::mutable_buffer buffer, size_t headroom, size_t data_len, port_type::write_handler_type handler) const;
 
 		private:
 
-			port_list_type::const_iterator get_target_for(port_index_type, boost::asio::const_buffer);
+			// The values are sorted like the routes used to be: by gateway, then by port index.
+			typedef route_trie<boost::asio::ip::address_v4, std::pair<boost::optional<boost::asio::ip::address_v4>, port_index_type> > ipv4_routes_type;
+			typedef route_trie<boost::asio::ip::address_v6, std::pair<boost::optional<boost::asio::ip::address_v6>, port_index_type> > ipv6_routes_type;
+
+			// Never modified once published. Its ports are copies that are not associated to the router.
+			//
+			// Consecutive tables share their ports when only routes change, and share the trie nodes that a change does not affect.
+			struct forwarding_table_type : boost::noncopyable
+			{
+				forwarding_table_type() :
+					ports(boost::make_shared<port_list_type>()),
+					ipv4_routes(),
+					ipv6_routes()
+				{}
+
+				boost::shared_ptr<const port_list_type> ports;
+				ipv4_routes_type ipv4_routes;
+				ipv6_routes_type ipv6_routes;
+			};
+
+			typedef boost::shared_ptr<const forwarding_table_type> forwarding_table_ptr_type;
 
-			template <typename AddressType>
-			port_list_type::const_iterator get_target_for(port_index_type, const AddressType&);
+			port_list_type::const_iterator get_target_for(const forwarding_table_type&, port_index_type, boost::asio::const_buffer) const;
 
-			router_configuration m_configuration;
+			template <typename RoutesType>
+			port_list_type::const_iterator get_target_for(const forwarding_table_type&, port_index_type, const RoutesType&, const typename RoutesType::address_type&) const;
 
-			port_list_type m_ports;
+			void publish_forwarding_table(port_index_type, const asiotap::ip_route_set&, const asiotap::ip_route_set&, bool);
 
-			asiotap::osi::filter<asiotap::osi::ipv4_frame> m_ipv4_filter;
-			asiotap::osi::filter<asiotap::osi::ipv6_frame> m_ipv6_filter;
+			class route_update_visitor;
 
-			typedef std::multimap<asiotap::ip_route, port_index_type> routes_port_type;
+			router_configuration m_configuration;
+
+			// Only used to build the forwarding tables.
+			port_list_type m_ports;
 
-			const routes_port_type& routes() const;
-			mutable boost::optional<routes_port_type> m_routes;
+			// Must only be accessed through boost::atomic_load() and boost::atomic_store().
+			forwarding_table_ptr_type m_forwarding_table;
 	};
 }
 
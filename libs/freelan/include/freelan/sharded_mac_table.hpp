@@ -0,0 +1,154 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file sharded_mac_table.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A MAC address learning table split into independently locked shards.
+ */
+
+#ifndef SHARDED_MAC_TABLE_HPP
+#define SHARDED_MAC_TABLE_HPP
+
+#include <memory>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+#include "mac_table.hpp"
+
+namespace freelan
+{
+	/**
+	 * \brief A MAC address learning table split into independently locked shards, so that concurrent writers seldom contend.
+	 *
+	 * Each shard is a mac_table of its own: the maximum entry count and the least-recently-learned eviction apply per shard.
+	 */
+	template <typename ValueType>
+	class sharded_mac_table
+	{
+		public:
+
+			/**
+			 * \brief The table type of a shard.
+			 */
+			typedef mac_table<ValueType> table_type;
+
+			/**
+			 * \brief The ethernet address type.
+			 */
+			typedef typename table_type::ethernet_address_type ethernet_address_type;
+
+			/**
+			 * \brief The count of bits of a shard index.
+			 */
+			static const unsigned int SHARD_BITS = 4;
+
+			/**
+			 * \brief The count of shards.
+			 */
+			static const size_t SHARD_COUNT = static_cast<size_t>(1) << SHARD_BITS;
+
+			/**
+			 * \brief A shard. Its table must only be accessed with its mutex locked.
+			 */
+			struct shard_type
+			{
+				shard_type(size_t max_entries, const typename table_type::duration_type& aging_time) :
+					mutex(),
+					table(max_entries, aging_time)
+				{}
+
+				boost::mutex mutex;
+				table_type table;
+			};
+
+			/**
+			 * \brief Create a new sharded MAC table.
+			 * \param max_entries The maximum count of entries, shared between the shards. No shard holds less than one entry.
+			 * \param aging_time The aging time. A null or special aging time disables aging.
+			 */
+			sharded_mac_table(size_t max_entries, const typename table_type::duration_type& aging_time) :
+				m_shards()
+			{
+				const size_t max_entries_per_shard = (max_entries + SHARD_COUNT - 1) / SHARD_COUNT;
+
+				for (size_t i = 0; i < SHARD_COUNT; ++i)
+				{
+					m_shards.push_back(std::unique_ptr<shard_type>(new shard_type(max_entries_per_shard, aging_time)));
+				}
+			}
+
+			sharded_mac_table(const sharded_mac_table&) = delete;
+			sharded_mac_table& operator=(const sharded_mac_table&) = delete;
+
+			/**
+			 * \brief Get the index of the shard that holds an address.
+			 * \param address The address.
+			 * \return The index of the shard.
+			 */
+			static size_t shard_index(const ethernet_address_type& address)
+			{
+				// The shard tables take their home slots from the high bits of the default hash: using another multiplier here keeps the addresses of a shard spread over all its slots.
+				return hash_ethernet_address(address, SHARD_BITS, 0xC2B2AE3D27D4EB4FULL);
+			}
+
+			/**
+			 * \brief Get the shard that holds an address.
+			 * \param address The address.
+			 * \return The shard.
+			 */
+			shard_type& shard(const ethernet_address_type& address)
+			{
+				return *m_shards[shard_index(address)];
+			}
+
+		private:
+
+			std::vector<std::unique_ptr<shard_type> > m_shards;
+	};
+
+	template <typename ValueType>
+	const unsigned int sharded_mac_table<ValueType>::SHARD_BITS;
+
+	template <typename ValueType>
+	const size_t sharded_mac_table<ValueType>::SHARD_COUNT;
+}
+
+#endif /* SHARDED_MAC_TABLE_HPP */
@@ -48,18 +48,23 @@
 
 #include <algorithm>
 #include <map>
-#include <set>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include "configuration.hpp"
 #include "port_index.hpp"
+#include "sharded_mac_table.hpp"
 
 namespace freelan
 {
 	/**
 	 * \brief A class that represents a switch.
+	 *
+	 * The ports are registered and unregistered from a single thread at a time, while data can be written from any thread: every registration publishes a new immutable forwarding table that the writers share.
 	 */
 	class switch_
 	{
@@ -102,11 +107,19 @@ namespace freelan
 					 */
 					typedef boost::function<void (boost::asio::const_buffer data, write_handler_type handler)> write_function_type;
 
+					/**
+					 * \brief An in-place write function type.
+					 *
+					 * The data starts at the headroom the port was registered for and the whole buffer may be overwritten.
+					 */
+					typedef boost::function<void (boost::asio::mutable_buffer buffer, size_t data_len, write_handler_type handler)> in_place_write_function_type;
+
 					/**
 					 * \brief Create a new default port.
 					 */
 					port_type() :
 						m_write_function(),
+						m_in_place_write_function(),
 						m_group()
 					{}
 
@@ -117,6 +130,19 @@ namespace freelan
 					 */
 					port_type(write_function_type write_function, port_group_type _group) :
 						m_write_function(write_function),
+						m_in_place_write_function(),
+						m_group(_group)
+					{}
+
+					/**
+					 * \brief Create a new port that can write data in place.
+					 * \param write_function The write function to use.
+					 * \param in_place_write_function The write function to use when the data can be overwritten.
+					 * \param _group The group this port belongs to.
+					 */
+					port_type(write_function_type write_function, in_place_write_function_type in_place_write_function, port_group_type _group) :
+						m_write_function(write_function),
+						m_in_place_write_function(in_place_write_function),
 						m_group(_group)
 					{}
 
@@ -125,11 +151,32 @@ namespace freelan
 					 * \param data The data to write.
 					 * \param handler The handler to call when the write is complete.
 					 */
-					void async_write(boost::asio::const_buffer data, write_handler_type handler)
+					void async_write(boost::asio::const_buffer data, write_handler_type handler) const
 					{
 						m_write_function(data, handler);
 					}
 
+					/**
+					 * \brief Write data to the port, allowing the port to overwrite it.
+					 * \param buffer The buffer that holds the data, after the headroom.
+					 * \param headroom The headroom.
+					 * \param data_len The data length.
+					 * \param handler The handler to call when the write is complete.
+					 *
+					 * If the port has no in-place write function, a regular write is done.
+					 */
+					void async_write_in_place(boost::asio::mutable_buffer buffer, size_t headroom, size_t data_len, write_handler_type handler) const
+					{
+						if (m_in_place_write_function)
+						{
+							m_in_place_write_function(buffer, data_len, handler);
+						}
+						else
+						{
+							m_write_function(boost::asio::buffer(buffer + headroom, data_len), handler);
+						}
+					}
+
 					port_group_type group() const
 					{
 						return m_group;
@@ -138,6 +185,7 @@ namespace freelan
 				private:
 
 					write_function_type m_write_function;
+					in_place_write_function_type m_in_place_write_function;
 					port_group_type m_group;
 			};
 
@@ -151,10 +199,7 @@ namespace freelan
 			 * \param configuration The switch configuration.
 			 * \param max_entries maximum entries allowed.
 			 */
-			switch_(const switch_configuration& configuration, const unsigned int max_entries = MAX_ENTRIES_DEFAULT) :
-				m_configuration(configuration),
-				m_max_entries(max_entries)
-			{}
+			switch_(const switch_configuration& configuration, const unsigned int max_entries = MAX_ENTRIES_DEFAULT);
 
 			/**
 			 * \brief Register a switch port.
@@ -164,6 +209,8 @@ namespace freelan
 			void register_port(port_index_type index, port_type port)
 			{
 				m_ports[index] = port;
+
+				publish_forwarding_table();
 			}
 
 			/**
@@ -174,7 +221,10 @@ namespace freelan
 			 */
 			void unregister_port(port_index_type index)
 			{
-				m_ports.erase(index);
+				if (m_ports.erase(index) > 0)
+				{
+					publish_forwarding_table();
+				}
 			}
 
 			/**
@@ -195,23 +245,80 @@ namespace freelan
 			 */
 			void async_write(port_index_type index, boost::asio::const_buffer data, multi_write_handler_type handler);
 
+			/**
+			 * \brief Receive data trough the specified port, allowing it to be overwritten.
+			 * \param index The port from which the data comes.
+			 * \param buffer The buffer that holds the data, after the headroom.
+			 * \param headroom The headroom.
+			 * \param data_len The data length.
+			 * \param handler The handler to call when the write is complete.
+			 *
+			 * If the data has a single target, it is written in place to avoid a copy. Otherwise, this is equivalent to async_write().
+			 */
+			void async_write_in_place(port_index_type index, boost::asio::mutable_buffer buffer, size_t headroom, size_t data_len, multi_write_handler_type handler);
+
+			/**
+			 * \brief Receive data trough the specified port, without gathering the results.
+			 * \param index The port from which the data comes.
+			 * \param data The data to write.
+			 * \param handler The handler to call when the write to a port is complete. It is called once per target port, or never if there are no targets.
+			 *
+			 * Unlike async_write(), this does not allocate anything to collect the results.
+			 */
+			void async_forward(port_index_type index, boost::asio::const_buffer data, port_type::write_handler_type handler);
+
+			/**
+			 * \brief Receive data trough the specified port, allowing it to be overwritten and without gathering the results.
+			 * \param index The port from which the data comes.
+			 * \param buffer The buffer that holds the data, after the headroom.
+			 * \param headroom The headroom.
+			 * \param data_len The data length.
+			 * \param handler The handler to call when the write to a port is complete. It is called once per target port, or never if there are no targets.
+			 *
+			 * If the data has a single target, it is written in place to avoid a copy. Otherwise, this is equivalent to async_forward().
+			 */
+			void async_forward_in_place(port_index_type index, boost::asio::mutable_buffer buffer, size_t headroom, size_t data_len, port_type::write_handler_type handler);
+
 		private:
 
-			std::set<port_index_type> get_targets_for(port_index_type, boost::asio::const_buffer);
-			std::set<port_index_type> get_targets_for(port_list_type::const_iterator);
+			typedef std::vector<port_list_type::const_iterator> target_list_type;
+			typedef std::map<port_group_type, target_list_type> flood_list_map_type;
+			typedef std::map<port_index_type, target_list_type> unicast_list_map_type;
+
+			// Never modified once published: the target lists refer to its own ports.
+			struct forwarding_table_type : boost::noncopyable
+			{
+				port_list_type ports;
+				flood_list_map_type flood_lists;
+				unicast_list_map_type unicast_lists;
+				target_list_type all_ports;
+				target_list_type no_ports;
+			};
+
+			typedef boost::shared_ptr<const forwarding_table_type> forwarding_table_ptr_type;
+
+			// The returned list may contain the source port, which must be skipped.
+			const target_list_type& get_targets_for(const forwarding_table_type&, port_list_type::const_iterator, boost::asio::const_buffer);
+			const target_list_type& get_flood_list(const forwarding_table_type&, port_list_type::const_iterator) const;
+			static size_t count_targets(const target_list_type&, port_list_type::const_iterator);
+
+			void publish_forwarding_table();
 
 			switch_configuration m_configuration;
-			unsigned int m_max_entries;
 
+			// Only used to build the forwarding tables.
 			port_list_type m_ports;
 
-			typedef boost::array<uint8_t, 6> ethernet_address_type;
-			typedef std::map<ethernet_address_type, port_index_type> ethernet_address_map_type;
+			// Must only be accessed through boost::atomic_load() and boost::atomic_store().
+			forwarding_table_ptr_type m_forwarding_table;
+
+			typedef sharded_mac_table<port_index_type> mac_table_type;
+			typedef mac_table_type::ethernet_address_type ethernet_address_type;
 
 			static ethernet_address_type to_ethernet_address(boost::asio::const_buffer);
 			static bool is_multicast_address(const ethernet_address_type&);
 
-			ethernet_address_map_type m_ethernet_address_map;
+			mac_table_type m_mac_table;
 	};
 }
 
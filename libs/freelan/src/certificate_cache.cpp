@@ -0,0 +1,150 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+
+/**
+ * \file certificate_cache.cpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A certificate validation verdict cache.
+ */
+
+#include "certificate_cache.hpp"
+
+namespace freelan
+{
+	certificate_cache::certificate_cache(size_t max_entries, const duration_type& ttl, const duration_type& negative_ttl) :
+		m_max_entries(max_entries),
+		m_ttl(ttl),
+		m_negative_ttl(negative_ttl),
+		m_mutex(),
+		m_generation(0),
+		m_entries(),
+		m_entry_map()
+	{
+	}
+
+	certificate_cache::generation_type certificate_cache::generation() const
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		return m_generation;
+	}
+
+	boost::optional<bool> certificate_cache::find(const key_type& key, const time_type& now)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		const entry_map_type::iterator it = m_entry_map.find(key);
+
+		if (it == m_entry_map.end())
+		{
+			return boost::none;
+		}
+
+		if (it->second->expiration <= now)
+		{
+			erase(it->second);
+
+			return boost::none;
+		}
+
+		m_entries.splice(m_entries.begin(), m_entries, it->second);
+
+		return it->second->verdict;
+	}
+
+	void certificate_cache::insert(const key_type& key, bool verdict, generation_type generation, const time_type& now, const time_type& not_after)
+	{
+		const duration_type& ttl = verdict ? m_ttl : m_negative_ttl;
+
+		if (ttl <= duration_type())
+		{
+			return;
+		}
+
+		time_type expiration = now + ttl;
+
+		// A valid certificate must not be remembered as such past its expiration.
+		if (!not_after.is_special() && (not_after < expiration))
+		{
+			expiration = not_after;
+		}
+
+		if (expiration <= now)
+		{
+			return;
+		}
+
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		if ((generation != m_generation) || (m_max_entries == 0))
+		{
+			return;
+		}
+
+		const entry_map_type::iterator it = m_entry_map.find(key);
+
+		if (it != m_entry_map.end())
+		{
+			erase(it->second);
+		}
+		else if (m_entries.size() >= m_max_entries)
+		{
+			erase(--m_entries.end());
+		}
+
+		m_entries.push_front(entry_type(key, verdict, expiration));
+		m_entry_map[key] = m_entries.begin();
+	}
+
+	void certificate_cache::clear()
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		++m_generation;
+		m_entry_map.clear();
+		m_entries.clear();
+	}
+
+	void certificate_cache::erase(entry_list_type::iterator entry)
+	{
+		m_entry_map.erase(entry->key);
+		m_entries.erase(entry);
+	}
+}
@@ -73,7 +73,13 @@ namespace freelan
 		accept_contact_requests(true),
 		accept_contacts(true),
 		hostname_resolution_protocol(HRP_IPV4),
-		hello_timeout(boost::posix_time::seconds(3))
+		hello_timeout(boost::posix_time::seconds(3)),
+		replay_window_size(fscp::DEFAULT_REPLAY_WINDOW_SIZE),
+		io_batch_size(fscp::DEFAULT_IO_BATCH_SIZE),
+		socket_count(fscp::DEFAULT_SOCKET_COUNT),
+		segmentation_offload(false),
+		handshake_thread_count(fscp::DEFAULT_HANDSHAKE_THREAD_COUNT),
+		handshake_queue_size(fscp::DEFAULT_HANDSHAKE_QUEUE_SIZE)
 	{
 	}
 
@@ -81,6 +87,7 @@ namespace freelan
 		identity(),
 		certificate_validation_method(CVM_DEFAULT),
 		certificate_validation_script(),
+		certificate_validator(),
 		certificate_authority_list(),
 		certificate_revocation_validation_method(CRVM_NONE),
 		certificate_revocation_list_list()
@@ -90,6 +97,7 @@ namespace freelan
 	tap_adapter_configuration::tap_adapter_configuration() :
 		enabled(true),
 		type(tap_adapter_type::tap),
+		queue_count(1),
 		ipv4_address_prefix_length(),
 		ipv6_address_prefix_length(),
 		arp_proxy_enabled(false),
@@ -104,7 +112,8 @@ namespace freelan
 
 	switch_configuration::switch_configuration() :
 		routing_method(RM_SWITCH),
-		relay_mode_enabled(false)
+		relay_mode_enabled(false),
+		mac_aging_time(boost::posix_time::seconds(300))
 	{
 	}
 
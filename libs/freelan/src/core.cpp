@@ -50,6 +50,7 @@
 #include "routes_message.hpp"
 
 #include <fscp/server_error.hpp>
+#include <fscp/data_message.hpp>
 
 #include <asiotap/types/ip_network_address.hpp>
 
@@ -78,12 +79,49 @@ namespace freelan
 		{
 		}
 
-		void null_switch_write_handler(const switch_::multi_write_result_type&)
+		void null_router_write_handler(const boost::system::error_code&)
 		{
 		}
 
-		void null_router_write_handler(const boost::system::error_code&)
+		// Only a few header fields are looked at and nothing is validated: the candidates still go through the proxy filters.
+		bool is_arp_proxy_candidate(boost::asio::const_buffer data)
 		{
+			if (buffer_size(data) < sizeof(asiotap::osi::ethernet_frame))
+			{
+				return false;
+			}
+
+			return (ntohs(buffer_cast<const asiotap::osi::ethernet_frame*>(data)->protocol) == asiotap::osi::ARP_PROTOCOL);
+		}
+
+		bool is_dhcp_proxy_candidate(boost::asio::const_buffer data)
+		{
+			if (buffer_size(data) < sizeof(asiotap::osi::ethernet_frame) + sizeof(asiotap::osi::ipv4_frame))
+			{
+				return false;
+			}
+
+			if (ntohs(buffer_cast<const asiotap::osi::ethernet_frame*>(data)->protocol) != asiotap::osi::IP_PROTOCOL)
+			{
+				return false;
+			}
+
+			const boost::asio::const_buffer ipv4_data = data + sizeof(asiotap::osi::ethernet_frame);
+			const asiotap::osi::ipv4_frame* const ipv4 = buffer_cast<const asiotap::osi::ipv4_frame*>(ipv4_data);
+
+			if (ipv4->protocol != asiotap::osi::UDP_PROTOCOL)
+			{
+				return false;
+			}
+
+			const size_t ipv4_header_length = (ipv4->version_ihl & 0x0F) * 4;
+
+			if (buffer_size(ipv4_data) < ipv4_header_length + sizeof(asiotap::osi::udp_frame))
+			{
+				return false;
+			}
+
+			return (ntohs(buffer_cast<const asiotap::osi::udp_frame*>(ipv4_data + ipv4_header_length)->destination) == asiotap::osi::BOOTP_PROTOCOL);
 		}
 
 		asiotap::endpoint to_endpoint(const core::ep_type& host)
@@ -218,6 +256,78 @@ namespace freelan
 		static const unsigned int TAP_ADAPTERS_GROUP = 0;
 		static const unsigned int ENDPOINTS_GROUP = 1;
 
+		// Frames are read after enough room for the FSCP data message header, so that they can be encrypted in place.
+		static const size_t TAP_ADAPTER_HEADROOM = fscp::data_message::CLEARTEXT_OFFSET;
+
+		// The cipher may need up to one extra block when finalizing.
+		static const size_t TAP_ADAPTER_TAILROOM = 16;
+
+		// Ethernet header, with room for a 802.1Q tag.
+		static const size_t ETHERNET_HEADER_LENGTH = 18;
+
+		// The same amount of memory as the former 8 blocks of 64 KiB.
+		static const size_t TAP_ADAPTER_BUFFER_POOL_SIZE = 65536 * 8;
+
+		size_t get_tap_adapter_buffer_size(const freelan::configuration& configuration)
+		{
+			const unsigned int mtu = compute_mtu(configuration.tap_adapter.mtu, get_auto_mtu_value());
+
+			if (mtu == 0)
+			{
+				// The system MTU is only known once the tap adapter is open: take the largest possible.
+				return fscp::DEFAULT_DATAGRAM_SIZE;
+			}
+
+			// A buffer holds a frame and the room needed to encrypt it in place: this is also the size of the resulting datagram.
+			return TAP_ADAPTER_HEADROOM + ETHERNET_HEADER_LENGTH + mtu + TAP_ADAPTER_TAILROOM;
+		}
+
+		uint32_t get_flow_hash(boost::asio::const_buffer data, asiotap::tap_adapter_layer layer)
+		{
+			const uint8_t* const frame = buffer_cast<const uint8_t*>(data);
+			const size_t frame_size = buffer_size(data);
+
+			size_t offset = 0;
+			size_t length = 0;
+
+			if (layer == asiotap::tap_adapter_layer::ethernet)
+			{
+				// The destination and source ethernet addresses.
+				length = 12;
+			}
+			else if (frame_size > 0)
+			{
+				switch (frame[0] >> 4)
+				{
+					case 4:
+						// The source and destination IPv4 addresses.
+						offset = 12;
+						length = 8;
+						break;
+					case 6:
+						// The source and destination IPv6 addresses.
+						offset = 8;
+						length = 32;
+						break;
+				}
+			}
+
+			if (offset + length > frame_size)
+			{
+				return 0;
+			}
+
+			// FNV-1a
+			uint32_t hash = 2166136261u;
+
+			for (size_t i = offset; i < offset + length; ++i)
+			{
+				hash = (hash ^ frame[i]) * 16777619u;
+			}
+
+			return hash;
+		}
+
 		asiotap::ip_route_set filter_routes(const asiotap::ip_route_set& routes, router_configuration::internal_route_scope_type scope, unsigned int limit, const asiotap::ip_network_address_list& network_addresses)
 		{
 			asiotap::ip_route_set result;
@@ -393,15 +503,28 @@ namespace freelan
 	const boost::posix_time::time_duration core::CONTACT_PERIOD = boost::posix_time::seconds(30);
 	const boost::posix_time::time_duration core::DYNAMIC_CONTACT_PERIOD = boost::posix_time::seconds(45);
 	const boost::posix_time::time_duration core::ROUTES_REQUEST_PERIOD = boost::posix_time::seconds(180);
+	const boost::posix_time::time_duration core::NETWORK_CHANGE_DELAY = boost::posix_time::milliseconds(100);
+	const size_t core::CERTIFICATE_CACHE_SIZE = 4096;
+	const boost::posix_time::time_duration core::CERTIFICATE_CACHE_TTL = boost::posix_time::minutes(5);
+	const boost::posix_time::time_duration core::CERTIFICATE_CACHE_NEGATIVE_TTL = boost::posix_time::seconds(10);
 
 	const std::string core::DEFAULT_SERVICE = "12000";
 
 	core::core(boost::asio::io_service& io_service, const freelan::configuration& _configuration) :
 		m_io_service(io_service),
 		m_configuration(_configuration),
-		m_logger_strand(m_io_service),
-		m_logger(m_logger_strand.wrap(boost::bind(&core::do_handle_log, this, _1, _2, _3))),
-		m_log_callback(),
+		m_log_queue(),
+		m_logger(boost::bind(&log_queue::push, &m_log_queue, _1, _2, _3)),
+		m_hello_received_log_limiter(),
+		m_banned_hello_log_limiter(),
+		m_banned_presentation_log_limiter(),
+		m_active_session_presentation_log_limiter(),
+		m_invalid_presentation_log_limiter(),
+		m_rejected_presentation_log_limiter(),
+		m_malformed_data_log_limiter(),
+		m_unhandled_data_log_limiter(),
+		m_unhandled_message_log_limiter(),
+		m_tap_adapter_write_log_limiter(),
 		m_core_opened_callback(),
 		m_core_closed_callback(),
 		m_session_failed_callback(),
@@ -409,15 +532,23 @@ namespace freelan
 		m_session_established_callback(),
 		m_session_lost_callback(),
 		m_certificate_validation_callback(),
+		m_async_certificate_validation_callback(),
 		m_tap_adapter_up_callback(),
 		m_tap_adapter_down_callback(),
 		m_server(),
 		m_contact_timer(m_io_service, CONTACT_PERIOD),
 		m_dynamic_contact_timer(m_io_service, DYNAMIC_CONTACT_PERIOD),
 		m_routes_request_timer(m_io_service, ROUTES_REQUEST_PERIOD),
+		m_network_change_timer(m_io_service),
+		m_network_change_pending(false),
+		m_ca_stores(),
+		m_ca_stores_mutex(),
+		m_certificate_cache(CERTIFICATE_CACHE_SIZE, CERTIFICATE_CACHE_TTL, CERTIFICATE_CACHE_NEGATIVE_TTL),
+		m_pending_presentation_validations(),
 		m_tap_adapter_strand(m_io_service),
-		m_proxies_strand(m_io_service),
-		m_tap_write_queue_strand(m_io_service),
+		m_proxies_mutex(),
+		m_tap_adapter_memory_pool(get_tap_adapter_buffer_size(m_configuration), TAP_ADAPTER_BUFFER_POOL_SIZE / get_tap_adapter_buffer_size(m_configuration)),
+		m_tap_adapter_queues(),
 		m_arp_filter(m_ethernet_filter),
 		m_ipv4_filter(m_ethernet_filter),
 		m_udp_filter(m_ipv4_filter),
@@ -475,15 +606,6 @@ namespace freelan
 
 	// Private methods
 
-	void core::do_handle_log(log_level level, const std::string& msg, const boost::posix_time::ptime& timestamp)
-	{
-		// All do_handle_log() calls are done within the same strand, so the user does not need to protect his callback with a mutex that might slow things down.
-		if (m_log_callback)
-		{
-			m_log_callback(level, msg, timestamp);
-		}
-	}
-
 	bool core::is_banned(const boost::asio::ip::address& address) const
 	{
 		return has_address(m_configuration.fscp.never_contact_list.begin(), m_configuration.fscp.never_contact_list.end(), address);
@@ -491,10 +613,20 @@ namespace freelan
 
 	void core::open_server()
 	{
-		m_server = boost::make_shared<fscp::server>(boost::ref(m_io_service), boost::cref(*m_configuration.security.identity));
+		// The receive buffers must hold any datagram a peer may send, such as a PRESENTATION with a large certificate chain or data from a peer with a larger MTU: the tap adapter buffer size is not enough.
+		m_server = boost::make_shared<fscp::server>(boost::ref(m_io_service), boost::cref(*m_configuration.security.identity), fscp::DEFAULT_DATAGRAM_SIZE);
+
+		// The validations started by a previous server won't complete anymore.
+		m_pending_presentation_validations.clear();
 
 		m_server->set_cipher_suites(m_configuration.fscp.cipher_suite_capabilities);
 		m_server->set_elliptic_curves(m_configuration.fscp.elliptic_curve_capabilities);
+		m_server->set_replay_window_size(m_configuration.fscp.replay_window_size);
+		m_server->set_io_batch_size(m_configuration.fscp.io_batch_size);
+		m_server->set_socket_count(m_configuration.fscp.socket_count);
+		m_server->set_segmentation_offload_enabled(m_configuration.fscp.segmentation_offload);
+		m_server->set_handshake_thread_count(m_configuration.fscp.handshake_thread_count);
+		m_server->set_handshake_queue_size(m_configuration.fscp.handshake_queue_size);
 
 		m_server->set_hello_message_received_callback(boost::bind(&core::do_handle_hello_received, this, _1, _2));
 		m_server->set_contact_request_received_callback(boost::bind(&core::do_handle_contact_request_received, this, _1, _2, _3, _4));
@@ -521,38 +653,8 @@ namespace freelan
 
 		m_logger(LL_IMPORTANT) << "Core set to listen on: " << listen_endpoint;
 
-		if (m_configuration.security.certificate_validation_method == security_configuration::CVM_DEFAULT)
-		{
-			m_ca_store = cryptoplus::x509::store::create();
-
-			BOOST_FOREACH(const cert_type& cert, m_configuration.security.certificate_authority_list)
-			{
-				m_ca_store.add_certificate(cert);
-			}
-
-			BOOST_FOREACH(const crl_type& crl, m_configuration.security.certificate_revocation_list_list)
-			{
-				m_ca_store.add_certificate_revocation_list(crl);
-			}
-
-			switch (m_configuration.security.certificate_revocation_validation_method)
-			{
-				case security_configuration::CRVM_LAST:
-					{
-						m_ca_store.set_verification_flags(X509_V_FLAG_CRL_CHECK);
-						break;
-					}
-				case security_configuration::CRVM_ALL:
-					{
-						m_ca_store.set_verification_flags(X509_V_FLAG_CRL_CHECK | X509_V_FLAG_CRL_CHECK_ALL);
-						break;
-					}
-				case security_configuration::CRVM_NONE:
-					{
-						break;
-					}
-			}
-		}
+		// The certificate authorities and revocation lists may have changed: the previous verdicts are irrelevant.
+		reset_certificate_validation();
 
 		for(auto&& network_address : m_configuration.fscp.never_contact_list)
 		{
@@ -565,16 +667,25 @@ namespace freelan
 #ifdef LINUX
 		if (!m_configuration.fscp.listen_on_device.empty())
 		{
-			const auto socket_fd = m_server->get_socket().native();
 			const std::string device_name = m_configuration.fscp.listen_on_device;
+			bool restricted = true;
 
-			if (::setsockopt(socket_fd, SOL_SOCKET, SO_BINDTODEVICE, device_name.c_str(), device_name.size()) == 0)
+			for (size_t index = 0; index < m_server->socket_count(); ++index)
 			{
-				m_logger(LL_IMPORTANT) << "Restricting VPN traffic on: " << device_name;
+				const auto socket_fd = m_server->get_socket(index).native();
+
+				if (::setsockopt(socket_fd, SOL_SOCKET, SO_BINDTODEVICE, device_name.c_str(), device_name.size()) != 0)
+				{
+					m_logger(LL_WARNING) << "Unable to restrict traffic on: " << device_name << ". Error was: " << boost::system::error_code(errno, boost::system::system_category()).message();
+					restricted = false;
+
+					break;
+				}
 			}
-			else
+
+			if (restricted)
 			{
-				m_logger(LL_WARNING) << "Unable to restrict traffic on: " << device_name << ". Error was: " << boost::system::error_code(errno, boost::system::system_category()).message();
+				m_logger(LL_IMPORTANT) << "Restricting VPN traffic on: " << device_name;
 			}
 		}
 #endif
@@ -585,10 +696,24 @@ namespace freelan
 		m_contact_timer.async_wait(boost::bind(&core::do_handle_periodic_contact, this, boost::asio::placeholders::error));
 		m_dynamic_contact_timer.async_wait(boost::bind(&core::do_handle_periodic_dynamic_contact, this, boost::asio::placeholders::error));
 		m_routes_request_timer.async_wait(boost::bind(&core::do_handle_periodic_routes_request, this, boost::asio::placeholders::error));
+
+		// Network changes are handled as soon as they happen, rather than when the sessions time out.
+		try
+		{
+			m_route_manager.start_network_monitoring(boost::bind(&core::do_handle_network_change, this));
+		}
+		catch (boost::system::system_error& ex)
+		{
+			m_logger(LL_WARNING) << "Unable to monitor network changes: " << ex.what();
+		}
 	}
 
 	void core::close_server()
 	{
+		m_route_manager.stop_network_monitoring();
+		m_network_change_timer.cancel();
+		m_network_change_pending = false;
+
 		// Stop the contact loop timers.
 		m_routes_request_timer.cancel();
 		m_dynamic_contact_timer.cancel();
@@ -890,6 +1015,34 @@ namespace freelan
 		}
 	}
 
+	void core::do_handle_network_change()
+	{
+		// Calls to do_handle_network_change() are serialized by the route manager: only the first change of a burst arms the timer.
+		if (!m_network_change_pending.exchange(true))
+		{
+			m_network_change_timer.expires_from_now(NETWORK_CHANGE_DELAY);
+			m_network_change_timer.async_wait(boost::bind(&core::do_handle_network_change_delay, this, boost::asio::placeholders::error));
+		}
+	}
+
+	void core::do_handle_network_change_delay(const boost::system::error_code& ec)
+	{
+		if (ec != boost::asio::error::operation_aborted)
+		{
+			m_network_change_pending = false;
+
+			m_logger(LL_INFORMATION) << "Network change detected. Checking sessions and contacting hosts...";
+
+			// Hosts we lost the sessions with are contacted again right away, and those that are now reached differently get new sessions.
+			async_contact_all();
+			async_dynamic_contact_all();
+
+			m_server->async_get_session_endpoints([this](const std::set<ep_type>& hosts) {
+				async_renew_rerouted_sessions(hosts);
+			});
+		}
+	}
+
 	void core::do_handle_send_contact_request(const ep_type& target, const boost::system::error_code& ec)
 	{
 		if (ec)
@@ -940,11 +1093,11 @@ namespace freelan
 
 	bool core::do_handle_hello_received(const ep_type& sender, bool default_accept)
 	{
-		m_logger(LL_DEBUG) << "Received HELLO_REQUEST from " << sender << ".";
+		m_logger(LL_DEBUG, m_hello_received_log_limiter) << "Received HELLO_REQUEST from " << sender << ".";
 
 		if (is_banned(sender.address()))
 		{
-			m_logger(LL_WARNING) << "Ignoring HELLO_REQUEST from " << sender << " as it is a banned host.";
+			m_logger(LL_WARNING, m_banned_hello_log_limiter) << "Ignoring HELLO_REQUEST from " << sender << " as it is a banned host.";
 
 			default_accept = false;
 		}
@@ -998,21 +1151,45 @@ namespace freelan
 
 		if (is_banned(sender.address()))
 		{
-			m_logger(LL_WARNING) << "Ignoring PRESENTATION from " << sender << " as it is a banned host.";
+			m_logger(LL_WARNING, m_banned_presentation_log_limiter) << "Ignoring PRESENTATION from " << sender << " as it is a banned host.";
 
 			return false;
 		}
 
 		if (has_session)
 		{
-			m_logger(LL_WARNING) << "Ignoring PRESENTATION from " << sender << " as an active session currently exists with this host.";
+			m_logger(LL_WARNING, m_active_session_presentation_log_limiter) << "Ignoring PRESENTATION from " << sender << " as an active session currently exists with this host.";
 
 			return false;
 		}
 
 		if (!certificate_is_valid(sig_cert))
 		{
-			m_logger(LL_WARNING) << "Ignoring PRESENTATION from " << sender << " as the signature certificate is invalid.";
+			m_logger(LL_WARNING, m_invalid_presentation_log_limiter) << "Ignoring PRESENTATION from " << sender << " as the signature certificate is invalid.";
+
+			return false;
+		}
+
+		if (m_async_certificate_validation_callback)
+		{
+			const hash_type hash = fscp::get_certificate_hash(sig_cert);
+			const std::map<ep_type, hash_type>::const_iterator pending_validation = m_pending_presentation_validations.find(sender);
+
+			// A host usually presents its certificate several times in a row: only the first presentation gets validated and requests a session.
+			if ((pending_validation != m_pending_presentation_validations.end()) && (pending_validation->second == hash))
+			{
+				if (m_logger.level() <= LL_DEBUG)
+				{
+					m_logger(LL_DEBUG) << "Ignoring PRESENTATION from " << sender << " as its signature certificate is already being validated.";
+				}
+
+				return false;
+			}
+
+			m_pending_presentation_validations[sender] = hash;
+
+			// The presentation is only stored once the verdict is known, so that a slow validation doesn't hold the presentation strand.
+			m_async_certificate_validation_callback(sig_cert, boost::bind(&core::handle_async_certificate_validation, this, boost::weak_ptr<fscp::server>(m_server), sender, sig_cert, hash, _1));
 
 			return false;
 		}
@@ -1109,6 +1286,10 @@ namespace freelan
 		m_logger(LL_INFORMATION) << "Cipher suite: " << cs;
 		m_logger(LL_INFORMATION) << "Elliptic curve: " << ec;
 
+		const fscp::worker_pool_statistics_type handshake_statistics = m_server->get_handshake_statistics();
+
+		m_logger(LL_DEBUG) << "Handshake queue depth: " << handshake_statistics.queue_depth << " (peak: " << handshake_statistics.peak_queue_depth << ", completed: " << handshake_statistics.completed << ", failed: " << handshake_statistics.failed << ", rejected: " << handshake_statistics.rejected << ").";
+
 		if (is_new)
 		{
 			if (m_configuration.tap_adapter.type == tap_adapter_configuration::tap_adapter_type::tap)
@@ -1121,8 +1302,15 @@ namespace freelan
 				async_register_router_port(host, boost::bind(&core::async_send_routes_request, this, host));
 			}
 
-			const auto route = m_route_manager.get_route_for(host.address());
-			async_save_system_route(host, route, void_handler_type());
+			// The routes we pinned ourselves are ignored: one of them may still point to the path this host was previously reached through.
+			m_route_manager.async_get_system_routes_for(std::vector<boost::asio::ip::address>(1, host.address()), [this, host](const std::map<boost::asio::ip::address, route_type>& routes) {
+				const auto route = routes.find(host.address());
+
+				if (route != routes.end())
+				{
+					async_save_system_route(host, route->second, void_handler_type());
+				}
+			});
 		}
 
 		if (m_session_established_callback)
@@ -1135,6 +1323,10 @@ namespace freelan
 	{
 		m_logger(LL_IMPORTANT) << "Session with " << host << " lost.";
 
+		m_server->async_get_replay_statistics(host, [this, host](const fscp::replay_statistics_type& statistics) {
+			m_logger(LL_DEBUG) << "Replay statistics for " << host << ": " << statistics.reordered << " reordered, " << statistics.replayed << " replayed, " << statistics.outdated << " outdated message(s).";
+		});
+
 		if (m_session_lost_callback)
 		{
 			m_session_lost_callback(host);
@@ -1165,7 +1357,7 @@ namespace freelan
 						data,
 						make_shared_buffer_handler(
 							buffer,
-							&null_switch_write_handler
+							&null_simple_write_handler
 						)
 					);
 				}
@@ -1192,12 +1384,12 @@ namespace freelan
 				}
 				catch (std::runtime_error& ex)
 				{
-					m_logger(LL_WARNING) << "Received incorrectly formatted message from " << sender << ". Error was: " << ex.what();
+					m_logger(LL_WARNING, m_malformed_data_log_limiter) << "Received incorrectly formatted message from " << sender << ". Error was: " << ex.what();
 				}
 
 				break;
 			default:
-				m_logger(LL_WARNING) << "Received unhandled " << buffer_size(data) << " byte(s) of data on FSCP channel #" << static_cast<int>(channel_number);
+				m_logger(LL_WARNING, m_unhandled_data_log_limiter) << "Received unhandled " << buffer_size(data) << " byte(s) of data on FSCP channel #" << static_cast<int>(channel_number);
 				break;
 		}
 	}
@@ -1225,7 +1417,7 @@ namespace freelan
 				}
 
 			default:
-				m_logger(LL_WARNING) << "Received unhandled message of type " << static_cast<int>(msg.type()) << " on the message channel";
+				m_logger(LL_WARNING, m_unhandled_message_log_limiter) << "Received unhandled message of type " << static_cast<int>(msg.type()) << " on the message channel";
 				break;
 		}
 	}
@@ -1369,16 +1561,38 @@ namespace freelan
 			}
 		}
 
-		client_router_info_type new_client_router_info;
-		new_client_router_info.saved_system_route = client_router_info.saved_system_route;
-		new_client_router_info.version = client_router_info.version;
+		std::vector<asiotap::route_manager::route_type> system_route_list;
 
 		for (auto&& route : filtered_system_routes)
 		{
-			new_client_router_info.system_route_entries.push_back(m_route_manager.get_route_entry(m_tap_adapter->get_route(route)));
+			system_route_list.push_back(m_tap_adapter->get_route(route));
+		}
+
+		// Setting the system routes takes system calls: we don't want to hold the router strand while they complete.
+		const uint64_t generation = ++client_router_info.system_routes_generation;
+
+		m_route_manager.async_get_route_entries(system_route_list, m_router_strand.wrap(boost::bind(&core::do_set_system_route_entries, this, sender, generation, _1)));
+	}
+
+	void core::do_set_system_route_entries(const ep_type& sender, uint64_t generation, const std::vector<asiotap::route_manager::entry_type>& entries)
+	{
+		// All calls to do_set_system_route_entries() are done within the m_router_strand, so the following is safe.
+		const auto client_router_info = m_client_router_info_map.find(sender);
+
+		if ((client_router_info == m_client_router_info_map.end()) || (client_router_info->second.system_routes_generation != generation))
+		{
+			// The routes were cleared or replaced in the meantime: the entries are released without blocking the router strand.
+			m_route_manager.async_release_route_entries(entries);
+
+			return;
 		}
 
-		client_router_info = new_client_router_info;
+		std::vector<asiotap::route_manager::entry_type> old_entries;
+		old_entries.swap(client_router_info->second.system_route_entries);
+		client_router_info->second.system_route_entries = entries;
+
+		// The routes that are still in use are held by the new entries and won't be released.
+		m_route_manager.async_release_route_entries(std::move(old_entries));
 	}
 
 	int core::certificate_validation_callback(int ok, X509_STORE_CTX* ctx)
@@ -1412,23 +1626,27 @@ namespace freelan
 		{
 			case security_configuration::CVM_DEFAULT:
 				{
-					using namespace cryptoplus;
-
-					// We can't easily ensure m_ca_store is used only in one strand, so we protect it with a mutex instead.
-					boost::mutex::scoped_lock lock(m_ca_store_mutex);
+					// Peers that reconnect often present the same certificate again and again: we only verify its chain once in a while.
+					const fscp::hash_type hash = fscp::get_certificate_hash(cert);
+					const boost::posix_time::ptime now = boost::posix_time::second_clock::universal_time();
+					const boost::optional<bool> cached_verdict = m_certificate_cache.find(hash, now);
 
-					// Create a store context to proceed to verification
-					x509::store_context store_context = x509::store_context::create();
+					if (cached_verdict)
+					{
+						if (!*cached_verdict)
+						{
+							return false;
+						}
 
-					store_context.initialize(m_ca_store, cert, NULL);
+						break;
+					}
 
-					// Ensure to set the verification callback *AFTER* you called initialize or it will be ignored.
-					store_context.set_verification_callback(&core::certificate_validation_callback);
+					const certificate_cache::generation_type generation = m_certificate_cache.generation();
+					const bool verdict = certificate_chain_is_valid(cert);
 
-					// Add a reference to the current instance into the store context.
-					store_context.set_external_data(core::ex_data_index, this);
+					m_certificate_cache.insert(hash, verdict, generation, now, cert.not_after().to_ptime());
 
-					if (!store_context.verify())
+					if (!verdict)
 					{
 						return false;
 					}
@@ -1449,6 +1667,164 @@ namespace freelan
 		return true;
 	}
 
+	bool core::certificate_chain_is_valid(cert_type cert)
+	{
+		using namespace cryptoplus;
+
+		certificate_cache::generation_type generation = 0;
+		const x509::store ca_store = acquire_ca_store(generation);
+
+		bool result = false;
+
+		{
+			// Create a store context to proceed to verification
+			x509::store_context store_context = x509::store_context::create();
+
+			store_context.initialize(ca_store, cert, NULL);
+
+			// Ensure to set the verification callback *AFTER* you called initialize or it will be ignored.
+			store_context.set_verification_callback(&core::certificate_validation_callback);
+
+			// Add a reference to the current instance into the store context.
+			store_context.set_external_data(core::ex_data_index, this);
+
+			result = store_context.verify();
+		}
+
+		release_ca_store(ca_store, generation);
+
+		return result;
+	}
+
+	cryptoplus::x509::store core::create_ca_store() const
+	{
+		cryptoplus::x509::store ca_store = cryptoplus::x509::store::create();
+
+		BOOST_FOREACH(const cert_type& cert, m_configuration.security.certificate_authority_list)
+		{
+			ca_store.add_certificate(cert);
+		}
+
+		BOOST_FOREACH(const crl_type& crl, m_configuration.security.certificate_revocation_list_list)
+		{
+			ca_store.add_certificate_revocation_list(crl);
+		}
+
+		switch (m_configuration.security.certificate_revocation_validation_method)
+		{
+			case security_configuration::CRVM_LAST:
+				{
+					ca_store.set_verification_flags(X509_V_FLAG_CRL_CHECK);
+					break;
+				}
+			case security_configuration::CRVM_ALL:
+				{
+					ca_store.set_verification_flags(X509_V_FLAG_CRL_CHECK | X509_V_FLAG_CRL_CHECK_ALL);
+					break;
+				}
+			case security_configuration::CRVM_NONE:
+				{
+					break;
+				}
+		}
+
+		return ca_store;
+	}
+
+	cryptoplus::x509::store core::acquire_ca_store(certificate_cache::generation_type& generation)
+	{
+		{
+			boost::mutex::scoped_lock lock(m_ca_stores_mutex);
+
+			generation = m_certificate_cache.generation();
+
+			if (!m_ca_stores.empty())
+			{
+				const cryptoplus::x509::store ca_store = m_ca_stores.back();
+				m_ca_stores.pop_back();
+
+				return ca_store;
+			}
+		}
+
+		// All the stores are in use: we make a new one, which will be kept for later validations.
+		// A shared pool, rather than a store per thread, can be emptied at once by reset_certificate_validation() whatever the thread that made the stores. It also avoids thread_local, which MSVC v120 doesn't support.
+		return create_ca_store();
+	}
+
+	void core::release_ca_store(cryptoplus::x509::store ca_store, certificate_cache::generation_type generation)
+	{
+		boost::mutex::scoped_lock lock(m_ca_stores_mutex);
+
+		// A store made before the last reset may hold outdated certificate authorities or revocation lists.
+		if (generation == m_certificate_cache.generation())
+		{
+			m_ca_stores.push_back(ca_store);
+		}
+	}
+
+	void core::reset_certificate_validation()
+	{
+		boost::mutex::scoped_lock lock(m_ca_stores_mutex);
+
+		m_ca_stores.clear();
+		m_certificate_cache.clear();
+	}
+
+	void core::handle_async_certificate_validation(boost::weak_ptr<fscp::server> weak_server, const ep_type& sender, cert_type sig_cert, const hash_type& hash, bool is_valid)
+	{
+		const boost::shared_ptr<fscp::server> server = weak_server.lock();
+
+		if (!server)
+		{
+			// The core was opened again since the validation started.
+			return;
+		}
+
+		// The host state may have changed while the certificate was being validated: it is checked again within the presentation strand.
+		server->async_handle_presentation(sender, sig_cert, boost::bind(&core::do_handle_validated_presentation, this, _1, _2, _3, _4, hash, is_valid));
+	}
+
+	bool core::do_handle_validated_presentation(const ep_type& sender, cert_type sig_cert, fscp::server::presentation_status_type status, bool has_session, const hash_type& hash, bool is_valid)
+	{
+		const std::map<ep_type, hash_type>::iterator pending_validation = m_pending_presentation_validations.find(sender);
+
+		if ((pending_validation == m_pending_presentation_validations.end()) || (pending_validation->second != hash))
+		{
+			// The host presented another certificate in the meantime: that validation prevails.
+			return false;
+		}
+
+		m_pending_presentation_validations.erase(pending_validation);
+
+		if (!is_valid)
+		{
+			m_logger(LL_WARNING, m_rejected_presentation_log_limiter) << "Ignoring PRESENTATION from " << sender << " as the signature certificate was rejected.";
+
+			return false;
+		}
+
+		if (is_banned(sender.address()))
+		{
+			m_logger(LL_WARNING, m_banned_presentation_log_limiter) << "Ignoring PRESENTATION from " << sender << " as it is a banned host.";
+
+			return false;
+		}
+
+		if (has_session)
+		{
+			m_logger(LL_WARNING, m_active_session_presentation_log_limiter) << "Ignoring PRESENTATION from " << sender << " as an active session currently exists with this host.";
+
+			return false;
+		}
+
+		m_logger(LL_INFORMATION) << "Accepting PRESENTATION from " << sender << " (" << sig_cert.subject().oneline() << "): " << status << ".";
+
+		async_request_session(sender);
+
+		return true;
+	}
+
 	void core::open_tap_adapter()
 	{
 		if (m_configuration.tap_adapter.enabled)
@@ -1463,7 +1839,18 @@ namespace freelan
 				});
 			};
 
+#ifdef WINDOWS
 			m_tap_adapter->open(m_configuration.tap_adapter.name);
+#else
+			m_tap_adapter->open(m_configuration.tap_adapter.name, m_configuration.tap_adapter.queue_count);
+#endif
+
+			m_tap_adapter_queues.clear();
+
+			for (size_t queue_index = 0; queue_index < m_tap_adapter->queue_count(); ++queue_index)
+			{
+				m_tap_adapter_queues.push_back(boost::make_shared<tap_adapter_queue_type>(boost::ref(m_io_service), queue_index));
+			}
 
 			asiotap::tap_adapter_configuration tap_config;
 
@@ -1472,6 +1859,11 @@ namespace freelan
 
 			m_logger(LL_IMPORTANT) << "Tap adapter \"" << *m_tap_adapter << "\" opened in mode " << m_configuration.tap_adapter.type << " with a MTU set to: " << tap_config.mtu;
 
+			if (m_tap_adapter->queue_count() > 1)
+			{
+				m_logger(LL_INFORMATION) << "Tap adapter \"" << *m_tap_adapter << "\" has " << m_tap_adapter->queue_count() << " queues.";
+			}
+
 			// IPv4 address
 			if (!m_configuration.tap_adapter.ipv4_address_prefix_length.is_null())
 			{
@@ -1614,7 +2006,10 @@ namespace freelan
 				m_tap_adapter_up_callback(*m_tap_adapter);
 			}
 
-			async_read_tap();
+			for (auto&& queue : m_tap_adapter_queues)
+			{
+				async_read_tap(queue);
+			}
 		}
 		else
 		{
@@ -1658,47 +2053,61 @@ namespace freelan
 		});
 	}
 
-	void core::async_read_tap()
+	void core::async_read_tap(tap_adapter_queue_ptr queue)
 	{
-		m_tap_adapter_strand.post(boost::bind(&core::do_read_tap, this));
+		queue->strand.post(boost::bind(&core::do_read_tap, this, queue));
 	}
 
-	void core::push_tap_write(void_handler_type handler)
+	const core::tap_adapter_queue_ptr& core::get_tap_adapter_queue_for(boost::asio::const_buffer data) const
 	{
-		// All push_write() calls are done in the same strand so the following is thread-safe.
-		if (m_tap_write_queue.empty())
+		assert(!m_tap_adapter_queues.empty());
+
+		if (m_tap_adapter_queues.size() == 1)
+		{
+			return m_tap_adapter_queues.front();
+		}
+
+		return m_tap_adapter_queues[get_flow_hash(data, m_tap_adapter->layer()) % m_tap_adapter_queues.size()];
+	}
+
+	void core::push_tap_write(tap_adapter_queue_ptr queue, void_handler_type handler)
+	{
+		// All push_write() calls for a given queue are done in the same strand so the following is thread-safe.
+		if (queue->write_queue.empty())
 		{
 			// Nothing is being written, lets start the write immediately.
-			m_tap_adapter_strand.post(make_causal_handler(handler, m_tap_write_queue_strand.wrap(boost::bind(&core::pop_tap_write, this))));
+			queue->strand.post(make_causal_handler(handler, queue->write_queue_strand.wrap(boost::bind(&core::pop_tap_write, this, queue))));
 		}
 
-		m_tap_write_queue.push(handler);
+		queue->write_queue.push(handler);
 	}
 
-	void core::pop_tap_write()
+	void core::pop_tap_write(tap_adapter_queue_ptr queue)
 	{
-		// All pop_write() calls are done in the same strand so the following is thread-safe.
-		m_tap_write_queue.pop();
+		// All pop_write() calls for a given queue are done in the same strand so the following is thread-safe.
+		queue->write_queue.pop();
 
-		if (!m_tap_write_queue.empty())
+		if (!queue->write_queue.empty())
 		{
-			m_tap_adapter_strand.post(make_causal_handler(m_tap_write_queue.front(), m_tap_write_queue_strand.wrap(boost::bind(&core::pop_tap_write, this))));
+			queue->strand.post(make_causal_handler(queue->write_queue.front(), queue->write_queue_strand.wrap(boost::bind(&core::pop_tap_write, this, queue))));
 		}
 	}
 
-	void core::do_read_tap()
+	void core::do_read_tap(tap_adapter_queue_ptr queue)
 	{
-		// All calls to do_read_tap() are done within the m_tap_adapter_strand, so the following is safe.
+		// All calls to do_read_tap() for a given queue are done within its strand, so the following is safe.
 		assert(m_tap_adapter);
 
 		const tap_adapter_memory_pool::shared_buffer_type receive_buffer = m_tap_adapter_memory_pool.allocate_shared_buffer();
 
 		m_tap_adapter->async_read(
-			buffer(receive_buffer),
-			m_proxies_strand.wrap(
+			queue->index,
+			buffer(buffer(receive_buffer) + TAP_ADAPTER_HEADROOM, buffer_size(receive_buffer) - TAP_ADAPTER_HEADROOM - TAP_ADAPTER_TAILROOM),
+			queue->read_strand.wrap(
 				boost::bind(
 					&core::do_handle_tap_adapter_read,
 					this,
+					queue,
 					receive_buffer,
 					boost::asio::placeholders::error,
 					boost::asio::placeholders::bytes_transferred
@@ -1707,18 +2116,18 @@ namespace freelan
 		);
 	}
 
-	void core::do_handle_tap_adapter_read(tap_adapter_memory_pool::shared_buffer_type receive_buffer, const boost::system::error_code& ec, size_t count)
+	void core::do_handle_tap_adapter_read(tap_adapter_queue_ptr queue, tap_adapter_memory_pool::shared_buffer_type receive_buffer, const boost::system::error_code& ec, size_t count)
 	{
-		// All calls to do_read_tap() are done within the m_proxies_strand, so the following is safe.
+		// All calls to do_handle_tap_adapter_read() for a given queue are done within the same strand, so the following is safe.
 		if (ec != boost::asio::error::operation_aborted)
 		{
 			// We try to read again, as soon as possible.
-			async_read_tap();
+			async_read_tap(queue);
 		}
 
 		if (!ec)
 		{
-			const boost::asio::const_buffer data = buffer(receive_buffer, count);
+			const boost::asio::const_buffer data = buffer(buffer(receive_buffer) + TAP_ADAPTER_HEADROOM, count);
 
 #ifdef FREELAN_DEBUG
 			std::cerr << "Read " << buffer_size(data) << " byte(s) on " << *m_tap_adapter << std::endl;
@@ -1726,44 +2135,23 @@ namespace freelan
 
 			if (m_tap_adapter->layer() == asiotap::tap_adapter_layer::ethernet)
 			{
-				bool handled = false;
-
-				if (m_arp_proxy || m_dhcp_proxy)
-				{
-					// This line will eventually call the filters callbacks.
-					m_ethernet_filter.parse(data);
-
-					if (m_arp_proxy && m_arp_filter.get_last_helper())
-					{
-						handled = true;
-						m_arp_filter.clear_last_helper();
-					}
+				// Walking the filter chain is expensive and the proxies only care about a tiny fraction of the frames.
+				const bool is_proxy_candidate = (m_arp_proxy && is_arp_proxy_candidate(data)) || (m_dhcp_proxy && is_dhcp_proxy_candidate(data));
 
-					if (m_dhcp_proxy && m_dhcp_filter.get_last_helper())
-					{
-						handled = true;
-						m_dhcp_filter.clear_last_helper();
-					}
-				}
-
-				if (!handled)
+				// The candidates are handled inline, so that the frames the proxies don't take keep their order.
+				if (!is_proxy_candidate || !handle_proxy_candidate(data))
 				{
-					async_write_switch(
-						make_port_index(m_tap_adapter),
-						data,
-						make_shared_buffer_handler(
-							receive_buffer,
-							&null_switch_write_handler
-						)
-					);
+					write_tap_frame_to_switch(receive_buffer, count);
 				}
 			}
 			else
 			{
 				// This is a TUN interface. We receive either IPv4 or IPv6 frames.
-				async_write_router(
+				async_write_router_in_place(
 					make_port_index(m_tap_adapter),
-					data,
+					buffer(receive_buffer),
+					TAP_ADAPTER_HEADROOM,
+					count,
 					make_shared_buffer_handler(
 						receive_buffer,
 						&null_router_write_handler
@@ -1777,13 +2165,52 @@ namespace freelan
 		}
 	}
 
+	bool core::handle_proxy_candidate(boost::asio::const_buffer data)
+	{
+		// The proxies keep parsing state in their filters: all the queues share them.
+		boost::mutex::scoped_lock lock(m_proxies_mutex);
+
+		bool handled = false;
+
+		// This line will eventually call the filters callbacks.
+		m_ethernet_filter.parse(data);
+
+		if (m_arp_proxy && m_arp_filter.get_last_helper())
+		{
+			handled = true;
+			m_arp_filter.clear_last_helper();
+		}
+
+		if (m_dhcp_proxy && m_dhcp_filter.get_last_helper())
+		{
+			handled = true;
+			m_dhcp_filter.clear_last_helper();
+		}
+
+		return handled;
+	}
+
+	void core::write_tap_frame_to_switch(tap_adapter_memory_pool::shared_buffer_type receive_buffer, size_t count)
+	{
+		async_write_switch_in_place(
+			make_port_index(m_tap_adapter),
+			buffer(receive_buffer),
+			TAP_ADAPTER_HEADROOM,
+			count,
+			make_shared_buffer_handler(
+				receive_buffer,
+				&null_simple_write_handler
+			)
+		);
+	}
+
 	void core::do_handle_tap_adapter_write(const boost::system::error_code& ec)
 	{
 		if (ec)
 		{
 			if (ec != boost::asio::error::operation_aborted)
 			{
-				m_logger(LL_WARNING) << "Write failed on " << m_tap_adapter->name() << ". Error: " << ec.message();
+				m_logger(LL_WARNING, m_tap_adapter_write_log_limiter) << "Write failed on " << m_tap_adapter->name() << ". Error: " << ec.message();
 			}
 		}
 	}
@@ -1867,7 +2294,7 @@ namespace freelan
 	void core::do_register_switch_port(const ep_type& host, void_handler_type handler)
 	{
 		// All calls to do_register_switch_port() are done within the m_router_strand, so the following is safe.
-		m_switch.register_port(make_port_index(host), switch_::port_type(boost::bind(&fscp::server::async_send_data, m_server, host, fscp::CHANNEL_NUMBER_0, _1, _2), ENDPOINTS_GROUP));
+		m_switch.register_port(make_port_index(host), switch_::port_type(boost::bind(&fscp::server::async_send_data, m_server, host, fscp::CHANNEL_NUMBER_0, _1, _2), boost::bind(&fscp::server::async_send_data_in_place, m_server, host, fscp::CHANNEL_NUMBER_0, _1, _2, _3), ENDPOINTS_GROUP));
 
 		if (handler)
 		{
@@ -1889,7 +2316,7 @@ namespace freelan
 	void core::do_register_router_port(const ep_type& host, void_handler_type handler)
 	{
 		// All calls to do_register_router_port() are done within the m_router_strand, so the following is safe.
-		m_router.register_port(make_port_index(host), router::port_type(boost::bind(&fscp::server::async_send_data, m_server, host, fscp::CHANNEL_NUMBER_0, _1, _2), ENDPOINTS_GROUP));
+		m_router.register_port(make_port_index(host), router::port_type(boost::bind(&fscp::server::async_send_data, m_server, host, fscp::CHANNEL_NUMBER_0, _1, _2), boost::bind(&fscp::server::async_send_data_in_place, m_server, host, fscp::CHANNEL_NUMBER_0, _1, _2, _3), ENDPOINTS_GROUP));
 
 		if (handler)
 		{
@@ -1912,7 +2339,28 @@ namespace freelan
 	{
 		// All calls to do_save_system_route() are done within the m_router_strand, so the following is safe.
 		client_router_info_type& client_router_info = m_client_router_info_map[host];
-		client_router_info.saved_system_route = m_route_manager.get_route_entry(route);
+		const uint64_t generation = ++client_router_info.saved_system_route_generation;
+
+		m_route_manager.async_get_route_entries(std::vector<route_type>(1, route), m_router_strand.wrap(boost::bind(&core::do_set_saved_system_route, this, host, generation, _1, handler)));
+	}
+
+	void core::do_set_saved_system_route(const ep_type& host, uint64_t generation, const std::vector<asiotap::route_manager::entry_type>& entries, void_handler_type handler)
+	{
+		// All calls to do_set_saved_system_route() are done within the m_router_strand, so the following is safe.
+		const auto client_router_info = m_client_router_info_map.find(host);
+
+		if ((client_router_info != m_client_router_info_map.end()) && (client_router_info->second.saved_system_route_generation == generation))
+		{
+			std::vector<asiotap::route_manager::entry_type> old_entries(1, client_router_info->second.saved_system_route);
+			client_router_info->second.saved_system_route = entries.front();
+
+			m_route_manager.async_release_route_entries(std::move(old_entries));
+		}
+		else
+		{
+			// The route was cleared or replaced in the meantime: the entry is released without blocking the router strand.
+			m_route_manager.async_release_route_entries(entries);
+		}
 
 		if (handler)
 		{
@@ -1924,8 +2372,19 @@ namespace freelan
 	{
 		// All calls to do_clear_client_router_info() are done within the m_router_strand, so the following is safe.
 
-		// This clears the routes, if any.
-		m_client_router_info_map.erase(host);
+		const auto client_router_info = m_client_router_info_map.find(host);
+
+		if (client_router_info != m_client_router_info_map.end())
+		{
+			std::vector<asiotap::route_manager::entry_type> entries;
+			entries.swap(client_router_info->second.system_route_entries);
+			entries.push_back(client_router_info->second.saved_system_route);
+
+			m_client_router_info_map.erase(client_router_info);
+
+			// This clears the routes, if any.
+			m_route_manager.async_release_route_entries(std::move(entries));
+		}
 
 		if (handler)
 		{
@@ -1933,15 +2392,64 @@ namespace freelan
 		}
 	}
 
-	void core::do_write_switch(const port_index_type& index, boost::asio::const_buffer data, switch_::multi_write_handler_type handler)
+	void core::do_renew_rerouted_sessions(const std::set<ep_type>& hosts)
 	{
-		// All calls to do_write_switch() are done within the m_router_strand, so the following is safe.
-		m_switch.async_write(index, data, handler);
+		// All calls to do_renew_rerouted_sessions() are done within the m_router_strand, so the following is safe.
+		std::vector<boost::asio::ip::address> addresses;
+
+		for (auto&& host : hosts)
+		{
+			const auto client_router_info = m_client_router_info_map.find(host);
+
+			if ((client_router_info != m_client_router_info_map.end()) && client_router_info->second.saved_system_route)
+			{
+				addresses.push_back(host.address());
+			}
+		}
+
+		if (addresses.empty())
+		{
+			return;
+		}
+
+		// Looking the routes up takes system calls: we don't want to hold the router strand while they complete.
+		m_route_manager.async_get_system_routes_for(addresses, m_router_strand.wrap(boost::bind(&core::do_check_rerouted_sessions, this, hosts, _1)));
 	}
 
-	void core::do_write_router(const port_index_type& index, boost::asio::const_buffer data, router::port_type::write_handler_type handler)
+	void core::do_check_rerouted_sessions(const std::set<ep_type>& hosts, const std::map<boost::asio::ip::address, route_type>& routes)
 	{
-		// All calls to do_write_router() are done within the m_router_strand, so the following is safe.
-		m_router.async_write(index, data, handler);
+		// All calls to do_check_rerouted_sessions() are done within the m_router_strand, so the following is safe.
+		for (auto&& host : hosts)
+		{
+			const auto client_router_info = m_client_router_info_map.find(host);
+
+			if ((client_router_info == m_client_router_info_map.end()) || !client_router_info->second.saved_system_route)
+			{
+				continue;
+			}
+
+			const route_type& saved_route = client_router_info->second.saved_system_route->route();
+
+			// The saved route is pinned: the routes are looked up without it, so that a change of the default gateway shows.
+			const auto route = routes.find(host.address());
+
+			if (route == routes.end())
+			{
+				m_logger(LL_IMPORTANT) << "Route to " << host << " was lost. Renewing the session...";
+			}
+			else if (route->second == saved_route)
+			{
+				continue;
+			}
+			else
+			{
+				m_logger(LL_IMPORTANT) << "Route to " << host << " changed from " << saved_route << " to " << route->second << ". Renewing the session...";
+			}
+
+			// The session is bound to the previous path: it would only time out.
+			m_server->async_close_session(host, [this, host](const boost::system::error_code&) {
+				async_request_session(host);
+			});
+		}
 	}
 }
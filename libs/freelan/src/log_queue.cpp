@@ -0,0 +1,242 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file log_queue.cpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A lock-free log queue.
+ */
+
+#include "log_queue.hpp"
+
+#include <cstring>
+#include <sstream>
+
+namespace freelan
+{
+	namespace
+	{
+		size_t get_capacity(size_t capacity)
+		{
+			size_t result = 2;
+
+			while (result < capacity)
+			{
+				result <<= 1;
+			}
+
+			return result;
+		}
+	}
+
+	const char log_queue::TRUNCATION_MARKER[] = "... [truncated]";
+
+	log_queue::log_queue(size_t capacity) :
+		m_mask(get_capacity(capacity) - 1),
+		m_records(new record_type[m_mask + 1]),
+		m_enqueue_position(0),
+		m_dequeue_position(0),
+		m_dropped(0),
+		m_total_dropped(0),
+		m_waiting(false),
+		m_stopping(false),
+		m_handler(),
+		m_mutex(),
+		m_condition(),
+		m_thread()
+	{
+		for (size_t index = 0; index <= m_mask; ++index)
+		{
+			m_records[index].sequence.store(index, std::memory_order_relaxed);
+		}
+
+		m_thread = boost::thread(&log_queue::drain, this);
+	}
+
+	log_queue::~log_queue()
+	{
+		m_stopping = true;
+
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+
+			m_condition.notify_one();
+		}
+
+		m_thread.join();
+	}
+
+	bool log_queue::push(log_level level, const std::string& msg, const timestamp_type& timestamp)
+	{
+		size_t position = m_enqueue_position.load(std::memory_order_relaxed);
+		record_type* record = nullptr;
+
+		for (;;)
+		{
+			record = &m_records[position & m_mask];
+
+			const size_t sequence = record->sequence.load(std::memory_order_acquire);
+			const ptrdiff_t difference = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(position);
+
+			if (difference == 0)
+			{
+				if (m_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (difference < 0)
+			{
+				// The queue is full: the drain thread will report the loss.
+				++m_dropped;
+				++m_total_dropped;
+
+				return false;
+			}
+			else
+			{
+				position = m_enqueue_position.load(std::memory_order_relaxed);
+			}
+		}
+
+		record->level = level;
+		record->timestamp = timestamp;
+
+		if (msg.size() > MAX_MESSAGE_SIZE)
+		{
+			const size_t marker_size = sizeof(TRUNCATION_MARKER) - 1;
+
+			std::memcpy(record->data, msg.data(), MAX_MESSAGE_SIZE - marker_size);
+			std::memcpy(record->data + MAX_MESSAGE_SIZE - marker_size, TRUNCATION_MARKER, marker_size);
+			record->size = MAX_MESSAGE_SIZE;
+		}
+		else
+		{
+			std::memcpy(record->data, msg.data(), msg.size());
+			record->size = msg.size();
+		}
+
+		record->sequence.store(position + 1, std::memory_order_release);
+
+		// Pairs with the fence in drain(): either the drain thread sees the record, or we see it waiting.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (m_waiting.load(std::memory_order_relaxed))
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+
+			m_condition.notify_one();
+		}
+
+		return true;
+	}
+
+	bool log_queue::has_record() const
+	{
+		const record_type& record = m_records[m_dequeue_position & m_mask];
+
+		return (record.sequence.load(std::memory_order_acquire) == m_dequeue_position + 1);
+	}
+
+	void log_queue::drain()
+	{
+		for (;;)
+		{
+			const bool stopping = m_stopping;
+
+			while (has_record())
+			{
+				record_type& record = m_records[m_dequeue_position & m_mask];
+
+				const std::string msg(record.data, record.size);
+				const log_level level = record.level;
+				const timestamp_type timestamp = record.timestamp;
+
+				// The record is given back before the (possibly slow) handler runs.
+				record.sequence.store(m_dequeue_position + m_mask + 1, std::memory_order_release);
+				++m_dequeue_position;
+
+				emit(level, msg, timestamp);
+			}
+
+			const uint64_t dropped = m_dropped.exchange(0);
+
+			if (dropped > 0)
+			{
+				std::ostringstream oss;
+				oss << dropped << " log message(s) dropped: the log queue was full.";
+
+				emit(LL_WARNING, oss.str(), boost::posix_time::microsec_clock::universal_time());
+			}
+
+			if (stopping)
+			{
+				break;
+			}
+
+			boost::mutex::scoped_lock lock(m_mutex);
+
+			m_waiting.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			if (!has_record() && !m_stopping)
+			{
+				m_condition.wait(lock);
+			}
+
+			m_waiting.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	void log_queue::emit(log_level level, const std::string& msg, const timestamp_type& timestamp)
+	{
+		log_handler_type handler;
+
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+
+			handler = m_handler;
+		}
+
+		if (handler)
+		{
+			handler(level, msg, timestamp);
+		}
+	}
+}
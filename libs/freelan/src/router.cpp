@@ -45,7 +45,10 @@
 
 #include "router.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <iterator>
+#include <vector>
 
 #include <boost/foreach.hpp>
 
@@ -54,12 +57,14 @@
 
 namespace freelan
 {
-	void router::async_write(port_index_type index, boost::asio::const_buffer data, port_type::write_handler_type handler)
+	void router::async_write(port_index_type index, boost::asio::const_buffer data, port_type::write_handler_type handler) const
 	{
-		const port_list_type::const_iterator port_entry = get_target_for(index, data);
+		// The target refers to the forwarding table, which must be kept alive until we are done with it.
+		const forwarding_table_ptr_type forwarding_table = boost::atomic_load(&m_forwarding_table);
+		const port_list_type::const_iterator port_entry = get_target_for(*forwarding_table, index, data);
 
 #if FREELAN_DEBUG
-		if (port_entry != m_ports.end())
+		if (port_entry != forwarding_table->ports->end())
 		{
 			std::cerr << "Routing " << buffer_size(data) << " byte(s) of data from " << index << " to " << port_entry->first << std::endl;
 		}
@@ -69,92 +74,145 @@ namespace freelan
 		}
 #endif
 
-		if (port_entry != m_ports.end())
+		if (port_entry != forwarding_table->ports->end())
 		{
 			port_entry->second.async_write(data, handler);
 		}
 	}
 
-	router::port_list_type::const_iterator router::get_target_for(port_index_type index, boost::asio::const_buffer data)
+	void router::async_write_in_place(port_index_type index, boost::asio::mutable_buffer buffer, size_t headroom, size_t data_len, port_type::write_handler_type handler) const
 	{
-		// Try IPv4 first because it is more likely.
+		const boost::asio::const_buffer data = boost::asio::buffer(buffer + headroom, data_len);
+		const forwarding_table_ptr_type forwarding_table = boost::atomic_load(&m_forwarding_table);
+		const port_list_type::const_iterator port_entry = get_target_for(*forwarding_table, index, data);
 
-		m_ipv4_filter.parse(data);
-
-		if (m_ipv4_filter.get_last_helper())
+		if (port_entry != forwarding_table->ports->end())
 		{
-			const boost::asio::ip::address_v4 destination = m_ipv4_filter.get_last_helper()->destination();
+			port_entry->second.async_write_in_place(buffer, headroom, data_len, handler);
+		}
+	}
 
-			m_ipv4_filter.clear_last_helper();
+	router::port_list_type::const_iterator router::get_target_for(const forwarding_table_type& forwarding_table, port_index_type index, boost::asio::const_buffer data) const
+	{
+		// The classification keeps no state: only the forwarding table is shared.
+		const asiotap::osi::frame_headers headers = asiotap::osi::classify_ip_packet(data);
 
-			return get_target_for(index, destination);
+		if (headers.ipv4)
+		{
+			return get_target_for(forwarding_table, index, forwarding_table.ipv4_routes, headers.ipv4->destination());
 		}
-		else
+		else if (headers.ipv6)
 		{
-			m_ipv6_filter.parse(data);
-
-			if (m_ipv6_filter.get_last_helper())
-			{
-				const boost::asio::ip::address_v6 destination = m_ipv6_filter.get_last_helper()->destination();
-
-				m_ipv6_filter.clear_last_helper();
-
-				return get_target_for(index, destination);
-			}
+			return get_target_for(forwarding_table, index, forwarding_table.ipv6_routes, headers.ipv6->destination());
 		}
 
 		// Frame of other types than IPv4 or IPv6 are silently dropped.
-		return m_ports.end();
+		return forwarding_table.ports->end();
 	}
 
-	template <typename AddressType>
-	router::port_list_type::const_iterator router::get_target_for(port_index_type index, const AddressType& dest_addr)
+	template <typename RoutesType>
+	router::port_list_type::const_iterator router::get_target_for(const forwarding_table_type& forwarding_table, port_index_type index, const RoutesType& routes, const typename RoutesType::address_type& dest_addr) const
 	{
-		const router::port_list_type::const_iterator source_port_entry = m_ports.find(index);
+		const port_list_type& ports = *forwarding_table.ports;
+		const router::port_list_type::const_iterator source_port_entry = ports.find(index);
 
-		if (source_port_entry != m_ports.end())
+		if (source_port_entry != ports.end())
 		{
-			const auto& routes_ports = routes();
+			// The longest matching prefix whose port is acceptable wins.
+			const auto target = routes.find(dest_addr, [this, &ports, source_port_entry](const typename RoutesType::value_type& value) {
+				const port_list_type::const_iterator port_entry = ports.find(value.second);
 
-			for (auto&& route_port : routes_ports)
-			{
-				if (has_address(route_port.first, dest_addr))
-				{
-					const port_list_type::const_iterator port_entry = m_ports.find(route_port.second);
+				return (port_entry != ports.end()) && (m_configuration.client_routing_enabled || (source_port_entry->second.group() != port_entry->second.group()));
+			});
 
-					if (m_configuration.client_routing_enabled || (source_port_entry->second.group() != port_entry->second.group()))
-					{
-						return port_entry;
-					}
-				}
+			if (target)
+			{
+				return ports.find(target->second);
 			}
 		}
 
 		// No route for the current frame so we return an invalid iterator.
-		return m_ports.end();
+		return ports.end();
 	}
 
-	const router::routes_port_type& router::routes() const
+	class router::route_update_visitor : public boost::static_visitor<void>
 	{
-		if (!m_routes)
-		{
-			// The routes were invalidated, we recompile them.
+		public:
+
+			route_update_visitor(forwarding_table_type& forwarding_table, const port_index_type& index, bool insert) :
+				m_forwarding_table(forwarding_table),
+				m_index(index),
+				m_insert(insert)
+			{}
+
+			void operator()(const asiotap::ipv4_route& route) const
+			{
+				update(m_forwarding_table.ipv4_routes, route);
+			}
+
+			void operator()(const asiotap::ipv6_route& route) const
+			{
+				update(m_forwarding_table.ipv6_routes, route);
+			}
 
-			m_routes = routes_port_type();
+		private:
 
-			// We add all the port routes to the routes list.
-			// These are sorted automatically by the container.
-			for (port_list_type::const_iterator port = m_ports.begin(); port != m_ports.end(); ++port)
+			template <typename RoutesType, typename RouteType>
+			void update(RoutesType& routes, const RouteType& route) const
 			{
-				const auto& local_routes = port->second.local_routes();
+				const typename RoutesType::value_type value(route.gateway(), m_index);
 
-				for (auto&& route : local_routes)
+				if (m_insert)
+				{
+					routes.insert(route.network_address().address(), route.network_address().prefix_length(), value);
+				}
+				else
 				{
-					m_routes->insert(std::make_pair(route, port->first));
+					routes.erase(route.network_address().address(), route.network_address().prefix_length(), value);
 				}
 			}
+
+			forwarding_table_type& m_forwarding_table;
+			const port_index_type& m_index;
+			bool m_insert;
+	};
+
+	void router::publish_forwarding_table(port_index_type index, const asiotap::ip_route_set& previous_local_routes, const asiotap::ip_route_set& local_routes, bool ports_changed)
+	{
+		// Only the thread that changes the ports publishes tables: the current one cannot change under us.
+		const forwarding_table_ptr_type current_forwarding_table = boost::atomic_load(&m_forwarding_table);
+		const boost::shared_ptr<forwarding_table_type> forwarding_table = boost::make_shared<forwarding_table_type>();
+
+		if (ports_changed)
+		{
+			forwarding_table->ports = boost::make_shared<port_list_type>(m_ports);
+		}
+		else
+		{
+			forwarding_table->ports = current_forwarding_table->ports;
+		}
+
+		// The tries are copied in constant time: only the nodes on the path of the changed routes get copied.
+		forwarding_table->ipv4_routes = current_forwarding_table->ipv4_routes;
+		forwarding_table->ipv6_routes = current_forwarding_table->ipv6_routes;
+
+		std::vector<asiotap::ip_route> removed_routes;
+		std::vector<asiotap::ip_route> added_routes;
+
+		std::set_difference(previous_local_routes.begin(), previous_local_routes.end(), local_routes.begin(), local_routes.end(), std::back_inserter(removed_routes));
+		std::set_difference(local_routes.begin(), local_routes.end(), previous_local_routes.begin(), previous_local_routes.end(), std::back_inserter(added_routes));
+
+		for (auto&& route : removed_routes)
+		{
+			boost::apply_visitor(route_update_visitor(*forwarding_table, index, false), route);
+		}
+
+		for (auto&& route : added_routes)
+		{
+			boost::apply_visitor(route_update_visitor(*forwarding_table, index, true), route);
 		}
 
-		return *m_routes;
+		// The writers that still hold the previous table keep it alive until they are done.
+		boost::atomic_store(&m_forwarding_table, forwarding_table_ptr_type(forwarding_table));
 	}
 }
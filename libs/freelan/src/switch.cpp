@@ -48,21 +48,11 @@
 #include <cassert>
 
 #include <boost/foreach.hpp>
-#include <boost/random/mersenne_twister.hpp>
-
-#include <boost/version.hpp>
-
-#if BOOST_VERSION >= 104700
-#include <boost/random/uniform_int_distribution.hpp>
-#else
-#include <boost/random/uniform_int.hpp>
-#include <boost/random/variate_generator.hpp>
-#endif
-
 #include <boost/thread/mutex.hpp>
 #include <boost/make_shared.hpp>
 
 #include <asiotap/osi/ethernet_helper.hpp>
+#include <asiotap/osi/ethernet_filter.hpp>
 
 namespace freelan
 {
@@ -73,14 +63,13 @@ namespace freelan
 		{
 			public:
 
-				typedef std::set<KeyType> set_type;
 				typedef std::map<KeyType, ValueType> map_type;
 
-				results_gatherer(Handler handler, const set_type& keys) :
+				results_gatherer(Handler handler, size_t count) :
 					m_handler(handler),
-					m_keys(keys)
+					m_count(count)
 				{
-					if (m_keys.empty())
+					if (m_count == 0)
 					{
 						m_handler(m_results);
 					}
@@ -90,14 +79,12 @@ namespace freelan
 				{
 					boost::mutex::scoped_lock lock(m_mutex);
 
-					const size_t erased_count = m_keys.erase(key);
-
 					// Ensure that gather was called only once for a given key.
-					assert(erased_count == 1);
+					assert(m_results.find(key) == m_results.end());
 
 					m_results[key] = value;
 
-					if (m_keys.empty())
+					if (--m_count == 0)
 					{
 						m_handler(m_results);
 					}
@@ -107,23 +94,35 @@ namespace freelan
 
 				boost::mutex m_mutex;
 				Handler m_handler;
-				set_type m_keys;
+				size_t m_count;
 				map_type m_results;
 		};
 	}
 
 	const unsigned int switch_::MAX_ENTRIES_DEFAULT = 1024;
 
+	switch_::switch_(const switch_configuration& configuration, const unsigned int max_entries) :
+		m_configuration(configuration),
+		m_ports(),
+		m_forwarding_table(boost::make_shared<forwarding_table_type>()),
+		m_mac_table(max_entries, m_configuration.mac_aging_time)
+	{
+	}
+
 	void switch_::async_write(port_index_type index, boost::asio::const_buffer data, multi_write_handler_type handler)
 	{
 		typedef results_gatherer<port_index_type, boost::system::error_code, multi_write_handler_type> results_gatherer_type;
 
-		const auto targets = get_targets_for(index, data);
+		// The targets refer to the forwarding table, which must be kept alive until we are done with them.
+		const forwarding_table_ptr_type forwarding_table = boost::atomic_load(&m_forwarding_table);
+		const port_list_type::const_iterator source_port_entry = forwarding_table->ports.find(index);
+		const target_list_type& targets = get_targets_for(*forwarding_table, source_port_entry, data);
+		const size_t target_count = count_targets(targets, source_port_entry);
 
 #if FREELAN_DEBUG
-		if (!targets.empty())
+		if (target_count > 0)
 		{
-			std::cerr << "Switching " << buffer_size(data) << " byte(s) of data from " << index << " to " << targets.size() << " host(s)." << std::endl;
+			std::cerr << "Switching " << buffer_size(data) << " byte(s) of data from " << index << " to " << target_count << " host(s)." << std::endl;
 		}
 		else
 		{
@@ -131,112 +130,220 @@ namespace freelan
 		}
 #endif
 
-		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, target_count);
 
 		for (auto&& target : targets)
 		{
+			if (target != source_port_entry)
+			{
 #if FREELAN_DEBUG
-			std::cerr << index << "-> " << target << std::endl;
+				std::cerr << index << "-> " << target->first << std::endl;
 #endif
 
-			m_ports[target].async_write(data, boost::bind(&results_gatherer_type::gather, rg, target, _1));
+				target->second.async_write(data, boost::bind(&results_gatherer_type::gather, rg, target->first, _1));
+			}
+		}
+	}
+
+	void switch_::async_write_in_place(port_index_type index, boost::asio::mutable_buffer buffer, size_t headroom, size_t data_len, multi_write_handler_type handler)
+	{
+		typedef results_gatherer<port_index_type, boost::system::error_code, multi_write_handler_type> results_gatherer_type;
+
+		const boost::asio::const_buffer data = boost::asio::buffer(buffer + headroom, data_len);
+		// The targets refer to the forwarding table, which must be kept alive until we are done with them.
+		const forwarding_table_ptr_type forwarding_table = boost::atomic_load(&m_forwarding_table);
+		const port_list_type::const_iterator source_port_entry = forwarding_table->ports.find(index);
+		const target_list_type& targets = get_targets_for(*forwarding_table, source_port_entry, data);
+		const size_t target_count = count_targets(targets, source_port_entry);
+
+		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, target_count);
+
+		for (auto&& target : targets)
+		{
+			if (target != source_port_entry)
+			{
+				if (target_count == 1)
+				{
+					// Only one port will ever see the data, so it may safely overwrite it.
+					target->second.async_write_in_place(buffer, headroom, data_len, boost::bind(&results_gatherer_type::gather, rg, target->first, _1));
+				}
+				else
+				{
+					target->second.async_write(data, boost::bind(&results_gatherer_type::gather, rg, target->first, _1));
+				}
+			}
+		}
+	}
+
+	void switch_::async_forward(port_index_type index, boost::asio::const_buffer data, port_type::write_handler_type handler)
+	{
+		// The targets refer to the forwarding table, which must be kept alive until we are done with them.
+		const forwarding_table_ptr_type forwarding_table = boost::atomic_load(&m_forwarding_table);
+		const port_list_type::const_iterator source_port_entry = forwarding_table->ports.find(index);
+		const target_list_type& targets = get_targets_for(*forwarding_table, source_port_entry, data);
+
+		for (auto&& target : targets)
+		{
+			if (target != source_port_entry)
+			{
+				target->second.async_write(data, handler);
+			}
 		}
 	}
 
-	std::set<port_index_type> switch_::get_targets_for(port_index_type index, boost::asio::const_buffer data)
+	void switch_::async_forward_in_place(port_index_type index, boost::asio::mutable_buffer buffer, size_t headroom, size_t data_len, port_type::write_handler_type handler)
 	{
-		const port_list_type::iterator source_port_entry = m_ports.find(index);
+		const boost::asio::const_buffer data = boost::asio::buffer(buffer + headroom, data_len);
+		// The targets refer to the forwarding table, which must be kept alive until we are done with them.
+		const forwarding_table_ptr_type forwarding_table = boost::atomic_load(&m_forwarding_table);
+		const port_list_type::const_iterator source_port_entry = forwarding_table->ports.find(index);
+		const target_list_type& targets = get_targets_for(*forwarding_table, source_port_entry, data);
 
-		if (source_port_entry != m_ports.end())
+		if (count_targets(targets, source_port_entry) == 1)
+		{
+			for (auto&& target : targets)
+			{
+				if (target != source_port_entry)
+				{
+					// Only one port will ever see the data, so it may safely overwrite it.
+					target->second.async_write_in_place(buffer, headroom, data_len, handler);
+				}
+			}
+		}
+		else
+		{
+			for (auto&& target : targets)
+			{
+				if (target != source_port_entry)
+				{
+					target->second.async_write(data, handler);
+				}
+			}
+		}
+	}
+
+	const switch_::target_list_type& switch_::get_targets_for(const forwarding_table_type& forwarding_table, port_list_type::const_iterator source_port_entry, boost::asio::const_buffer data)
+	{
+		if (source_port_entry != forwarding_table.ports.end())
 		{
 			switch (m_configuration.routing_method)
 			{
 				case switch_configuration::RM_HUB:
 				{
-					return get_targets_for(source_port_entry);
+					return get_flood_list(forwarding_table, source_port_entry);
 				}
 				case switch_configuration::RM_SWITCH:
 				{
-					asiotap::osi::const_helper<asiotap::osi::ethernet_frame> ethernet_helper(data);
+					const boost::optional<asiotap::osi::const_helper<asiotap::osi::ethernet_frame> > ethernet_helper = asiotap::osi::try_parse<asiotap::osi::ethernet_frame>(data);
 
-					const ethernet_address_type target_address = to_ethernet_address(ethernet_helper.target());
+					// Runt frames are dropped.
+					if (!ethernet_helper)
+					{
+						return forwarding_table.no_ports;
+					}
+
+					const ethernet_address_type target_address = to_ethernet_address(ethernet_helper->target());
 
 					if (is_multicast_address(target_address))
 					{
-						return get_targets_for(source_port_entry);
+						return get_flood_list(forwarding_table, source_port_entry);
 					}
 					else
 					{
-						m_ethernet_address_map[to_ethernet_address(ethernet_helper.sender())] = index;
+						const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+						const ethernet_address_type sender_address = to_ethernet_address(ethernet_helper->sender());
 
-						// We exceeded the maximum count for entries: we delete random entries to fix it.
-						while (m_ethernet_address_map.size() > m_max_entries)
 						{
-							ethernet_address_map_type::iterator entry = m_ethernet_address_map.begin();
-
-#if BOOST_VERSION >= 104700
-							boost::random::mt19937 gen;
+							mac_table_type::shard_type& shard = m_mac_table.shard(sender_address);
+							boost::mutex::scoped_lock lock(shard.mutex);
 
-							std::advance(entry, boost::random::uniform_int_distribution<>(0, static_cast<int>(m_ethernet_address_map.size()) - 1)(gen));
-#else
-							boost::mt19937 gen;
-
-							boost::variate_generator<boost::mt19937&, boost::uniform_int<> > vgen(gen, boost::uniform_int<>(0, m_ethernet_address_map.size() - 1));
-							std::advance(entry, vgen());
-#endif
-
-							m_ethernet_address_map.erase(entry);
+							// When the table is full, the least recently learned address is evicted.
+							shard.table.learn(sender_address, source_port_entry->first, now);
 						}
 
-						// We look in the ethernet address map
+						// We look in the ethernet address table
 
-						const ethernet_address_map_type::iterator target_entry = m_ethernet_address_map.find(target_address);
+						mac_table_type::shard_type& shard = m_mac_table.shard(target_address);
+						boost::mutex::scoped_lock lock(shard.mutex);
 
-						if (target_entry == m_ethernet_address_map.end())
+						const port_index_type* target_port_index = shard.table.find(target_address, now);
+
+						if (!target_port_index)
 						{
-							// No target entry: we send the message to everybody.
-							return get_targets_for(source_port_entry);
+							// No target entry (or an expired one): we send the message to everybody.
+							return get_flood_list(forwarding_table, source_port_entry);
 						}
 
-						const port_index_type target_port_index = target_entry->second;
+						const unicast_list_map_type::const_iterator unicast_list = forwarding_table.unicast_lists.find(*target_port_index);
 
-						if (!is_registered(target_port_index))
+						if (unicast_list == forwarding_table.unicast_lists.end())
 						{
 							// The port does not exist: we delete the entry and send to everybody.
-							m_ethernet_address_map.erase(target_entry);
+							shard.table.erase(target_address);
 
-							return get_targets_for(source_port_entry);
+							return get_flood_list(forwarding_table, source_port_entry);
 						}
 
-						std::set<port_index_type> targets;
-
-						targets.insert(target_port_index);
-
-						return targets;
+						return unicast_list->second;
 					}
 				}
 			}
 		}
 
-		return std::set<port_index_type>();
+		return forwarding_table.no_ports;
 	}
 
-	std::set<port_index_type> switch_::get_targets_for(port_list_type::const_iterator source_port_entry)
+	const switch_::target_list_type& switch_::get_flood_list(const forwarding_table_type& forwarding_table, port_list_type::const_iterator source_port_entry) const
 	{
-		std::set<port_index_type> targets;
+		if (m_configuration.relay_mode_enabled)
+		{
+			return forwarding_table.all_ports;
+		}
+
+		const flood_list_map_type::const_iterator flood_list = forwarding_table.flood_lists.find(source_port_entry->second.group());
+
+		if (flood_list == forwarding_table.flood_lists.end())
+		{
+			return forwarding_table.no_ports;
+		}
+
+		return flood_list->second;
+	}
+
+	size_t switch_::count_targets(const target_list_type& targets, port_list_type::const_iterator source_port_entry)
+	{
+		return targets.size() - std::count(targets.begin(), targets.end(), source_port_entry);
+	}
+
+	void switch_::publish_forwarding_table()
+	{
+		const boost::shared_ptr<forwarding_table_type> forwarding_table = boost::make_shared<forwarding_table_type>();
+
+		forwarding_table->ports = m_ports;
+
+		for (port_list_type::const_iterator port_entry = forwarding_table->ports.begin(); port_entry != forwarding_table->ports.end(); ++port_entry)
+		{
+			forwarding_table->all_ports.push_back(port_entry);
+			forwarding_table->unicast_lists[port_entry->first].push_back(port_entry);
+
+			// Make sure every group has a flood list, even an empty one.
+			forwarding_table->flood_lists[port_entry->second.group()];
+		}
 
-		for (port_list_type::const_iterator port_entry = m_ports.begin(); port_entry != m_ports.end(); ++port_entry)
+		// Without relay mode, a frame is flooded to the ports of all the other groups.
+		for (auto&& flood_list : forwarding_table->flood_lists)
 		{
-			if (source_port_entry != port_entry)
+			for (auto&& port_entry : forwarding_table->all_ports)
 			{
-				if (m_configuration.relay_mode_enabled || (source_port_entry->second.group() != port_entry->second.group()))
+				if (port_entry->second.group() != flood_list.first)
 				{
-					targets.insert(port_entry->first);
+					flood_list.second.push_back(port_entry);
 				}
 			}
 		}
 
-		return targets;
+		// The writers that still hold the previous table keep it alive until they are done.
+		boost::atomic_store(&m_forwarding_table, forwarding_table_ptr_type(forwarding_table));
 	}
 
 	switch_::ethernet_address_type switch_::to_ethernet_address(boost::asio::const_buffer buf)
@@ -0,0 +1,250 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file buffer_pool.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A lock-free packet buffer pool class.
+ */
+
+#ifndef FSCP_BUFFER_POOL_HPP
+#define FSCP_BUFFER_POOL_HPP
+
+#include <boost/noncopyable.hpp>
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <cstddef>
+
+#include <stdint.h>
+
+namespace fscp
+{
+	/**
+	 * @brief A lock-free packet buffer pool.
+	 *
+	 * Preallocates block_count() blocks of block_size() bytes each. The block size is meant to be computed from the MTU, so that a packet fits in exactly one block.
+	 *
+	 * Free blocks are kept in a lock-free stack shared by all threads, and every thread keeps a small cache of free blocks in front of it: most allocations and deallocations touch neither the shared stack nor any lock.
+	 *
+	 * When the pool is exhausted, blocks are allocated on the heap.
+	 */
+	class buffer_pool : public boost::noncopyable
+	{
+		public:
+
+			/**
+			 * @brief The number of blocks moved at once between a thread cache and the shared stack.
+			 */
+			static const size_t thread_cache_batch_size = 16;
+
+			/**
+			 * @brief A mutable buffer type.
+			 */
+			typedef boost::asio::mutable_buffers_1 buffer_type;
+
+			/**
+			 * @brief A scoped buffer type that gets deallocated upon destruction.
+			 */
+			class scoped_buffer_type : public boost::noncopyable
+			{
+				public:
+					~scoped_buffer_type()
+					{
+						m_buffer_pool.deallocate(boost::asio::buffer_cast<uint8_t*>(m_buffer));
+					}
+
+				private:
+
+					scoped_buffer_type(buffer_pool& bufpool, buffer_type buffer) : m_buffer_pool(bufpool), m_buffer(buffer) {}
+
+					buffer_pool& m_buffer_pool;
+					buffer_type m_buffer;
+
+					friend class buffer_pool;
+
+					friend inline buffer_type buffer(const scoped_buffer_type& _buffer)
+					{
+						return boost::asio::buffer(_buffer.m_buffer);
+					}
+
+					friend inline buffer_type buffer(const scoped_buffer_type& _buffer, size_t size)
+					{
+						return boost::asio::buffer(_buffer.m_buffer, size);
+					}
+
+					template <typename Type>
+					friend inline Type buffer_cast(const scoped_buffer_type& _buffer)
+					{
+						return boost::asio::buffer_cast<Type>(buffer(_buffer));
+					}
+
+					friend inline size_t buffer_size(const scoped_buffer_type& _buffer)
+					{
+						return boost::asio::buffer_size(buffer(_buffer));
+					}
+			};
+
+			/**
+			 * @brief A shared buffer type.
+			 */
+			typedef boost::shared_ptr<scoped_buffer_type> shared_buffer_type;
+
+			friend inline buffer_type buffer(shared_buffer_type _buffer)
+			{
+				return buffer(*_buffer);
+			}
+
+			friend inline buffer_type buffer(shared_buffer_type _buffer, size_t size)
+			{
+				return buffer(*_buffer, size);
+			}
+
+			template <typename Type>
+			friend inline Type buffer_cast(shared_buffer_type _buffer)
+			{
+				return boost::asio::buffer_cast<Type>(buffer(*_buffer));
+			}
+
+			friend inline size_t buffer_size(shared_buffer_type _buffer)
+			{
+				return buffer_size(*_buffer);
+			}
+
+			/**
+			 * @brief Create a buffer pool instance.
+			 * @param _block_size The size of every block. Should be computed from the MTU.
+			 * @param _block_count The count of preallocated blocks.
+			 */
+			buffer_pool(size_t _block_size, size_t _block_count);
+
+			/**
+			 * @brief Destroy the buffer pool.
+			 *
+			 * Blocks cached by other threads are released when those threads exit, or when they next use a pool built at the same address.
+			 */
+			~buffer_pool();
+
+			/**
+			 * @brief Get the block size.
+			 * @return The block size.
+			 */
+			size_t block_size() const;
+
+			/**
+			 * @brief Get the count of preallocated blocks.
+			 * @return The block count.
+			 */
+			size_t block_count() const;
+
+			/**
+			 * @brief Check whether some memory is one of the preallocated blocks.
+			 * @param buffer The memory to check.
+			 * @return true if buffer is a preallocated block, false if it was heap-allocated because the pool was exhausted.
+			 */
+			bool is_pool_block(const uint8_t* buffer) const;
+
+			/**
+			 * @brief Allocate a shared buffer.
+			 * @return The allocated shared buffer.
+			 *
+			 * This method is thread-safe.
+			 */
+			shared_buffer_type allocate_shared_buffer()
+			{
+				return shared_buffer_type(new scoped_buffer_type(*this, allocate_buffer()));
+			}
+
+			/**
+			 * @brief Allocate a buffer.
+			 * @return The allocated buffer.
+			 *
+			 * This method is thread-safe.
+			 *
+			 * The return buffer must be deallocated by passing it to deallocate_buffer() to avoid memory leaks.
+			 */
+			buffer_type allocate_buffer()
+			{
+				return boost::asio::buffer(allocate(), block_size());
+			}
+
+			/**
+			 * @brief Deallocate a buffer.
+			 * @param buffer The buffer to deallocate. If buffer was not allocated by this allocator (or if it was deallocated already), the behavior is undefined.
+			 * @tparam MutableBufferType The buffer type.
+			 *
+			 * This method is thread-safe.
+			 */
+			template <typename MutableBufferType>
+			void deallocate_buffer(MutableBufferType buffer)
+			{
+				deallocate(boost::asio::buffer_cast<uint8_t*>(buffer));
+			}
+
+			/**
+			 * @brief Allocate some memory.
+			 * @return A pointer to the allocated memory.
+			 *
+			 * This method is thread-safe and lock-free, unless the pool is exhausted in which case the memory is heap-allocated.
+			 *
+			 * The return buffer must be deallocated by passing it to deallocate() to avoid memory leaks.
+			 */
+			uint8_t* allocate();
+
+			/**
+			 * @brief Deallocate a buffer.
+			 * @param buffer The buffer to deallocate. If buffer was not allocated by this allocator (or if it was deallocated already), the behavior is undefined.
+			 *
+			 * This method is thread-safe and lock-free.
+			 */
+			void deallocate(uint8_t* buffer);
+
+		private:
+
+			class shared_state;
+			class thread_cache;
+
+			thread_cache& get_thread_cache();
+
+			boost::shared_ptr<shared_state> m_shared_state;
+			boost::thread_specific_ptr<thread_cache> m_thread_cache;
+	};
+}
+
+#endif /* FSCP_BUFFER_POOL_HPP */
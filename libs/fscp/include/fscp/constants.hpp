@@ -214,6 +214,67 @@ namespace fscp
 	 */
 	const size_t DEFAULT_NONCE_PREFIX_SIZE = 8;
 
+	/**
+	 * \brief The default maximum datagram size.
+	 */
+	const size_t DEFAULT_DATAGRAM_SIZE = 65536;
+
+	/**
+	 * \brief The maximum size of a CONTACT message datagram.
+	 *
+	 * This is the largest UDP payload that fits in the minimum IPv6 MTU, so that contact messages never get fragmented. Larger contact maps are split over several messages.
+	 */
+	const size_t MAX_CONTACT_DATAGRAM_SIZE = 1280 - 40 - 8;
+
+	/**
+	 * \brief The amount of memory preallocated for the socket buffers.
+	 */
+	const size_t SOCKET_BUFFER_POOL_SIZE = 65536 * 32;
+
+	/**
+	 * \brief The default anti-replay window size, in sequence numbers.
+	 */
+	const size_t DEFAULT_REPLAY_WINDOW_SIZE = 1024;
+
+	/**
+	 * \brief The maximum anti-replay window size, in sequence numbers.
+	 *
+	 * Each session keeps one bit per sequence number, so this bounds the window to 8 KiB per session.
+	 */
+	const size_t MAX_REPLAY_WINDOW_SIZE = 65536;
+
+	/**
+	 * \brief The default maximum count of datagrams received or sent in a single system call.
+	 */
+	const size_t DEFAULT_IO_BATCH_SIZE = 32;
+
+	/**
+	 * \brief The default count of sockets bound on the listen endpoint.
+	 */
+	const size_t DEFAULT_SOCKET_COUNT = 1;
+
+	/**
+	 * \brief The size of the receive buffers when the UDP generic receive offload is enabled.
+	 *
+	 * The kernel may coalesce several datagrams from the same peer into a single one of up to 64 KiB.
+	 */
+	const size_t MAX_GRO_DATAGRAM_SIZE = 65536;
+
+	/**
+	 * \brief The default count of threads that run the handshake cryptography. 0 means one per hardware thread.
+	 */
+	const size_t DEFAULT_HANDSHAKE_THREAD_COUNT = 0;
+
+	/**
+	 * \brief The maximum count of threads that run the handshake cryptography.
+	 */
+	const size_t MAX_HANDSHAKE_THREAD_COUNT = 64;
+
+	/**
+	 * \brief The default maximum count of handshake cryptographic operations that can be pending at once.
+	 */
+	const size_t DEFAULT_HANDSHAKE_QUEUE_SIZE = 256;
+
 	/**
 	 * \brief The different message types.
 	 */
@@ -560,6 +621,18 @@ namespace fscp
 	 */
 	const boost::posix_time::time_duration SESSION_TIMEOUT = SESSION_KEEP_ALIVE_PERIOD * 3;
 
+	/**
+	 * \brief The count of slots the keep-alive period is divided into.
+	 *
+	 * Every session is checked once per period, with a phase given by its slot, so that the checks are spread over the period.
+	 */
+	const size_t SESSION_KEEP_ALIVE_SLOT_COUNT = 10;
+
+	/**
+	 * \brief The tick of the timer wheel that runs the HELLO timeouts and the keep-alive checks.
+	 */
+	const boost::posix_time::time_duration TIMER_WHEEL_TICK = boost::posix_time::milliseconds(10);
+
 	/**
 	 * \brief The keep-alive data size.
 	 */
@@ -50,6 +50,7 @@
 #include "constants.hpp"
 
 #include <cryptoplus/pkey/pkey.hpp>
+#include <cryptoplus/cipher/cipher_context.hpp>
 
 namespace fscp
 {
@@ -65,67 +66,104 @@ namespace fscp
 			 */
 			typedef cryptoplus::cipher::cipher_algorithm calg_t;
 
+			/**
+			 * \brief The offset of the cleartext in a buffer that is to be encrypted in place.
+			 *
+			 * \see write_in_place()
+			 */
+			static const size_t CLEARTEXT_OFFSET = HEADER_LENGTH + sizeof(sequence_number_type) + GCM_TAG_LENGTH + sizeof(uint16_t);
+
+			/**
+			 * \brief Initialize a cipher context so that it can be used to write or read data messages.
+			 * \param cipher_context The cipher context to initialize.
+			 * \param direction The direction of the cipher context.
+			 * \param cipher_algorithm The cipher algorithm to use.
+			 * \param enc_key The encryption key.
+			 * \param enc_key_len The encryption key length.
+			 * \param nonce_prefix_len The nonce prefix length.
+			 *
+			 * The cipher context is keyed once and for all: writing or reading a data message with it only sets the nonce.
+			 */
+			static void initialize_cipher_context(cryptoplus::cipher::cipher_context& cipher_context, cryptoplus::cipher::cipher_context::cipher_direction direction, data_message::calg_t cipher_algorithm, const void* enc_key, size_t enc_key_len, size_t nonce_prefix_len);
+
 			/**
 			 * \brief Write a data message to a buffer.
 			 * \param buf The buffer to write to.
 			 * \param buf_len The length of buf.
 			 * \param channel_number The channel number.
 			 * \param sequence_number The sequence number.
-			 * \param cipher_algorithm The cipher algorithm to use.
+			 * \param cipher_context The encryption cipher context, as initialized by initialize_cipher_context().
 			 * \param cleartext The cleartext data.
 			 * \param cleartext_len The data length.
-			 * \param enc_key The encryption key.
-			 * \param enc_key_len The encryption key length.
 			 * \param nonce_prefix The nonce prefix.
 			 * \param nonce_prefix_len The nonce prefix length.
 			 * \return The count of bytes written.
 			 */
-			static size_t write(void* buf, size_t buf_len, channel_number_type channel_number, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const void* cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
+			static size_t write(void* buf, size_t buf_len, channel_number_type channel_number, sequence_number_type sequence_number, cryptoplus::cipher::cipher_context& cipher_context, const void* cleartext, size_t cleartext_len, const void* nonce_prefix, size_t nonce_prefix_len);
+
+			/**
+			 * \brief Write a data message to a buffer, encrypting its cleartext in place.
+			 * \param buf The buffer to write to. The cleartext must start at buf + CLEARTEXT_OFFSET.
+			 * \param buf_len The length of buf.
+			 * \param channel_number The channel number.
+			 * \param sequence_number The sequence number.
+			 * \param cipher_context The encryption cipher context, as initialized by initialize_cipher_context().
+			 * \param cleartext_len The data length.
+			 * \param nonce_prefix The nonce prefix.
+			 * \param nonce_prefix_len The nonce prefix length.
+			 * \return The count of bytes written.
+			 *
+			 * The cleartext is overwritten by the ciphertext and the header is written in the CLEARTEXT_OFFSET bytes that precede it, so that no copy is needed.
+			 */
+			static size_t write_in_place(void* buf, size_t buf_len, channel_number_type channel_number, sequence_number_type sequence_number, cryptoplus::cipher::cipher_context& cipher_context, size_t cleartext_len, const void* nonce_prefix, size_t nonce_prefix_len);
 
 			/**
 			 * \brief Write a contact-request message to a buffer.
 			 * \param buf The buffer to write to.
 			 * \param buf_len The length of buf.
 			 * \param sequence_number The sequence number.
-			 * \param cipher_algorithm The cipher algorithm to use.
+			 * \param cipher_context The encryption cipher context, as initialized by initialize_cipher_context().
 			 * \param hash_list The hash list.
-			 * \param enc_key The encryption key.
-			 * \param enc_key_len The encryption key length.
 			 * \param nonce_prefix The nonce prefix.
 			 * \param nonce_prefix_len The nonce prefix length.
 			 * \return The count of bytes written.
 			 */
-			static size_t write_contact_request(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const hash_list_type& hash_list, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
+			static size_t write_contact_request(void* buf, size_t buf_len, sequence_number_type sequence_number, cryptoplus::cipher::cipher_context& cipher_context, const hash_list_type& hash_list, const void* nonce_prefix, size_t nonce_prefix_len);
+
+			/**
+			 * \brief Get the size a contact takes in the cleartext of a contact message.
+			 * \param contact The contact.
+			 * \return The size of the contact, in bytes.
+			 */
+			static size_t contact_size(const contact_map_type::value_type& contact);
 
 			/**
 			 * \brief Write a contact message to a buffer.
 			 * \param buf The buffer to write to.
 			 * \param buf_len The length of buf.
 			 * \param sequence_number The sequence number.
-			 * \param cipher_algorithm The cipher algorithm to use.
+			 * \param cipher_context The encryption cipher context, as initialized by initialize_cipher_context().
 			 * \param contact_map The contact map.
-			 * \param enc_key The encryption key.
-			 * \param enc_key_len The encryption key length.
 			 * \param nonce_prefix The nonce prefix.
 			 * \param nonce_prefix_len The nonce prefix length.
 			 * \return The count of bytes written.
 			 */
-			static size_t write_contact(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const contact_map_type& contact_map, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
+			static size_t write_contact(void* buf, size_t buf_len, sequence_number_type sequence_number, cryptoplus::cipher::cipher_context& cipher_context, const contact_map_type& contact_map, const void* nonce_prefix, size_t nonce_prefix_len);
 
 			/**
 			 * \brief Write a keep-alive message to a buffer.
 			 * \param buf The buffer to write to.
 			 * \param buf_len The length of buf.
 			 * \param sequence_number The sequence number.
-			 * \param cipher_algorithm The cipher algorithm to use.
-			 * \param random_len The length of the random content to send.
-			 * \param enc_key The encryption key.
-			 * \param enc_key_len The encryption key length.
+			 * \param cipher_context The encryption cipher context, as initialized by initialize_cipher_context().
+			 * \param padding_len The length of the padding to send.
 			 * \param nonce_prefix The nonce prefix.
 			 * \param nonce_prefix_len The nonce prefix length.
 			 * \return The count of bytes written.
+			 *
+			 * The padding is written in place at the cleartext offset of buf and is zero-filled: it gets encrypted anyway.
 			 */
-			static size_t write_keep_alive(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, size_t random_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
+			static size_t write_keep_alive(void* buf, size_t buf_len, sequence_number_type sequence_number, cryptoplus::cipher::cipher_context& cipher_context, size_t padding_len, const void* nonce_prefix, size_t nonce_prefix_len);
 
 			/**
 			 * \brief Parse the hash list.
@@ -189,17 +227,15 @@ namespace fscp
 			size_t ciphertext_size() const;
 
 			/**
-			 * \brief Get the clear text data, using a given encryption key.
+			 * \brief Get the clear text data, using a given decryption cipher context.
 			 * \param buf The buffer that must receive the data. If buf is NULL, the function returns the expected size of buf.
 			 * \param buf_len The length of buf.
-			 * \param cipher_algorithm The cipher algorithm to use.
-			 * \param enc_key The encryption key.
-			 * \param enc_key_len The encryption key length.
+			 * \param cipher_context The decryption cipher context, as initialized by initialize_cipher_context().
 			 * \param nonce_prefix The nonce prefix.
 			 * \param nonce_prefix_len The nonce prefix length.
 			 * \return The count of bytes deciphered.
 			 */
-			size_t get_cleartext(void* buf, size_t buf_len, data_message::calg_t cipher_algorithm, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len) const;
+			size_t get_cleartext(void* buf, size_t buf_len, cryptoplus::cipher::cipher_context& cipher_context, const void* nonce_prefix, size_t nonce_prefix_len) const;
 
 		protected:
 
@@ -213,17 +249,15 @@ namespace fscp
 			 * \param buf The buffer to write to.
 			 * \param buf_len The length of buf.
 			 * \param sequence_number The sequence number.
-			 * \param cipher_algorithm The cipher algorithm to use.
-			 * \param cleartext The cleartext data.
+			 * \param cipher_context The encryption cipher context, as initialized by initialize_cipher_context().
+			 * \param cleartext The cleartext data. May be buf + CLEARTEXT_OFFSET, in which case the encryption is done in place.
 			 * \param cleartext_len The data length.
-			 * \param enc_key The encryption key.
-			 * \param enc_key_len The encryption key length.
 			 * \param nonce_prefix The nonce prefix.
 			 * \param nonce_prefix_len The nonce prefix length.
 			 * \param type The message type.
 			 * \return The count of bytes written.
 			 */
-			static size_t raw_write(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const void* cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len, message_type type);
+			static size_t raw_write(void* buf, size_t buf_len, sequence_number_type sequence_number, cryptoplus::cipher::cipher_context& cipher_context, const void* cleartext, size_t cleartext_len, const void* nonce_prefix, size_t nonce_prefix_len, message_type type);
 
 		private:
 
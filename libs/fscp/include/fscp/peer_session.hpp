@@ -46,14 +46,21 @@
 #define FSCP_PEER_SESSION_HPP
 
 #include "constants.hpp"
+#include "replay_window.hpp"
 
 #include <cryptoplus/buffer.hpp>
 #include <cryptoplus/random/random.hpp>
 #include <cryptoplus/pkey/ecdhe.hpp>
+#include <cryptoplus/pkey/pkey.hpp>
+#include <cryptoplus/cipher/cipher_context.hpp>
 
 #include <boost/optional.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <atomic>
+#include <limits>
 
 namespace fscp
 {
@@ -90,29 +97,120 @@ namespace fscp
 				session_parameters parameters;
 			};
 
+			/**
+			 * \brief An established session.
+			 *
+			 * Data messages are encrypted and decrypted from any thread: each direction of the session is serialized by its own mutex, while the rest of the peer session stays owned by the session strand.
+			 */
 			struct current_session_type
 			{
-				explicit current_session_type(const session_parameters& _parameters) :
+				/**
+				 * \brief The value of socket_index when no traffic was received yet.
+				 */
+				static const size_t NO_SOCKET_INDEX = std::numeric_limits<size_t>::max();
+
+				current_session_type(const session_parameters& _parameters, size_t replay_window_size) :
 					parameters(_parameters),
-					local_sequence_number(),
-					remote_sequence_number()
+					local_mutex(),
+					local_sequence_number(0),
+					has_transmitted(false),
+					remote_mutex(),
+					remote_replay_window(replay_window_size),
+					replay_statistics(),
+					last_sign_of_life(boost::posix_time::microsec_clock::local_time()),
+					socket_index(NO_SOCKET_INDEX)
 				{}
 
+				current_session_type(const current_session_type&) = delete;
+				current_session_type& operator=(const current_session_type&) = delete;
+
+				/**
+				 * \brief Check if the session must be renewed.
+				 * \return true if the sequence numbers are about to wrap.
+				 *
+				 * remote_mutex must be locked.
+				 */
 				bool is_old() const;
 
+				/**
+				 * \brief Increment the local sequence number.
+				 * \return The new sequence number.
+				 *
+				 * local_mutex must be locked, so that the messages are encrypted with the sequence number they are given.
+				 */
+				sequence_number_type increment_local_sequence_number()
+				{
+					has_transmitted = true;
+
+					return ++local_sequence_number;
+				}
+
+				/**
+				 * \brief Check a remote sequence number against the anti-replay window.
+				 * \param sequence_number The remote sequence number.
+				 * \return true if sequence_number was never received and is recent enough, false otherwise. Rejected sequence numbers are accounted for in the replay statistics.
+				 *
+				 * This does not mark sequence_number as received: call set_remote_sequence_number() once the message was authenticated. remote_mutex must be locked.
+				 */
+				bool check_remote_sequence_number(sequence_number_type sequence_number);
+
+				/**
+				 * \brief Set the remote sequence number.
+				 * \param sequence_number The remote sequence number. Must have been accepted by check_remote_sequence_number().
+				 * \return true if sequence_number is the highest received so far, false if it arrived out of order.
+				 *
+				 * remote_mutex must be locked.
+				 */
+				bool set_remote_sequence_number(sequence_number_type sequence_number);
+
 				session_parameters parameters;
-				sequence_number_type local_sequence_number;
-				sequence_number_type remote_sequence_number;
-				cryptoplus::buffer local_session_key;
-				cryptoplus::buffer remote_session_key;
 				cryptoplus::buffer local_nonce_prefix;
 				cryptoplus::buffer remote_nonce_prefix;
+
+				// The cipher contexts are keyed once when the session is completed and reused for every message: each is only used with the mutex of its direction locked.
+
+				// Protects the members of the sending direction.
+				boost::mutex local_mutex;
+				std::atomic<sequence_number_type> local_sequence_number;
+				cryptoplus::cipher::cipher_context local_cipher_context;
+				std::atomic<bool> has_transmitted;
+
+				// Protects the members of the receiving direction.
+				boost::mutex remote_mutex;
+				replay_window remote_replay_window;
+				cryptoplus::cipher::cipher_context remote_cipher_context;
+				replay_statistics_type replay_statistics;
+				boost::posix_time::ptime last_sign_of_life;
+
+				// The index of the socket the session traffic is received on.
+				std::atomic<size_t> socket_index;
 			};
 
+			typedef boost::shared_ptr<next_session_type> next_session_ptr;
+			typedef boost::shared_ptr<current_session_type> current_session_ptr;
+
+			/**
+			 * \brief Derive the keys of a session.
+			 * \param next_session The prepared session.
+			 * \param local_host_identifier The local host identifier.
+			 * \param remote_host_identifier The remote host identifier.
+			 * \param remote_public_key The remote public key.
+			 * \param replay_window_size The size of the anti-replay window of the new session.
+			 * \return The new session, to be passed to complete_session().
+			 *
+			 * This does not access any peer session, so that it can be called from any thread as long as next_session is not used concurrently.
+			 */
+			static current_session_ptr derive_session(next_session_type& next_session, const host_identifier_type& local_host_identifier, const host_identifier_type& remote_host_identifier, const cryptoplus::buffer& remote_public_key, size_t replay_window_size);
+
 			peer_session() :
 				m_local_host_identifier(),
 				m_remote_host_identifier(),
-				m_last_sign_of_life(boost::posix_time::microsec_clock::local_time())
+				m_last_sign_of_life(boost::posix_time::microsec_clock::local_time()),
+				m_keep_alive_scheduled(false),
+				m_socket_index(),
+				m_handshake_generation(0),
+				m_handshake_pending(false),
+				m_replay_statistics()
 			{
 				// Generate a random host identifier.
 				cryptoplus::random::get_random_bytes(m_local_host_identifier.data.data(), m_local_host_identifier.data.size());
@@ -136,24 +234,48 @@ namespace fscp
 			 */
 			void clear_remote_host_identifier() { m_remote_host_identifier = boost::none; }
 
+			/**
+			 * \brief Get the remote host identifier.
+			 * \return The remote host identifier, if it is known.
+			 */
+			const boost::optional<host_identifier_type>& remote_host_identifier() const { return m_remote_host_identifier; }
+
 			/**
 			 * \brief Check if the session has timed out.
 			 * \param timeout The timeout value.
 			 * \return true if the session has timed out, false otherwise.
 			 */
-			bool has_timed_out(const boost::posix_time::time_duration& timeout) const
-			{
-				return (boost::posix_time::microsec_clock::local_time() > m_last_sign_of_life + timeout);
-			}
+			bool has_timed_out(const boost::posix_time::time_duration& timeout) const;
 
 			/**
-			 * \brief Keep the session alive.
+			 * \brief Check whether messages were sent to the peer since the last call.
+			 * \return true if a message was sent in the current session since the last call.
+			 *
+			 * A peer we keep sending to doesn't need keep-alives.
 			 */
-			void keep_alive()
+			bool clear_has_transmitted()
 			{
-				m_last_sign_of_life = boost::posix_time::microsec_clock::local_time();
+				return m_current_session && m_current_session->has_transmitted.exchange(false);
 			}
 
+			/**
+			 * \brief Check if the session is scheduled for keep-alive checks.
+			 * \return true if the session is scheduled for keep-alive checks.
+			 */
+			bool is_keep_alive_scheduled() const { return m_keep_alive_scheduled; }
+
+			/**
+			 * \brief Set whether the session is scheduled for keep-alive checks.
+			 * \param scheduled The new value.
+			 */
+			void set_keep_alive_scheduled(bool scheduled) { m_keep_alive_scheduled = scheduled; }
+
+			/**
+			 * \brief Get the index of the socket the session traffic is received on.
+			 * \return The index of the socket, if any traffic was received yet, in this session or in a previous one.
+			 */
+			boost::optional<size_t> socket_index() const;
+
 			/**
 			 * \brief Prepare the next session.
 			 * \param _session_number The next session number.
@@ -163,13 +285,100 @@ namespace fscp
 			 */
 			bool prepare_session(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve);
 
+			/**
+			 * \brief Prepare the next session with an already generated one.
+			 * \param next_session The next session.
+			 * \return true if next_session was set, false if the session in preparation already matches its parameters.
+			 */
+			bool prepare_session(const next_session_ptr& next_session);
+
+			/**
+			 * \brief Check if the session in preparation matches the specified parameters.
+			 * \param _session_number The session number.
+			 * \param _cipher_suite The cipher suite.
+			 * \param _elliptic_curve The elliptic curve.
+			 * \return true if a session is in preparation with those parameters.
+			 */
+			bool has_next_session(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve) const;
+
+			/**
+			 * \brief Get the session in preparation.
+			 * \return The session in preparation, or a null pointer if there is none.
+			 */
+			const next_session_ptr& next_session() const { return m_next_session; }
+
 			/**
 			 * \brief Complete the next session.
 			 * \param remote_public_key The remote public key.
 			 * \param remote_public_key_size The remote public key size.
+			 * \param replay_window_size The size of the anti-replay window of the new session.
 			 * \return true if the session was completed.
 			 */
-			bool complete_session(const void* remote_public_key, size_t remote_public_key_size);
+			bool complete_session(const void* remote_public_key, size_t remote_public_key_size, size_t replay_window_size);
+
+			/**
+			 * \brief Complete the next session with keys derived by derive_session().
+			 * \param next_session The prepared session the keys were derived from.
+			 * \param current_session The new session.
+			 * \return true if the session was completed, false if another session was prepared in the meantime.
+			 */
+			bool complete_session(const next_session_ptr& next_session, const current_session_ptr& current_session);
+
+			/**
+			 * \brief Get the handshake generation.
+			 * \return A number that changes whenever the session is cleared. Handshake results computed for another generation must be discarded.
+			 */
+			uint64_t handshake_generation() const { return m_handshake_generation; }
+
+			/**
+			 * \brief Check if handshake cryptography is being computed for this session.
+			 * \return true if a handshake is pending.
+			 */
+			bool has_pending_handshake() const { return m_handshake_pending; }
+
+			/**
+			 * \brief Set whether handshake cryptography is being computed for this session.
+			 * \param pending The new value.
+			 */
+			void set_pending_handshake(bool pending) { m_handshake_pending = pending; }
+
+			/**
+			 * \brief Get the signed SESSION message for the specified parameters.
+			 * \param parameters The session parameters.
+			 * \param signature_key The key the message must have been signed with.
+			 * \return The message bytes, if a message was signed with those parameters and key. The reference is invalidated by set_signed_session_message().
+			 */
+			boost::optional<const cryptoplus::buffer&> signed_session_message(const session_parameters& parameters, const cryptoplus::pkey::pkey& signature_key) const;
+
+			/**
+			 * \brief Cache a signed SESSION message.
+			 * \param parameters The session parameters.
+			 * \param signature_key The key the message was signed with.
+			 * \param data The message bytes.
+			 * \param data_len The message size.
+			 */
+			void set_signed_session_message(const session_parameters& parameters, const cryptoplus::pkey::pkey& signature_key, const void* data, size_t data_len);
+
+			/**
+			 * \brief Get the signed SESSION_REQUEST message for the specified parameters.
+			 * \param session_number The session number.
+			 * \param cipher_suites The cipher suites capabilities.
+			 * \param elliptic_curves The elliptic curves capabilities.
+			 * \param signature_key The key the message must have been signed with.
+			 * \return The message bytes, if a message was signed with those parameters and key. The reference is invalidated by set_signed_session_request_message().
+			 */
+			boost::optional<const cryptoplus::buffer&> signed_session_request_message(session_number_type session_number, const cipher_suite_list_type& cipher_suites, const elliptic_curve_list_type& elliptic_curves, const cryptoplus::pkey::pkey& signature_key) const;
+
+			/**
+			 * \brief Cache a signed SESSION_REQUEST message.
+			 * \param session_number The session number.
+			 * \param cipher_suites The cipher suites capabilities.
+			 * \param elliptic_curves The elliptic curves capabilities.
+			 * \param signature_key The key the message was signed with.
+			 * \param data The message bytes.
+			 * \param data_len The message size.
+			 */
+			void set_signed_session_request_message(session_number_type session_number, const cipher_suite_list_type& cipher_suites, const elliptic_curve_list_type& elliptic_curves, const cryptoplus::pkey::pkey& signature_key, const void* data, size_t data_len);
 
 			/**
 			 * \brief Get the next session number.
@@ -199,20 +408,19 @@ namespace fscp
 			 * \brief Get the current session.
 			 * \return The current session, if there is one. If there is no current session, the behavior is undefined.
 			 */
-			const current_session_type& current_session() const { return *m_current_session; }
+			current_session_type& current_session() const { return *m_current_session; }
 
 			/**
-			 * \brief Increment the local sequence number.
-			 * \return Return the current sequence number and increment it afterwards.
+			 * \brief Get the current session.
+			 * \return The current session, or a null pointer if there is none.
 			 */
-			sequence_number_type increment_local_sequence_number() { return ++m_current_session->local_sequence_number; }
+			const current_session_ptr& current_session_pointer() const { return m_current_session; }
 
 			/**
-			 * \brief Set the remote sequence number.
-			 * \param sequence_number The remote sequence number.
-			 * \return true if the sequence number was incremented with the new value, false is the current sequence number is greater than sequence_number.
+			 * \brief Get the replay statistics.
+			 * \return The replay statistics, accumulated over all the sessions.
 			 */
-			bool set_remote_sequence_number(sequence_number_type sequence_number);
+			replay_statistics_type replay_statistics() const;
 
 			/**
 			 * \brief Clear the current session.
@@ -222,13 +430,57 @@ namespace fscp
 
 		private:
 
+			// Keeps what the current session learned once it is replaced or cleared.
+			void retire_current_session();
+
+			// The handshake messages are signed once and replayed as-is on retransmission: they only change with their parameters.
+			struct signed_session_message_type
+			{
+				signed_session_message_type(const session_parameters& _parameters, const cryptoplus::pkey::pkey& _signature_key, const void* data, size_t data_len) :
+					parameters(_parameters),
+					signature_key(_signature_key),
+					message(data, data_len)
+				{}
+
+				session_parameters parameters;
+				cryptoplus::pkey::pkey signature_key;
+				cryptoplus::buffer message;
+			};
+
+			struct signed_session_request_message_type
+			{
+				signed_session_request_message_type(session_number_type _session_number, const cipher_suite_list_type& _cipher_suites, const elliptic_curve_list_type& _elliptic_curves, const cryptoplus::pkey::pkey& _signature_key, const void* data, size_t data_len) :
+					session_number(_session_number),
+					cipher_suites(_cipher_suites),
+					elliptic_curves(_elliptic_curves),
+					signature_key(_signature_key),
+					message(data, data_len)
+				{}
+
+				session_number_type session_number;
+				cipher_suite_list_type cipher_suites;
+				elliptic_curve_list_type elliptic_curves;
+				cryptoplus::pkey::pkey signature_key;
+				cryptoplus::buffer message;
+			};
+
 			host_identifier_type m_local_host_identifier;
 			boost::optional<host_identifier_type> m_remote_host_identifier;
 
 			boost::posix_time::ptime m_last_sign_of_life;
+			bool m_keep_alive_scheduled;
+			boost::optional<size_t> m_socket_index;
+
+			next_session_ptr m_next_session;
+			current_session_ptr m_current_session;
+
+			uint64_t m_handshake_generation;
+			bool m_handshake_pending;
+
+			replay_statistics_type m_replay_statistics;
 
-			boost::shared_ptr<next_session_type> m_next_session;
-			boost::shared_ptr<current_session_type> m_current_session;
+			boost::optional<signed_session_message_type> m_signed_session_message;
+			boost::optional<signed_session_request_message_type> m_signed_session_request_message;
 	};
 }
 
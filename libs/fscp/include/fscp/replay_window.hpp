@@ -0,0 +1,155 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file replay_window.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief An anti-replay window class.
+ */
+
+#ifndef FSCP_REPLAY_WINDOW_HPP
+#define FSCP_REPLAY_WINDOW_HPP
+
+#include "constants.hpp"
+
+#include <vector>
+
+#include <stdint.h>
+
+namespace fscp
+{
+	/**
+	 * \brief Anti-replay statistics.
+	 */
+	struct replay_statistics_type
+	{
+		replay_statistics_type() :
+			reordered(0),
+			replayed(0),
+			outdated(0)
+		{}
+
+		/**
+		 * \brief The count of messages that were accepted although they arrived after a message with a higher sequence number.
+		 */
+		uint64_t reordered;
+
+		/**
+		 * \brief The count of messages that were dropped because their sequence number was already received.
+		 */
+		uint64_t replayed;
+
+		/**
+		 * \brief The count of messages that were dropped because their sequence number was too old for the window.
+		 *
+		 * A high value on a reordering link indicates the window is too small.
+		 */
+		uint64_t outdated;
+	};
+
+	/**
+	 * \brief A sliding anti-replay window.
+	 *
+	 * Keeps track of the highest sequence number received and of which of the size() previous ones were received too, in a circular bitmap. This allows out-of-order messages within the window to be accepted exactly once.
+	 */
+	class replay_window
+	{
+		public:
+
+			/**
+			 * \brief The result of a sequence number check.
+			 */
+			enum check_result_type
+			{
+				accepted, /**< \brief The sequence number was never received. */
+				replayed, /**< \brief The sequence number was already received. */
+				outdated /**< \brief The sequence number is too old to tell. */
+			};
+
+			/**
+			 * \brief Create a new replay window.
+			 * \param size The window size, in sequence numbers. Rounded up to a multiple of 64.
+			 */
+			explicit replay_window(size_t size = DEFAULT_REPLAY_WINDOW_SIZE);
+
+			/**
+			 * \brief Get the window size.
+			 * \return The window size.
+			 */
+			size_t size() const { return m_size; }
+
+			/**
+			 * \brief Get the highest sequence number received so far.
+			 * \return The highest sequence number.
+			 */
+			sequence_number_type highest() const { return m_highest; }
+
+			/**
+			 * \brief Check a sequence number without marking it as received.
+			 * \param sequence_number The sequence number.
+			 * \return The check result.
+			 *
+			 * This is meant to be called before the message is authenticated.
+			 */
+			check_result_type check(sequence_number_type sequence_number) const;
+
+			/**
+			 * \brief Mark a sequence number as received.
+			 * \param sequence_number The sequence number. Must have been accepted by check().
+			 * \return true if sequence_number is the highest received so far, false if it arrived out of order.
+			 *
+			 * This is meant to be called once the message was authenticated.
+			 */
+			bool update(sequence_number_type sequence_number);
+
+		private:
+
+			typedef uint64_t word_type;
+
+			static const size_t WORD_BITS = sizeof(word_type) * 8;
+
+			bool test(sequence_number_type sequence_number) const;
+			void set(sequence_number_type sequence_number);
+
+			size_t m_size;
+			std::vector<word_type> m_words;
+			sequence_number_type m_highest;
+	};
+}
+
+#endif /* FSCP_REPLAY_WINDOW_HPP */
@@ -49,17 +49,26 @@
 
 #include "identity_store.hpp"
 #include "memory_pool.hpp"
+#include "buffer_pool.hpp"
 #include "presentation_store.hpp"
 #include "peer_session.hpp"
+#include "worker_pool.hpp"
+#include "timer_wheel.hpp"
 
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
 #include <boost/optional.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
 
 #include <set>
 #include <map>
 #include <queue>
+#include <vector>
+#include <algorithm>
 #include <iostream>
+#include <exception>
 
 #include <stdint.h>
 
@@ -85,7 +94,7 @@ namespace fscp
 	{
 		private:
 
-			typedef memory_pool<65536, 32> socket_memory_pool;
+			typedef buffer_pool socket_memory_pool;
 
 		public:
 
@@ -153,6 +162,11 @@ namespace fscp
 			 */
 			typedef boost::function<void (const std::set<ep_type>&)> endpoints_handler_type;
 
+			/**
+			 * \brief A replay statistics handler.
+			 */
+			typedef boost::function<void (const replay_statistics_type&)> replay_statistics_handler_type;
+
 			// Callbacks
 
 			/**
@@ -265,15 +279,26 @@ namespace fscp
 			 * \brief Create a new FSCP server.
 			 * \param io_service The Boost Asio io_service instance to associate with the server.
 			 * \param identity The identity store.
+			 * \param datagram_size The maximum size of the datagrams to send or receive. Received datagrams that are larger are truncated, so this must cover the largest datagram any peer may send, including PRESENTATION messages.
+			 */
+			server(boost::asio::io_service& io_service, const identity_store& identity, size_t datagram_size = DEFAULT_DATAGRAM_SIZE);
+
+			/**
+			 * \brief Get one of the underlying sockets.
+			 * \param index The index of the socket, which must be lower than socket_count().
 			 */
-			server(boost::asio::io_service& io_service, const identity_store& identity);
+			socket_type& get_socket(size_t index = 0)
+			{
+				return m_socket_shards[index]->socket;
+			}
 
 			/**
-			 * \brief Get the underlying socket.
+			 * \brief Get the count of underlying sockets.
+			 * \return The count of underlying sockets. Until the server is opened, it is always 1.
 			 */
-			socket_type& get_socket()
+			size_t socket_count() const
 			{
-				return m_socket;
+				return m_socket_shards.size();
 			}
 
 			/**
@@ -288,11 +313,10 @@ namespace fscp
 			/**
 			 * \brief Get the identity of the server.
 			 * \return The identity.
-			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
 			 */
-			const identity_store& get_identity() const
+			identity_store get_identity() const
 			{
-				return m_identity_store;
+				return *boost::atomic_load(&m_identity_store);
 			}
 
 			/**
@@ -301,7 +325,7 @@ namespace fscp
 			 */
 			void async_get_identity(identity_handler_type handler)
 			{
-				m_socket_strand.post(boost::bind(&server::do_get_identity, this, handler));
+				m_identity_strand.post(boost::bind(&server::do_get_identity, this, handler));
 			}
 
 			/**
@@ -319,7 +343,8 @@ namespace fscp
 			 */
 			void set_identity(const identity_store& identity)
 			{
-				m_identity_store = identity;
+				// The receive loops of all the sockets read the identity: it is replaced as a whole.
+				boost::atomic_store(&m_identity_store, identity_store_ptr(boost::make_shared<identity_store>(identity)));
 			}
 
 			/**
@@ -329,7 +354,7 @@ namespace fscp
 			 */
 			void async_set_identity(const identity_store& identity, void_handler_type handler = void_handler_type())
 			{
-				m_socket_strand.post(boost::bind(&server::do_set_identity, this, identity, handler));
+				m_identity_strand.post(boost::bind(&server::do_set_identity, this, identity, handler));
 			}
 
 			/**
@@ -340,6 +365,73 @@ namespace fscp
 			 */
 			void sync_set_identity(const identity_store& identity);
 
+			/**
+			 * \brief Set the I/O batch size.
+			 * \param io_batch_size The maximum count of datagrams to receive or send in a single system call. A value of 1 disables batching.
+			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 *
+			 * Batching relies on recvmmsg() and sendmmsg() and is only available on Linux: on other platforms, this setting is ignored.
+			 */
+			void set_io_batch_size(size_t io_batch_size)
+			{
+				m_io_batch_size = std::max<size_t>(io_batch_size, 1);
+			}
+
+			/**
+			 * \brief Set the count of sockets to open.
+			 * \param socket_count The count of sockets to bind on the listen endpoint. Each socket has its own receive loop and write queue, and the sessions are pinned to the socket the kernel delivers their traffic to.
+			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 *
+			 * Opening several sockets on the same endpoint relies on SO_REUSEPORT and is only available on Linux: on other platforms, this setting is ignored.
+			 */
+			void set_socket_count(size_t socket_count)
+			{
+				m_socket_count = std::max<size_t>(socket_count, 1);
+			}
+
+			/**
+			 * \brief Enable or disable the UDP segmentation offload.
+			 * \param enabled If true, consecutive datagrams of the same size to the same peer are handed to the kernel as a single UDP_SEGMENT message and received datagrams are coalesced with UDP_GRO.
+			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 *
+			 * The segmentation offload is only available on Linux and the send side only applies to batched writes (see set_io_batch_size()). If the kernel rejects it, the server silently falls back to regular datagrams.
+			 */
+			void set_segmentation_offload_enabled(bool enabled)
+			{
+				m_segmentation_offload_enabled = enabled;
+			}
+
+			/**
+			 * \brief Set the count of threads that run the handshake cryptography.
+			 * \param handshake_thread_count The count of threads that sign the session messages, check their signatures and derive the session keys, away from the strands that carry the data. If 0, one thread per hardware thread (as reported by boost::thread::hardware_concurrency()) is started. Values above MAX_HANDSHAKE_THREAD_COUNT are capped.
+			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 */
+			void set_handshake_thread_count(size_t handshake_thread_count)
+			{
+				m_handshake_thread_count = std::min(handshake_thread_count, MAX_HANDSHAKE_THREAD_COUNT);
+			}
+
+			/**
+			 * \brief Set the handshake queue size.
+			 * \param handshake_queue_size The maximum count of handshake cryptographic operations that can be pending at once. Handshake messages that would exceed it are dropped and will be handled when the peer sends them again.
+			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 */
+			void set_handshake_queue_size(size_t handshake_queue_size)
+			{
+				m_handshake_queue_size = std::max<size_t>(handshake_queue_size, 1);
+			}
+
+			/**
+			 * \brief Get the handshake statistics.
+			 * \return The statistics of the handshake worker pool, including its current queue depth. If the server was never opened, the statistics are all zero.
+			 *
+			 * This method is thread-safe once the server is opened.
+			 */
+			worker_pool_statistics_type get_handshake_statistics() const
+			{
+				return m_handshake_pool ? m_handshake_pool->statistics() : worker_pool_statistics_type();
+			}
+
 			/**
 			 * \brief Open the server.
 			 * \param listen_endpoint The listen endpoint.
@@ -504,6 +596,16 @@ namespace fscp
 			 */
 			void sync_set_presentation(const ep_type& target, cert_type signature_certificate);
 
+			/**
+			 * \brief Handle a presentation again, once its signature certificate was validated.
+			 * \param sender The host that sent the presentation.
+			 * \param signature_certificate The signature certificate.
+			 * \param handler The handler to call, within the presentation strand, with the current presentation status and session state. The presentation is stored only if it returns true.
+			 *
+			 * The handler is not called if the server was closed in the meantime.
+			 */
+			void async_handle_presentation(const ep_type& sender, cert_type signature_certificate, presentation_message_received_handler_type handler);
+
 			/**
 			 * \brief Clear the presentation for the given host.
 			 * \param target The host to set the presentation for.
@@ -618,6 +720,25 @@ namespace fscp
 			 */
 			bool sync_has_session_with_endpoint(const ep_type& host);
 
+			/**
+			 * \brief Get the anti-replay statistics of the specified endpoint.
+			 * \param host The host.
+			 * \param handler The handler to call with the statistics. If the server never had a session with host, the statistics are all zero.
+			 */
+			void async_get_replay_statistics(const ep_type& host, replay_statistics_handler_type handler)
+			{
+				m_session_strand.post(boost::bind(&server::do_get_replay_statistics, this, host, handler));
+			}
+
+			/**
+			 * \brief Get the anti-replay statistics of the specified endpoint.
+			 * \param host The host.
+			 * \return The statistics.
+			 * \warning If the io_service is not being run, the call will block undefinitely.
+			 * \warning This function must **NEVER** be called from inside a thread that runs one of the server's handlers.
+			 */
+			replay_statistics_type sync_get_replay_statistics(const ep_type& host);
+
 			/**
 			 * \brief Set the default acceptance behavior of incoming session requests.
 			 * \param value The default value.
@@ -702,6 +823,34 @@ namespace fscp
 			 */
 			void sync_set_elliptic_curves(const elliptic_curve_list_type& elliptic_curves);
 
+			/**
+			 * \brief Set the anti-replay window size.
+			 * \param replay_window_size The count of sequence numbers below the highest received one that are still accepted, once. Applies to the sessions established afterwards.
+			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 */
+			void set_replay_window_size(size_t replay_window_size)
+			{
+				m_replay_window_size = replay_window_size;
+			}
+
+			/**
+			 * \brief Set the anti-replay window size.
+			 * \param replay_window_size The anti-replay window size.
+			 * \param handler The handler to call when the change was made effective.
+			 */
+			void async_set_replay_window_size(size_t replay_window_size, void_handler_type handler = void_handler_type())
+			{
+				m_session_strand.post(boost::bind(&server::do_set_replay_window_size, this, replay_window_size, handler));
+			}
+
+			/**
+			 * \brief Set the anti-replay window size.
+			 * \param replay_window_size The anti-replay window size.
+			 * \warning If the io_service is not being run, the call will block undefinitely.
+			 * \warning This function must **NEVER** be called from inside a thread that runs one of the server's handlers.
+			 */
+			void sync_set_replay_window_size(size_t replay_window_size);
+
 			/**
 			 * \brief Set the session request message received callback.
 			 * \param callback The callback.
@@ -918,6 +1067,30 @@ namespace fscp
 			 */
 			boost::system::error_code sync_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data);
 
+			/**
+			 * \brief Send data to a host, encrypting it in place.
+			 * \param target The target host.
+			 * \param channel_number The channel number.
+			 * \param buffer The buffer that holds the data. The data must start at data_message::CLEARTEXT_OFFSET and will be overwritten.
+			 * \param data_len The length of the data.
+			 * \param handler The handler to call when the data was sent or an error occured.
+			 *
+			 * Unlike async_send_data(), no intermediate buffer is used: the message header is written in the room reserved in front of the data. The caller must keep buffer alive until handler is called.
+			 */
+			void async_send_data_in_place(const ep_type& target, channel_number_type channel_number, boost::asio::mutable_buffer buffer, size_t data_len, simple_handler_type handler);
+
+			/**
+			 * \brief Send data to a host, encrypting it in place.
+			 * \param target The target host.
+			 * \param channel_number The channel number.
+			 * \param buffer The buffer that holds the data. The data must start at data_message::CLEARTEXT_OFFSET and will be overwritten.
+			 * \param data_len The length of the data.
+			 * \return The error code associated to the send operation.
+			 * \warning If the io_service is not being run, the call will block undefinitely.
+			 * \warning This function must **NEVER** be called from inside a thread that runs one of the server's handlers.
+			 */
+			boost::system::error_code sync_send_data_in_place(const ep_type& target, channel_number_type channel_number, boost::asio::mutable_buffer buffer, size_t data_len);
+
 			/**
 			 * \brief Send data to a list of hosts.
 			 * \param targets The list of hosts.
@@ -976,7 +1149,7 @@ namespace fscp
 			 */
 			void async_send_data_to_all(channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
 			{
-				m_session_strand.post(boost::bind(&server::do_send_data_to_all, this, channel_number, data, handler));
+				send_data_to_all(channel_number, data, handler);
 			}
 
 			/**
@@ -1241,53 +1414,124 @@ namespace fscp
 
 		private:
 
-			identity_store m_identity_store;
+			typedef boost::shared_ptr<const identity_store> identity_store_ptr;
+
+			// Must only be accessed through boost::atomic_load() and boost::atomic_store().
+			identity_store_ptr m_identity_store;
+			boost::asio::strand m_identity_strand;
 
 			void do_get_identity(identity_handler_type);
 			void do_set_identity(const identity_store&, void_handler_type);
 
 		private:
 
-			void async_receive_from()
+			typedef boost::function<void (const boost::system::error_code&, size_t)> write_handler_type;
+
+			struct pending_write_type
+			{
+				pending_write_type(boost::asio::const_buffer _data, const ep_type& _target, write_handler_type _handler) :
+					data(_data),
+					target(_target),
+					handler(_handler)
+				{}
+
+				boost::asio::const_buffer data;
+				ep_type target;
+				write_handler_type handler;
+			};
+
+			typedef std::vector<pending_write_type> pending_write_batch_type;
+
+			/**
+			 * \brief The buffers and headers of a batched read, kept from one read to the next.
+			 */
+			struct receive_batch_type;
+
+			/**
+			 * \brief A socket, with its own receive loop and write queue.
+			 */
+			struct socket_shard_type
+			{
+				socket_shard_type(boost::asio::io_service& io_service, size_t _index) :
+					index(_index),
+					socket(io_service),
+					socket_strand(io_service),
+					write_queue(),
+					write_in_progress(false),
+					write_queue_strand(io_service),
+					gso_enabled(false),
+					gro_enabled(false),
+					receive_batch()
+				{}
+
+				size_t index;
+				socket_type socket;
+				boost::asio::strand socket_strand;
+				std::queue<pending_write_type> write_queue;
+				bool write_in_progress;
+				boost::asio::strand write_queue_strand;
+				bool gso_enabled;
+				bool gro_enabled;
+				boost::shared_ptr<receive_batch_type> receive_batch;
+			};
+
+			typedef boost::shared_ptr<socket_shard_type> socket_shard_ptr;
+
+			void async_receive_from(socket_shard_ptr shard)
 			{
-				m_socket_strand.post(boost::bind(&server::do_async_receive_from, this));
+				shard->socket_strand.post(boost::bind(&server::do_async_receive_from, this, shard));
 			}
 
-			void do_async_receive_from();
-			void handle_receive_from(const identity_store&, boost::shared_ptr<ep_type>, socket_memory_pool::shared_buffer_type, const boost::system::error_code&, size_t);
+			void do_async_receive_from(socket_shard_ptr);
+			void handle_receive_from(socket_shard_ptr, const identity_store&, boost::shared_ptr<ep_type>, socket_memory_pool::shared_buffer_type, const boost::system::error_code&, size_t);
 
 			ep_type to_socket_format(const ep_type& ep);
 
-			class async_sender
-			{
-				public:
-					template <typename ConstBufferSequence, typename WriteHandler>
-					void operator()(boost::asio::ip::udp::socket* socket, const ConstBufferSequence& data, const ep_type& target, int flags, WriteHandler handler)
-					{
-						assert(socket);
+			void handle_receive_ready(socket_shard_ptr, const identity_store&, const boost::system::error_code&);
+			void read_error_queue(socket_shard_type&);
+			void handle_receive_error(const ep_type&, const boost::system::error_code&);
+			void handle_message_from(size_t, const identity_store&, const ep_type&, socket_memory_pool::shared_buffer_type, boost::asio::const_buffer);
 
-						socket->async_send_to(data, target, flags, handler);
-					}
-			};
+			size_t get_socket_index_for(const ep_type&) const;
+			size_t get_socket_index_for(const peer_session&, const ep_type&) const;
+			size_t get_socket_index_for(const peer_session::current_session_type&, const ep_type&) const;
+
+			void async_send_to(boost::asio::const_buffer data, const ep_type& target, write_handler_type handler)
+			{
+				async_send_to(get_socket_index_for(target), data, target, handler);
+			}
 
-			template <typename ConstBufferSequence, typename WriteHandler>
-			void async_send_to(const ConstBufferSequence& data, const ep_type& target, WriteHandler handler)
+			void async_send_to(size_t socket_index, boost::asio::const_buffer data, const ep_type& target, write_handler_type handler)
 			{
-				const void_handler_type write_handler = boost::bind<void>(async_sender(), &m_socket, data, to_socket_format(target), 0, handler);
+				const socket_shard_ptr& shard = m_socket_shards[socket_index];
 
-				m_write_queue_strand.post(boost::bind(&server::push_write, this, write_handler));
+				shard->write_queue_strand.post(boost::bind(&server::push_write, this, shard, pending_write_type(data, to_socket_format(target), handler)));
 			}
 
-			void push_write(void_handler_type);
-			void pop_write();
+			void push_write(socket_shard_ptr, const pending_write_type&);
+			void pop_write(socket_shard_ptr);
+			void start_write(socket_shard_ptr);
+			void do_write(socket_shard_ptr, const pending_write_type&);
+			void do_write_batch(socket_shard_ptr, boost::shared_ptr<pending_write_batch_type>, size_t);
+			void handle_write_batch_ready(socket_shard_ptr, boost::shared_ptr<pending_write_batch_type>, size_t, const boost::system::error_code&);
+			static size_t get_segment_count(const pending_write_batch_type&, size_t);
+			void complete_write(const pending_write_type&, const boost::system::error_code&, size_t);
 
 			void handle_send_to(const boost::system::error_code&, size_t) {};
 
-			socket_type m_socket;
-			boost::asio::strand m_socket_strand;
+			// The first shard always exists, so that the socket can be configured before the server is opened. The others are created by open().
+			std::vector<socket_shard_ptr> m_socket_shards;
+			size_t m_socket_count;
 			socket_memory_pool m_socket_memory_pool;
-			std::queue<void_handler_type> m_write_queue;
-			boost::asio::strand m_write_queue_strand;
+			size_t m_io_batch_size;
+			boost::scoped_ptr<socket_memory_pool> m_receive_memory_pool;
+			bool m_segmentation_offload_enabled;
+			boost::scoped_ptr<socket_memory_pool> m_gro_memory_pool;
+
+		private: // Timers
+
+			// HELLO timeouts and keep-alive checks all share this wheel so that starting a timer is cheap regardless of the count of peers.
+			timer_wheel m_timer_wheel;
 
 		private: // HELLO messages
 
@@ -1317,28 +1561,30 @@ namespace fscp
 
 					/**
 					 * @brief Asynchronously waits for a hello reply.
-					 * @param io_service The io_service instance to use for the wait.
+					 * @param wheel The timer wheel to use for the wait.
 					 * @param hello_unique_number The unique hello number.
 					 * @param timeout The time to wait for the reply.
 					 * @param handler The handler to call upon timeout or cancellation.
 					 */
 					template <typename WaitHandler>
-					void async_wait_reply(boost::asio::io_service& io_service, uint32_t hello_unique_number, const boost::posix_time::time_duration& timeout, WaitHandler handler);
+					void async_wait_reply(timer_wheel& wheel, uint32_t hello_unique_number, const boost::posix_time::time_duration& timeout, WaitHandler handler);
 
 					/**
 					 * @brief Cancel a hello reply wait timer.
+					 * @param wheel The timer wheel the wait was started on.
 					 * @param hello_unique_number The hello reply number.
 					 * @param success Whether the cancel is the result of a received reply.
 					 * @return true if the timer was cancelled or false if it was too late to do so.
 					 */
-					bool cancel_reply_wait(uint32_t hello_unique_number, bool success);
+					bool cancel_reply_wait(timer_wheel& wheel, uint32_t hello_unique_number, bool success);
 
 					/**
 					 * @brief Cancel all pending hello request wait timers.
+					 * @param wheel The timer wheel the waits were started on.
 					 *
 					 * This call is similar to calling cancel_reply_wait(<num>, false) for all hello unique numbers.
 					 */
-					void cancel_all_reply_wait();
+					void cancel_all_reply_wait(timer_wheel& wheel);
 
 					/**
 					 * @brief Remove a hello reply wait from the pending list.
@@ -1358,13 +1604,13 @@ namespace fscp
 							success(false)
 						{}
 
-						pending_request_status(boost::shared_ptr<boost::asio::deadline_timer> _timer) :
+						pending_request_status(timer_wheel::timer_id_type _timer) :
 							timer(_timer),
 							start_date(boost::posix_time::microsec_clock::universal_time()),
 							success(false)
 						{}
 
-						boost::shared_ptr<boost::asio::deadline_timer> timer;
+						timer_wheel::timer_id_type timer;
 						boost::posix_time::ptime start_date;
 						bool success;
 					};
@@ -1401,7 +1647,10 @@ namespace fscp
 
 			typedef memory_pool<4096, 4> presentation_memory_pool;
 			typedef std::map<ep_type, presentation_store> presentation_store_map;
+			typedef std::map<hash_type, std::set<ep_type> > presentation_index_map;
 
+			void store_presentation(const ep_type&, const presentation_store&);
+			void erase_presentation(const ep_type&);
 			bool has_presentation_store_for(const ep_type&) const;
 			void do_introduce_to(const ep_type&, simple_handler_type);
 			void do_reintroduce_to_all(multiple_endpoints_handler_type);
@@ -1410,6 +1659,8 @@ namespace fscp
 			void do_clear_presentation(const ep_type&, void_handler_type);
 			void handle_presentation_message_from(const presentation_message&, const ep_type&);
 			void do_handle_presentation(const ep_type&, bool, cert_type);
+			void do_handle_validated_presentation(const ep_type&, bool, cert_type, presentation_message_received_handler_type);
+			void handle_presentation(const ep_type&, bool, cert_type, const presentation_message_received_handler_type&);
 
 			void do_set_presentation_message_received_callback(presentation_message_received_handler_type, void_handler_type);
 
@@ -1419,44 +1670,79 @@ namespace fscp
 
 			presentation_store_map m_presentation_store_map;
 
+			// The endpoints of m_presentation_store_map, indexed by certificate hash. It must be updated with every change to m_presentation_store_map.
+			presentation_index_map m_presentation_index;
+
 			presentation_message_received_handler_type m_presentation_message_received_handler;
 
 		private: // SESSION_REQUEST messages
 
 			typedef std::map<ep_type, peer_session> peer_session_map_type;
 
+			// The current sessions, for the threads that send and receive data messages outside of the session strand.
+			typedef std::map<ep_type, peer_session::current_session_ptr> session_table_type;
+			typedef boost::shared_ptr<const session_table_type> session_table_ptr_type;
+
 			static cipher_suite_type get_first_common_supported_cipher_suite(const cipher_suite_list_type&, const cipher_suite_list_type&, cipher_suite_type);
 			static elliptic_curve_type get_first_common_supported_elliptic_curve(const elliptic_curve_list_type&, const elliptic_curve_list_type&, elliptic_curve_type);
 
 			void do_request_session(const identity_store&, const ep_type&, simple_handler_type);
+			void do_sign_session_request(const ep_type&, session_number_type, host_identifier_type, cipher_suite_list_type, elliptic_curve_list_type, identity_store::key_type, simple_handler_type);
+			void do_send_signed_session_request(const ep_type&, session_number_type, cipher_suite_list_type, elliptic_curve_list_type, identity_store::key_type, socket_memory_pool::shared_buffer_type, size_t, simple_handler_type);
 			void do_close_session(const ep_type&, simple_handler_type);
 			void do_handle_session_request(socket_memory_pool::shared_buffer_type, const identity_store&, const ep_type&, const session_request_message&);
+			void do_verify_session_request(socket_memory_pool::shared_buffer_type, const identity_store&, const ep_type&, const session_request_message&, cert_type);
 			void do_handle_verified_session_request(const identity_store&, const ep_type&, const session_request_message&);
+			void do_prepare_session(const identity_store&, const ep_type&, uint64_t, session_number_type, cipher_suite_type, elliptic_curve_type);
+			void do_handle_prepared_session(const identity_store&, const ep_type&, uint64_t, peer_session::next_session_ptr);
 
 			std::set<ep_type> get_session_endpoints() const;
 			bool has_session_with_endpoint(const ep_type&);
 			void do_get_session_endpoints(endpoints_handler_type);
 			void do_has_session_with_endpoint(const ep_type&, boolean_handler_type);
+			void do_get_replay_statistics(const ep_type&, replay_statistics_handler_type);
 			void do_set_accept_session_request_messages_default(bool, void_handler_type);
 			void do_set_cipher_suites(cipher_suite_list_type, void_handler_type);
 			void do_set_elliptic_curves(elliptic_curve_list_type, void_handler_type);
+			void do_set_replay_window_size(size_t, void_handler_type);
 			void do_set_session_request_message_received_callback(session_request_received_handler_type, void_handler_type);
+			void publish_current_session(const ep_type&, const peer_session&);
 
-			// This strand is common to session requests, session messages and data messages.
+			// This strand is common to session requests, session messages and the bookkeeping of the peer sessions. Data messages are encrypted and decrypted outside of it.
 			boost::asio::strand m_session_strand;
 
 			peer_session_map_type m_peer_sessions;
 
+			// Must only be accessed through boost::atomic_load() and boost::atomic_store(). A new table is published from the session strand whenever a current session changes.
+			session_table_ptr_type m_session_table;
+
 			bool m_accept_session_request_messages_default;
 			cipher_suite_list_type m_cipher_suites;
 			elliptic_curve_list_type m_elliptic_curves;
+			size_t m_replay_window_size;
 			session_request_received_handler_type m_session_request_message_received_handler;
 
+		private: // Handshake cryptography
+
+			bool post_handshake_task(worker_pool::task_type, worker_pool::error_handler_type);
+			worker_pool::error_handler_type make_handshake_error_handler(const ep_type&, boost::optional<uint64_t> = boost::none);
+			void do_handle_handshake_error(const ep_type&, boost::optional<uint64_t>, std::exception_ptr);
+
+			size_t m_handshake_thread_count;
+			size_t m_handshake_queue_size;
+
+			// Created when the server is opened. It is declared after the session strand, so that its threads are joined before the strand they post to is destroyed.
+			boost::scoped_ptr<worker_pool> m_handshake_pool;
+
 		private: // SESSION messages
 
 			void do_send_session(const identity_store&, const ep_type&, const peer_session::session_parameters&);
+			void do_sign_session(const ep_type&, peer_session::session_parameters, host_identifier_type, identity_store::key_type);
+			void do_send_signed_session(const ep_type&, peer_session::session_parameters, identity_store::key_type, socket_memory_pool::shared_buffer_type, size_t);
 			void do_handle_session(socket_memory_pool::shared_buffer_type, const identity_store&, const ep_type&, const session_message&);
+			void do_verify_session(socket_memory_pool::shared_buffer_type, const identity_store&, const ep_type&, const session_message&, cert_type);
 			void do_handle_verified_session(const identity_store&, const ep_type&, const session_message&);
+			void do_handle_completed_session(const identity_store&, const ep_type&, uint64_t, peer_session::next_session_ptr, peer_session::current_session_ptr, std::exception_ptr);
 
 			void do_set_accept_session_messages_default(bool, void_handler_type);
 			void do_set_session_message_received_callback(session_received_handler_type, void_handler_type);
@@ -1474,10 +1760,11 @@ namespace fscp
 
 		private: // DATA messages
 
-			void do_send_data(const ep_type&, channel_number_type, boost::asio::const_buffer, simple_handler_type);
-			void do_send_data_to_list(const std::set<ep_type>&, channel_number_type, boost::asio::const_buffer, multiple_endpoints_handler_type);
-			void do_send_data_to_all(channel_number_type, boost::asio::const_buffer, multiple_endpoints_handler_type);
-			void do_send_data_to_session(peer_session&, const ep_type&, channel_number_type, boost::asio::const_buffer, simple_handler_type);
+			void send_data(const ep_type&, channel_number_type, boost::asio::const_buffer, simple_handler_type);
+			void send_data_to_list(const std::set<ep_type>&, channel_number_type, boost::asio::const_buffer, multiple_endpoints_handler_type);
+			void send_data_to_all(channel_number_type, boost::asio::const_buffer, multiple_endpoints_handler_type);
+			void send_data_to_session(peer_session::current_session_type&, const ep_type&, channel_number_type, boost::asio::const_buffer, simple_handler_type);
+			void send_data_in_place(const ep_type&, channel_number_type, boost::asio::mutable_buffer, size_t, simple_handler_type);
 			void do_send_contact_request(const ep_type&, const hash_list_type&, simple_handler_type);
 			void do_send_contact_request_to_list(const std::set<ep_type>&, const hash_list_type&, multiple_endpoints_handler_type);
 			void do_send_contact_request_to_all(const hash_list_type&, multiple_endpoints_handler_type);
@@ -1487,7 +1774,8 @@ namespace fscp
 			void do_send_contact_to_all(const contact_map_type&, multiple_endpoints_handler_type);
 			void do_send_contact_to_session(peer_session&, const ep_type&, const contact_map_type&, simple_handler_type);
 			void handle_data_message_from(const identity_store&, socket_memory_pool::shared_buffer_type, const data_message&, const ep_type&);
-			void do_handle_data(const identity_store&, const ep_type&, const data_message&);
+			void handle_data_from(size_t, const identity_store&, const ep_type&, const data_message&);
+			void do_renew_session(const identity_store&, const ep_type&, peer_session::current_session_ptr);
 			void do_handle_data_message(const ep_type&, message_type, shared_buffer_type, boost::asio::const_buffer);
 			void do_handle_contact_request(const ep_type&, const std::set<hash_type>&);
 			void do_handle_contact(const ep_type&, const contact_map_type&);
@@ -1505,10 +1793,11 @@ namespace fscp
 
 		private: // Keep-alive
 
-			void do_check_keep_alive(const boost::system::error_code&);
+			void schedule_keep_alive(const ep_type&, peer_session&);
+			void do_check_keep_alive(const ep_type&, const boost::system::error_code&);
 			void do_send_keep_alive(const ep_type&, simple_handler_type);
 
-			boost::asio::deadline_timer m_keep_alive_timer;
+			size_t m_keep_alive_next_slot;
 
 		private: // Misc
 
@@ -73,7 +73,8 @@ namespace fscp
 			no_presentation_for_host,
 			session_already_exist,
 			no_session_for_host,
-			cryptographic_error
+			cryptographic_error,
+			handshake_queue_full
 		};
 
 		/**
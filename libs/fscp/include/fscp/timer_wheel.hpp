@@ -0,0 +1,202 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file timer_wheel.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A hierarchical timer wheel class.
+ */
+
+#ifndef FSCP_TIMER_WHEEL_HPP
+#define FSCP_TIMER_WHEEL_HPP
+
+#include <boost/noncopyable.hpp>
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/function.hpp>
+#include <boost/optional.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <cstddef>
+#include <list>
+#include <vector>
+
+#include <stdint.h>
+
+namespace fscp
+{
+	/**
+	 * @brief A hierarchical timer wheel.
+	 *
+	 * It multiplexes any count of timers on a single asio timer. Scheduling and cancelling a timer are O(1) operations, at the cost of a resolution that is limited to the tick duration.
+	 *
+	 * The wheel has LEVEL_COUNT levels of SLOT_COUNT slots each: a slot of the first level spans one tick and a slot of any other level spans a whole revolution of the level below it. Timers are moved down one level each time the level below completes a revolution.
+	 */
+	class timer_wheel : public boost::noncopyable
+	{
+		public:
+
+			/**
+			 * @brief The timer identifier type.
+			 */
+			typedef uint64_t timer_id_type;
+
+			/**
+			 * @brief The wait handler type.
+			 *
+			 * The handler is called with a null error code when the timer expires or with boost::asio::error::operation_aborted when it is cancelled. It is never called from within async_wait(), cancel() or cancel_all().
+			 */
+			typedef boost::function<void (const boost::system::error_code&)> handler_type;
+
+			/**
+			 * @brief The count of levels.
+			 */
+			static const size_t LEVEL_COUNT = 4;
+
+			/**
+			 * @brief The count of bits of a slot index.
+			 */
+			static const size_t SLOT_BITS = 6;
+
+			/**
+			 * @brief The count of slots per level.
+			 */
+			static const size_t SLOT_COUNT = static_cast<size_t>(1) << SLOT_BITS;
+
+			/**
+			 * @brief Create a timer wheel.
+			 * @param io_service The io_service to use.
+			 * @param tick The tick duration. Must be positive.
+			 */
+			timer_wheel(boost::asio::io_service& io_service, const boost::posix_time::time_duration& tick);
+
+			/**
+			 * @brief Destroy the timer wheel.
+			 *
+			 * The pending handlers are dropped without being called.
+			 */
+			~timer_wheel();
+
+			/**
+			 * @brief Get the tick duration.
+			 * @return The tick duration.
+			 */
+			const boost::posix_time::time_duration& tick() const
+			{
+				return m_tick;
+			}
+
+			/**
+			 * @brief Start a timer.
+			 * @param timeout The time to wait. It is rounded up to the next tick.
+			 * @param handler The handler to call upon expiration or cancellation.
+			 * @return The timer identifier, to be given to cancel().
+			 *
+			 * This method is thread-safe.
+			 */
+			timer_id_type async_wait(const boost::posix_time::time_duration& timeout, handler_type handler);
+
+			/**
+			 * @brief Cancel a timer.
+			 * @param timer_id The timer identifier.
+			 * @return true if the timer was cancelled, false if it already expired or was cancelled.
+			 *
+			 * This method is thread-safe.
+			 */
+			bool cancel(timer_id_type timer_id);
+
+			/**
+			 * @brief Cancel all the timers.
+			 * @return The count of timers that were cancelled.
+			 *
+			 * This method is thread-safe.
+			 */
+			size_t cancel_all();
+
+			/**
+			 * @brief Get the count of pending timers.
+			 * @return The count of pending timers.
+			 *
+			 * This method is thread-safe.
+			 */
+			size_t size() const;
+
+		private:
+
+			struct entry_type
+			{
+				entry_type(timer_id_type _id, uint64_t _expiration, handler_type _handler) :
+					id(_id),
+					expiration(_expiration),
+					handler(_handler),
+					slot(0)
+				{}
+
+				timer_id_type id;
+				uint64_t expiration;
+				handler_type handler;
+				size_t slot;
+			};
+
+			typedef std::list<entry_type> slot_type;
+			typedef boost::unordered_map<timer_id_type, slot_type::iterator> entry_map_type;
+
+			uint64_t current_tick() const;
+			slot_type& slot_for(uint64_t expiration, size_t& slot);
+			void insert(slot_type& from, slot_type::iterator entry);
+			void advance(slot_type& expired);
+			void arm(uint64_t tick);
+			void arm_next();
+			void handle_timeout(const boost::system::error_code& ec);
+
+			boost::asio::io_service& m_io_service;
+			const boost::posix_time::time_duration m_tick;
+			const boost::posix_time::ptime m_origin;
+			boost::asio::deadline_timer m_timer;
+
+			mutable boost::mutex m_mutex;
+			std::vector<slot_type> m_slots;
+			entry_map_type m_entries;
+			timer_id_type m_next_id;
+			uint64_t m_tick_count;
+			boost::optional<uint64_t> m_armed_tick;
+	};
+}
+
+#endif /* FSCP_TIMER_WHEEL_HPP */
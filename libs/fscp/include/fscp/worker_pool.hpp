@@ -0,0 +1,195 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file worker_pool.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A bounded worker thread pool class.
+ */
+
+#ifndef FSCP_WORKER_POOL_HPP
+#define FSCP_WORKER_POOL_HPP
+
+#include <boost/noncopyable.hpp>
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+
+#include <stdint.h>
+
+namespace fscp
+{
+	/**
+	 * @brief The worker pool statistics.
+	 */
+	struct worker_pool_statistics_type
+	{
+		worker_pool_statistics_type() :
+			queue_depth(0),
+			peak_queue_depth(0),
+			completed(0),
+			failed(0),
+			rejected(0)
+		{}
+
+		/**
+		 * @brief The count of tasks that are queued or running.
+		 */
+		size_t queue_depth;
+
+		/**
+		 * @brief The highest queue depth ever reached.
+		 */
+		size_t peak_queue_depth;
+
+		/**
+		 * @brief The count of tasks that were run.
+		 */
+		uint64_t completed;
+
+		/**
+		 * @brief The count of tasks that threw an exception. They are also counted in completed.
+		 */
+		uint64_t failed;
+
+		/**
+		 * @brief The count of tasks that were rejected because the queue was full.
+		 */
+		uint64_t rejected;
+	};
+
+	/**
+	 * @brief A pool of worker threads with a bounded queue.
+	 *
+	 * It is meant to run CPU-bound tasks (like cryptographic handshakes) away from the threads that run the I/O handlers. Tasks that would make the queue exceed its maximum depth are rejected rather than delayed.
+	 */
+	class worker_pool : public boost::noncopyable
+	{
+		public:
+
+			/**
+			 * @brief The task type.
+			 */
+			typedef boost::function<void ()> task_type;
+
+			/**
+			 * @brief The error handler type.
+			 *
+			 * It is called from the worker thread, with the exception thrown by a task.
+			 */
+			typedef boost::function<void (std::exception_ptr)> error_handler_type;
+
+			/**
+			 * @brief Get the count of worker threads to start.
+			 * @param thread_count The requested count of worker threads. If 0, one thread per hardware thread.
+			 * @return The count of worker threads to start, which is at least 1.
+			 */
+			static size_t get_thread_count(size_t thread_count);
+
+			/**
+			 * @brief Create a worker pool.
+			 * @param thread_count The count of worker threads. If 0, one thread per hardware thread (as reported by boost::thread::hardware_concurrency()) is started.
+			 * @param max_queue_depth The maximum count of tasks that can be queued or running at once. Must be at least 1.
+			 */
+			worker_pool(size_t thread_count, size_t max_queue_depth);
+
+			/**
+			 * @brief Destroy the worker pool.
+			 *
+			 * The queued tasks are run before the threads are joined.
+			 */
+			~worker_pool();
+
+			/**
+			 * @brief Get the count of worker threads.
+			 * @return The count of worker threads.
+			 */
+			size_t thread_count() const
+			{
+				return m_threads.size();
+			}
+
+			/**
+			 * @brief Get the maximum queue depth.
+			 * @return The maximum queue depth.
+			 */
+			size_t max_queue_depth() const
+			{
+				return m_max_queue_depth;
+			}
+
+			/**
+			 * @brief Queue a task.
+			 * @param task The task.
+			 * @param error_handler The handler to call if the task throws. A task that throws is otherwise only counted in the statistics: tasks that leave some state pending until they complete must give one, so that the state can be cleared.
+			 * @return true if the task was queued, false if the queue was full.
+			 *
+			 * This method is thread-safe.
+			 */
+			bool post(task_type task, error_handler_type error_handler = error_handler_type());
+
+			/**
+			 * @brief Get the statistics.
+			 * @return The statistics.
+			 *
+			 * This method is thread-safe.
+			 */
+			worker_pool_statistics_type statistics() const;
+
+		private:
+
+			void run_task(task_type task, error_handler_type error_handler);
+
+			const size_t m_max_queue_depth;
+			boost::asio::io_service m_io_service;
+			boost::scoped_ptr<boost::asio::io_service::work> m_work;
+			boost::thread_group m_threads;
+			std::atomic<size_t> m_queue_depth;
+			std::atomic<size_t> m_peak_queue_depth;
+			std::atomic<uint64_t> m_completed;
+			std::atomic<uint64_t> m_failed;
+			std::atomic<uint64_t> m_rejected;
+	};
+}
+
+#endif /* FSCP_WORKER_POOL_HPP */
@@ -0,0 +1,251 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file buffer_pool.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A lock-free packet buffer pool class.
+ */
+
+#include "buffer_pool.hpp"
+
+#include <boost/lockfree/stack.hpp>
+#include <boost/make_shared.hpp>
+
+#include <vector>
+#include <cassert>
+
+namespace fscp
+{
+	class buffer_pool::shared_state : public boost::noncopyable
+	{
+		public:
+
+			shared_state(size_t _block_size, size_t _block_count) :
+				m_block_size(_block_size),
+				m_block_count(_block_count),
+				m_pool(_block_size * _block_count),
+				m_available_blocks(_block_count)
+			{
+				for (size_t block = 0; block < m_block_count; ++block)
+				{
+					push(&m_pool[0] + block * m_block_size);
+				}
+			}
+
+			size_t block_size() const
+			{
+				return m_block_size;
+			}
+
+			size_t block_count() const
+			{
+				return m_block_count;
+			}
+
+			bool is_pool_block(const uint8_t* buffer) const
+			{
+				return !m_pool.empty() && (buffer >= &m_pool[0]) && (buffer < &m_pool[0] + m_pool.size());
+			}
+
+			uint8_t* pop()
+			{
+				uint8_t* buffer = NULL;
+
+				return m_available_blocks.pop(buffer) ? buffer : NULL;
+			}
+
+			void push(uint8_t* buffer)
+			{
+				assert(is_pool_block(buffer));
+				assert(&m_pool[0] + (std::distance(&m_pool[0], buffer) / m_block_size) * m_block_size == buffer);
+
+				// The stack can hold all the blocks so this can't fail.
+				const bool pushed = m_available_blocks.bounded_push(buffer);
+
+				assert(pushed);
+				static_cast<void>(pushed);
+			}
+
+		private:
+
+			const size_t m_block_size;
+			const size_t m_block_count;
+			std::vector<uint8_t> m_pool;
+			boost::lockfree::stack<uint8_t*, boost::lockfree::fixed_sized<true> > m_available_blocks;
+	};
+
+	class buffer_pool::thread_cache : public boost::noncopyable
+	{
+		public:
+
+			explicit thread_cache(boost::shared_ptr<shared_state> state) :
+				m_shared_state(state)
+			{
+				m_blocks.reserve(2 * thread_cache_batch_size);
+			}
+
+			const boost::shared_ptr<shared_state>& state() const
+			{
+				return m_shared_state;
+			}
+
+			~thread_cache()
+			{
+				// The thread may exit after the pool was destroyed: the shared state is kept alive until then.
+				for (uint8_t* buffer : m_blocks)
+				{
+					m_shared_state->push(buffer);
+				}
+			}
+
+			uint8_t* pop()
+			{
+				if (m_blocks.empty())
+				{
+					for (size_t i = 0; i < thread_cache_batch_size; ++i)
+					{
+						uint8_t* const buffer = m_shared_state->pop();
+
+						if (!buffer)
+						{
+							break;
+						}
+
+						m_blocks.push_back(buffer);
+					}
+
+					if (m_blocks.empty())
+					{
+						return NULL;
+					}
+				}
+
+				uint8_t* const buffer = m_blocks.back();
+				m_blocks.pop_back();
+
+				return buffer;
+			}
+
+			void push(uint8_t* buffer)
+			{
+				// Blocks tend to be allocated by one thread and released by another: don't let them pile up here.
+				if (m_blocks.size() >= 2 * thread_cache_batch_size)
+				{
+					for (size_t i = 0; i < thread_cache_batch_size; ++i)
+					{
+						m_shared_state->push(m_blocks.back());
+						m_blocks.pop_back();
+					}
+				}
+
+				m_blocks.push_back(buffer);
+			}
+
+		private:
+
+			boost::shared_ptr<shared_state> m_shared_state;
+			std::vector<uint8_t*> m_blocks;
+	};
+
+	buffer_pool::buffer_pool(size_t _block_size, size_t _block_count) :
+		m_shared_state(boost::make_shared<shared_state>(_block_size, _block_count)),
+		m_thread_cache()
+	{
+		assert(_block_size > 0);
+	}
+
+	buffer_pool::~buffer_pool()
+	{
+	}
+
+	size_t buffer_pool::block_size() const
+	{
+		return m_shared_state->block_size();
+	}
+
+	size_t buffer_pool::block_count() const
+	{
+		return m_shared_state->block_count();
+	}
+
+	bool buffer_pool::is_pool_block(const uint8_t* buffer) const
+	{
+		return m_shared_state->is_pool_block(buffer);
+	}
+
+	uint8_t* buffer_pool::allocate()
+	{
+		uint8_t* const buffer = get_thread_cache().pop();
+
+		if (buffer)
+		{
+			return buffer;
+		}
+
+		// There is no more room for this allocation: we fall back to the heap.
+		return new uint8_t[block_size()];
+	}
+
+	void buffer_pool::deallocate(uint8_t* buffer)
+	{
+		if (m_shared_state->is_pool_block(buffer))
+		{
+			get_thread_cache().push(buffer);
+		}
+		else
+		{
+			// The buffer was heap allocated.
+			delete[] buffer;
+		}
+	}
+
+	buffer_pool::thread_cache& buffer_pool::get_thread_cache()
+	{
+		thread_cache* cache = m_thread_cache.get();
+
+		// The thread specific data is keyed by the address of m_thread_cache: a cache may be left over from a destroyed pool that lived at the same address.
+		if (!cache || (cache->state() != m_shared_state))
+		{
+			cache = new thread_cache(m_shared_state);
+			m_thread_cache.reset(cache);
+		}
+
+		return *cache;
+	}
+}
@@ -46,27 +46,39 @@
 
 #include <cryptoplus/cipher/cipher_context.hpp>
 #include <cryptoplus/hash/hmac.hpp>
-#include <cryptoplus/random/random.hpp>
 
 #include <boost/iterator/transform_iterator.hpp>
+#include <boost/array.hpp>
 
 #include <cassert>
+#include <cstring>
 #include <stdexcept>
 
 namespace fscp
 {
 	namespace
 	{
-		typedef std::vector<uint8_t> iv_type;
+		// The IV is computed for every message so we keep it on the stack.
+		typedef boost::array<uint8_t, EVP_MAX_IV_LENGTH> iv_type;
 
-		iv_type compute_iv(const void* nonce_prefix, size_t nonce_prefix_len, sequence_number_type sequence_number)
+		size_t get_iv_length(size_t nonce_prefix_len)
 		{
-			iv_type result(nonce_prefix_len + sizeof(sequence_number_type));
+			const size_t iv_len = nonce_prefix_len + sizeof(sequence_number_type);
 
-			std::copy(static_cast<const uint8_t*>(nonce_prefix), static_cast<const uint8_t*>(nonce_prefix) + nonce_prefix_len, result.begin());
-			buffer_tools::set<sequence_number_type>(result.data(), nonce_prefix_len, htonl(sequence_number));
+			if (iv_len > iv_type::static_size)
+			{
+				throw std::runtime_error("nonce_prefix_len");
+			}
 
-			return result;
+			return iv_len;
+		}
+
+		void compute_iv(iv_type& iv, const void* nonce_prefix, size_t nonce_prefix_len, sequence_number_type sequence_number)
+		{
+			const size_t iv_len = get_iv_length(nonce_prefix_len);
+
+			std::copy(static_cast<const uint8_t*>(nonce_prefix), static_cast<const uint8_t*>(nonce_prefix) + nonce_prefix_len, iv.begin());
+			buffer_tools::set<sequence_number_type>(iv.data(), iv_len - sizeof(sequence_number_type), htonl(sequence_number));
 		}
 
 		const hash_type::data_type& hash_to_data(const hash_type& hash)
@@ -77,29 +89,81 @@ namespace fscp
 
 	using boost::make_transform_iterator;
 
-	size_t data_message::write(void* buf, size_t buf_len, channel_number_type channel_number, sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, const void* _cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	void data_message::initialize_cipher_context(cryptoplus::cipher::cipher_context& cipher_context, cryptoplus::cipher::cipher_context::cipher_direction direction, data_message::calg_t cipher_algorithm, const void* enc_key, size_t enc_key_len, size_t nonce_prefix_len)
 	{
-		return raw_write(buf, buf_len, _sequence_number, cipher_algorithm, _cleartext, cleartext_len, enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, to_data_message_type(channel_number));
+		assert(enc_key);
+
+		// First initialization - required to set GCM specific attributes
+		cipher_context.initialize(cipher_algorithm, direction, NULL, 0, NULL);
+		cipher_context.ctrl_set(EVP_CTRL_GCM_SET_IVLEN, static_cast<int>(get_iv_length(nonce_prefix_len)));
+
+		// The key is set once: the IV will be set for every message.
+		cipher_context.initialize(data_message::calg_t(), cryptoplus::cipher::cipher_context::unchanged, enc_key, enc_key_len, NULL);
 	}
 
-	size_t data_message::write_keep_alive(void* buf, size_t buf_len, sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, size_t random_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	size_t data_message::write(void* buf, size_t buf_len, channel_number_type channel_number, sequence_number_type _sequence_number, cryptoplus::cipher::cipher_context& cipher_context, const void* _cleartext, size_t cleartext_len, const void* nonce_prefix, size_t nonce_prefix_len)
 	{
-		const cryptoplus::buffer random = cryptoplus::random::get_random_bytes(random_len);
+		return raw_write(buf, buf_len, _sequence_number, cipher_context, _cleartext, cleartext_len, nonce_prefix, nonce_prefix_len, to_data_message_type(channel_number));
+	}
 
-		return raw_write(buf, buf_len, _sequence_number, cipher_algorithm, cryptoplus::buffer_cast<const uint8_t*>(random), cryptoplus::buffer_size(random), enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_KEEP_ALIVE);
+	size_t data_message::write_in_place(void* buf, size_t buf_len, channel_number_type channel_number, sequence_number_type _sequence_number, cryptoplus::cipher::cipher_context& cipher_context, size_t cleartext_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	{
+		if (buf_len < CLEARTEXT_OFFSET)
+		{
+			throw std::runtime_error("buf_len");
+		}
+
+		return raw_write(buf, buf_len, _sequence_number, cipher_context, static_cast<const uint8_t*>(buf) + CLEARTEXT_OFFSET, cleartext_len, nonce_prefix, nonce_prefix_len, to_data_message_type(channel_number));
+	}
+
+	size_t data_message::write_keep_alive(void* buf, size_t buf_len, sequence_number_type _sequence_number, cryptoplus::cipher::cipher_context& cipher_context, size_t padding_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	{
+		if (buf_len < CLEARTEXT_OFFSET + padding_len)
+		{
+			throw std::runtime_error("buf_len");
+		}
+
+		// The padding is encrypted and authenticated like any other payload: its content needn't be random.
+		uint8_t* const padding = static_cast<uint8_t*>(buf) + CLEARTEXT_OFFSET;
+		std::memset(padding, 0x00, padding_len);
+
+		return raw_write(buf, buf_len, _sequence_number, cipher_context, padding, padding_len, nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_KEEP_ALIVE);
 	}
 
-	size_t data_message::write_contact_request(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const hash_list_type& hash_list, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	size_t data_message::write_contact_request(void* buf, size_t buf_len, sequence_number_type sequence_number, cryptoplus::cipher::cipher_context& cipher_context, const hash_list_type& hash_list, const void* nonce_prefix, size_t nonce_prefix_len)
 	{
 		const std::vector<hash_type::data_type> hash_vec(make_transform_iterator(hash_list.begin(), hash_to_data), make_transform_iterator(hash_list.end(), hash_to_data));
 
-		return raw_write(buf, buf_len, sequence_number, cipher_algorithm, reinterpret_cast<const char*>(&hash_vec[0]), hash_vec.size() * hash_type::data_type::static_size, enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_CONTACT_REQUEST);
+		return raw_write(buf, buf_len, sequence_number, cipher_context, reinterpret_cast<const char*>(&hash_vec[0]), hash_vec.size() * hash_type::data_type::static_size, nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_CONTACT_REQUEST);
+	}
+
+	size_t data_message::contact_size(const contact_map_type::value_type& contact)
+	{
+		const boost::asio::ip::address& address = contact.second.address();
+
+		if (address.is_v4())
+		{
+			return hash_type::data_type::static_size + 1 + sizeof(boost::asio::ip::address_v4::bytes_type) + sizeof(uint16_t);
+		}
+		else if (address.is_v6())
+		{
+			return hash_type::data_type::static_size + 1 + sizeof(boost::asio::ip::address_v6::bytes_type) + sizeof(uint16_t);
+		}
+
+		return 0;
 	}
 
-	size_t data_message::write_contact(void* buf, size_t buf_len, sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, const contact_map_type& contact_map, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	size_t data_message::write_contact(void* buf, size_t buf_len, sequence_number_type _sequence_number, cryptoplus::cipher::cipher_context& cipher_context, const contact_map_type& contact_map, const void* nonce_prefix, size_t nonce_prefix_len)
 	{
+		size_t cleartext_len = 0;
+
+		for (contact_map_type::const_iterator it = contact_map.begin(); it != contact_map.end(); ++it)
+		{
+			cleartext_len += contact_size(*it);
+		}
+
 		std::vector<uint8_t> cleartext;
-		cleartext.resize(contact_map.size() * 49);
+		cleartext.resize(cleartext_len);
 
 		std::vector<uint8_t>::iterator ptr = cleartext.begin();
 
@@ -136,7 +200,7 @@ namespace fscp
 
 		cleartext.resize(std::distance(cleartext.begin(), ptr));
 
-		return raw_write(buf, buf_len, _sequence_number, cipher_algorithm, &cleartext[0], cleartext.size(), enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_CONTACT);
+		return raw_write(buf, buf_len, _sequence_number, cipher_context, &cleartext[0], cleartext.size(), nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_CONTACT);
 	}
 
 	hash_list_type data_message::parse_hash_list(const void* buf, size_t buflen)
@@ -258,23 +322,17 @@ namespace fscp
 		}
 	}
 
-	size_t data_message::get_cleartext(void* buf, size_t buf_len, data_message::calg_t cipher_algorithm, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len) const
+	size_t data_message::get_cleartext(void* buf, size_t buf_len, cryptoplus::cipher::cipher_context& cipher_context, const void* nonce_prefix, size_t nonce_prefix_len) const
 	{
-		assert(enc_key);
-
 		if (buf)
 		{
-			const iv_type iv = compute_iv(nonce_prefix, nonce_prefix_len, sequence_number());
-
-			cryptoplus::cipher::cipher_context cipher_context;
+			iv_type iv;
+			compute_iv(iv, nonce_prefix, nonce_prefix_len, sequence_number());
 
-			// First initialization - required to set GCM specific attributes
-			cipher_context.initialize(cipher_algorithm, cryptoplus::cipher::cipher_context::decrypt, NULL, 0, NULL);
-			cipher_context.ctrl_set(EVP_CTRL_GCM_SET_IVLEN, static_cast<int>(iv.size()));
+			// The cipher context is already keyed: we only set the IV and the expected tag.
+			cipher_context.initialize(data_message::calg_t(), cryptoplus::cipher::cipher_context::unchanged, NULL, 0, iv.data());
 			cipher_context.ctrl(EVP_CTRL_GCM_SET_TAG, static_cast<int>(tag_size()), const_cast<uint8_t*>(tag()));
 
-			cipher_context.initialize(data_message::calg_t(), cryptoplus::cipher::cipher_context::unchanged, enc_key, enc_key_len, iv.data());
-
 			size_t cnt = cipher_context.update(buf, buf_len, ciphertext(), ciphertext_size());
 
 			cnt += cipher_context.finalize(static_cast<uint8_t*>(buf) + cnt, buf_len - cnt);
@@ -287,36 +345,33 @@ namespace fscp
 		}
 	}
 
-	size_t data_message::raw_write(void* buf, size_t buf_len, sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, const void* _cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len, message_type type)
+	size_t data_message::raw_write(void* buf, size_t buf_len, sequence_number_type _sequence_number, cryptoplus::cipher::cipher_context& cipher_context, const void* _cleartext, size_t cleartext_len, const void* nonce_prefix, size_t nonce_prefix_len, message_type type)
 	{
-		assert(enc_key);
-
-		const iv_type iv = compute_iv(nonce_prefix, nonce_prefix_len, _sequence_number);
+		const size_t block_size = cipher_context.algorithm().block_size();
 
-		if (buf_len < HEADER_LENGTH + sizeof(sequence_number_type) + GCM_TAG_LENGTH + sizeof(uint16_t) + (cleartext_len + cipher_algorithm.block_size()))
+		if (buf_len < HEADER_LENGTH + sizeof(sequence_number_type) + GCM_TAG_LENGTH + sizeof(uint16_t) + (cleartext_len + block_size))
 		{
 			throw std::runtime_error("buf_len");
 		}
 
+		iv_type iv;
+		compute_iv(iv, nonce_prefix, nonce_prefix_len, _sequence_number);
+
 		uint8_t* const payload = static_cast<uint8_t*>(buf) + HEADER_LENGTH;
 		uint8_t* const tag = payload + sizeof(sequence_number_type);
 		uint8_t* const ciphertext = tag + GCM_TAG_LENGTH + sizeof(uint16_t);
 
-		buffer_tools::set<sequence_number_type>(payload, 0, htonl(_sequence_number));
-
-		cryptoplus::cipher::cipher_context cipher_context;
+		// GCM is a stream mode: the cleartext may either be elsewhere or exactly at the ciphertext location, but must not partially overlap it.
+		assert((_cleartext == ciphertext) || (static_cast<const uint8_t*>(_cleartext) + cleartext_len <= ciphertext) || (_cleartext >= ciphertext + cleartext_len));
 
-		// First initialization - required to set GCM specific attributes
-		cipher_context.initialize(cipher_algorithm, cryptoplus::cipher::cipher_context::encrypt, NULL, 0, NULL);
-		cipher_context.ctrl_set(EVP_CTRL_GCM_SET_IVLEN, static_cast<int>(iv.size()));
-
-		cipher_context.initialize(data_message::calg_t(), cryptoplus::cipher::cipher_context::unchanged, enc_key, enc_key_len, iv.data());
+		buffer_tools::set<sequence_number_type>(payload, 0, htonl(_sequence_number));
 
-		const size_t max_ciphertext_len = buf_len - HEADER_LENGTH - sizeof(sequence_number_type) - GCM_TAG_LENGTH - sizeof(uint16_t) - cipher_algorithm.block_size();
+		// The cipher context is already keyed: we only set the IV.
+		cipher_context.initialize(data_message::calg_t(), cryptoplus::cipher::cipher_context::unchanged, NULL, 0, iv.data());
 
-		const cryptoplus::buffer cleartext(_cleartext, cleartext_len);
+		const size_t max_ciphertext_len = buf_len - HEADER_LENGTH - sizeof(sequence_number_type) - GCM_TAG_LENGTH - sizeof(uint16_t) - block_size;
 
-		size_t ciphertext_len = cipher_context.update(ciphertext, max_ciphertext_len, cleartext);
+		size_t ciphertext_len = cipher_context.update(ciphertext, max_ciphertext_len, _cleartext, cleartext_len);
 		ciphertext_len += cipher_context.finalize(ciphertext + ciphertext_len, max_ciphertext_len - ciphertext_len);
 
 		cipher_context.ctrl(EVP_CTRL_GCM_GET_TAG, GCM_TAG_LENGTH, tag);
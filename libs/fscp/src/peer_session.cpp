@@ -44,78 +44,122 @@
 
 #include "peer_session.hpp"
 
+#include "data_message.hpp"
+
 #include <cryptoplus/tls/tls.hpp>
 
+#include <algorithm>
+
 namespace fscp
 {
+	const size_t peer_session::current_session_type::NO_SOCKET_INDEX;
+
 	bool peer_session::current_session_type::is_old() const
 	{
 		const auto max = std::numeric_limits<sequence_number_type>::max() / 2;
-		return ((local_sequence_number > max) || (remote_sequence_number > max));
+		return ((local_sequence_number.load() > max) || (remote_replay_window.highest() > max));
 	}
 
-	bool peer_session::set_first_remote_host_identifier(const host_identifier_type& _host_identifier)
+	bool peer_session::current_session_type::check_remote_sequence_number(sequence_number_type sequence_number)
 	{
-		if (!m_remote_host_identifier)
+		switch (remote_replay_window.check(sequence_number))
 		{
-			m_remote_host_identifier = _host_identifier;
+			case replay_window::accepted:
+				return true;
+			case replay_window::replayed:
+				++replay_statistics.replayed;
+				return false;
+			case replay_window::outdated:
+				++replay_statistics.outdated;
+				return false;
+		}
+
+		assert(false);
+		return false;
+	}
 
+	bool peer_session::current_session_type::set_remote_sequence_number(sequence_number_type sequence_number)
+	{
+		if (remote_replay_window.update(sequence_number))
+		{
 			return true;
 		}
 
-		return (_host_identifier == *m_remote_host_identifier);
+		++replay_statistics.reordered;
+
+		return false;
 	}
 
-	bool peer_session::prepare_session(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve)
+	bool peer_session::has_timed_out(const boost::posix_time::time_duration& timeout) const
+	{
+		boost::posix_time::ptime last_sign_of_life = m_last_sign_of_life;
+
+		if (m_current_session)
+		{
+			boost::mutex::scoped_lock lock(m_current_session->remote_mutex);
+
+			last_sign_of_life = std::max(last_sign_of_life, m_current_session->last_sign_of_life);
+		}
+
+		return (boost::posix_time::microsec_clock::local_time() > last_sign_of_life + timeout);
+	}
+
+	boost::optional<size_t> peer_session::socket_index() const
 	{
-		if (m_next_session)
+		if (m_current_session)
 		{
-			if ((m_next_session->parameters.session_number == _session_number) && (m_next_session->parameters.cipher_suite == _cipher_suite) && (m_next_session->parameters.elliptic_curve == _elliptic_curve))
+			const size_t index = m_current_session->socket_index;
+
+			if (index != current_session_type::NO_SOCKET_INDEX)
 			{
-				// The session in preparation matches the requested one: not creating one to ensure the private DH key stays the same.
-				return false;
+				return index;
 			}
 		}
 
-		m_next_session = boost::make_shared<next_session_type>(_session_number, _cipher_suite, _elliptic_curve);
-
-		return true;
+		return m_socket_index;
 	}
 
-	bool peer_session::complete_session(const void* _remote_public_key, size_t remote_public_key_size)
+	bool peer_session::set_first_remote_host_identifier(const host_identifier_type& _host_identifier)
 	{
-		using cryptoplus::buffer_cast;
-
-		if (!m_next_session || !m_remote_host_identifier)
+		if (!m_remote_host_identifier)
 		{
-			return false;
+			m_remote_host_identifier = _host_identifier;
+
+			return true;
 		}
 
-		boost::shared_ptr<current_session_type> _current_session = boost::make_shared<current_session_type>(m_next_session->parameters);
+		return (_host_identifier == *m_remote_host_identifier);
+	}
+
+	peer_session::current_session_ptr peer_session::derive_session(next_session_type& next_session, const host_identifier_type& local_host_identifier, const host_identifier_type& remote_host_identifier, const cryptoplus::buffer& remote_public_key, size_t replay_window_size)
+	{
+		using cryptoplus::buffer_cast;
+
+		const current_session_ptr _current_session = boost::make_shared<current_session_type>(next_session.parameters, replay_window_size);
 
-		const size_t key_length = m_next_session->parameters.cipher_suite.to_cipher_algorithm().key_length();
-		const auto remote_public_key = cryptoplus::buffer(_remote_public_key, remote_public_key_size);
+		const data_message::calg_t cipher_algorithm = next_session.parameters.cipher_suite.to_cipher_algorithm();
+		const size_t key_length = cipher_algorithm.key_length();
 
 		// We get the derived secret key.
-		const auto secret_key = m_next_session->ecdhe_context.derive_secret_key(remote_public_key);
+		const auto secret_key = next_session.ecdhe_context.derive_secret_key(remote_public_key);
 
-		_current_session->local_session_key = cryptoplus::tls::prf(
+		const auto local_session_key = cryptoplus::tls::prf(
 			key_length,
 			buffer_cast<const void*>(secret_key),
 			buffer_size(secret_key),
 			"session key",
-			m_local_host_identifier.data.data(),
-			m_local_host_identifier.data.size(),
+			local_host_identifier.data.data(),
+			local_host_identifier.data.size(),
 			get_default_digest_algorithm()
 		);
 
-		_current_session->remote_session_key = cryptoplus::tls::prf(
+		const auto remote_session_key = cryptoplus::tls::prf(
 			key_length,
 			buffer_cast<const void*>(secret_key),
 			buffer_size(secret_key),
 			"session key",
-			m_remote_host_identifier->data.data(),
-			m_remote_host_identifier->data.size(),
+			remote_host_identifier.data.data(),
+			remote_host_identifier.data.size(),
 			get_default_digest_algorithm()
 		);
 
@@ -124,8 +168,8 @@ namespace fscp
 			buffer_cast<const void*>(secret_key),
 			buffer_size(secret_key),
 			"nonce prefix",
-			m_local_host_identifier.data.data(),
-			m_local_host_identifier.data.size(),
+			local_host_identifier.data.data(),
+			local_host_identifier.data.size(),
 			get_default_digest_algorithm()
 		);
 
@@ -134,13 +178,91 @@ namespace fscp
 			buffer_cast<const void*>(secret_key),
 			buffer_size(secret_key),
 			"nonce prefix",
-			m_remote_host_identifier->data.data(),
-			m_remote_host_identifier->data.size(),
+			remote_host_identifier.data.data(),
+			remote_host_identifier.data.size(),
 			get_default_digest_algorithm()
 		);
 
+		// The cipher contexts are keyed here once and for all: data messages will only set their nonce.
+		data_message::initialize_cipher_context(
+			_current_session->local_cipher_context,
+			cryptoplus::cipher::cipher_context::encrypt,
+			cipher_algorithm,
+			buffer_cast<const void*>(local_session_key),
+			buffer_size(local_session_key),
+			buffer_size(_current_session->local_nonce_prefix)
+		);
+
+		data_message::initialize_cipher_context(
+			_current_session->remote_cipher_context,
+			cryptoplus::cipher::cipher_context::decrypt,
+			cipher_algorithm,
+			buffer_cast<const void*>(remote_session_key),
+			buffer_size(remote_session_key),
+			buffer_size(_current_session->remote_nonce_prefix)
+		);
+
+		return _current_session;
+	}
+
+	bool peer_session::prepare_session(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve)
+	{
+		if (has_next_session(_session_number, _cipher_suite, _elliptic_curve))
+		{
+			// The session in preparation matches the requested one: not creating one to ensure the private DH key stays the same.
+			return false;
+		}
+
+		m_next_session = boost::make_shared<next_session_type>(_session_number, _cipher_suite, _elliptic_curve);
+
+		return true;
+	}
+
+	bool peer_session::prepare_session(const next_session_ptr& next_session)
+	{
+		if (has_next_session(next_session->parameters.session_number, next_session->parameters.cipher_suite, next_session->parameters.elliptic_curve))
+		{
+			// The session in preparation matches the requested one: we keep it to ensure the private DH key stays the same.
+			return false;
+		}
+
+		m_next_session = next_session;
+
+		return true;
+	}
+
+	bool peer_session::has_next_session(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve) const
+	{
+		return (m_next_session && (m_next_session->parameters.session_number == _session_number) && (m_next_session->parameters.cipher_suite == _cipher_suite) && (m_next_session->parameters.elliptic_curve == _elliptic_curve));
+	}
+
+	bool peer_session::complete_session(const void* _remote_public_key, size_t remote_public_key_size, size_t replay_window_size)
+	{
+		if (!m_next_session || !m_remote_host_identifier)
+		{
+			return false;
+		}
+
+		return complete_session(m_next_session, derive_session(*m_next_session, m_local_host_identifier, *m_remote_host_identifier, cryptoplus::buffer(_remote_public_key, remote_public_key_size), replay_window_size));
+	}
+
+	bool peer_session::complete_session(const next_session_ptr& next_session, const current_session_ptr& current_session)
+	{
+		if (m_next_session && (m_next_session != next_session))
+		{
+			return false;
+		}
+
+		retire_current_session();
+
 		m_next_session.reset();
-		swap(m_current_session, _current_session);
+		m_current_session = current_session;
+
+		// The peer keeps sending to the same socket across sessions.
+		if (m_socket_index)
+		{
+			m_current_session->socket_index = *m_socket_index;
+		}
 
 		return true;
 	}
@@ -175,16 +297,63 @@ namespace fscp
 		return m_current_session->parameters;
 	}
 
-	bool peer_session::set_remote_sequence_number(sequence_number_type sequence_number)
+	replay_statistics_type peer_session::replay_statistics() const
 	{
-		if (sequence_number > m_current_session->remote_sequence_number)
+		replay_statistics_type result = m_replay_statistics;
+
+		if (m_current_session)
 		{
-			m_current_session->remote_sequence_number = sequence_number;
+			boost::mutex::scoped_lock lock(m_current_session->remote_mutex);
 
-			return true;
+			result.reordered += m_current_session->replay_statistics.reordered;
+			result.replayed += m_current_session->replay_statistics.replayed;
+			result.outdated += m_current_session->replay_statistics.outdated;
 		}
 
-		return false;
+		return result;
+	}
+
+	boost::optional<const cryptoplus::buffer&> peer_session::signed_session_message(const session_parameters& parameters, const cryptoplus::pkey::pkey& signature_key) const
+	{
+		if (
+			m_signed_session_message &&
+			(m_signed_session_message->parameters.session_number == parameters.session_number) &&
+			(m_signed_session_message->parameters.cipher_suite == parameters.cipher_suite) &&
+			(m_signed_session_message->parameters.elliptic_curve == parameters.elliptic_curve) &&
+			(m_signed_session_message->parameters.public_key == parameters.public_key) &&
+			(m_signed_session_message->signature_key == signature_key)
+		)
+		{
+			return m_signed_session_message->message;
+		}
+
+		return boost::none;
+	}
+
+	void peer_session::set_signed_session_message(const session_parameters& parameters, const cryptoplus::pkey::pkey& signature_key, const void* data, size_t data_len)
+	{
+		m_signed_session_message = signed_session_message_type(parameters, signature_key, data, data_len);
+	}
+
+	boost::optional<const cryptoplus::buffer&> peer_session::signed_session_request_message(session_number_type session_number, const cipher_suite_list_type& cipher_suites, const elliptic_curve_list_type& elliptic_curves, const cryptoplus::pkey::pkey& signature_key) const
+	{
+		if (
+			m_signed_session_request_message &&
+			(m_signed_session_request_message->session_number == session_number) &&
+			(m_signed_session_request_message->cipher_suites == cipher_suites) &&
+			(m_signed_session_request_message->elliptic_curves == elliptic_curves) &&
+			(m_signed_session_request_message->signature_key == signature_key)
+		)
+		{
+			return m_signed_session_request_message->message;
+		}
+
+		return boost::none;
+	}
+
+	void peer_session::set_signed_session_request_message(session_number_type session_number, const cipher_suite_list_type& cipher_suites, const elliptic_curve_list_type& elliptic_curves, const cryptoplus::pkey::pkey& signature_key, const void* data, size_t data_len)
+	{
+		m_signed_session_request_message = signed_session_request_message_type(session_number, cipher_suites, elliptic_curves, signature_key, data, data_len);
 	}
 
 	bool peer_session::clear()
@@ -193,9 +362,34 @@ namespace fscp
 
 		const bool result = has_current_session();
 
+		retire_current_session();
+
 		m_current_session.reset();
 		m_next_session.reset();
 
+		// Any handshake computed for the cleared session is now irrelevant.
+		++m_handshake_generation;
+		m_handshake_pending = false;
+
 		return result;
 	}
+
+	void peer_session::retire_current_session()
+	{
+		if (!m_current_session)
+		{
+			return;
+		}
+
+		{
+			boost::mutex::scoped_lock lock(m_current_session->remote_mutex);
+
+			m_replay_statistics.reordered += m_current_session->replay_statistics.reordered;
+			m_replay_statistics.replayed += m_current_session->replay_statistics.replayed;
+			m_replay_statistics.outdated += m_current_session->replay_statistics.outdated;
+			m_last_sign_of_life = std::max(m_last_sign_of_life, m_current_session->last_sign_of_life);
+		}
+
+		m_socket_index = socket_index();
+	}
 }
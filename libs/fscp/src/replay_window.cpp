@@ -0,0 +1,115 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file replay_window.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief An anti-replay window class.
+ */
+
+#include "replay_window.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace fscp
+{
+	replay_window::replay_window(size_t _size) :
+		m_size(((std::max<size_t>(_size, 1) + WORD_BITS - 1) / WORD_BITS) * WORD_BITS),
+		// One extra word so that advancing the window never clears bits that are still inside it.
+		m_words(m_size / WORD_BITS + 1, 0),
+		m_highest(0)
+	{
+	}
+
+	replay_window::check_result_type replay_window::check(sequence_number_type sequence_number) const
+	{
+		if (sequence_number > m_highest)
+		{
+			return accepted;
+		}
+
+		// Sequence numbers start at 1: 0 is never valid.
+		if ((sequence_number == 0) || (m_highest - sequence_number >= m_size))
+		{
+			return outdated;
+		}
+
+		return test(sequence_number) ? replayed : accepted;
+	}
+
+	bool replay_window::update(sequence_number_type sequence_number)
+	{
+		assert(check(sequence_number) == accepted);
+
+		if (sequence_number > m_highest)
+		{
+			const size_t current_word = m_highest / WORD_BITS;
+			const size_t new_word = sequence_number / WORD_BITS;
+			const size_t words_to_clear = std::min(new_word - current_word, m_words.size());
+
+			for (size_t i = 1; i <= words_to_clear; ++i)
+			{
+				m_words[(current_word + i) % m_words.size()] = 0;
+			}
+
+			m_highest = sequence_number;
+			set(sequence_number);
+
+			return true;
+		}
+
+		set(sequence_number);
+
+		return false;
+	}
+
+	bool replay_window::test(sequence_number_type sequence_number) const
+	{
+		const word_type& word = m_words[(sequence_number / WORD_BITS) % m_words.size()];
+
+		return ((word >> (sequence_number % WORD_BITS)) & 1) != 0;
+	}
+
+	void replay_window::set(sequence_number_type sequence_number)
+	{
+		word_type& word = m_words[(sequence_number / WORD_BITS) % m_words.size()];
+
+		word |= (word_type(1) << (sequence_number % WORD_BITS));
+	}
+}
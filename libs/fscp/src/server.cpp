@@ -59,7 +59,26 @@
 #include <boost/thread/future.hpp>
 #include <boost/iterator/transform_iterator.hpp>
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <cerrno>
+
+// These are missing from older system headers, but the values are part of the kernel ABI.
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
 
 namespace fscp
 {
@@ -69,6 +88,33 @@ namespace fscp
 
 	namespace
 	{
+#ifdef __linux__
+		typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port_option;
+		typedef boost::asio::detail::socket_option::integer<IPPROTO_UDP, UDP_SEGMENT> udp_segment_option;
+		typedef boost::asio::detail::socket_option::boolean<IPPROTO_UDP, UDP_GRO> udp_gro_option;
+		typedef boost::asio::detail::socket_option::boolean<IPPROTO_IP, IP_RECVERR> ipv4_receive_error_option;
+		typedef boost::asio::detail::socket_option::boolean<IPPROTO_IPV6, IPV6_RECVERR> ipv6_receive_error_option;
+
+		// The control buffers must be suitably aligned for a cmsghdr.
+		union udp_segment_control_type
+		{
+			struct cmsghdr header;
+			char data[CMSG_SPACE(sizeof(uint16_t))];
+		};
+
+		union udp_gro_control_type
+		{
+			struct cmsghdr header;
+			char data[CMSG_SPACE(sizeof(int))];
+		};
+
+		// The kernel won't segment a datagram in more segments than this.
+		const size_t MAX_UDP_SEGMENT_COUNT = 64;
+
+		// The largest UDP payload that fits in an IPv4 packet.
+		const size_t MAX_UDP_PAYLOAD_SIZE = 65507;
+#endif
+
 		void null_simple_handler(const boost::system::error_code&) {}
 		void null_multiple_endpoints_handler(const std::map<server::ep_type, boost::system::error_code>&) {}
 
@@ -199,6 +245,49 @@ namespace fscp
 			return causal_handler<Handler, CausalHandler>(_handler, _causal_handler);
 		}
 
+		template <typename Handler>
+		class error_gatherer
+		{
+			public:
+
+				error_gatherer(Handler handler, size_t count) :
+					m_handler(handler),
+					m_count(count),
+					m_error()
+				{
+					if (m_count == 0)
+					{
+						m_handler(m_error);
+					}
+				}
+
+				void gather(const boost::system::error_code& ec)
+				{
+					boost::mutex::scoped_lock lock(m_mutex);
+
+					// Ensure that gather was not called more than count times.
+					assert(m_count > 0);
+
+					// The first error is the one that gets reported.
+					if (ec && !m_error)
+					{
+						m_error = ec;
+					}
+
+					if (--m_count == 0)
+					{
+						m_handler(m_error);
+					}
+				}
+
+			private:
+
+				boost::mutex m_mutex;
+				Handler m_handler;
+				size_t m_count;
+				boost::system::error_code m_error;
+		};
+
 		template <typename KeyType, typename ValueType, typename Handler>
 		class results_gatherer
 		{
@@ -251,23 +340,94 @@ namespace fscp
 		}
 	}
 
+#ifdef __linux__
+	struct server::receive_batch_type
+	{
+		receive_batch_type(socket_memory_pool& _memory_pool, size_t size, bool gro_enabled) :
+			memory_pool(_memory_pool),
+			buffers(size),
+			senders(size),
+			iovecs(size),
+			messages(size),
+			controls(gro_enabled ? size : 0)
+		{
+			for (size_t i = 0; i < size; ++i)
+			{
+				std::memset(&messages[i], 0x00, sizeof(messages[i]));
+				messages[i].msg_hdr.msg_name = senders[i].data();
+				messages[i].msg_hdr.msg_iov = &iovecs[i];
+				messages[i].msg_hdr.msg_iovlen = 1;
+
+				if (gro_enabled)
+				{
+					messages[i].msg_hdr.msg_control = controls[i].data;
+				}
+
+				refill(i);
+			}
+		}
+
+		size_t size() const
+		{
+			return buffers.size();
+		}
+
+		// The kernel overwrites the lengths and the flags on every read.
+		void reset()
+		{
+			for (size_t i = 0; i < size(); ++i)
+			{
+				messages[i].msg_hdr.msg_namelen = static_cast<socklen_t>(senders[i].capacity());
+				messages[i].msg_hdr.msg_controllen = controls.empty() ? 0 : sizeof(controls[i].data);
+				messages[i].msg_hdr.msg_flags = 0;
+			}
+		}
+
+		// Only the blocks handed to the upper layers get replaced: the others are reused as is.
+		void refill(size_t i)
+		{
+			buffers[i] = memory_pool.allocate_shared_buffer();
+			iovecs[i].iov_base = buffer_cast<void*>(buffers[i]);
+			iovecs[i].iov_len = buffer_size(buffers[i]);
+		}
+
+		socket_memory_pool& memory_pool;
+		std::vector<socket_memory_pool::shared_buffer_type> buffers;
+		std::vector<ep_type> senders;
+		std::vector<struct iovec> iovecs;
+		std::vector<struct mmsghdr> messages;
+		std::vector<udp_gro_control_type> controls;
+	};
+#endif
+
 	// Public methods
 
-	server::server(boost::asio::io_service& io_service, const identity_store& identity) :
-		m_identity_store(identity),
-		m_socket(io_service),
-		m_socket_strand(io_service),
-		m_write_queue_strand(io_service),
+	server::server(boost::asio::io_service& io_service, const identity_store& identity, size_t datagram_size) :
+		m_identity_store(boost::make_shared<identity_store>(identity)),
+		m_identity_strand(io_service),
+		m_socket_shards(1, boost::make_shared<socket_shard_type>(boost::ref(io_service), 0)),
+		m_socket_count(DEFAULT_SOCKET_COUNT),
+		m_socket_memory_pool(datagram_size, std::max<size_t>(SOCKET_BUFFER_POOL_SIZE / datagram_size, 1)),
+		m_io_batch_size(DEFAULT_IO_BATCH_SIZE),
+		m_receive_memory_pool(),
+		m_segmentation_offload_enabled(false),
+		m_gro_memory_pool(),
+		m_timer_wheel(io_service, TIMER_WHEEL_TICK),
 		m_greet_strand(io_service),
 		m_accept_hello_messages_default(true),
 		m_hello_message_received_handler(),
 		m_presentation_strand(io_service),
 		m_presentation_message_received_handler(),
 		m_session_strand(io_service),
+		m_session_table(boost::make_shared<session_table_type>()),
 		m_accept_session_request_messages_default(true),
 		m_cipher_suites(get_default_cipher_suites()),
 		m_elliptic_curves(get_default_elliptic_curves()),
+		m_replay_window_size(DEFAULT_REPLAY_WINDOW_SIZE),
 		m_session_request_message_received_handler(),
+		m_handshake_thread_count(DEFAULT_HANDSHAKE_THREAD_COUNT),
+		m_handshake_queue_size(DEFAULT_HANDSHAKE_QUEUE_SIZE),
+		m_handshake_pool(),
 		m_accept_session_messages_default(true),
 		m_session_message_received_handler(),
 		m_session_failed_handler(),
@@ -279,7 +439,7 @@ namespace fscp
 		m_data_received_handler(),
 		m_contact_request_message_received_handler(),
 		m_contact_message_received_handler(),
-		m_keep_alive_timer(io_service, SESSION_KEEP_ALIVE_PERIOD)
+		m_keep_alive_next_slot(0)
 	{
 		// These calls are needed in C++03 to ensure that static initializations are done in a single thread.
 		server_category();
@@ -309,28 +469,115 @@ namespace fscp
 
 	void server::open(const ep_type& listen_endpoint)
 	{
-		m_socket.open(listen_endpoint.protocol());
+		if (!m_handshake_pool)
+		{
+			m_handshake_pool.reset(new worker_pool(m_handshake_thread_count, m_handshake_queue_size));
+		}
+
+#ifdef __linux__
+		const size_t socket_count = m_socket_count;
+#else
+		const size_t socket_count = 1;
+#endif
+
+		while (m_socket_shards.size() < socket_count)
+		{
+			m_socket_shards.push_back(boost::make_shared<socket_shard_type>(boost::ref(get_io_service()), m_socket_shards.size()));
+		}
+
+		m_socket_shards.resize(socket_count);
 
-		if (listen_endpoint.address().is_v6())
+		ep_type bind_endpoint = listen_endpoint;
+
+		for (auto&& shard : m_socket_shards)
 		{
-			// We accept both IPv4 and IPv6 addresses
-			m_socket.set_option(boost::asio::ip::v6_only(false));
+			shard->socket.open(listen_endpoint.protocol());
+
+			if (listen_endpoint.address().is_v6())
+			{
+				// We accept both IPv4 and IPv6 addresses
+				shard->socket.set_option(boost::asio::ip::v6_only(false));
+			}
+
+#ifdef __linux__
+			if (socket_count > 1)
+			{
+				// The kernel spreads the peers over the sockets, by hashing their address and port.
+				shard->socket.set_option(reuse_port_option(true));
+			}
+#endif
+
+			shard->socket.bind(bind_endpoint);
+
+			// If the port was chosen by the system, the other sockets must use the same.
+			bind_endpoint = shard->socket.local_endpoint();
+
+#ifdef __linux__
+			if (m_segmentation_offload_enabled)
+			{
+				// Kernels that don't support the offloads reject the options: we then just do without them.
+				boost::system::error_code ec;
+
+				shard->socket.set_option(udp_segment_option(0), ec);
+				shard->gso_enabled = !ec;
+
+				shard->socket.set_option(udp_gro_option(true), ec);
+				shard->gro_enabled = !ec;
+			}
+			else
+			{
+				shard->gso_enabled = false;
+				shard->gro_enabled = false;
+			}
+
+			if ((m_io_batch_size > 1) || shard->gro_enabled)
+			{
+				// recvmmsg() doesn't tell which host an ICMP error is about: the kernel must queue the errors with their addresses instead.
+				boost::system::error_code ec;
+
+				shard->socket.set_option(ipv4_receive_error_option(true), ec);
+
+				if (listen_endpoint.address().is_v6())
+				{
+					shard->socket.set_option(ipv6_receive_error_option(true), ec);
+				}
+			}
+
+			// The batch is sized for the current settings: it gets created again on the next read.
+			shard->receive_batch.reset();
+#endif
 		}
 
-		m_socket.bind(listen_endpoint);
+#ifdef __linux__
+		// Every batched read keeps a batch of blocks ready for the next read: those come from a dedicated pool, large enough for the blocks still being processed too.
+		if ((m_io_batch_size > 1) && !m_receive_memory_pool)
+		{
+			m_receive_memory_pool.reset(new socket_memory_pool(m_socket_memory_pool.block_size(), 2 * m_io_batch_size * socket_count));
+		}
 
-		async_receive_from();
+		if (m_segmentation_offload_enabled && !m_gro_memory_pool)
+		{
+			m_gro_memory_pool.reset(new socket_memory_pool(MAX_GRO_DATAGRAM_SIZE, 2 * m_io_batch_size * socket_count));
+		}
+#endif
 
-		m_keep_alive_timer.async_wait(m_session_strand.wrap(boost::bind(&server::do_check_keep_alive, this, boost::asio::placeholders::error)));
+		for (auto&& shard : m_socket_shards)
+		{
+			async_receive_from(shard);
+		}
 	}
 
 	void server::close()
 	{
 		cancel_all_greetings();
 
-		m_keep_alive_timer.cancel();
+		// This also stops the keep-alive checks: they are scheduled again as sessions are negotiated.
+		m_timer_wheel.cancel_all();
 
-		m_socket.close();
+		for (auto&& shard : m_socket_shards)
+		{
+			shard->socket.close();
+		}
 	}
 
 	void server::async_greet(const ep_type& target, duration_handler_type handler, const boost::posix_time::time_duration& timeout)
@@ -360,7 +607,7 @@ namespace fscp
 
 	void server::async_introduce_to(const ep_type& target, simple_handler_type handler)
 	{
-		m_socket_strand.post(boost::bind(&server::do_introduce_to, this, normalize(target), handler));
+		m_identity_strand.post(boost::bind(&server::do_introduce_to, this, normalize(target), handler));
 	}
 
 	boost::system::error_code server::sync_introduce_to(const ep_type& target)
@@ -427,7 +674,7 @@ namespace fscp
 
 	void server::set_presentation(const ep_type& target, cert_type signature_certificate)
 	{
-		m_presentation_store_map[target] = presentation_store(signature_certificate);
+		store_presentation(target, presentation_store(signature_certificate));
 	}
 
 	void server::async_set_presentation(const ep_type& target, cert_type signature_certificate, void_handler_type handler)
@@ -445,9 +692,27 @@ namespace fscp
 		return promise.get_future().wait();
 	}
 
+	void server::async_handle_presentation(const ep_type& sender, cert_type signature_certificate, presentation_message_received_handler_type handler)
+	{
+		const ep_type normalized_sender = normalize(sender);
+
+		async_has_session_with_endpoint(normalized_sender, [this, normalized_sender, signature_certificate, handler](bool has_session) {
+			m_presentation_strand.post(
+				boost::bind(
+					&server::do_handle_validated_presentation,
+					this,
+					normalized_sender,
+					has_session,
+					signature_certificate,
+					handler
+				)
+			);
+		});
+	}
+
 	void server::clear_presentation(const ep_type& target)
 	{
-		m_presentation_store_map.erase(target);
+		erase_presentation(target);
 	}
 
 	void server::async_clear_presentation(const ep_type& target, void_handler_type handler)
@@ -523,6 +788,19 @@ namespace fscp
 		return promise.get_future().get();
 	}
 
+	replay_statistics_type server::sync_get_replay_statistics(const ep_type& host)
+	{
+		typedef replay_statistics_type result_type;
+		typedef boost::promise<result_type> promise_type;
+		promise_type promise;
+
+		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
+
+		async_get_replay_statistics(host, boost::bind(setter, &promise, _1));
+
+		return promise.get_future().get();
+	}
+
 	boost::system::error_code server::sync_request_session(const ep_type& target)
 	{
 		typedef boost::promise<boost::system::error_code> promise_type;
@@ -565,6 +843,16 @@ namespace fscp
 		return promise.get_future().wait();
 	}
 
+	void server::sync_set_replay_window_size(size_t replay_window_size)
+	{
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
+
+		async_set_replay_window_size(replay_window_size, boost::bind(&promise_type::set_value, &promise));
+
+		return promise.get_future().wait();
+	}
+
 	void server::sync_set_session_request_message_received_callback(session_request_received_handler_type callback)
 	{
 		typedef boost::promise<void> promise_type;
@@ -637,7 +925,7 @@ namespace fscp
 
 	void server::async_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler)
 	{
-		m_session_strand.post(boost::bind(&server::do_send_data, this, normalize(target), channel_number, data, handler));
+		send_data(normalize(target), channel_number, data, handler);
 	}
 
 	boost::system::error_code server::sync_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data)
@@ -652,11 +940,28 @@ namespace fscp
 		return promise.get_future().get();
 	}
 
+	void server::async_send_data_in_place(const ep_type& target, channel_number_type channel_number, boost::asio::mutable_buffer _buffer, size_t data_len, simple_handler_type handler)
+	{
+		send_data_in_place(normalize(target), channel_number, _buffer, data_len, handler);
+	}
+
+	boost::system::error_code server::sync_send_data_in_place(const ep_type& target, channel_number_type channel_number, boost::asio::mutable_buffer _buffer, size_t data_len)
+	{
+		typedef boost::promise<boost::system::error_code> promise_type;
+		promise_type promise;
+
+		void (promise_type::*setter)(const boost::system::error_code&) = &promise_type::set_value;
+
+		async_send_data_in_place(target, channel_number, _buffer, data_len, boost::bind(setter, &promise, _1));
+
+		return promise.get_future().get();
+	}
+
 	void server::async_send_data_to_list(const std::set<ep_type>& targets, channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
 	{
 		const std::set<ep_type> normalized_targets(boost::make_transform_iterator(targets.begin(), normalize), boost::make_transform_iterator(targets.end(), normalize));
 
-		m_session_strand.post(boost::bind(&server::do_send_data_to_list, this, normalized_targets, channel_number, data, handler));
+		send_data_to_list(normalized_targets, channel_number, data, handler);
 	}
 
 	std::map<server::ep_type, boost::system::error_code> server::sync_send_data_to_list(const std::set<ep_type>& targets, channel_number_type channel_number, boost::asio::const_buffer data)
@@ -825,14 +1130,14 @@ namespace fscp
 
 	void server::do_get_identity(identity_handler_type handler)
 	{
-		// do_set_identity() is executed within the socket strand so this is safe.
+		// do_get_identity() is executed within the identity strand so this is safe.
 
 		handler(get_identity());
 	}
 
 	void server::do_set_identity(const identity_store& identity, void_handler_type handler)
 	{
-		// do_set_identity() is executed within the socket strand so this is safe.
+		// do_set_identity() is executed within the identity strand so this is safe.
 		set_identity(identity);
 
 		async_reintroduce_to_all(&null_multiple_endpoints_handler);
@@ -843,19 +1148,39 @@ namespace fscp
 		}
 	}
 
-	void server::do_async_receive_from()
+	void server::do_async_receive_from(socket_shard_ptr shard)
 	{
-		// do_async_receive_from() is executed within the socket strand so this is safe.
+		// do_async_receive_from() is executed within the socket strand of the shard so this is safe.
+#ifdef __linux__
+		if ((m_io_batch_size > 1) || shard->gro_enabled)
+		{
+			// We only wait for the socket to be readable: handle_receive_ready() will then drain as many datagrams as possible at once.
+			shard->socket.async_receive(
+				boost::asio::null_buffers(),
+				boost::bind(
+					&server::handle_receive_ready,
+					this,
+					shard,
+					get_identity(),
+					boost::asio::placeholders::error
+				)
+			);
+
+			return;
+		}
+#endif
+
 		boost::shared_ptr<ep_type> sender = boost::make_shared<ep_type>();
 
 		socket_memory_pool::shared_buffer_type receive_buffer = m_socket_memory_pool.allocate_shared_buffer();
 
-		m_socket.async_receive_from(
+		shard->socket.async_receive_from(
 			buffer(receive_buffer),
 			*sender,
 			boost::bind(
 				&server::handle_receive_from,
 				this,
+				shard,
 				get_identity(),
 				sender,
 				receive_buffer,
@@ -865,227 +1190,646 @@ namespace fscp
 		);
 	}
 
-	void server::handle_receive_from(const identity_store& identity, boost::shared_ptr<ep_type> sender, socket_memory_pool::shared_buffer_type data, const boost::system::error_code& ec, size_t bytes_received)
+	void server::handle_receive_from(socket_shard_ptr shard, const identity_store& identity, boost::shared_ptr<ep_type> sender, socket_memory_pool::shared_buffer_type data, const boost::system::error_code& ec, size_t bytes_received)
 	{
 		assert(sender);
 
 		if (ec != boost::asio::error::operation_aborted)
 		{
 			// Let's read again !
-			async_receive_from();
+			async_receive_from(shard);
 
 			*sender = normalize(*sender);
 
 			if (!ec)
 			{
-				try
-				{
-					message message(buffer_cast<const uint8_t*>(data), bytes_received);
-
-					switch (message.type())
-					{
-						case MESSAGE_TYPE_DATA_0:
-						case MESSAGE_TYPE_DATA_1:
-						case MESSAGE_TYPE_DATA_2:
-						case MESSAGE_TYPE_DATA_3:
-						case MESSAGE_TYPE_DATA_4:
-						case MESSAGE_TYPE_DATA_5:
-						case MESSAGE_TYPE_DATA_6:
-						case MESSAGE_TYPE_DATA_7:
-						case MESSAGE_TYPE_DATA_8:
-						case MESSAGE_TYPE_DATA_9:
-						case MESSAGE_TYPE_DATA_10:
-						case MESSAGE_TYPE_DATA_11:
-						case MESSAGE_TYPE_DATA_12:
-						case MESSAGE_TYPE_DATA_13:
-						case MESSAGE_TYPE_DATA_14:
-						case MESSAGE_TYPE_DATA_15:
-						case MESSAGE_TYPE_CONTACT_REQUEST:
-						case MESSAGE_TYPE_CONTACT:
-						case MESSAGE_TYPE_KEEP_ALIVE:
-						{
-							data_message data_message(message);
-
-							m_session_strand.post(
-								make_shared_buffer_handler(
-									data,
-									boost::bind(
-										&server::do_handle_data,
-										this,
-										identity,
-										*sender,
-										data_message
-									)
-								)
-							);
-
-							break;
-						}
-						case MESSAGE_TYPE_HELLO_REQUEST:
-						case MESSAGE_TYPE_HELLO_RESPONSE:
-						{
-							hello_message hello_message(message);
-
-							handle_hello_message_from(hello_message, *sender);
-
-							break;
-						}
-						case MESSAGE_TYPE_PRESENTATION:
-						{
-							presentation_message presentation_message(message);
-
-							handle_presentation_message_from(presentation_message, *sender);
-
-							break;
-						}
-						case MESSAGE_TYPE_SESSION_REQUEST:
-						{
-							session_request_message session_request_message(message);
-
-							m_presentation_strand.post(
-								boost::bind(
-									&server::do_handle_session_request,
-									this,
-									data,
-									identity,
-									*sender,
-									session_request_message
-								)
-							);
-
-							break;
-						}
-						case MESSAGE_TYPE_SESSION:
-						{
-							session_message session_message(message);
-
-							m_presentation_strand.post(
-								boost::bind(
-									&server::do_handle_session,
-									this,
-									data,
-									identity,
-									*sender,
-									session_message
-								)
-							);
-
-							break;
-						}
-						default:
-						{
-							break;
-						}
-					}
-				}
-				catch (std::runtime_error&)
-				{
-					// These errors can happen in normal situations (for instance when a crypto operation fails due to invalid input).
-				}
+				handle_message_from(shard->index, identity, *sender, data, buffer(data, bytes_received));
 			}
-			else if (ec == boost::asio::error::connection_refused)
+			else
 			{
-				// The host refused the connection, meaning it closed its socket so we can force-terminate the session.
-				async_close_session(*sender, &null_simple_handler);
+				handle_receive_error(*sender, ec);
 			}
 		}
 	}
 
-	void server::push_write(void_handler_type handler)
+	void server::handle_receive_ready(socket_shard_ptr shard, const identity_store& identity, const boost::system::error_code& ec)
 	{
-		// All push_write() calls are done in the same strand so the following is thread-safe.
-		if (m_write_queue.empty())
+#ifdef __linux__
+		if (ec == boost::asio::error::operation_aborted)
 		{
-			// Nothing is being written, lets start the write immediately.
-			m_socket_strand.post(make_causal_handler(handler, m_write_queue_strand.wrap(boost::bind(&server::pop_write, this))));
+			return;
 		}
 
-		m_write_queue.push(handler);
-	}
-
-	void server::pop_write()
-	{
-		// All pop_write() calls are done in the same strand so the following is thread-safe.
-		m_write_queue.pop();
-
-		if (!m_write_queue.empty())
+		if (ec)
 		{
-			m_socket_strand.post(make_causal_handler(m_write_queue.front(), m_write_queue_strand.wrap(boost::bind(&server::pop_write, this))));
-		}
-	}
+			async_receive_from(shard);
 
-	server::ep_type server::to_socket_format(const server::ep_type& ep)
-	{
-#ifdef WINDOWS
-		if (m_socket.local_endpoint().address().is_v6() && ep.address().is_v4())
-		{
-			return server::ep_type(boost::asio::ip::address_v6::v4_mapped(ep.address().to_v4()), ep.port());
+			return;
 		}
-		else
+
+		// With GRO, the kernel coalesces the datagrams of a same flow: the buffers must be large enough for a coalesced datagram.
+		if (!shard->receive_batch)
 		{
-			return ep;
-		}
-#else
-		static_cast<void>(socket);
+			socket_memory_pool& memory_pool = shard->gro_enabled ? *m_gro_memory_pool : *m_receive_memory_pool;
 
-		return ep;
-#endif
-	}
+			shard->receive_batch = boost::make_shared<receive_batch_type>(boost::ref(memory_pool), m_io_batch_size, shard->gro_enabled);
+		}
 
-	uint32_t server::ep_hello_context_type::generate_unique_number()
-	{
-		// The first call to this function is *NOT* thread-safe in C++03 !
-		static boost::mt19937 rng(static_cast<uint32_t>(time(0)));
+		receive_batch_type& batch = *shard->receive_batch;
 
-		return rng();
-	}
+		batch.reset();
 
-	server::ep_hello_context_type::ep_hello_context_type() :
-		m_current_hello_unique_number(generate_unique_number())
-	{
-	}
+		const int count = ::recvmmsg(shard->socket.native_handle(), &batch.messages[0], static_cast<unsigned int>(batch.size()), MSG_DONTWAIT, NULL);
 
-	uint32_t server::ep_hello_context_type::next_hello_unique_number()
-	{
-		return m_current_hello_unique_number++;
-	}
+		if (count < 0)
+		{
+			// The pending socket error was consumed: the errors themselves, and the hosts they are about, are in the error queue.
+			read_error_queue(*shard);
 
-	template <typename WaitHandler>
-	void server::ep_hello_context_type::async_wait_reply(boost::asio::io_service& io_service, uint32_t hello_unique_number, const boost::posix_time::time_duration& timeout, WaitHandler handler)
-	{
-		const boost::shared_ptr<boost::asio::deadline_timer> timer = boost::make_shared<boost::asio::deadline_timer>(boost::ref(io_service), timeout);
+			async_receive_from(shard);
 
-		m_pending_requests[hello_unique_number] = pending_request_status(timer);
+			return;
+		}
 
-		timer->async_wait(handler);
-	}
+		struct received_datagram_type
+		{
+			ep_type sender;
+			socket_memory_pool::shared_buffer_type data;
+			size_t size;
+			size_t segment_size;
+		};
 
-	bool server::ep_hello_context_type::cancel_reply_wait(uint32_t hello_unique_number, bool success)
-	{
-		pending_requests_map::iterator request = m_pending_requests.find(hello_unique_number);
+		// The batch belongs to this handler until the next read is started: its content is moved out first.
+		std::vector<received_datagram_type> datagrams;
+		datagrams.reserve(static_cast<size_t>(count));
 
-		if (request != m_pending_requests.end())
+		for (int i = 0; i < count; ++i)
 		{
-			if (request->second.timer->cancel() > 0)
+			batch.senders[i].resize(batch.messages[i].msg_hdr.msg_namelen);
+
+			const ep_type sender = normalize(batch.senders[i]);
+			const size_t datagram_size = batch.messages[i].msg_len;
+			size_t segment_size = datagram_size;
+
+			if (shard->gro_enabled)
 			{
-				// At least one handler was cancelled which means we can set the success flag.
-				request->second.success = success;
+				for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&batch.messages[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&batch.messages[i].msg_hdr, cmsg))
+				{
+					if ((cmsg->cmsg_level == IPPROTO_UDP) && (cmsg->cmsg_type == UDP_GRO))
+					{
+						int gro_size = 0;
+						std::memcpy(&gro_size, CMSG_DATA(cmsg), sizeof(gro_size));
 
-				return true;
+						if (gro_size > 0)
+						{
+							segment_size = static_cast<size_t>(gro_size);
+						}
+					}
+				}
 			}
+
+			// The block now belongs to the upper layers: the batch gets a fresh one for the next read.
+			const received_datagram_type datagram = { sender, batch.buffers[i], datagram_size, segment_size };
+			datagrams.push_back(datagram);
+			batch.refill(static_cast<size_t>(i));
 		}
 
-		return false;
-	}
+		// Let's read again !
+		async_receive_from(shard);
 
-	void server::ep_hello_context_type::cancel_all_reply_wait()
-	{
-		for (pending_requests_map::iterator request = m_pending_requests.begin(); request != m_pending_requests.end(); ++request)
+		for (auto&& datagram : datagrams)
 		{
-			if (request->second.timer->cancel() > 0)
+			// All the segments but the last have the same size. The buffer is shared by all the segments.
+			for (size_t offset = 0; offset < datagram.size; offset += datagram.segment_size)
 			{
-				// At least one handler was cancelled which means we can set the success flag.
-				request->second.success = false;
+				handle_message_from(shard->index, identity, datagram.sender, datagram.data, buffer(buffer(datagram.data) + offset, std::min(datagram.segment_size, datagram.size - offset)));
+			}
+		}
+#else
+		static_cast<void>(shard);
+		static_cast<void>(identity);
+		static_cast<void>(ec);
+#endif
+	}
+
+	void server::read_error_queue(socket_shard_type& shard)
+	{
+#ifdef __linux__
+		// Reading the queue also clears the readiness it causes: it is drained whatever the errors.
+		for (;;)
+		{
+			ep_type sender;
+			char control[512];
+			struct msghdr message;
+
+			std::memset(&message, 0x00, sizeof(message));
+			message.msg_name = sender.data();
+			message.msg_namelen = static_cast<socklen_t>(sender.capacity());
+			message.msg_control = control;
+			message.msg_controllen = sizeof(control);
+
+			if (::recvmsg(shard.socket.native_handle(), &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			{
+				return;
+			}
+
+			sender.resize(message.msg_namelen);
+
+			for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg))
+			{
+				if (((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_RECVERR)) || ((cmsg->cmsg_level == IPPROTO_IPV6) && (cmsg->cmsg_type == IPV6_RECVERR)))
+				{
+					struct sock_extended_err error;
+					std::memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+
+					if ((error.ee_origin == SO_EE_ORIGIN_ICMP) || (error.ee_origin == SO_EE_ORIGIN_ICMP6))
+					{
+						handle_receive_error(sender, boost::system::error_code(static_cast<int>(error.ee_errno), boost::system::system_category()));
+					}
+				}
+			}
+		}
+#else
+		static_cast<void>(shard);
+#endif
+	}
+
+	void server::handle_receive_error(const ep_type& sender, const boost::system::error_code& ec)
+	{
+		if (ec == boost::asio::error::connection_refused)
+		{
+			// The host refused the connection, meaning it closed its socket so we can force-terminate the session.
+			async_close_session(normalize(sender), &null_simple_handler);
+		}
+	}
+
+	void server::handle_message_from(size_t socket_index, const identity_store& identity, const ep_type& sender, socket_memory_pool::shared_buffer_type data, boost::asio::const_buffer datagram)
+	{
+		try
+		{
+			message message(buffer_cast<const uint8_t*>(datagram), buffer_size(datagram));
+
+			switch (message.type())
+			{
+				case MESSAGE_TYPE_DATA_0:
+				case MESSAGE_TYPE_DATA_1:
+				case MESSAGE_TYPE_DATA_2:
+				case MESSAGE_TYPE_DATA_3:
+				case MESSAGE_TYPE_DATA_4:
+				case MESSAGE_TYPE_DATA_5:
+				case MESSAGE_TYPE_DATA_6:
+				case MESSAGE_TYPE_DATA_7:
+				case MESSAGE_TYPE_DATA_8:
+				case MESSAGE_TYPE_DATA_9:
+				case MESSAGE_TYPE_DATA_10:
+				case MESSAGE_TYPE_DATA_11:
+				case MESSAGE_TYPE_DATA_12:
+				case MESSAGE_TYPE_DATA_13:
+				case MESSAGE_TYPE_DATA_14:
+				case MESSAGE_TYPE_DATA_15:
+				case MESSAGE_TYPE_CONTACT_REQUEST:
+				case MESSAGE_TYPE_CONTACT:
+				case MESSAGE_TYPE_KEEP_ALIVE:
+				{
+					data_message data_message(message);
+
+					handle_data_from(socket_index, identity, sender, data_message);
+
+					break;
+				}
+				case MESSAGE_TYPE_HELLO_REQUEST:
+				case MESSAGE_TYPE_HELLO_RESPONSE:
+				{
+					hello_message hello_message(message);
+
+					handle_hello_message_from(hello_message, sender);
+
+					break;
+				}
+				case MESSAGE_TYPE_PRESENTATION:
+				{
+					presentation_message presentation_message(message);
+
+					handle_presentation_message_from(presentation_message, sender);
+
+					break;
+				}
+				case MESSAGE_TYPE_SESSION_REQUEST:
+				{
+					session_request_message session_request_message(message);
+
+					m_presentation_strand.post(
+						boost::bind(
+							&server::do_handle_session_request,
+							this,
+							data,
+							identity,
+							sender,
+							session_request_message
+						)
+					);
+
+					break;
+				}
+				case MESSAGE_TYPE_SESSION:
+				{
+					session_message session_message(message);
+
+					m_presentation_strand.post(
+						boost::bind(
+							&server::do_handle_session,
+							this,
+							data,
+							identity,
+							sender,
+							session_message
+						)
+					);
+
+					break;
+				}
+				default:
+				{
+					break;
+				}
+			}
+		}
+		catch (std::runtime_error&)
+		{
+			// These errors can happen in normal situations (for instance when a crypto operation fails due to invalid input).
+		}
+	}
+
+	void server::push_write(socket_shard_ptr shard, const pending_write_type& write)
+	{
+		// All push_write() calls for a given shard are done in the same strand so the following is thread-safe.
+		shard->write_queue.push(write);
+
+		if (!shard->write_in_progress)
+		{
+			// Nothing is being written, lets start the write immediately.
+			start_write(shard);
+		}
+	}
+
+	void server::pop_write(socket_shard_ptr shard)
+	{
+		// All pop_write() calls for a given shard are done in the same strand so the following is thread-safe.
+		shard->write_in_progress = false;
+
+		if (!shard->write_queue.empty())
+		{
+			start_write(shard);
+		}
+	}
+
+	void server::start_write(socket_shard_ptr shard)
+	{
+		// start_write() is always called from the write queue strand so the following is thread-safe.
+		assert(!shard->write_queue.empty());
+
+		shard->write_in_progress = true;
+
+#ifdef __linux__
+		if ((m_io_batch_size > 1) && (shard->write_queue.size() > 1))
+		{
+			const boost::shared_ptr<pending_write_batch_type> batch = boost::make_shared<pending_write_batch_type>();
+			batch->reserve(std::min(shard->write_queue.size(), m_io_batch_size));
+
+			while (!shard->write_queue.empty() && (batch->size() < m_io_batch_size))
+			{
+				batch->push_back(shard->write_queue.front());
+				shard->write_queue.pop();
+			}
+
+			// do_write_batch() calls pop_write() itself once the whole batch was handed to the kernel.
+			shard->socket_strand.post(boost::bind(&server::do_write_batch, this, shard, batch, 0));
+
+			return;
+		}
+#endif
+
+		const pending_write_type write = shard->write_queue.front();
+		shard->write_queue.pop();
+
+		shard->socket_strand.post(make_causal_handler(boost::bind(&server::do_write, this, shard, write), shard->write_queue_strand.wrap(boost::bind(&server::pop_write, this, shard))));
+	}
+
+	void server::do_write(socket_shard_ptr shard, const pending_write_type& write)
+	{
+		// do_write() is executed within the socket strand so this is safe.
+		shard->socket.async_send_to(boost::asio::const_buffers_1(write.data), write.target, 0, write.handler);
+	}
+
+	void server::do_write_batch(socket_shard_ptr shard, boost::shared_ptr<pending_write_batch_type> batch, size_t offset)
+	{
+#ifdef __linux__
+		// do_write_batch() is executed within the socket strand so this is safe.
+		const size_t first = offset;
+		std::vector<struct iovec> iovecs(batch->size() - first);
+		std::vector<struct mmsghdr> messages(batch->size() - first);
+		std::vector<udp_segment_control_type> controls(shard->gso_enabled ? batch->size() - first : 0);
+
+		// Once a coalesced message fails, the rest of the batch is sent datagram by datagram.
+		bool segment = shard->gso_enabled;
+
+		// The count of writes that each message carries.
+		std::vector<size_t> write_counts(batch->size() - first);
+
+		while (offset < batch->size())
+		{
+			size_t count = 0;
+
+			for (size_t index = offset; index < batch->size(); index += write_counts[count++])
+			{
+				write_counts[count] = segment ? get_segment_count(*batch, index) : 1;
+
+				for (size_t i = 0; i < write_counts[count]; ++i)
+				{
+					const pending_write_type& write = (*batch)[index + i];
+
+					iovecs[index - first + i].iov_base = const_cast<void*>(buffer_cast<const void*>(write.data));
+					iovecs[index - first + i].iov_len = buffer_size(write.data);
+				}
+
+				const pending_write_type& write = (*batch)[index];
+
+				std::memset(&messages[count], 0x00, sizeof(messages[count]));
+				messages[count].msg_hdr.msg_name = const_cast<boost::asio::detail::socket_addr_type*>(write.target.data());
+				messages[count].msg_hdr.msg_namelen = static_cast<socklen_t>(write.target.size());
+				messages[count].msg_hdr.msg_iov = &iovecs[index - first];
+				messages[count].msg_hdr.msg_iovlen = write_counts[count];
+
+				if (write_counts[count] > 1)
+				{
+					// The kernel (or the network device) splits the message back into datagrams of the size of the first one.
+					const uint16_t segment_size = static_cast<uint16_t>(buffer_size(write.data));
+
+					messages[count].msg_hdr.msg_control = controls[count].data;
+					messages[count].msg_hdr.msg_controllen = sizeof(controls[count].data);
+
+					struct cmsghdr* const cmsg = CMSG_FIRSTHDR(&messages[count].msg_hdr);
+					cmsg->cmsg_level = IPPROTO_UDP;
+					cmsg->cmsg_type = UDP_SEGMENT;
+					cmsg->cmsg_len = CMSG_LEN(sizeof(segment_size));
+					std::memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+				}
+			}
+
+			const int result = ::sendmmsg(shard->socket.native_handle(), &messages[0], static_cast<unsigned int>(count), MSG_DONTWAIT);
+
+			if (result < 0)
+			{
+				const int error = errno;
+
+				if ((error == EAGAIN) || (error == EWOULDBLOCK))
+				{
+					// The send buffer is full: we resume once the socket is writable again.
+					shard->socket.async_send(
+						boost::asio::null_buffers(),
+						shard->socket_strand.wrap(
+							boost::bind(
+								&server::handle_write_batch_ready,
+								this,
+								shard,
+								batch,
+								offset,
+								boost::asio::placeholders::error
+							)
+						)
+					);
+
+					return;
+				}
+
+				if (write_counts[0] > 1)
+				{
+					if ((error == EIO) || (error == EINVAL) || (error == EOPNOTSUPP))
+					{
+						// The socket or the network device can't segment: we stop using the offload on this socket.
+						shard->gso_enabled = false;
+					}
+
+					// Whatever the error, the datagrams are sent again one by one so that only the faulty ones get reported.
+					segment = false;
+
+					continue;
+				}
+
+				// The first datagram of the batch could not be sent: we report it and carry on with the next ones.
+				complete_write((*batch)[offset], boost::system::error_code(error, boost::system::system_category()), 0);
+
+				++offset;
+			}
+			else
+			{
+				for (int i = 0; i < result; ++i)
+				{
+					for (size_t j = 0; j < write_counts[i]; ++j)
+					{
+						const pending_write_type& write = (*batch)[offset + j];
+
+						complete_write(write, boost::system::error_code(), buffer_size(write.data));
+					}
+
+					offset += write_counts[i];
+				}
+			}
+		}
+#else
+		static_cast<void>(shard);
+		static_cast<void>(offset);
+
+		// Batches are only made on Linux.
+		assert(false);
+#endif
+
+		shard->write_queue_strand.post(boost::bind(&server::pop_write, this, shard));
+	}
+
+	size_t server::get_segment_count(const pending_write_batch_type& batch, size_t index)
+	{
+#ifdef __linux__
+		const pending_write_type& first = batch[index];
+		const size_t segment_size = buffer_size(first.data);
+		size_t total_size = segment_size;
+		size_t count = 1;
+
+		// Only the consecutive datagrams to the same target can be coalesced, and all but the last must have the same size.
+		while ((index + count < batch.size()) && (count < MAX_UDP_SEGMENT_COUNT))
+		{
+			const pending_write_type& write = batch[index + count];
+			const size_t size = buffer_size(write.data);
+
+			if ((write.target != first.target) || (size == 0) || (size > segment_size) || (total_size + size > MAX_UDP_PAYLOAD_SIZE))
+			{
+				break;
+			}
+
+			total_size += size;
+			++count;
+
+			if (size < segment_size)
+			{
+				break;
+			}
+		}
+
+		return count;
+#else
+		static_cast<void>(batch);
+		static_cast<void>(index);
+
+		return 1;
+#endif
+	}
+
+	void server::handle_write_batch_ready(socket_shard_ptr shard, boost::shared_ptr<pending_write_batch_type> batch, size_t offset, const boost::system::error_code& ec)
+	{
+		if (ec)
+		{
+			for (; offset < batch->size(); ++offset)
+			{
+				complete_write((*batch)[offset], ec, 0);
+			}
+
+			shard->write_queue_strand.post(boost::bind(&server::pop_write, this, shard));
+
+			return;
+		}
+
+		do_write_batch(shard, batch, offset);
+	}
+
+	void server::complete_write(const pending_write_type& write, const boost::system::error_code& ec, size_t bytes_transferred)
+	{
+		// The handlers are posted so that they are never invoked from within the socket strand, as with a regular async_send_to().
+		get_io_service().post(boost::bind(write.handler, ec, bytes_transferred));
+	}
+
+	server::ep_type server::to_socket_format(const server::ep_type& ep)
+	{
+#ifdef WINDOWS
+		if (get_socket().local_endpoint().address().is_v6() && ep.address().is_v4())
+		{
+			return server::ep_type(boost::asio::ip::address_v6::v4_mapped(ep.address().to_v4()), ep.port());
+		}
+		else
+		{
+			return ep;
+		}
+#else
+		static_cast<void>(socket);
+
+		return ep;
+#endif
+	}
+
+	size_t server::get_socket_index_for(const ep_type& target) const
+	{
+		if (m_socket_shards.size() == 1)
+		{
+			return 0;
+		}
+
+		// Until we receive traffic from a peer, we don't know which socket the kernel picked for it: we just make sure to always use the same.
+		size_t hash = target.port();
+
+		if (target.address().is_v4())
+		{
+			hash ^= target.address().to_v4().to_ulong();
+		}
+		else
+		{
+			for (auto&& byte : target.address().to_v6().to_bytes())
+			{
+				hash = hash * 31 + byte;
+			}
+		}
+
+		return hash % m_socket_shards.size();
+	}
+
+	size_t server::get_socket_index_for(const peer_session& p_session, const ep_type& target) const
+	{
+		const boost::optional<size_t> socket_index = p_session.socket_index();
+
+		// The server may have been reopened with less sockets since the traffic was received.
+		if (socket_index && (*socket_index < m_socket_shards.size()))
+		{
+			return *socket_index;
+		}
+
+		return get_socket_index_for(target);
+	}
+
+	size_t server::get_socket_index_for(const peer_session::current_session_type& session, const ep_type& target) const
+	{
+		const size_t socket_index = session.socket_index;
+
+		if (socket_index < m_socket_shards.size())
+		{
+			return socket_index;
+		}
+
+		return get_socket_index_for(target);
+	}
+
+	uint32_t server::ep_hello_context_type::generate_unique_number()
+	{
+		// The first call to this function is *NOT* thread-safe in C++03 !
+		static boost::mt19937 rng(static_cast<uint32_t>(time(0)));
+
+		return rng();
+	}
+
+	server::ep_hello_context_type::ep_hello_context_type() :
+		m_current_hello_unique_number(generate_unique_number())
+	{
+	}
+
+	uint32_t server::ep_hello_context_type::next_hello_unique_number()
+	{
+		return m_current_hello_unique_number++;
+	}
+
+	template <typename WaitHandler>
+	void server::ep_hello_context_type::async_wait_reply(timer_wheel& wheel, uint32_t hello_unique_number, const boost::posix_time::time_duration& timeout, WaitHandler handler)
+	{
+		pending_request_status& request = m_pending_requests[hello_unique_number];
+
+		request = pending_request_status();
+
+		// The wheel can't call the handler before we return so that the identifier is always set in time.
+		request.timer = wheel.async_wait(timeout, handler);
+	}
+
+	bool server::ep_hello_context_type::cancel_reply_wait(timer_wheel& wheel, uint32_t hello_unique_number, bool success)
+	{
+		pending_requests_map::iterator request = m_pending_requests.find(hello_unique_number);
+
+		if (request != m_pending_requests.end())
+		{
+			if (wheel.cancel(request->second.timer))
+			{
+				// At least one handler was cancelled which means we can set the success flag.
+				request->second.success = success;
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void server::ep_hello_context_type::cancel_all_reply_wait(timer_wheel& wheel)
+	{
+		for (pending_requests_map::iterator request = m_pending_requests.begin(); request != m_pending_requests.end(); ++request)
+		{
+			if (wheel.cancel(request->second.timer))
+			{
+				// At least one handler was cancelled which means we can set the success flag.
+				request->second.success = false;
 			}
 		}
 	}
@@ -1107,7 +1851,7 @@ namespace fscp
 
 	void server::do_greet(const ep_type& target, duration_handler_type handler, const boost::posix_time::time_duration& timeout)
 	{
-		if (!m_socket.is_open())
+		if (!get_socket().is_open())
 		{
 			handler(server_error::server_offline, boost::posix_time::time_duration());
 
@@ -1159,7 +1903,7 @@ namespace fscp
 		// All do_greet() calls are done in the same strand so the following is thread-safe.
 		ep_hello_context_type& ep_hello_context = m_ep_hello_contexts[target];
 
-		ep_hello_context.async_wait_reply(get_io_service(), hello_unique_number, timeout, m_greet_strand.wrap(boost::bind(&server::do_greet_timeout, this, target, hello_unique_number, handler, _1)));
+		ep_hello_context.async_wait_reply(m_timer_wheel, hello_unique_number, timeout, m_greet_strand.wrap(boost::bind(&server::do_greet_timeout, this, target, hello_unique_number, handler, _1)));
 	}
 
 	void server::do_greet_timeout(const ep_type& target, uint32_t hello_unique_number, duration_handler_type handler, const boost::system::error_code& ec)
@@ -1198,7 +1942,7 @@ namespace fscp
 		// All do_cancel_all_greetings() calls are done in the same strand so the following is thread-safe.
 		for (ep_hello_context_map::iterator hello_context = m_ep_hello_contexts.begin(); hello_context != m_ep_hello_contexts.end(); ++hello_context)
 		{
-			hello_context->second.cancel_all_reply_wait();
+			hello_context->second.cancel_all_reply_wait(m_timer_wheel);
 		}
 	}
 
@@ -1267,7 +2011,7 @@ namespace fscp
 		// All do_handle_hello_response() calls are done in the same strand so the following is thread-safe.
 		ep_hello_context_type& ep_hello_context = m_ep_hello_contexts[sender];
 
-		ep_hello_context.cancel_reply_wait(hello_unique_number, true);
+		ep_hello_context.cancel_reply_wait(m_timer_wheel, hello_unique_number, true);
 	}
 
 	void server::do_set_accept_hello_messages_default(bool value, void_handler_type handler)
@@ -1275,20 +2019,59 @@ namespace fscp
 		// All do_set_accept_hello_messages_default() calls are done in the same strand so the following is thread-safe.
 		set_accept_hello_messages_default(value);
 
-		if (handler)
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_hello_message_received_callback(hello_message_received_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
+		set_hello_message_received_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::store_presentation(const ep_type& target, const presentation_store& _presentation_store)
+	{
+		// This method should only be called from within the presentation strand.
+		erase_presentation(target);
+
+		m_presentation_store_map[target] = _presentation_store;
+
+		if (!_presentation_store.empty())
 		{
-			handler();
+			m_presentation_index[_presentation_store.signature_certificate_hash()].insert(target);
 		}
 	}
 
-	void server::do_set_hello_message_received_callback(hello_message_received_handler_type callback, void_handler_type handler)
+	void server::erase_presentation(const ep_type& target)
 	{
-		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
-		set_hello_message_received_callback(callback);
+		// This method should only be called from within the presentation strand.
+		const presentation_store_map::iterator entry = m_presentation_store_map.find(target);
 
-		if (handler)
+		if (entry != m_presentation_store_map.end())
 		{
-			handler();
+			if (!entry->second.empty())
+			{
+				const presentation_index_map::iterator index_entry = m_presentation_index.find(entry->second.signature_certificate_hash());
+
+				if (index_entry != m_presentation_index.end())
+				{
+					index_entry->second.erase(target);
+
+					if (index_entry->second.empty())
+					{
+						m_presentation_index.erase(index_entry);
+					}
+				}
+			}
+
+			m_presentation_store_map.erase(entry);
 		}
 	}
 
@@ -1308,7 +2091,7 @@ namespace fscp
 	void server::do_introduce_to(const ep_type& target, simple_handler_type handler)
 	{
 		// All do_introduce_to() calls are done in the same strand so the following is thread-safe.
-		if (!m_socket.is_open())
+		if (!get_socket().is_open())
 		{
 			handler(server_error::server_offline);
 
@@ -1413,6 +2196,23 @@ namespace fscp
 	void server::do_handle_presentation(const ep_type& sender, bool has_session, cert_type signature_certificate)
 	{
 		// All do_handle_presentation() calls are done in the same strand so the following is thread-safe.
+		handle_presentation(sender, has_session, signature_certificate, m_presentation_message_received_handler);
+	}
+
+	void server::do_handle_validated_presentation(const ep_type& sender, bool has_session, cert_type signature_certificate, presentation_message_received_handler_type handler)
+	{
+		// All do_handle_validated_presentation() calls are done in the same strand so the following is thread-safe.
+		if (!get_socket().is_open())
+		{
+			// The server was closed while the certificate was being validated.
+			return;
+		}
+
+		handle_presentation(sender, has_session, signature_certificate, handler);
+	}
+
+	void server::handle_presentation(const ep_type& sender, bool has_session, cert_type signature_certificate, const presentation_message_received_handler_type& handler)
+	{
 		presentation_status_type presentation_status = PS_FIRST;
 
 		const presentation_store_map::iterator entry = m_presentation_store_map.find(sender);
@@ -1429,15 +2229,15 @@ namespace fscp
 			}
 		}
 
-		if (m_presentation_message_received_handler)
+		if (handler)
 		{
-			if (!m_presentation_message_received_handler(sender, signature_certificate, presentation_status, has_session))
+			if (!handler(sender, signature_certificate, presentation_status, has_session))
 			{
 				return;
 			}
 		}
 
-		m_presentation_store_map[sender] = presentation_store(signature_certificate);
+		store_presentation(sender, presentation_store(signature_certificate));
 	}
 
 	void server::do_set_presentation_message_received_callback(presentation_message_received_handler_type callback, void_handler_type handler)
@@ -1481,7 +2281,7 @@ namespace fscp
 	void server::do_request_session(const identity_store& identity, const ep_type& target, simple_handler_type handler)
 	{
 		// All do_request_session() calls are done in the session strand so the following is thread-safe.
-		if (!m_socket.is_open())
+		if (!get_socket().is_open())
 		{
 			handler(server_error::server_offline);
 
@@ -1497,36 +2297,121 @@ namespace fscp
 			return;
 		}
 
-		const socket_memory_pool::shared_buffer_type send_buffer = m_socket_memory_pool.allocate_shared_buffer();
+		const session_number_type session_number = p_session.next_session_number();
+		const identity_store::key_type signature_key = identity.signature_key();
 
 		try
 		{
-			const size_t size = session_request_message::write(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				p_session.next_session_number(),
+			// Retransmitted requests are replayed from the cache: signing is only done when the parameters change.
+			const boost::optional<const cryptoplus::buffer&> signed_message = p_session.signed_session_request_message(session_number, m_cipher_suites, m_elliptic_curves, signature_key);
+
+			if (signed_message && (buffer_size(*signed_message) <= m_socket_memory_pool.block_size()))
+			{
+				const socket_memory_pool::shared_buffer_type send_buffer = m_socket_memory_pool.allocate_shared_buffer();
+				const size_t size = buffer_size(*signed_message);
+
+				std::memcpy(buffer_cast<uint8_t*>(send_buffer), buffer_cast<const uint8_t*>(*signed_message), size);
+
+				async_send_to(
+					buffer(send_buffer, size),
+					target,
+					make_shared_buffer_handler(
+						send_buffer,
+						boost::bind(
+							handler,
+							boost::asio::placeholders::error
+						)
+					)
+				);
+
+				return;
+			}
+		}
+		catch (const cryptoplus::error::cryptographic_exception&)
+		{
+			handler(server_error::cryptographic_error);
+
+			return;
+		}
+
+		// Signing is expensive: it is done by the handshake workers, which hand the message back to the session strand.
+		const bool posted = post_handshake_task(
+			boost::bind(
+				&server::do_sign_session_request,
+				this,
+				target,
+				session_number,
 				p_session.local_host_identifier(),
 				m_cipher_suites,
 				m_elliptic_curves,
-				identity.signature_key()
-			);
+				signature_key,
+				handler
+			),
+			[this, handler](std::exception_ptr) {
+				m_session_strand.post(boost::bind(handler, boost::system::error_code(server_error::cryptographic_error)));
+			}
+		);
 
-			async_send_to(
-				buffer(send_buffer, size),
-				target,
-				make_shared_buffer_handler(
-					send_buffer,
-					boost::bind(
-						handler,
-						boost::asio::placeholders::error
-					)
-				)
+		if (!posted)
+		{
+			handler(server_error::handshake_queue_full);
+		}
+	}
+
+	void server::do_sign_session_request(const ep_type& target, session_number_type session_number, host_identifier_type local_host_identifier, cipher_suite_list_type cipher_suites, elliptic_curve_list_type elliptic_curves, identity_store::key_type signature_key, simple_handler_type handler)
+	{
+		// All do_sign_session_request() calls are done in the handshake workers so this must not access the server state.
+		const socket_memory_pool::shared_buffer_type send_buffer = m_socket_memory_pool.allocate_shared_buffer();
+		size_t size = 0;
+
+		try
+		{
+			size = session_request_message::write(
+				buffer_cast<uint8_t*>(send_buffer),
+				buffer_size(send_buffer),
+				session_number,
+				local_host_identifier,
+				cipher_suites,
+				elliptic_curves,
+				signature_key
 			);
 		}
 		catch (const cryptoplus::error::cryptographic_exception&)
 		{
-			handler(server_error::cryptographic_error);
+			m_session_strand.post(boost::bind(handler, boost::system::error_code(server_error::cryptographic_error)));
+
+			return;
+		}
+
+		m_session_strand.post(boost::bind(&server::do_send_signed_session_request, this, target, session_number, cipher_suites, elliptic_curves, signature_key, send_buffer, size, handler));
+	}
+
+	void server::do_send_signed_session_request(const ep_type& target, session_number_type session_number, cipher_suite_list_type cipher_suites, elliptic_curve_list_type elliptic_curves, identity_store::key_type signature_key, socket_memory_pool::shared_buffer_type send_buffer, size_t size, simple_handler_type handler)
+	{
+		// All do_send_signed_session_request() calls are done in the session strand so the following is thread-safe.
+		peer_session& p_session = m_peer_sessions[target];
+
+		if (p_session.has_current_session())
+		{
+			// The session was established while the request was being signed.
+			handler(server_error::session_already_exist);
+
+			return;
 		}
+
+		p_session.set_signed_session_request_message(session_number, cipher_suites, elliptic_curves, signature_key, buffer_cast<const uint8_t*>(send_buffer), size);
+
+		async_send_to(
+			buffer(send_buffer, size),
+			target,
+			make_shared_buffer_handler(
+				send_buffer,
+				boost::bind(
+					handler,
+					boost::asio::placeholders::error
+				)
+			)
+		);
 	}
 
 	void server::do_close_session(const ep_type& target, simple_handler_type handler)
@@ -1535,6 +2420,8 @@ namespace fscp
 
 		if (m_peer_sessions[target].clear())
 		{
+			publish_current_session(target, m_peer_sessions[target]);
+
 			handler(server_error::success);
 
 			if (m_session_lost_handler)
@@ -1559,8 +2446,27 @@ namespace fscp
 			return;
 		}
 
+		// Checking the signature is expensive: it is done by the handshake workers so that it doesn't hold the strands.
+		post_handshake_task(
+			boost::bind(
+				&server::do_verify_session_request,
+				this,
+				data,
+				identity,
+				sender,
+				_session_request_message,
+				m_presentation_store_map[sender].signature_certificate()
+			),
+			make_handshake_error_handler(sender)
+		);
+	}
+
+	void server::do_verify_session_request(socket_memory_pool::shared_buffer_type data, const identity_store& identity, const ep_type& sender, const session_request_message& _session_request_message, cert_type signature_certificate)
+	{
+		// All do_verify_session_request() calls are done in the handshake workers so this must not access the server state.
+
 		// We make sure the signatures matches.
-		if (!_session_request_message.check_signature(m_presentation_store_map[sender].signature_certificate().public_key()))
+		if (!_session_request_message.check_signature(signature_certificate.public_key()))
 		{
 			return;
 		}
@@ -1593,6 +2499,8 @@ namespace fscp
 			return;
 		}
 
+		schedule_keep_alive(sender, p_session);
+
 		const cipher_suite_list_type cipher_suites = _session_request_message.cipher_suite_capabilities();
 		const elliptic_curve_list_type elliptic_curves = _session_request_message.elliptic_curve_capabilities();
 		const cipher_suite_type calg = get_first_common_supported_cipher_suite(m_cipher_suites, cipher_suites);
@@ -1613,24 +2521,128 @@ namespace fscp
 
 		if (can_reply)
 		{
-			if (!p_session.has_current_session())
-			{
-				p_session.prepare_session(_session_request_message.session_number(), calg, ec);
-				do_send_session(identity, sender, p_session.next_session_parameters());
-			}
-			else
+			const session_number_type session_number = _session_request_message.session_number();
+
+			if (!p_session.has_current_session() || (session_number > p_session.current_session().parameters.session_number))
 			{
-				if (_session_request_message.session_number() > p_session.current_session().parameters.session_number)
+				if (p_session.has_next_session(session_number, calg, ec))
 				{
-					// A new session is requested. Sending a new message.
-					p_session.prepare_session(_session_request_message.session_number(), calg, ec);
+					// The requested session is already prepared: sending the same message.
 					do_send_session(identity, sender, p_session.next_session_parameters());
 				}
-				else
+				else if (!p_session.has_pending_handshake())
 				{
-					// An old session is requested: sending the same message.
-					do_send_session(identity, sender, p_session.current_session_parameters());
+					// A new session is requested. Generating its ephemeral key is expensive: this is done by the handshake workers, which will send a new message.
+					p_session.set_pending_handshake(true);
+
+					if (!post_handshake_task(boost::bind(&server::do_prepare_session, this, identity, sender, p_session.handshake_generation(), session_number, calg, ec), make_handshake_error_handler(sender, p_session.handshake_generation())))
+					{
+						p_session.set_pending_handshake(false);
+					}
 				}
+
+				// Otherwise, a handshake is already being computed for this host: the request will be sent again.
+			}
+			else
+			{
+				// An old session is requested: sending the same message.
+				do_send_session(identity, sender, p_session.current_session_parameters());
+			}
+		}
+	}
+
+	void server::do_prepare_session(const identity_store& identity, const ep_type& sender, uint64_t handshake_generation, session_number_type session_number, cipher_suite_type calg, elliptic_curve_type ec)
+	{
+		// All do_prepare_session() calls are done in the handshake workers so this must not access the server state.
+		peer_session::next_session_ptr next_session;
+
+		try
+		{
+			next_session = boost::make_shared<peer_session::next_session_type>(session_number, calg, ec);
+		}
+		catch (const std::exception&)
+		{
+			// The session can't be prepared: the pending handshake is simply cleared.
+		}
+
+		m_session_strand.post(boost::bind(&server::do_handle_prepared_session, this, identity, sender, handshake_generation, next_session));
+	}
+
+	void server::do_handle_prepared_session(const identity_store& identity, const ep_type& sender, uint64_t handshake_generation, peer_session::next_session_ptr next_session)
+	{
+		// All do_handle_prepared_session() calls are done in the session strand so the following is thread-safe.
+		peer_session& p_session = m_peer_sessions[sender];
+
+		if (p_session.handshake_generation() != handshake_generation)
+		{
+			// The session was cleared in the meantime.
+			return;
+		}
+
+		p_session.set_pending_handshake(false);
+
+		if (!next_session)
+		{
+			return;
+		}
+
+		if (p_session.has_current_session() && (next_session->parameters.session_number <= p_session.current_session().parameters.session_number))
+		{
+			// The session was established in the meantime: sending the same message.
+			do_send_session(identity, sender, p_session.current_session_parameters());
+
+			return;
+		}
+
+		p_session.prepare_session(next_session);
+		do_send_session(identity, sender, p_session.next_session_parameters());
+	}
+
+	bool server::post_handshake_task(worker_pool::task_type task, worker_pool::error_handler_type error_handler)
+	{
+		// The handshake pool is only created when the server is opened, before any message can be received.
+		return (m_handshake_pool && m_handshake_pool->post(task, error_handler));
+	}
+
+	worker_pool::error_handler_type server::make_handshake_error_handler(const ep_type& host, boost::optional<uint64_t> handshake_generation)
+	{
+		// The error handler is called in the handshake workers: the error is handled in the session strand.
+		return [this, host, handshake_generation](std::exception_ptr error) {
+			m_session_strand.post(boost::bind(&server::do_handle_handshake_error, this, host, handshake_generation, error));
+		};
+	}
+
+	void server::do_handle_handshake_error(const ep_type& host, boost::optional<uint64_t> handshake_generation, std::exception_ptr error)
+	{
+		// All do_handle_handshake_error() calls are done in the session strand so the following is thread-safe.
+		bool session_is_new = true;
+
+		const auto p_session = m_peer_sessions.find(host);
+
+		if (p_session != m_peer_sessions.end())
+		{
+			// The failed task won't complete the handshake: a new one must be allowed to start.
+			if (handshake_generation && (p_session->second.handshake_generation() == *handshake_generation))
+			{
+				p_session->second.set_pending_handshake(false);
+			}
+
+			session_is_new = !p_session->second.has_current_session();
+		}
+
+		if (m_session_error_handler)
+		{
+			try
+			{
+				std::rethrow_exception(error);
+			}
+			catch (const std::exception& ex)
+			{
+				m_session_error_handler(host, session_is_new, ex);
+			}
+			catch (...)
+			{
+				m_session_error_handler(host, session_is_new, std::runtime_error("Unknown handshake error"));
 			}
 		}
 	}
@@ -1676,6 +2688,21 @@ namespace fscp
 		handler(has_session_with_endpoint(host));
 	}
 
+	void server::do_get_replay_statistics(const ep_type& host, replay_statistics_handler_type handler)
+	{
+		// All do_get_replay_statistics() calls are done in the same strand so the following is thread-safe.
+		const auto p_session = m_peer_sessions.find(host);
+
+		if (p_session != m_peer_sessions.end())
+		{
+			handler(p_session->second.replay_statistics());
+		}
+		else
+		{
+			handler(replay_statistics_type());
+		}
+	}
+
 	void server::do_set_accept_session_request_messages_default(bool value, void_handler_type handler)
 	{
 		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
@@ -1709,6 +2736,17 @@ namespace fscp
 		}
 	}
 
+	void server::do_set_replay_window_size(size_t replay_window_size, void_handler_type handler)
+	{
+		// All do_set_replay_window_size() calls are done in the same strand so the following is thread-safe.
+		set_replay_window_size(replay_window_size);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
 	void server::do_set_session_request_message_received_callback(session_request_received_handler_type callback, void_handler_type handler)
 	{
 		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
@@ -1720,46 +2758,127 @@ namespace fscp
 		}
 	}
 
+	void server::publish_current_session(const ep_type& host, const peer_session& p_session)
+	{
+		// All publish_current_session() calls are done in the session strand so the following is thread-safe.
+		const boost::shared_ptr<session_table_type> session_table = boost::make_shared<session_table_type>(*boost::atomic_load(&m_session_table));
+
+		if (p_session.has_current_session())
+		{
+			(*session_table)[host] = p_session.current_session_pointer();
+		}
+		else
+		{
+			session_table->erase(host);
+		}
+
+		// The threads that still hold the previous table may finish their message with the previous session.
+		boost::atomic_store(&m_session_table, session_table_ptr_type(session_table));
+	}
+
 	void server::do_send_session(const identity_store& identity, const ep_type& target, const peer_session::session_parameters& parameters)
 	{
 		// All do_send_session() calls are done in the session strand so the following is thread-safe.
 
 		peer_session& p_session = m_peer_sessions[target];
 
-		const socket_memory_pool::shared_buffer_type send_buffer = m_socket_memory_pool.allocate_shared_buffer();
+		const identity_store::key_type signature_key = identity.signature_key();
 
 		try
 		{
-			const size_t size = session_message::write(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				parameters.session_number,
-				p_session.local_host_identifier(),
-				parameters.cipher_suite,
-				parameters.elliptic_curve,
-				buffer_cast<const void*>(parameters.public_key),
-				buffer_size(parameters.public_key),
-				identity.signature_key()
-			);
+			// A peer that missed our SESSION message gets the very same bytes again: signing is only done when the parameters change.
+			const boost::optional<const cryptoplus::buffer&> signed_message = p_session.signed_session_message(parameters, signature_key);
 
-			async_send_to(
-				buffer(send_buffer, size),
-				target,
-				make_shared_buffer_handler(
-					send_buffer,
-					boost::bind(
-						&server::handle_send_to,
-						this,
-						boost::asio::placeholders::error,
-						boost::asio::placeholders::bytes_transferred
+			if (signed_message && (buffer_size(*signed_message) <= m_socket_memory_pool.block_size()))
+			{
+				const socket_memory_pool::shared_buffer_type send_buffer = m_socket_memory_pool.allocate_shared_buffer();
+				const size_t size = buffer_size(*signed_message);
+
+				std::memcpy(buffer_cast<uint8_t*>(send_buffer), buffer_cast<const uint8_t*>(*signed_message), size);
+
+				async_send_to(
+					buffer(send_buffer, size),
+					target,
+					make_shared_buffer_handler(
+						send_buffer,
+						boost::bind(
+							&server::handle_send_to,
+							this,
+							boost::asio::placeholders::error,
+							boost::asio::placeholders::bytes_transferred
+						)
 					)
-				)
+				);
+
+				return;
+			}
+		}
+		catch (const cryptoplus::error::cryptographic_exception&)
+		{
+			return;
+		}
+
+		// Signing is expensive: it is done by the handshake workers. If the queue is full, the peer will send its message again.
+		post_handshake_task(
+			boost::bind(
+				&server::do_sign_session,
+				this,
+				target,
+				parameters,
+				p_session.local_host_identifier(),
+				signature_key
+			),
+			make_handshake_error_handler(target)
+		);
+	}
+
+	void server::do_sign_session(const ep_type& target, peer_session::session_parameters parameters, host_identifier_type local_host_identifier, identity_store::key_type signature_key)
+	{
+		// All do_sign_session() calls are done in the handshake workers so this must not access the server state.
+		const socket_memory_pool::shared_buffer_type send_buffer = m_socket_memory_pool.allocate_shared_buffer();
+		size_t size = 0;
+
+		try
+		{
+			size = session_message::write(
+				buffer_cast<uint8_t*>(send_buffer),
+				buffer_size(send_buffer),
+				parameters.session_number,
+				local_host_identifier,
+				parameters.cipher_suite,
+				parameters.elliptic_curve,
+				buffer_cast<const void*>(parameters.public_key),
+				buffer_size(parameters.public_key),
+				signature_key
 			);
 		}
 		catch (const cryptoplus::error::cryptographic_exception&)
 		{
 			// Do nothing.
+			return;
 		}
+
+		m_session_strand.post(boost::bind(&server::do_send_signed_session, this, target, parameters, signature_key, send_buffer, size));
+	}
+
+	void server::do_send_signed_session(const ep_type& target, peer_session::session_parameters parameters, identity_store::key_type signature_key, socket_memory_pool::shared_buffer_type send_buffer, size_t size)
+	{
+		// All do_send_signed_session() calls are done in the session strand so the following is thread-safe.
+		m_peer_sessions[target].set_signed_session_message(parameters, signature_key, buffer_cast<const uint8_t*>(send_buffer), size);
+
+		async_send_to(
+			buffer(send_buffer, size),
+			target,
+			make_shared_buffer_handler(
+				send_buffer,
+				boost::bind(
+					&server::handle_send_to,
+					this,
+					boost::asio::placeholders::error,
+					boost::asio::placeholders::bytes_transferred
+				)
+			)
+		);
 	}
 
 	void server::do_handle_session(socket_memory_pool::shared_buffer_type data, const identity_store& identity, const ep_type& sender, const session_message& _session_message)
@@ -1774,8 +2893,27 @@ namespace fscp
 			return;
 		}
 
+		// Checking the signature is expensive: it is done by the handshake workers so that it doesn't hold the strands.
+		post_handshake_task(
+			boost::bind(
+				&server::do_verify_session,
+				this,
+				data,
+				identity,
+				sender,
+				_session_message,
+				m_presentation_store_map[sender].signature_certificate()
+			),
+			make_handshake_error_handler(sender)
+		);
+	}
+
+	void server::do_verify_session(socket_memory_pool::shared_buffer_type data, const identity_store& identity, const ep_type& sender, const session_message& _session_message, cert_type signature_certificate)
+	{
+		// All do_verify_session() calls are done in the handshake workers so this must not access the server state.
+
 		// We make sure the signatures matches.
-		if (!_session_message.check_signature(m_presentation_store_map[sender].signature_certificate().public_key()))
+		if (!_session_message.check_signature(signature_certificate.public_key()))
 		{
 			return;
 		}
@@ -1805,6 +2943,8 @@ namespace fscp
 			return;
 		}
 
+		schedule_keep_alive(sender, p_session);
+
 		if (_session_message.cipher_suite() == cipher_suite_type::unsupported)
 		{
 			return;
@@ -1852,41 +2992,100 @@ namespace fscp
 
 		if (can_accept)
 		{
-			bool session_completed = true;
-
-			try
+			if (p_session.has_pending_handshake())
 			{
-				if (!p_session.complete_session(_session_message.public_key(), _session_message.public_key_size()))
-				{
-					// We received a session message but no session was prepared yet: we issue one and retry.
-					p_session.prepare_session(_session_message.session_number(), _session_message.cipher_suite(), _session_message.elliptic_curve());
+				// A handshake is already being computed for this host: the session message will be sent again.
+				return;
+			}
+
+			// Deriving the session keys is expensive: this is done by the handshake workers.
+			const uint64_t handshake_generation = p_session.handshake_generation();
+			const peer_session::next_session_ptr next_session = p_session.next_session();
+			const session_number_type session_number = _session_message.session_number();
+			const cipher_suite_type cipher_suite = _session_message.cipher_suite();
+			const elliptic_curve_type elliptic_curve = _session_message.elliptic_curve();
+			const cryptoplus::buffer remote_public_key(_session_message.public_key(), _session_message.public_key_size());
+			const host_identifier_type local_host_identifier = p_session.local_host_identifier();
+			const host_identifier_type remote_host_identifier = *p_session.remote_host_identifier();
+			const size_t replay_window_size = m_replay_window_size;
+
+			p_session.set_pending_handshake(true);
+
+			const bool posted = post_handshake_task([=]() {
+				peer_session::next_session_ptr _next_session = next_session;
+				peer_session::current_session_ptr current_session;
+				std::exception_ptr error;
 
-					if (!p_session.complete_session(_session_message.public_key(), _session_message.public_key_size()))
+				try
+				{
+					if (!_next_session)
 					{
-						// Unable to complete the session.
-						return;
+						// We received a session message but no session was prepared yet: we issue one.
+						_next_session = boost::make_shared<peer_session::next_session_type>(session_number, cipher_suite, elliptic_curve);
 					}
+
+					current_session = peer_session::derive_session(*_next_session, local_host_identifier, remote_host_identifier, remote_public_key, replay_window_size);
+				}
+				catch (const std::exception&)
+				{
+					error = std::current_exception();
 				}
+
+				m_session_strand.post(boost::bind(&server::do_handle_completed_session, this, identity, sender, handshake_generation, _next_session, current_session, error));
+			}, make_handshake_error_handler(sender, handshake_generation));
+
+			if (!posted)
+			{
+				p_session.set_pending_handshake(false);
+			}
+		}
+	}
+
+	void server::do_handle_completed_session(const identity_store& identity, const ep_type& sender, uint64_t handshake_generation, peer_session::next_session_ptr next_session, peer_session::current_session_ptr current_session, std::exception_ptr error)
+	{
+		// All do_handle_completed_session() calls are done in the session strand so the following is thread-safe.
+		peer_session& p_session = m_peer_sessions[sender];
+
+		if (p_session.handshake_generation() != handshake_generation)
+		{
+			// The session was cleared in the meantime.
+			return;
+		}
+
+		p_session.set_pending_handshake(false);
+
+		const bool session_is_new = !p_session.has_current_session();
+
+		if (error)
+		{
+			try
+			{
+				std::rethrow_exception(error);
 			}
 			catch (const std::exception& ex)
 			{
-				session_completed = false;
-
 				if (m_session_error_handler)
 				{
 					m_session_error_handler(sender, session_is_new, ex);
 				}
 			}
 
-			if (session_completed)
-			{
-				do_send_session(identity, sender, p_session.current_session_parameters());
+			return;
+		}
 
-				if (m_session_established_handler)
-				{
-					m_session_established_handler(sender, session_is_new, p_session.current_session().parameters.cipher_suite, p_session.current_session().parameters.elliptic_curve);
-				}
-			}
+		if (!p_session.complete_session(next_session, current_session))
+		{
+			// Another session was prepared in the meantime: the session message will be sent again.
+			return;
+		}
+
+		publish_current_session(sender, p_session);
+
+		do_send_session(identity, sender, p_session.current_session_parameters());
+
+		if (m_session_established_handler)
+		{
+			m_session_established_handler(sender, session_is_new, p_session.current_session().parameters.cipher_suite, p_session.current_session().parameters.elliptic_curve);
 		}
 	}
 
@@ -1956,49 +3155,64 @@ namespace fscp
 		}
 	}
 
-	void server::do_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler)
+	void server::send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler)
 	{
-		// All do_send_data() calls are done in the session strand so the following is thread-safe.
-		peer_session& p_session = m_peer_sessions[target];
+		// send_data() is called from the caller's thread: the current sessions are looked up in the published table.
+		const session_table_ptr_type session_table = boost::atomic_load(&m_session_table);
+		const session_table_type::const_iterator entry = session_table->find(target);
+
+		if (entry == session_table->end())
+		{
+			get_io_service().post(boost::bind(handler, boost::system::error_code(get_socket().is_open() ? server_error::no_session_for_host : server_error::server_offline)));
+
+			return;
+		}
 
-		do_send_data_to_session(p_session, target, channel_number, data, handler);
+		send_data_to_session(*entry->second, target, channel_number, data, handler);
 	}
 
-	void server::do_send_data_to_list(const std::set<ep_type>& targets, channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
+	void server::send_data_to_list(const std::set<ep_type>& targets, channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
 	{
-		// All do_send_data_to_list() calls are done in the session strand so the following is thread-safe.
 		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
 
 		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
 
-		for (auto&& item: m_peer_sessions)
+		const session_table_ptr_type session_table = boost::atomic_load(&m_session_table);
+
+		for (auto&& target: targets)
 		{
-			if (targets.count(item.first) > 0)
+			const session_table_type::const_iterator entry = session_table->find(target);
+
+			if (entry != session_table->end())
+			{
+				send_data_to_session(*entry->second, target, channel_number, data, boost::bind(&results_gatherer_type::gather, rg, target, _1));
+			}
+			else
 			{
-				do_send_data_to_session(item.second, item.first, channel_number, data, boost::bind(&results_gatherer_type::gather, rg, item.first, _1));
+				get_io_service().post(boost::bind(&results_gatherer_type::gather, rg, target, boost::system::error_code(server_error::no_session_for_host)));
 			}
 		}
 	}
 
-	void server::do_send_data_to_all(channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
+	void server::send_data_to_all(channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
 	{
-		// All do_send_data_to_all() calls are done in the session strand so the following is thread-safe.
-		do_send_data_to_list(get_session_endpoints(), channel_number, data, handler);
-	}
+		const session_table_ptr_type session_table = boost::atomic_load(&m_session_table);
 
-	void server::do_send_data_to_session(peer_session& p_session, const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler)
-	{
-		// All do_send_data_to_session() calls are done in the session strand so the following is thread-safe.
-		if (!m_socket.is_open())
-		{
-			handler(server_error::server_offline);
+		std::set<ep_type> targets;
 
-			return;
+		for (auto&& entry: *session_table)
+		{
+			targets.insert(entry.first);
 		}
 
-		if (!p_session.has_current_session())
+		send_data_to_list(targets, channel_number, data, handler);
+	}
+
+	void server::send_data_to_session(peer_session::current_session_type& session, const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler)
+	{
+		if (!get_socket().is_open())
 		{
-			handler(server_error::no_session_for_host);
+			get_io_service().post(boost::bind(handler, boost::system::error_code(server_error::server_offline)));
 
 			return;
 		}
@@ -2007,21 +3221,27 @@ namespace fscp
 
 		try
 		{
-			const size_t size = data_message::write(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				channel_number,
-				p_session.increment_local_sequence_number(),
-				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
-				buffer_cast<const uint8_t*>(data),
-				buffer_size(data),
-				buffer_cast<const uint8_t*>(p_session.current_session().local_session_key),
-				buffer_size(p_session.current_session().local_session_key),
-				buffer_cast<const uint8_t*>(p_session.current_session().local_nonce_prefix),
-				buffer_size(p_session.current_session().local_nonce_prefix)
-			);
+			size_t size = 0;
+
+			{
+				// The sequence number and the cipher context of a session must be used by one sender at a time.
+				boost::mutex::scoped_lock lock(session.local_mutex);
+
+				size = data_message::write(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					channel_number,
+					session.increment_local_sequence_number(),
+					session.local_cipher_context,
+					buffer_cast<const uint8_t*>(data),
+					buffer_size(data),
+					buffer_cast<const uint8_t*>(session.local_nonce_prefix),
+					buffer_size(session.local_nonce_prefix)
+				);
+			}
 
 			async_send_to(
+				get_socket_index_for(session, target),
 				buffer(send_buffer, size),
 				target,
 				make_shared_buffer_handler(
@@ -2035,7 +3255,63 @@ namespace fscp
 		}
 		catch (const cryptoplus::error::cryptographic_exception&)
 		{
-			handler(server_error::cryptographic_error);
+			get_io_service().post(boost::bind(handler, boost::system::error_code(server_error::cryptographic_error)));
+		}
+	}
+
+	void server::send_data_in_place(const ep_type& target, channel_number_type channel_number, boost::asio::mutable_buffer _buffer, size_t data_len, simple_handler_type handler)
+	{
+		if (!get_socket().is_open())
+		{
+			get_io_service().post(boost::bind(handler, boost::system::error_code(server_error::server_offline)));
+
+			return;
+		}
+
+		const session_table_ptr_type session_table = boost::atomic_load(&m_session_table);
+		const session_table_type::const_iterator entry = session_table->find(target);
+
+		if (entry == session_table->end())
+		{
+			get_io_service().post(boost::bind(handler, boost::system::error_code(server_error::no_session_for_host)));
+
+			return;
+		}
+
+		peer_session::current_session_type& session = *entry->second;
+
+		try
+		{
+			size_t size = 0;
+
+			{
+				boost::mutex::scoped_lock lock(session.local_mutex);
+
+				size = data_message::write_in_place(
+					buffer_cast<uint8_t*>(_buffer),
+					buffer_size(_buffer),
+					channel_number,
+					session.increment_local_sequence_number(),
+					session.local_cipher_context,
+					data_len,
+					buffer_cast<const uint8_t*>(session.local_nonce_prefix),
+					buffer_size(session.local_nonce_prefix)
+				);
+			}
+
+			// The caller owns the buffer: it will remain valid until the handler is called.
+			async_send_to(
+				get_socket_index_for(session, target),
+				buffer(_buffer, size),
+				target,
+				[handler](const boost::system::error_code& ec, size_t) {
+					handler(ec);
+				}
+			);
+		}
+		catch (const cryptoplus::error::cryptographic_exception&)
+		{
+			get_io_service().post(boost::bind(handler, boost::system::error_code(server_error::cryptographic_error)));
 		}
 	}
 
@@ -2072,7 +3348,7 @@ namespace fscp
 	void server::do_send_contact_request_to_session(peer_session& p_session, const ep_type& target, const hash_list_type& hash_list, simple_handler_type handler)
 	{
 		// All do_send_contact_request_to_session() calls are done in the same strand so the following is thread-safe.
-		if (!m_socket.is_open())
+		if (!get_socket().is_open())
 		{
 			handler(server_error::server_offline);
 
@@ -2086,23 +3362,29 @@ namespace fscp
 			return;
 		}
 
+		peer_session::current_session_type& session = p_session.current_session();
 		const socket_memory_pool::shared_buffer_type send_buffer = m_socket_memory_pool.allocate_shared_buffer();
 
 		try
 		{
-			const size_t size = data_message::write_contact_request(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				p_session.increment_local_sequence_number(),
-				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
-				hash_list,
-				buffer_cast<const uint8_t*>(p_session.current_session().local_session_key),
-				buffer_size(p_session.current_session().local_session_key),
-				buffer_cast<const uint8_t*>(p_session.current_session().local_nonce_prefix),
-				buffer_size(p_session.current_session().local_nonce_prefix)
-			);
+			size_t size = 0;
+
+			{
+				boost::mutex::scoped_lock lock(session.local_mutex);
+
+				size = data_message::write_contact_request(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					session.increment_local_sequence_number(),
+					session.local_cipher_context,
+					hash_list,
+					buffer_cast<const uint8_t*>(session.local_nonce_prefix),
+					buffer_size(session.local_nonce_prefix)
+				);
+			}
 
 			async_send_to(
+				get_socket_index_for(p_session, target),
 				buffer(send_buffer, size),
 				target,
 				make_shared_buffer_handler(
@@ -2153,7 +3435,7 @@ namespace fscp
 	void server::do_send_contact_to_session(peer_session& p_session, const ep_type& target, const contact_map_type& contact_map, simple_handler_type handler)
 	{
 		// All do_send_contact_to_session() calls are done in the same strand so the following is thread-safe.
-		if (!m_socket.is_open())
+		if (!get_socket().is_open())
 		{
 			handler(server_error::server_offline);
 
@@ -2167,104 +3449,164 @@ namespace fscp
 			return;
 		}
 
-		const socket_memory_pool::shared_buffer_type send_buffer = m_socket_memory_pool.allocate_shared_buffer();
+		// The contacts are split so that no message exceeds the datagram size.
+		const size_t max_datagram_size = std::min(MAX_CONTACT_DATAGRAM_SIZE, m_socket_memory_pool.block_size());
+		peer_session::current_session_type& session = p_session.current_session();
+		const size_t max_cleartext_len = max_datagram_size - data_message::CLEARTEXT_OFFSET - session.local_cipher_context.algorithm().block_size();
 
-		try
+		std::vector<contact_map_type> contact_maps;
+		size_t cleartext_len = 0;
+
+		for (contact_map_type::const_iterator contact = contact_map.begin(); contact != contact_map.end(); ++contact)
 		{
-			const size_t size = data_message::write_contact(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				p_session.increment_local_sequence_number(),
-				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
-				contact_map,
-				buffer_cast<const uint8_t*>(p_session.current_session().local_session_key),
-				buffer_size(p_session.current_session().local_session_key),
-				buffer_cast<const uint8_t*>(p_session.current_session().local_nonce_prefix),
-				buffer_size(p_session.current_session().local_nonce_prefix)
-			);
+			const size_t contact_len = data_message::contact_size(*contact);
 
-			async_send_to(
-				buffer(send_buffer, size),
-				target,
-				make_shared_buffer_handler(
-					send_buffer,
-					boost::bind(
-						handler,
-						boost::asio::placeholders::error
-					)
-				)
-			);
+			if (contact_maps.empty() || ((cleartext_len + contact_len > max_cleartext_len) && !contact_maps.back().empty()))
+			{
+				contact_maps.push_back(contact_map_type());
+				cleartext_len = 0;
+			}
+
+			contact_maps.back().insert(*contact);
+			cleartext_len += contact_len;
 		}
-		catch (const cryptoplus::error::cryptographic_exception&)
+
+		typedef error_gatherer<simple_handler_type> error_gatherer_type;
+
+		const boost::shared_ptr<error_gatherer_type> eg = boost::make_shared<error_gatherer_type>(handler, contact_maps.size());
+
+		for (std::vector<contact_map_type>::const_iterator chunk = contact_maps.begin(); chunk != contact_maps.end(); ++chunk)
 		{
-			handler(server_error::cryptographic_error);
+			const socket_memory_pool::shared_buffer_type send_buffer = m_socket_memory_pool.allocate_shared_buffer();
+
+			try
+			{
+				size_t size = 0;
+
+				{
+					boost::mutex::scoped_lock lock(session.local_mutex);
+
+					size = data_message::write_contact(
+						buffer_cast<uint8_t*>(send_buffer),
+						buffer_size(send_buffer),
+						session.increment_local_sequence_number(),
+						session.local_cipher_context,
+						*chunk,
+						buffer_cast<const uint8_t*>(session.local_nonce_prefix),
+						buffer_size(session.local_nonce_prefix)
+					);
+				}
+
+				async_send_to(
+					get_socket_index_for(p_session, target),
+					buffer(send_buffer, size),
+					target,
+					make_shared_buffer_handler(
+						send_buffer,
+						boost::bind(
+							&error_gatherer_type::gather,
+							eg,
+							boost::asio::placeholders::error
+						)
+					)
+				);
+			}
+			catch (const cryptoplus::error::cryptographic_exception&)
+			{
+				eg->gather(server_error::cryptographic_error);
+			}
 		}
 	}
 
-	void server::do_handle_data(const identity_store& identity, const ep_type& sender, const data_message& _data_message)
+	void server::handle_data_from(size_t socket_index, const identity_store& identity, const ep_type& sender, const data_message& _data_message)
 	{
-		// All do_handle_data() calls are done in the same strand so the following is thread-safe.
-		peer_session& p_session = m_peer_sessions[sender];
-
-		if (!p_session.has_current_session())
-		{
-			return;
-		}
+		// handle_data_from() is called from the receiving thread: only the remote direction of the session is locked so that the shards decrypt in parallel.
+		const session_table_ptr_type session_table = boost::atomic_load(&m_session_table);
+		const session_table_type::const_iterator entry = session_table->find(sender);
 
-		if (_data_message.sequence_number() <= p_session.current_session().remote_sequence_number)
+		if (entry == session_table->end())
 		{
-			// The message is outdated: we ignore it.
 			return;
 		}
 
+		peer_session::current_session_type& session = *entry->second;
 		socket_memory_pool::shared_buffer_type cleartext_buffer = m_socket_memory_pool.allocate_shared_buffer();
+		size_t cleartext_len = 0;
+		bool is_old = false;
 
-		try
 		{
-			const size_t cleartext_len = _data_message.get_cleartext(
-				buffer_cast<uint8_t*>(cleartext_buffer),
-				buffer_size(cleartext_buffer),
-				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
-				buffer_cast<const uint8_t*>(p_session.current_session().remote_session_key),
-				buffer_size(p_session.current_session().remote_session_key),
-				buffer_cast<const uint8_t*>(p_session.current_session().remote_nonce_prefix),
-				buffer_size(p_session.current_session().remote_nonce_prefix)
-			);
+			boost::mutex::scoped_lock lock(session.remote_mutex);
 
-			p_session.set_remote_sequence_number(_data_message.sequence_number());
-			p_session.keep_alive();
-
-			if (p_session.current_session().is_old())
+			if (!session.check_remote_sequence_number(_data_message.sequence_number()))
 			{
-				// do_send_clear_session() and do_handle_data() are to be invoked through the same strand, so this is fine.
-				p_session.prepare_session(p_session.next_session_number(), p_session.current_session().parameters.cipher_suite, p_session.current_session().parameters.elliptic_curve);
-				do_send_session(identity, sender, p_session.next_session_parameters());
+				// The message is a replay or is too old for the anti-replay window: we ignore it.
+				return;
 			}
 
-			const message_type type = _data_message.type();
-
-			if (type == MESSAGE_TYPE_KEEP_ALIVE)
+			try
+			{
+				cleartext_len = _data_message.get_cleartext(
+					buffer_cast<uint8_t*>(cleartext_buffer),
+					buffer_size(cleartext_buffer),
+					session.remote_cipher_context,
+					buffer_cast<const uint8_t*>(session.remote_nonce_prefix),
+					buffer_size(session.remote_nonce_prefix)
+				);
+			}
+			catch (const cryptoplus::error::cryptographic_exception&)
 			{
-				// If the message is a keep alive then nothing is to be done and we avoid posting an empty call into the data strand.
+				// This can happen if a message is decoded after a session rekeying.
 				return;
 			}
 
-			// We don't need the original buffer at this point, so we just defer handling in another call so that it will free the buffer sooner and that it will allow parallel processing.
-			m_data_strand.post(
-				boost::bind(
-					&server::do_handle_data_message,
-					this,
-					sender,
-					type,
-					cleartext_buffer,
-					buffer(cleartext_buffer, cleartext_len)
-				)
-			);
+			// The sequence number is only marked as received once the message was authenticated, so that forged messages can't poison the window.
+			session.set_remote_sequence_number(_data_message.sequence_number());
+			session.last_sign_of_life = boost::posix_time::microsec_clock::local_time();
+			is_old = session.is_old();
 		}
-		catch (const cryptoplus::error::cryptographic_exception&)
+
+		// We answer through the socket the kernel delivers the peer traffic to.
+		session.socket_index = socket_index;
+
+		if (is_old)
+		{
+			m_session_strand.post(boost::bind(&server::do_renew_session, this, identity, sender, entry->second));
+		}
+
+		const message_type type = _data_message.type();
+
+		if (type == MESSAGE_TYPE_KEEP_ALIVE)
 		{
-			// This can happen if a message is decoded after a session rekeying.
+			// If the message is a keep alive then nothing is to be done and we avoid posting an empty call into the data strand.
+			return;
+		}
+
+		// We don't need the original buffer at this point, so we just defer handling in another call so that it will free the buffer sooner and that it will allow parallel processing.
+		m_data_strand.post(
+			boost::bind(
+				&server::do_handle_data_message,
+				this,
+				sender,
+				type,
+				cleartext_buffer,
+				buffer(cleartext_buffer, cleartext_len)
+			)
+		);
+	}
+
+	void server::do_renew_session(const identity_store& identity, const ep_type& sender, peer_session::current_session_ptr session)
+	{
+		// All do_renew_session() calls are done in the session strand so the following is thread-safe.
+		peer_session& p_session = m_peer_sessions[sender];
+
+		// The session may have been renewed or cleared since the message was received.
+		if (!p_session.has_current_session() || (&p_session.current_session() != session.get()))
+		{
+			return;
 		}
+
+		p_session.prepare_session(p_session.next_session_number(), session->parameters.cipher_suite, session->parameters.elliptic_curve);
+		do_send_session(identity, sender, p_session.next_session_parameters());
 	}
 
 	void server::do_handle_data_message(const ep_type& sender, message_type type, shared_buffer_type buffer, boost::asio::const_buffer data)
@@ -2315,16 +3657,20 @@ namespace fscp
 
 		for (std::set<hash_type>::iterator hash_it = hash_list.begin(); hash_it != hash_list.end(); ++hash_it)
 		{
-			for (presentation_store_map::const_iterator it = m_presentation_store_map.begin(); it != m_presentation_store_map.end(); ++it)
+			const presentation_index_map::const_iterator index_entry = m_presentation_index.find(*hash_it);
+
+			if (index_entry == m_presentation_index.end())
+			{
+				continue;
+			}
+
+			for (std::set<ep_type>::const_iterator ep_it = index_entry->second.begin(); ep_it != index_entry->second.end(); ++ep_it)
 			{
-				const hash_type hash = it->second.signature_certificate_hash();
+				const presentation_store& _presentation_store = m_presentation_store_map[*ep_it];
 
-				if (hash == *hash_it)
+				if (!m_contact_request_message_received_handler || m_contact_request_message_received_handler(sender, _presentation_store.signature_certificate(), *hash_it, *ep_it))
 				{
-					if (!m_contact_request_message_received_handler || m_contact_request_message_received_handler(sender, it->second.signature_certificate(), hash, it->first))
-					{
-						contact_map[*hash_it] = it->first;
-					}
+					contact_map[*hash_it] = *ep_it;
 				}
 			}
 		}
@@ -2382,38 +3728,64 @@ namespace fscp
 		}
 	}
 
-	void server::do_check_keep_alive(const boost::system::error_code& ec)
+	void server::schedule_keep_alive(const ep_type& target, peer_session& p_session)
+	{
+		// All schedule_keep_alive() calls are done in the session strand so the following is thread-safe.
+		if (!p_session.is_keep_alive_scheduled())
+		{
+			// The first checks are spread over the slots so that sessions established at once don't all get checked at once afterwards.
+			const boost::posix_time::time_duration offset = (SESSION_KEEP_ALIVE_PERIOD / static_cast<int>(SESSION_KEEP_ALIVE_SLOT_COUNT)) * static_cast<int>(m_keep_alive_next_slot);
+			m_keep_alive_next_slot = (m_keep_alive_next_slot + 1) % SESSION_KEEP_ALIVE_SLOT_COUNT;
+
+			m_timer_wheel.async_wait(SESSION_KEEP_ALIVE_PERIOD + offset, m_session_strand.wrap(boost::bind(&server::do_check_keep_alive, this, target, _1)));
+
+			p_session.set_keep_alive_scheduled(true);
+		}
+	}
+
+	void server::do_check_keep_alive(const ep_type& target, const boost::system::error_code& ec)
 	{
 		// All do_check_keep_alive() calls are done in the same strand so the following is thread-safe.
+		peer_session& p_session = m_peer_sessions[target];
+
 		if (ec != boost::asio::error::operation_aborted)
 		{
-			for (auto&& p_session: m_peer_sessions)
+			if (p_session.has_timed_out(SESSION_TIMEOUT))
 			{
-				if (p_session.second.has_timed_out(SESSION_TIMEOUT))
+				if (p_session.clear())
 				{
-					if (p_session.second.clear())
+					publish_current_session(target, p_session);
+
+					if (m_session_lost_handler)
 					{
-						if (m_session_lost_handler)
-						{
-							m_session_lost_handler(p_session.first);
-						}
+						m_session_lost_handler(target);
 					}
 				}
-				else
+			}
+			else if (p_session.has_current_session() || p_session.remote_host_identifier())
+			{
+				// Only sessions that were idle in the transmit direction for a whole period need a keep-alive. Sessions that are still being negotiated are only checked for timeouts.
+				if (p_session.has_current_session() && !p_session.clear_has_transmitted())
 				{
-					do_send_keep_alive(p_session.first, &null_simple_handler);
+					do_send_keep_alive(target, &null_simple_handler);
+
+					// The keep-alive itself does not count as traffic.
+					p_session.clear_has_transmitted();
 				}
-			}
 
-			m_keep_alive_timer.expires_from_now(SESSION_KEEP_ALIVE_PERIOD);
-			m_keep_alive_timer.async_wait(m_session_strand.wrap(boost::bind(&server::do_check_keep_alive, this, boost::asio::placeholders::error)));
+				m_timer_wheel.async_wait(SESSION_KEEP_ALIVE_PERIOD, m_session_strand.wrap(boost::bind(&server::do_check_keep_alive, this, target, _1)));
+
+				return;
+			}
 		}
+
+		p_session.set_keep_alive_scheduled(false);
 	}
 
 	void server::do_send_keep_alive(const ep_type& target, simple_handler_type handler)
 	{
 		// All do_send_keep_alive() calls are done in the same strand so the following is thread-safe.
-		if (!m_socket.is_open())
+		if (!get_socket().is_open())
 		{
 			handler(server_error::server_offline);
 
@@ -2429,23 +3801,29 @@ namespace fscp
 			return;
 		}
 
+		peer_session::current_session_type& session = p_session.current_session();
 		const socket_memory_pool::shared_buffer_type send_buffer = m_socket_memory_pool.allocate_shared_buffer();
 
 		try
 		{
-			const size_t size = data_message::write_keep_alive(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				p_session.increment_local_sequence_number(),
-				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
-				SESSION_KEEP_ALIVE_DATA_SIZE, // This is the count of random data to send.
-				buffer_cast<const uint8_t*>(p_session.current_session().local_session_key),
-				buffer_size(p_session.current_session().local_session_key),
-				buffer_cast<const uint8_t*>(p_session.current_session().local_nonce_prefix),
-				buffer_size(p_session.current_session().local_nonce_prefix)
-			);
+			size_t size = 0;
+
+			{
+				boost::mutex::scoped_lock lock(session.local_mutex);
+
+				size = data_message::write_keep_alive(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					session.increment_local_sequence_number(),
+					session.local_cipher_context,
+					SESSION_KEEP_ALIVE_DATA_SIZE, // This is the count of padding bytes to send.
+					buffer_cast<const uint8_t*>(session.local_nonce_prefix),
+					buffer_size(session.local_nonce_prefix)
+				);
+			}
 
 			async_send_to(
+				get_socket_index_for(p_session, target),
 				buffer(send_buffer, size),
 				target,
 				make_shared_buffer_handler(
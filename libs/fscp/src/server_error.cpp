@@ -90,6 +90,10 @@ namespace fscp
 			{
 				return "A cryptographic error occured";
 			}
+			case server_error::handshake_queue_full:
+			{
+				return "Too many handshake cryptographic operations are pending";
+			}
 			default:
 			{
 				return "Unknown FSCP error";
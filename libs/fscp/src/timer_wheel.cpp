@@ -0,0 +1,308 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file timer_wheel.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A hierarchical timer wheel class.
+ */
+
+#include "timer_wheel.hpp"
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cassert>
+
+namespace fscp
+{
+	namespace
+	{
+		const uint64_t SLOT_MASK = timer_wheel::SLOT_COUNT - 1;
+
+		uint64_t level_span(size_t level)
+		{
+			return static_cast<uint64_t>(1) << (timer_wheel::SLOT_BITS * level);
+		}
+	}
+
+	timer_wheel::timer_wheel(boost::asio::io_service& io_service, const boost::posix_time::time_duration& _tick) :
+		m_io_service(io_service),
+		m_tick(_tick),
+		m_origin(boost::posix_time::microsec_clock::universal_time()),
+		m_timer(io_service),
+		m_mutex(),
+		m_slots(LEVEL_COUNT * SLOT_COUNT),
+		m_entries(),
+		m_next_id(0),
+		m_tick_count(0),
+		m_armed_tick()
+	{
+		assert(m_tick.total_microseconds() > 0);
+	}
+
+	timer_wheel::~timer_wheel()
+	{
+		m_timer.cancel();
+	}
+
+	timer_wheel::timer_id_type timer_wheel::async_wait(const boost::posix_time::time_duration& timeout, handler_type handler)
+	{
+		const int64_t tick_us = m_tick.total_microseconds();
+		const int64_t timeout_us = std::max<int64_t>(timeout.total_microseconds(), 0);
+		const uint64_t ticks = static_cast<uint64_t>((timeout_us + tick_us - 1) / tick_us);
+
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		if (m_entries.empty())
+		{
+			// Nothing is scheduled so the wheel may have stopped turning: we catch up with the time that passed in O(1).
+			m_tick_count = std::max(m_tick_count, current_tick());
+		}
+
+		// The current tick is already started: counting it would make the timer expire early.
+		const uint64_t expiration = std::max(current_tick() + ticks + 1, m_tick_count + 1);
+		const timer_id_type timer_id = m_next_id++;
+
+		slot_type pending;
+		pending.push_back(entry_type(timer_id, expiration, handler));
+
+		const slot_type::iterator entry = pending.begin();
+		m_entries[timer_id] = entry;
+		insert(pending, entry);
+
+		// A timer on the first level is due at its exact tick. Others only need the wheel to turn up to the next revolution of the first level.
+		const uint64_t wake_tick = (entry->slot < SLOT_COUNT) ? expiration : (m_tick_count | SLOT_MASK) + 1;
+
+		if (!m_armed_tick || (wake_tick < *m_armed_tick))
+		{
+			arm(wake_tick);
+		}
+
+		return timer_id;
+	}
+
+	bool timer_wheel::cancel(timer_id_type timer_id)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		const entry_map_type::iterator entry = m_entries.find(timer_id);
+
+		if (entry == m_entries.end())
+		{
+			return false;
+		}
+
+		const boost::system::error_code ec = boost::asio::error::operation_aborted;
+		m_io_service.post(boost::bind(entry->second->handler, ec));
+
+		m_slots[entry->second->slot].erase(entry->second);
+		m_entries.erase(entry);
+
+		return true;
+	}
+
+	size_t timer_wheel::cancel_all()
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		const boost::system::error_code ec = boost::asio::error::operation_aborted;
+
+		for (entry_map_type::iterator entry = m_entries.begin(); entry != m_entries.end(); ++entry)
+		{
+			m_io_service.post(boost::bind(entry->second->handler, ec));
+		}
+
+		const size_t result = m_entries.size();
+
+		for (std::vector<slot_type>::iterator slot = m_slots.begin(); slot != m_slots.end(); ++slot)
+		{
+			slot->clear();
+		}
+
+		m_entries.clear();
+
+		return result;
+	}
+
+	size_t timer_wheel::size() const
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		return m_entries.size();
+	}
+
+	uint64_t timer_wheel::current_tick() const
+	{
+		const int64_t elapsed_us = (boost::posix_time::microsec_clock::universal_time() - m_origin).total_microseconds();
+
+		return (elapsed_us > 0) ? static_cast<uint64_t>(elapsed_us / m_tick.total_microseconds()) : 0;
+	}
+
+	timer_wheel::slot_type& timer_wheel::slot_for(uint64_t expiration, size_t& slot)
+	{
+		const uint64_t delta = (expiration > m_tick_count) ? (expiration - m_tick_count) : 0;
+
+		for (size_t level = 0; level < LEVEL_COUNT; ++level)
+		{
+			if (delta < level_span(level + 1))
+			{
+				slot = level * SLOT_COUNT + static_cast<size_t>((expiration >> (SLOT_BITS * level)) & SLOT_MASK);
+
+				return m_slots[slot];
+			}
+		}
+
+		// The timer is beyond the wheel: we park it in the farthest slot and it will be inserted again when its slot comes.
+		const size_t level = LEVEL_COUNT - 1;
+		const uint64_t farthest = m_tick_count + level_span(LEVEL_COUNT) - 1;
+
+		slot = level * SLOT_COUNT + static_cast<size_t>((farthest >> (SLOT_BITS * level)) & SLOT_MASK);
+
+		return m_slots[slot];
+	}
+
+	void timer_wheel::insert(slot_type& from, slot_type::iterator entry)
+	{
+		slot_type& to = slot_for(entry->expiration, entry->slot);
+
+		// Splicing keeps the iterators valid so that m_entries needn't be updated.
+		to.splice(to.end(), from, entry);
+	}
+
+	void timer_wheel::advance(slot_type& expired)
+	{
+		++m_tick_count;
+
+		// Each time a level completes a revolution, the current slot of the level above it is distributed on the lower levels.
+		for (size_t level = 1; (level < LEVEL_COUNT) && ((m_tick_count & (level_span(level) - 1)) == 0); ++level)
+		{
+			slot_type cascaded;
+			cascaded.splice(cascaded.end(), m_slots[level * SLOT_COUNT + static_cast<size_t>((m_tick_count >> (SLOT_BITS * level)) & SLOT_MASK)]);
+
+			while (!cascaded.empty())
+			{
+				insert(cascaded, cascaded.begin());
+			}
+		}
+
+		slot_type current;
+		current.splice(current.end(), m_slots[static_cast<size_t>(m_tick_count & SLOT_MASK)]);
+
+		while (!current.empty())
+		{
+			const slot_type::iterator entry = current.begin();
+
+			if (entry->expiration <= m_tick_count)
+			{
+				m_entries.erase(entry->id);
+				expired.splice(expired.end(), current, entry);
+			}
+			else
+			{
+				insert(current, entry);
+			}
+		}
+	}
+
+	void timer_wheel::arm(uint64_t _tick)
+	{
+		m_armed_tick = _tick;
+
+		// Changing the expiration cancels the previous wait, whose handler then does nothing.
+		m_timer.expires_at(m_origin + boost::posix_time::microseconds(m_tick.total_microseconds() * static_cast<int64_t>(_tick)));
+		m_timer.async_wait(boost::bind(&timer_wheel::handle_timeout, this, boost::asio::placeholders::error));
+	}
+
+	void timer_wheel::arm_next()
+	{
+		if (m_entries.empty())
+		{
+			m_armed_tick = boost::none;
+			m_timer.cancel();
+
+			return;
+		}
+
+		const uint64_t revolution_tick = (m_tick_count | SLOT_MASK) + 1;
+
+		for (uint64_t _tick = m_tick_count + 1; _tick < revolution_tick; ++_tick)
+		{
+			if (!m_slots[static_cast<size_t>(_tick & SLOT_MASK)].empty())
+			{
+				arm(_tick);
+
+				return;
+			}
+		}
+
+		arm(revolution_tick);
+	}
+
+	void timer_wheel::handle_timeout(const boost::system::error_code& ec)
+	{
+		if (ec == boost::asio::error::operation_aborted)
+		{
+			return;
+		}
+
+		slot_type expired;
+
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+
+			// The timer may fire slightly before its tick because of the clock resolution.
+			const uint64_t target_tick = m_armed_tick ? std::max(*m_armed_tick, current_tick()) : current_tick();
+
+			while (m_tick_count < target_tick)
+			{
+				advance(expired);
+			}
+
+			arm_next();
+		}
+
+		// The handlers are called without the lock held so that they can start new timers.
+		const boost::system::error_code success;
+
+		for (slot_type::iterator entry = expired.begin(); entry != expired.end(); ++entry)
+		{
+			entry->handler(success);
+		}
+	}
+}
@@ -0,0 +1,150 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file worker_pool.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A bounded worker thread pool class.
+ */
+
+#include "worker_pool.hpp"
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+
+namespace fscp
+{
+	size_t worker_pool::get_thread_count(size_t thread_count)
+	{
+		if (thread_count == 0)
+		{
+			// hardware_concurrency() returns 0 when the information is not available.
+			thread_count = boost::thread::hardware_concurrency();
+		}
+
+		return std::max<size_t>(thread_count, 1);
+	}
+
+	worker_pool::worker_pool(size_t thread_count, size_t max_queue_depth) :
+		m_max_queue_depth(std::max<size_t>(max_queue_depth, 1)),
+		m_io_service(),
+		m_work(new boost::asio::io_service::work(m_io_service)),
+		m_threads(),
+		m_queue_depth(0),
+		m_peak_queue_depth(0),
+		m_completed(0),
+		m_failed(0),
+		m_rejected(0)
+	{
+		thread_count = get_thread_count(thread_count);
+
+		for (size_t i = 0; i < thread_count; ++i)
+		{
+			m_threads.create_thread(boost::bind(&boost::asio::io_service::run, &m_io_service));
+		}
+	}
+
+	worker_pool::~worker_pool()
+	{
+		m_work.reset();
+		m_threads.join_all();
+	}
+
+	bool worker_pool::post(task_type task, error_handler_type error_handler)
+	{
+		const size_t queue_depth = ++m_queue_depth;
+
+		if (queue_depth > m_max_queue_depth)
+		{
+			--m_queue_depth;
+			++m_rejected;
+
+			return false;
+		}
+
+		size_t peak_queue_depth = m_peak_queue_depth.load();
+
+		while ((queue_depth > peak_queue_depth) && !m_peak_queue_depth.compare_exchange_weak(peak_queue_depth, queue_depth)) {}
+
+		m_io_service.post(boost::bind(&worker_pool::run_task, this, task, error_handler));
+
+		return true;
+	}
+
+	worker_pool_statistics_type worker_pool::statistics() const
+	{
+		worker_pool_statistics_type result;
+
+		result.queue_depth = m_queue_depth.load();
+		result.peak_queue_depth = m_peak_queue_depth.load();
+		result.completed = m_completed.load();
+		result.failed = m_failed.load();
+		result.rejected = m_rejected.load();
+
+		return result;
+	}
+
+	void worker_pool::run_task(task_type task, error_handler_type error_handler)
+	{
+		try
+		{
+			task();
+		}
+		catch (...)
+		{
+			// A failing task must not take a worker thread down with it: the error is handed to its owner instead.
+			++m_failed;
+
+			if (error_handler)
+			{
+				try
+				{
+					error_handler(std::current_exception());
+				}
+				catch (...)
+				{
+					// The error handler failed too: there is nothing more we can do.
+				}
+			}
+		}
+
+		++m_completed;
+		--m_queue_depth;
+	}
+}
@@ -47,7 +47,13 @@
 #include <boost/asio.hpp>
 #include <boost/optional.hpp>
 
+#include <array>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "protocol.hpp"
 
@@ -111,7 +117,10 @@ namespace netlinkplus
 			destination_length{},
 			source_length{},
 			priority{},
-			metric{}
+			metric{},
+			type{},
+			protocol{},
+			table{}
 		{
 		}
 
@@ -124,6 +133,48 @@ namespace netlinkplus
 		boost::optional<boost::asio::ip::address> gateway;
 		unsigned int priority;
 		unsigned int metric;
+
+		/**
+		 * \brief The route type (RTN_UNICAST, RTN_LOCAL, ...).
+		 */
+		unsigned char type;
+
+		/**
+		 * \brief The protocol that set the route (RTPROT_KERNEL, RTPROT_BOOT, ...).
+		 */
+		unsigned char protocol;
+
+		/**
+		 * \brief The routing table of the route (RT_TABLE_MAIN, ...).
+		 */
+		unsigned char table;
+	};
+
+	/**
+	 * \brief A route operation, to be batched with others.
+	 */
+	struct route_operation
+	{
+		/**
+		 * \brief The action type.
+		 */
+		enum class action_type
+		{
+			add,
+			remove
+		};
+
+		route_operation() :
+			action(action_type::add),
+			destination_length{}
+		{
+		}
+
+		action_type action;
+		interface_entry interface;
+		boost::asio::ip::address destination;
+		unsigned int destination_length;
+		boost::optional<boost::asio::ip::address> gateway;
 	};
 
 	/**
@@ -150,6 +201,27 @@ namespace netlinkplus
 	{
 		public:
 
+			/**
+			 * \brief The route operations handler type.
+			 *
+			 * The handler receives one error code per operation, in the same order.
+			 */
+			typedef std::function<void (const std::vector<boost::system::error_code>&)> route_operations_handler_type;
+
+			/**
+			 * \brief The maximum count of requests sent at once.
+			 *
+			 * Every request gets its own acknowledgement: this must be low enough for all of them to fit in the receive buffer.
+			 */
+			static const size_t MAX_BATCH_SIZE = 64;
+
+			/**
+			 * \brief The protocol the routes set by the manager are tagged with.
+			 *
+			 * It tells them apart from the routes set by the system or by other programs, in the route dumps and in the change notifications. The value is not used by the kernel nor by the usual routing daemons.
+			 */
+			static const unsigned char ROUTE_PROTOCOL = 70;
+
 			/**
 			 * \brief Create a route manager.
 			 */
@@ -158,9 +230,22 @@ namespace netlinkplus
 			/**
 			 * \brief Get the route entry for the specified host.
 			 * \param host The host to get the route for.
+			 * \param matching_entry If true, the routing table entry the lookup matched is returned instead of the resolved route, so that its protocol and table are known. Kernels older than Linux 4.13 ignore this and return the resolved route.
 			 * \return The route entry, if any.
+			 *
+			 * The lookup is done by the kernel and follows the routing policy rules.
+			 */
+			route_entry get_route_for(const boost::asio::ip::address& host, bool matching_entry = false);
+
+			/**
+			 * \brief Get the route entries of a routing table.
+			 * \param family The address family of the routes, AF_INET or AF_INET6.
+			 * \param table The routing table.
+			 * \return The route entries of the table. Entries that can't be parsed are skipped.
+			 *
+			 * The dump is done on its own netlink socket, so that it can't mix with the replies to the other calls.
 			 */
-			route_entry get_route_for(const boost::asio::ip::address& host);
+			std::vector<route_entry> get_routes(unsigned char family, unsigned char table = RT_TABLE_MAIN);
 			
 			/**
 			 * \brief Add a route entry.
@@ -180,6 +265,19 @@ namespace netlinkplus
 			 */
 			void remove_route(const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway = boost::optional<boost::asio::ip::address>());
 
+			/**
+			 * \brief Add and remove route entries asynchronously.
+			 * \param operations The route operations.
+			 * \param handler The handler to call when all the operations completed.
+			 *
+			 * The operations are queued and sent in batches of up to MAX_BATCH_SIZE requests per netlink message, along with the operations of other calls: many routes are set in a few round trips. Operations are applied in the order they were queued in.
+			 *
+			 * The operations of a batch whose acknowledgements don't all arrive in time complete with boost::asio::error::timed_out.
+			 *
+			 * This method is thread-safe.
+			 */
+			void async_apply_routes(const std::vector<route_operation>& operations, route_operations_handler_type handler);
+
 			/**
 			 * \brief Add an interface address.
 			 * \param interface The interface to set the address on.
@@ -216,9 +314,42 @@ namespace netlinkplus
 
 		private:
 
+			struct route_operations_request_type
+			{
+				std::vector<route_operation> operations;
+				std::vector<boost::system::error_code> results;
+				size_t remaining;
+				route_operations_handler_type handler;
+			};
+
+			typedef std::pair<std::shared_ptr<route_operations_request_type>, size_t> pending_route_operation_type;
+
 			void generic_route(uint16_t type, const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway);
 			void generic_interface_address(uint16_t type, const interface_entry& interface, const boost::asio::ip::address& address, size_t prefix_length, const boost::asio::ip::address& remote_address);
 
+			void do_apply_routes(std::shared_ptr<route_operations_request_type> request);
+			void send_route_batch();
+			void handle_route_batch_sent(const boost::system::error_code& ec);
+			void handle_route_batch_acknowledgements(const boost::system::error_code& ec, size_t bytes_transferred);
+			void handle_route_batch_timeout(uint64_t batch_generation, const boost::system::error_code& ec);
+			void complete_route_operation(const pending_route_operation_type& pending, const boost::system::error_code& ec);
+			void complete_route_batch(const boost::system::error_code& ec);
+
 			netlink_route_protocol::socket m_socket;
+
+			// The asynchronous operations get their own socket so that their acknowledgements never mix with the replies to the synchronous calls.
+			boost::asio::strand m_strand;
+			netlink_route_protocol::socket m_async_socket;
+			std::deque<pending_route_operation_type> m_route_operations_queue;
+			std::map<uint32_t, pending_route_operation_type> m_route_batch;
+			std::vector<char> m_route_batch_buffer;
+			std::array<char, 16384> m_acknowledgement_buffer;
+			uint32_t m_sequence_number;
+			boost::asio::deadline_timer m_route_batch_timer;
+			uint64_t m_route_batch_generation;
+			bool m_route_batch_timed_out;
+
+			// The route dumps open their own sockets on it.
+			boost::asio::io_service& m_io_service;
 	};
 }
@@ -0,0 +1,172 @@
+/*
+ * libnetlinkplus - A portable netlink extension for Boost::ASIO.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libnetlinkplus.
+ *
+ * libnetlinkplus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libnetlinkplus is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libnetlinkplus in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file monitor.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief netlink change monitor class.
+ */
+
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "protocol.hpp"
+#include "manager.hpp"
+
+namespace netlinkplus
+{
+	/**
+	 * \brief A network change, as notified by the kernel.
+	 */
+	struct network_change
+	{
+		/**
+		 * \brief The change type.
+		 */
+		enum class change_type
+		{
+			link,
+			address,
+			route,
+			overrun
+		};
+
+		network_change() :
+			type(change_type::overrun),
+			removed(false),
+			route_protocol(0)
+		{
+		}
+
+		/**
+		 * \brief The type of the change.
+		 *
+		 * change_type::overrun means that notifications were lost: anything may have changed.
+		 */
+		change_type type;
+
+		/**
+		 * \brief Whether the link, address or route was removed.
+		 */
+		bool removed;
+
+		/**
+		 * \brief The interface the change relates to, if any.
+		 */
+		interface_entry interface;
+
+		/**
+		 * \brief The name of the interface, or an empty string if it is unknown.
+		 */
+		std::string interface_name;
+
+		/**
+		 * \brief The protocol that set the route, for route changes. 0 otherwise.
+		 */
+		unsigned char route_protocol;
+	};
+
+	/**
+	 * \brief Monitor the link, address and route changes.
+	 */
+	class monitor
+	{
+		public:
+
+			/**
+			 * \brief The network change handler type.
+			 */
+			typedef std::function<void (const network_change&)> network_change_handler_type;
+
+			/**
+			 * \brief The multicast groups to subscribe to, by default.
+			 */
+			static const uint32_t DEFAULT_GROUPS = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+
+			/**
+			 * \brief Create a monitor.
+			 * \param io_service The io_service to use.
+			 * \param groups The multicast groups to subscribe to.
+			 */
+			explicit monitor(boost::asio::io_service& io_service, uint32_t groups = DEFAULT_GROUPS);
+
+			/**
+			 * \brief Start monitoring the changes.
+			 * \param handler The handler to call on every change. Calls are serialized.
+			 *
+			 * The subscription is done synchronously: failures are reported by throwing a boost::system::system_error.
+			 *
+			 * Any previous subscription is closed first, so start() may be called right after stop().
+			 *
+			 * \warning This method is *NOT* thread-safe and must not be called concurrently with stop().
+			 */
+			void start(network_change_handler_type handler);
+
+			/**
+			 * \brief Stop monitoring the changes.
+			 *
+			 * The handler is not called anymore once the stop completes.
+			 */
+			void stop();
+
+		private:
+
+			typedef std::shared_ptr<netlink_route_protocol::socket> socket_ptr;
+
+			void do_start(socket_ptr socket, network_change_handler_type handler);
+			void do_stop();
+			void async_receive(socket_ptr socket);
+			void handle_receive(socket_ptr socket, const boost::system::error_code& ec, size_t bytes_transferred);
+			void handle_message(const ::nlmsghdr& header);
+
+			boost::asio::io_service& m_io_service;
+			boost::asio::strand m_strand;
+			uint32_t m_groups;
+
+			// Every start() gets its own socket, so that a stop() that completes late only closes the socket it was meant to.
+			socket_ptr m_socket;
+			network_change_handler_type m_handler;
+			std::array<char, 16384> m_buffer;
+	};
+}
@@ -49,10 +49,18 @@
 #include <net/if.h>
 #include <errno.h>
 
+// Older kernel headers lack it: the kernels that don't know it ignore it.
+#ifndef RTM_F_FIB_MATCH
+#define RTM_F_FIB_MATCH 0x2000
+#endif
+
 namespace netlinkplus
 {
 	namespace
 	{
+		// The kernel acknowledges route changes right away: this only guards against lost acknowledgements.
+		const boost::posix_time::time_duration ROUTE_BATCH_TIMEOUT = boost::posix_time::seconds(5);
+
 		template <typename AddressType, typename AttributesType>
 		route_entry get_route_entry(const AttributesType& attributes)
 		{
@@ -155,6 +163,34 @@ namespace netlinkplus
 
 			return result;
 		}
+
+		void prepare_route_request(route_request_type& request, const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway)
+		{
+			request.subheader().rtm_table = RT_TABLE_MAIN;
+			request.subheader().rtm_scope = RT_SCOPE_UNIVERSE;
+			request.subheader().rtm_type = RTN_UNICAST;
+			request.subheader().rtm_protocol = manager::ROUTE_PROTOCOL;
+
+			request.set_route_destination(destination, destination_length);
+			request.set_output_interface(interface.index());
+
+			if (gateway)
+			{
+				request.set_gateway(*gateway);
+			}
+		}
+
+		uint16_t get_route_request_flags(uint16_t type)
+		{
+			int flags = NLM_F_REQUEST | NLM_F_ACK;
+
+			if (type == RTM_NEWROUTE)
+			{
+				flags |= NLM_F_CREATE | NLM_F_EXCL;
+			}
+
+			return static_cast<uint16_t>(flags);
+		}
 	}
 
 	std::string interface_entry::name() const
@@ -188,13 +224,28 @@ namespace netlinkplus
 	}
 
 	manager::manager(boost::asio::io_service& io_service) :
-		m_socket(io_service, netlink_route_protocol::endpoint())
+		m_socket(io_service, netlink_route_protocol::endpoint()),
+		m_strand(io_service),
+		m_async_socket(io_service, netlink_route_protocol::endpoint()),
+		m_route_operations_queue(),
+		m_route_batch(),
+		m_route_batch_buffer(),
+		m_acknowledgement_buffer(),
+		m_sequence_number(0),
+		m_route_batch_timer(io_service),
+		m_route_batch_generation(0),
+		m_route_batch_timed_out(false),
+		m_io_service(io_service)
 	{
 		m_socket.set_option(boost::asio::socket_base::send_buffer_size(32768));
 		m_socket.set_option(boost::asio::socket_base::receive_buffer_size(32768));
+
+		// Every acknowledgement is queued separately by the kernel and takes much more room than its size in the receive buffer.
+		m_async_socket.set_option(boost::asio::socket_base::send_buffer_size(262144));
+		m_async_socket.set_option(boost::asio::socket_base::receive_buffer_size(262144));
 	}
 
-	route_entry manager::get_route_for(const boost::asio::ip::address& host)
+	route_entry manager::get_route_for(const boost::asio::ip::address& host, bool matching_entry)
 	{
 		using boost::asio::buffer_size;
 		using boost::asio::buffer_cast;
@@ -203,6 +254,11 @@ namespace netlinkplus
 		route_response_type response;
 		request.set_route_destination(host);
 
+		if (matching_entry)
+		{
+			request.subheader().rtm_flags |= RTM_F_FIB_MATCH;
+		}
+
 		m_socket.send(boost::asio::buffer(request.data(), request.size()));
 		const size_t cnt = m_socket.receive(boost::asio::buffer(response.data(), response.max_size()));
 
@@ -230,10 +286,93 @@ namespace netlinkplus
 
 		result.destination_length = response.subheader().rtm_dst_len;
 		result.source_length = response.subheader().rtm_src_len;
+		result.type = response.subheader().rtm_type;
+		result.protocol = response.subheader().rtm_protocol;
+		result.table = response.subheader().rtm_table;
 
 		return result;
 	}
 
+	std::vector<route_entry> manager::get_routes(unsigned char family, unsigned char table)
+	{
+		netlink_route_protocol::socket socket(m_io_service, netlink_route_protocol::endpoint());
+
+		route_request_type request(RTM_GETROUTE, NLM_F_REQUEST | NLM_F_DUMP);
+		request.subheader().rtm_family = family;
+		request.subheader().rtm_table = table;
+
+		socket.send(boost::asio::buffer(request.data(), request.size()));
+
+		std::vector<route_entry> result;
+
+		// The kernel sizes the dump messages after the buffers we receive them in.
+		std::vector<char> buffer(32768);
+
+		for (;;)
+		{
+			const size_t cnt = socket.receive(boost::asio::buffer(buffer));
+			int len = static_cast<int>(cnt);
+
+			for (const ::nlmsghdr* header = reinterpret_cast<const ::nlmsghdr*>(buffer.data()); NLMSG_OK(header, len); header = NLMSG_NEXT(header, len))
+			{
+				if (header->nlmsg_type == NLMSG_DONE)
+				{
+					return result;
+				}
+
+				if (header->nlmsg_type == NLMSG_ERROR)
+				{
+					if (header->nlmsg_len < NLMSG_LENGTH(sizeof(::nlmsgerr)))
+					{
+						throw boost::system::system_error(make_error_code(netlinkplus_error::invalid_response));
+					}
+
+					throw boost::system::system_error(-static_cast<const ::nlmsgerr*>(NLMSG_DATA(header))->error, boost::system::system_category());
+				}
+
+				route_response_type response;
+
+				if ((header->nlmsg_type != RTM_NEWROUTE) || (header->nlmsg_len < NLMSG_LENGTH(sizeof(::rtmsg))) || (header->nlmsg_len > response.max_size()))
+				{
+					continue;
+				}
+
+				::memcpy(response.data(), header, header->nlmsg_len);
+
+				if ((response.subheader().rtm_table != table) || (response.subheader().rtm_flags & RTM_F_CLONED))
+				{
+					continue;
+				}
+
+				try
+				{
+					route_entry entry;
+
+					if (family == AF_INET)
+					{
+						entry = get_route_entry<boost::asio::ip::address_v4>(response.attributes());
+					}
+					else
+					{
+						entry = get_route_entry<boost::asio::ip::address_v6>(response.attributes());
+					}
+
+					entry.destination_length = response.subheader().rtm_dst_len;
+					entry.source_length = response.subheader().rtm_src_len;
+					entry.type = response.subheader().rtm_type;
+					entry.protocol = response.subheader().rtm_protocol;
+					entry.table = response.subheader().rtm_table;
+
+					result.push_back(entry);
+				}
+				catch (const boost::system::system_error&)
+				{
+					// Some attributes (like nested metrics) are not understood: such routes are simply skipped.
+				}
+			}
+		}
+	}
+
 	void manager::add_route(const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway)
 	{
 		generic_route(RTM_NEWROUTE, interface, destination, destination_length, gateway);
@@ -269,28 +408,10 @@ namespace netlinkplus
 		using boost::asio::buffer_size;
 		using boost::asio::buffer_cast;
 
-		int flags = NLM_F_REQUEST | NLM_F_ACK;
-
-		if (type == RTM_NEWROUTE)
-		{
-			flags |= NLM_F_CREATE | NLM_F_EXCL;
-		}
-
-		route_request_type request(type, flags);
+		route_request_type request(type, get_route_request_flags(type));
 		error_message_type response;
 
-		request.subheader().rtm_table = RT_TABLE_MAIN;
-		request.subheader().rtm_scope = RT_SCOPE_UNIVERSE;
-		request.subheader().rtm_type = RTN_UNICAST;
-		request.subheader().rtm_protocol = RTPROT_STATIC;
-
-		request.set_route_destination(destination, destination_length);
-		request.set_output_interface(interface.index());
-
-		if (gateway)
-		{
-			request.set_gateway(*gateway);
-		}
+		prepare_route_request(request, interface, destination, destination_length, gateway);
 
 		m_socket.send(boost::asio::buffer(request.data(), request.size()));
 		const size_t cnt = m_socket.receive(boost::asio::buffer(response.data(), response.max_size()));
@@ -341,4 +462,186 @@ namespace netlinkplus
 			throw boost::system::system_error(-response.subheader().error, boost::system::system_category());
 		}
 	}
+
+	void manager::async_apply_routes(const std::vector<route_operation>& operations, route_operations_handler_type handler)
+	{
+		const auto request = std::make_shared<route_operations_request_type>();
+		request->operations = operations;
+		request->results.resize(operations.size());
+		request->remaining = operations.size();
+		request->handler = handler;
+
+		m_strand.post(std::bind(&manager::do_apply_routes, this, request));
+	}
+
+	void manager::do_apply_routes(std::shared_ptr<route_operations_request_type> request)
+	{
+		// All calls to do_apply_routes() are done within m_strand, so the following is safe.
+		if (request->operations.empty())
+		{
+			if (request->handler)
+			{
+				request->handler(request->results);
+			}
+
+			return;
+		}
+
+		for (size_t index = 0; index < request->operations.size(); ++index)
+		{
+			m_route_operations_queue.push_back(pending_route_operation_type(request, index));
+		}
+
+		// If a batch is in progress, the operations will be sent along with the others queued in the meantime once it completes.
+		if (m_route_batch.empty())
+		{
+			send_route_batch();
+		}
+	}
+
+	void manager::send_route_batch()
+	{
+		m_route_batch_buffer.clear();
+
+		while (!m_route_operations_queue.empty() && (m_route_batch.size() < MAX_BATCH_SIZE))
+		{
+			const pending_route_operation_type pending = m_route_operations_queue.front();
+			m_route_operations_queue.pop_front();
+
+			const route_operation& operation = pending.first->operations[pending.second];
+			const uint16_t type = (operation.action == route_operation::action_type::add) ? RTM_NEWROUTE : RTM_DELROUTE;
+
+			route_request_type request(type, get_route_request_flags(type));
+			prepare_route_request(request, operation.interface, operation.destination, operation.destination_length, operation.gateway);
+			request.header().nlmsg_seq = ++m_sequence_number;
+
+			const char* const data = static_cast<const char*>(request.data());
+			m_route_batch_buffer.insert(m_route_batch_buffer.end(), data, data + request.size());
+			m_route_batch[m_sequence_number] = pending;
+		}
+
+		if (!m_route_batch.empty())
+		{
+			// If the acknowledgements get lost, the batch must not block the queue forever.
+			m_route_batch_timed_out = false;
+			m_route_batch_timer.expires_from_now(ROUTE_BATCH_TIMEOUT);
+			m_route_batch_timer.async_wait(m_strand.wrap(std::bind(&manager::handle_route_batch_timeout, this, ++m_route_batch_generation, std::placeholders::_1)));
+
+			// The kernel handles every message of the datagram in turn and acknowledges each of them separately.
+			m_async_socket.async_send(boost::asio::buffer(m_route_batch_buffer), m_strand.wrap(std::bind(&manager::handle_route_batch_sent, this, std::placeholders::_1)));
+		}
+	}
+
+	void manager::handle_route_batch_sent(const boost::system::error_code& ec)
+	{
+		// All calls to handle_route_batch_sent() are done within m_strand, so the following is safe.
+		if (ec || m_route_batch_timed_out)
+		{
+			complete_route_batch(m_route_batch_timed_out ? boost::asio::error::timed_out : ec);
+
+			return;
+		}
+
+		m_async_socket.async_receive(boost::asio::buffer(m_acknowledgement_buffer), m_strand.wrap(std::bind(&manager::handle_route_batch_acknowledgements, this, std::placeholders::_1, std::placeholders::_2)));
+	}
+
+	void manager::handle_route_batch_acknowledgements(const boost::system::error_code& ec, size_t bytes_transferred)
+	{
+		// All calls to handle_route_batch_acknowledgements() are done within m_strand, so the following is safe.
+		if (ec)
+		{
+			complete_route_batch(m_route_batch_timed_out ? boost::asio::error::timed_out : ec);
+
+			return;
+		}
+
+		int len = static_cast<int>(bytes_transferred);
+
+		for (const ::nlmsghdr* header = reinterpret_cast<const ::nlmsghdr*>(m_acknowledgement_buffer.data()); NLMSG_OK(header, len); header = NLMSG_NEXT(header, len))
+		{
+			const auto pending = m_route_batch.find(header->nlmsg_seq);
+
+			if (pending == m_route_batch.end())
+			{
+				continue;
+			}
+
+			boost::system::error_code result;
+
+			if (header->nlmsg_type != NLMSG_ERROR)
+			{
+				result = make_error_code(netlinkplus_error::unexpected_response_type);
+			}
+			else if (header->nlmsg_len < NLMSG_LENGTH(sizeof(::nlmsgerr)))
+			{
+				result = make_error_code(netlinkplus_error::invalid_response);
+			}
+			else
+			{
+				const ::nlmsgerr* const error = static_cast<const ::nlmsgerr*>(NLMSG_DATA(header));
+
+				if (error->error != 0)
+				{
+					result = boost::system::error_code(-error->error, boost::system::system_category());
+				}
+			}
+
+			complete_route_operation(pending->second, result);
+			m_route_batch.erase(pending);
+		}
+
+		if (m_route_batch.empty())
+		{
+			m_route_batch_timer.cancel();
+
+			send_route_batch();
+		}
+		else if (m_route_batch_timed_out)
+		{
+			complete_route_batch(boost::asio::error::timed_out);
+		}
+		else
+		{
+			m_async_socket.async_receive(boost::asio::buffer(m_acknowledgement_buffer), m_strand.wrap(std::bind(&manager::handle_route_batch_acknowledgements, this, std::placeholders::_1, std::placeholders::_2)));
+		}
+	}
+
+	void manager::handle_route_batch_timeout(uint64_t batch_generation, const boost::system::error_code& ec)
+	{
+		// All calls to handle_route_batch_timeout() are done within m_strand, so the following is safe.
+		if ((ec == boost::asio::error::operation_aborted) || (batch_generation != m_route_batch_generation) || m_route_batch.empty())
+		{
+			return;
+		}
+
+		// Cancelling the pending operation completes the batch with a timeout error.
+		m_route_batch_timed_out = true;
+		m_async_socket.cancel();
+	}
+
+	void manager::complete_route_operation(const pending_route_operation_type& pending, const boost::system::error_code& ec)
+	{
+		route_operations_request_type& request = *pending.first;
+
+		request.results[pending.second] = ec;
+
+		if ((--request.remaining == 0) && request.handler)
+		{
+			request.handler(request.results);
+		}
+	}
+
+	void manager::complete_route_batch(const boost::system::error_code& ec)
+	{
+		m_route_batch_timer.cancel();
+
+		for (auto&& pending : m_route_batch)
+		{
+			complete_route_operation(pending.second, ec);
+		}
+
+		m_route_batch.clear();
+
+		send_route_batch();
+	}
 }
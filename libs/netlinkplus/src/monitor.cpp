@@ -0,0 +1,263 @@
+/*
+ * libnetlinkplus - A portable netlink extension for Boost::ASIO.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libnetlinkplus.
+ *
+ * libnetlinkplus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libnetlinkplus is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libnetlinkplus in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file monitor.cpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief netlink change monitor class.
+ */
+
+#include "monitor.hpp"
+
+#include <net/if.h>
+#include <errno.h>
+
+#include <cstring>
+
+namespace netlinkplus
+{
+	namespace
+	{
+		std::string get_interface_name(unsigned int index)
+		{
+			char ifname_buf[IF_NAMESIZE];
+
+			// Removed interfaces have no name anymore: this is not an error.
+			if ((index == 0) || (::if_indextoname(index, ifname_buf) == nullptr))
+			{
+				return std::string();
+			}
+
+			return std::string(ifname_buf);
+		}
+	}
+
+	monitor::monitor(boost::asio::io_service& io_service, uint32_t groups) :
+		m_io_service(io_service),
+		m_strand(io_service),
+		m_groups(groups),
+		m_socket(),
+		m_handler(),
+		m_buffer()
+	{
+	}
+
+	void monitor::start(network_change_handler_type handler)
+	{
+		const socket_ptr socket = std::make_shared<netlink_route_protocol::socket>(m_io_service);
+
+		socket->open(netlink_route_protocol());
+
+		// Bursts of changes (an interface going down drops all its routes at once) must not overrun the subscription.
+		socket->set_option(boost::asio::socket_base::receive_buffer_size(262144));
+		socket->bind(netlink_route_protocol::endpoint(m_groups));
+
+		// A previous stop() may not have completed yet: do_start() is queued after it.
+		m_strand.dispatch(std::bind(&monitor::do_start, this, socket, handler));
+	}
+
+	void monitor::stop()
+	{
+		m_strand.dispatch(std::bind(&monitor::do_stop, this));
+	}
+
+	void monitor::do_start(socket_ptr socket, network_change_handler_type handler)
+	{
+		// All calls to do_start() are done within m_strand, so the following is safe.
+		do_stop();
+
+		m_socket = socket;
+		m_handler = handler;
+
+		async_receive(socket);
+	}
+
+	void monitor::do_stop()
+	{
+		// All calls to do_stop() are done within m_strand, so the following is safe.
+		if (m_socket)
+		{
+			boost::system::error_code ec;
+			m_socket->close(ec);
+			m_socket.reset();
+		}
+
+		m_handler = network_change_handler_type();
+	}
+
+	void monitor::async_receive(socket_ptr socket)
+	{
+		// All calls to async_receive() are done within m_strand, so the following is safe.
+		if (socket == m_socket)
+		{
+			socket->async_receive(boost::asio::buffer(m_buffer), m_strand.wrap(std::bind(&monitor::handle_receive, this, socket, std::placeholders::_1, std::placeholders::_2)));
+		}
+	}
+
+	void monitor::handle_receive(socket_ptr socket, const boost::system::error_code& ec, size_t bytes_transferred)
+	{
+		// All calls to handle_receive() are done within m_strand, so the following is safe.
+		if ((ec == boost::asio::error::operation_aborted) || (socket != m_socket))
+		{
+			return;
+		}
+
+		if (ec)
+		{
+			// The kernel drops notifications when the receive buffer is full: the subscription remains valid but some changes went unnoticed.
+			if ((ec == boost::system::error_code(ENOBUFS, boost::system::system_category())) && m_handler)
+			{
+				m_handler(network_change());
+			}
+		}
+		else
+		{
+			int len = static_cast<int>(bytes_transferred);
+
+			for (const ::nlmsghdr* header = reinterpret_cast<const ::nlmsghdr*>(m_buffer.data()); NLMSG_OK(header, len); header = NLMSG_NEXT(header, len))
+			{
+				handle_message(*header);
+			}
+		}
+
+		async_receive(socket);
+	}
+
+	void monitor::handle_message(const ::nlmsghdr& header)
+	{
+		network_change change;
+
+		switch (header.nlmsg_type)
+		{
+			case RTM_NEWLINK:
+			case RTM_DELLINK:
+				{
+					if (header.nlmsg_len < NLMSG_LENGTH(sizeof(::ifinfomsg)))
+					{
+						return;
+					}
+
+					const ::ifinfomsg* const info = static_cast<const ::ifinfomsg*>(NLMSG_DATA(&header));
+
+					// Wireless drivers send link notifications that change no flag at all, quite often: those are of no interest.
+					if ((header.nlmsg_type == RTM_NEWLINK) && (info->ifi_change == 0))
+					{
+						return;
+					}
+
+					change.type = network_change::change_type::link;
+					change.removed = (header.nlmsg_type == RTM_DELLINK);
+					change.interface = interface_entry(static_cast<unsigned int>(info->ifi_index));
+
+					int attributes_len = static_cast<int>(IFLA_PAYLOAD(&header));
+
+					for (const ::rtattr* attribute = IFLA_RTA(info); RTA_OK(attribute, attributes_len); attribute = RTA_NEXT(attribute, attributes_len))
+					{
+						if ((attribute->rta_type == IFLA_IFNAME) && (RTA_PAYLOAD(attribute) > 0))
+						{
+							change.interface_name = std::string(static_cast<const char*>(RTA_DATA(attribute)), ::strnlen(static_cast<const char*>(RTA_DATA(attribute)), RTA_PAYLOAD(attribute)));
+						}
+					}
+
+					break;
+				}
+			case RTM_NEWADDR:
+			case RTM_DELADDR:
+				{
+					if (header.nlmsg_len < NLMSG_LENGTH(sizeof(::ifaddrmsg)))
+					{
+						return;
+					}
+
+					const ::ifaddrmsg* const info = static_cast<const ::ifaddrmsg*>(NLMSG_DATA(&header));
+
+					change.type = network_change::change_type::address;
+					change.removed = (header.nlmsg_type == RTM_DELADDR);
+					change.interface = interface_entry(info->ifa_index);
+
+					break;
+				}
+			case RTM_NEWROUTE:
+			case RTM_DELROUTE:
+				{
+					if (header.nlmsg_len < NLMSG_LENGTH(sizeof(::rtmsg)))
+					{
+						return;
+					}
+
+					const ::rtmsg* const info = static_cast<const ::rtmsg*>(NLMSG_DATA(&header));
+
+					// Cached routes come and go with the traffic and say nothing about the routing table.
+					if (info->rtm_flags & RTM_F_CLONED)
+					{
+						return;
+					}
+
+					change.type = network_change::change_type::route;
+					change.removed = (header.nlmsg_type == RTM_DELROUTE);
+					change.route_protocol = info->rtm_protocol;
+
+					int attributes_len = static_cast<int>(RTM_PAYLOAD(&header));
+
+					for (const ::rtattr* attribute = RTM_RTA(info); RTA_OK(attribute, attributes_len); attribute = RTA_NEXT(attribute, attributes_len))
+					{
+						if ((attribute->rta_type == RTA_OIF) && (RTA_PAYLOAD(attribute) >= sizeof(unsigned int)))
+						{
+							change.interface = interface_entry(*static_cast<const unsigned int*>(RTA_DATA(attribute)));
+						}
+					}
+
+					break;
+				}
+			default:
+				{
+					return;
+				}
+		}
+
+		if (change.interface_name.empty())
+		{
+			change.interface_name = get_interface_name(change.interface.index());
+		}
+
+		if (m_handler)
+		{
+			m_handler(change);
+		}
+	}
+}
@@ -0,0 +1,57 @@
+/**
+ * \file check.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Minimal helpers for the test programs.
+ */
+
+#ifndef TESTS_CHECK_HPP
+#define TESTS_CHECK_HPP
+
+#include <cstdlib>
+#include <iostream>
+
+/**
+ * \brief Check a condition, reporting it and counting a failure if it doesn't hold.
+ */
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " << #condition << std::endl; \
+			++check_failures(); \
+		} \
+	} \
+	while (false)
+
+/**
+ * \brief Get the count of failed checks.
+ * \return A reference to the count of failed checks.
+ */
+inline unsigned int& check_failures()
+{
+	static unsigned int failures = 0;
+
+	return failures;
+}
+
+/**
+ * \brief Get the exit status of a test program.
+ * \param name The name of the test.
+ * \return EXIT_SUCCESS if no check failed, EXIT_FAILURE otherwise.
+ */
+inline int check_result(const char* name)
+{
+	if (check_failures() > 0)
+	{
+		std::cerr << name << ": " << check_failures() << " check(s) failed." << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	std::cout << name << ": all checks passed." << std::endl;
+
+	return EXIT_SUCCESS;
+}
+
+#endif /* TESTS_CHECK_HPP */
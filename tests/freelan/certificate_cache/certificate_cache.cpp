@@ -0,0 +1,167 @@
+/**
+ * \file certificate_cache.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief The certificate cache tests.
+ */
+
+#include <freelan/certificate_cache.hpp>
+
+#include "check.hpp"
+
+using freelan::certificate_cache;
+
+namespace
+{
+	const certificate_cache::duration_type TTL = boost::posix_time::minutes(5);
+	const certificate_cache::duration_type NEGATIVE_TTL = boost::posix_time::seconds(10);
+
+	certificate_cache::key_type make_key(uint8_t value)
+	{
+		certificate_cache::key_type key;
+		key.data.fill(value);
+
+		return key;
+	}
+
+	certificate_cache::time_type make_time(long seconds)
+	{
+		return certificate_cache::time_type(boost::gregorian::date(2026, 1, 1)) + boost::posix_time::seconds(seconds);
+	}
+
+	void test_find()
+	{
+		certificate_cache cache(4, TTL, NEGATIVE_TTL);
+
+		CHECK(!cache.find(make_key(1), make_time(0)));
+
+		cache.insert(make_key(1), true, cache.generation(), make_time(0));
+		cache.insert(make_key(2), false, cache.generation(), make_time(0));
+
+		CHECK(cache.find(make_key(1), make_time(0)) == true);
+		CHECK(cache.find(make_key(2), make_time(0)) == false);
+		CHECK(!cache.find(make_key(3), make_time(0)));
+
+		// A new verdict replaces the previous one.
+		cache.insert(make_key(2), true, cache.generation(), make_time(1));
+
+		CHECK(cache.find(make_key(2), make_time(1)) == true);
+	}
+
+	void test_ttl()
+	{
+		certificate_cache cache(4, TTL, NEGATIVE_TTL);
+
+		cache.insert(make_key(1), true, cache.generation(), make_time(0));
+		cache.insert(make_key(2), false, cache.generation(), make_time(0));
+
+		// Negative verdicts expire much sooner than positive ones.
+		CHECK(cache.find(make_key(2), make_time(9)) == false);
+		CHECK(!cache.find(make_key(2), make_time(10)));
+
+		CHECK(cache.find(make_key(1), make_time(299)) == true);
+		CHECK(!cache.find(make_key(1), make_time(300)));
+
+		// Expired verdicts are removed.
+		CHECK(!cache.find(make_key(1), make_time(0)));
+
+		// A null negative TTL disables the caching of negative verdicts.
+		certificate_cache positive_cache(4, TTL, certificate_cache::duration_type());
+
+		positive_cache.insert(make_key(1), false, positive_cache.generation(), make_time(0));
+		positive_cache.insert(make_key(2), true, positive_cache.generation(), make_time(0));
+
+		CHECK(!positive_cache.find(make_key(1), make_time(0)));
+		CHECK(positive_cache.find(make_key(2), make_time(0)) == true);
+	}
+
+	void test_ttl_capped_at_not_after()
+	{
+		certificate_cache cache(4, TTL, NEGATIVE_TTL);
+
+		// The certificate expires before the TTL does.
+		cache.insert(make_key(1), true, cache.generation(), make_time(0), make_time(60));
+
+		CHECK(cache.find(make_key(1), make_time(59)) == true);
+		CHECK(!cache.find(make_key(1), make_time(60)));
+
+		// The certificate expires after the TTL does.
+		cache.insert(make_key(2), true, cache.generation(), make_time(0), make_time(3600));
+
+		CHECK(cache.find(make_key(2), make_time(299)) == true);
+		CHECK(!cache.find(make_key(2), make_time(300)));
+
+		// An already expired certificate is not cached at all.
+		cache.insert(make_key(3), true, cache.generation(), make_time(0), make_time(-1));
+
+		CHECK(!cache.find(make_key(3), make_time(0)));
+	}
+
+	void test_lru_eviction()
+	{
+		certificate_cache cache(3, TTL, NEGATIVE_TTL);
+
+		cache.insert(make_key(1), true, cache.generation(), make_time(0));
+		cache.insert(make_key(2), true, cache.generation(), make_time(0));
+		cache.insert(make_key(3), true, cache.generation(), make_time(0));
+
+		// Looking the oldest verdict up makes it the most recently used.
+		CHECK(cache.find(make_key(1), make_time(0)) == true);
+
+		cache.insert(make_key(4), true, cache.generation(), make_time(0));
+
+		CHECK(cache.find(make_key(1), make_time(0)) == true);
+		CHECK(!cache.find(make_key(2), make_time(0)));
+		CHECK(cache.find(make_key(3), make_time(0)) == true);
+		CHECK(cache.find(make_key(4), make_time(0)) == true);
+
+		// Replacing a verdict does not evict another one.
+		cache.insert(make_key(3), false, cache.generation(), make_time(0));
+
+		CHECK(cache.find(make_key(1), make_time(0)) == true);
+		CHECK(cache.find(make_key(3), make_time(0)) == false);
+		CHECK(cache.find(make_key(4), make_time(0)) == true);
+
+		// A cache without entries caches nothing.
+		certificate_cache disabled_cache(0, TTL, NEGATIVE_TTL);
+
+		disabled_cache.insert(make_key(1), true, disabled_cache.generation(), make_time(0));
+
+		CHECK(!disabled_cache.find(make_key(1), make_time(0)));
+	}
+
+	void test_generation()
+	{
+		certificate_cache cache(4, TTL, NEGATIVE_TTL);
+
+		cache.insert(make_key(1), true, cache.generation(), make_time(0));
+
+		// A verdict computation starts before the cache is cleared.
+		const certificate_cache::generation_type generation = cache.generation();
+
+		cache.clear();
+
+		CHECK(cache.generation() != generation);
+		CHECK(!cache.find(make_key(1), make_time(0)));
+
+		// Its verdict may rely on outdated certificate authorities: it is discarded.
+		cache.insert(make_key(2), true, generation, make_time(0));
+
+		CHECK(!cache.find(make_key(2), make_time(0)));
+
+		// Verdicts computed after the reset are kept.
+		cache.insert(make_key(2), true, cache.generation(), make_time(0));
+
+		CHECK(cache.find(make_key(2), make_time(0)) == true);
+	}
+}
+
+int main()
+{
+	test_find();
+	test_ttl();
+	test_ttl_capped_at_not_after();
+	test_lru_eviction();
+	test_generation();
+
+	return check_result("certificate_cache");
+}
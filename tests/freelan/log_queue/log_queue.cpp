@@ -0,0 +1,275 @@
+/**
+ * \file log_queue.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief The log queue tests.
+ */
+
+#include <freelan/log_queue.hpp>
+
+#include <boost/thread/future.hpp>
+
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+using freelan::log_queue;
+using freelan::log_level;
+
+namespace
+{
+	struct log_entry
+	{
+		log_level level;
+		std::string message;
+	};
+
+	class log_sink
+	{
+		public:
+
+			void operator()(log_level level, const std::string& message, const log_queue::timestamp_type&)
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+
+				const log_entry entry = { level, message };
+				m_entries.push_back(entry);
+				m_condition.notify_all();
+			}
+
+			std::vector<log_entry> wait_for(size_t count)
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+
+				while (m_entries.size() < count)
+				{
+					m_condition.wait(lock);
+				}
+
+				return m_entries;
+			}
+
+		private:
+
+			boost::mutex m_mutex;
+			boost::condition_variable m_condition;
+			std::vector<log_entry> m_entries;
+	};
+
+	std::string make_message(unsigned int producer, unsigned int index)
+	{
+		std::ostringstream oss;
+		oss << producer << ":" << index;
+
+		return oss.str();
+	}
+
+	void test_wraparound()
+	{
+		log_sink sink;
+		log_queue queue(2);
+		queue.set_handler(boost::ref(sink));
+
+		// Each entry is drained before the next is pushed, so the positions wrap around the ring many times.
+		for (unsigned int index = 0; index < 64; ++index)
+		{
+			CHECK(queue.push(freelan::LL_INFORMATION, make_message(0, index), log_queue::timestamp_type()));
+			sink.wait_for(index + 1);
+		}
+
+		const std::vector<log_entry> entries = sink.wait_for(64);
+
+		CHECK(entries.size() == 64);
+
+		for (unsigned int index = 0; index < entries.size(); ++index)
+		{
+			CHECK(entries[index].message == make_message(0, index));
+		}
+
+		CHECK(queue.dropped() == 0);
+	}
+
+	void test_full_queue()
+	{
+		log_sink sink;
+		boost::promise<void> blocked;
+		boost::promise<void> release;
+		boost::shared_future<void> released = release.get_future().share();
+
+		{
+			log_queue queue(2);
+
+			// The first entry holds the drain thread until it is released.
+			queue.set_handler([&sink, &blocked, released](log_level level, const std::string& message, const log_queue::timestamp_type& timestamp) {
+				if (message == "blocking")
+				{
+					blocked.set_value();
+					released.wait();
+				}
+
+				sink(level, message, timestamp);
+			});
+
+			CHECK(queue.push(freelan::LL_INFORMATION, "blocking", log_queue::timestamp_type()));
+			blocked.get_future().wait();
+
+			CHECK(queue.push(freelan::LL_INFORMATION, "first", log_queue::timestamp_type()));
+			CHECK(queue.push(freelan::LL_INFORMATION, "second", log_queue::timestamp_type()));
+			CHECK(!queue.push(freelan::LL_INFORMATION, "dropped", log_queue::timestamp_type()));
+			CHECK(!queue.push(freelan::LL_INFORMATION, "dropped", log_queue::timestamp_type()));
+			CHECK(queue.dropped() == 2);
+
+			release.set_value();
+
+			const std::vector<log_entry> entries = sink.wait_for(4);
+
+			CHECK(entries.size() == 4);
+			CHECK(entries[0].message == "blocking");
+			CHECK(entries[1].message == "first");
+			CHECK(entries[2].message == "second");
+			CHECK(entries[3].level == freelan::LL_WARNING);
+			CHECK(entries[3].message == "2 log message(s) dropped: the log queue was full.");
+		}
+	}
+
+	void test_concurrent_producers()
+	{
+		const unsigned int producer_count = 4;
+		const unsigned int message_count = 2000;
+
+		log_sink sink;
+		std::vector<log_entry> entries;
+		uint64_t dropped = 0;
+
+		{
+			log_queue queue(64);
+			queue.set_handler(boost::ref(sink));
+
+			boost::thread_group producers;
+
+			for (unsigned int producer = 0; producer < producer_count; ++producer)
+			{
+				producers.create_thread([&queue, producer, message_count]() {
+					for (unsigned int index = 0; index < message_count; ++index)
+					{
+						queue.push(freelan::LL_INFORMATION, make_message(producer, index), log_queue::timestamp_type());
+					}
+				});
+			}
+
+			producers.join_all();
+			dropped = queue.dropped();
+
+			// The destructor emits the remaining entries.
+		}
+
+		entries = sink.wait_for(0);
+
+		// Every entry is either emitted or counted as dropped, and each producer's entries keep their order.
+		std::map<unsigned int, unsigned int> next_index;
+		uint64_t emitted = 0;
+		uint64_t reported = 0;
+
+		for (std::vector<log_entry>::const_iterator entry = entries.begin(); entry != entries.end(); ++entry)
+		{
+			if (entry->level == freelan::LL_WARNING)
+			{
+				std::istringstream iss(entry->message);
+				uint64_t count = 0;
+				iss >> count;
+				reported += count;
+
+				continue;
+			}
+
+			std::istringstream iss(entry->message);
+			unsigned int producer = 0;
+			unsigned int index = 0;
+			char separator = 0;
+			iss >> producer >> separator >> index;
+
+			CHECK(producer < producer_count);
+			CHECK(index >= next_index[producer]);
+
+			next_index[producer] = index + 1;
+			++emitted;
+		}
+
+		CHECK(emitted + dropped == producer_count * message_count);
+		CHECK(reported == dropped);
+	}
+
+	void test_truncation()
+	{
+		log_sink sink;
+		log_queue queue;
+		queue.set_handler(boost::ref(sink));
+
+		const std::string long_message(log_queue::MAX_MESSAGE_SIZE + 100, 'x');
+		const std::string exact_message(log_queue::MAX_MESSAGE_SIZE, 'y');
+		const std::string marker(log_queue::TRUNCATION_MARKER);
+
+		CHECK(queue.push(freelan::LL_INFORMATION, long_message, log_queue::timestamp_type()));
+		CHECK(queue.push(freelan::LL_INFORMATION, exact_message, log_queue::timestamp_type()));
+
+		const std::vector<log_entry> entries = sink.wait_for(2);
+
+		CHECK(entries[0].message.size() == log_queue::MAX_MESSAGE_SIZE);
+		CHECK(entries[0].message.compare(log_queue::MAX_MESSAGE_SIZE - marker.size(), marker.size(), marker) == 0);
+		CHECK(entries[0].message.compare(0, log_queue::MAX_MESSAGE_SIZE - marker.size(), long_message, 0, log_queue::MAX_MESSAGE_SIZE - marker.size()) == 0);
+		CHECK(entries[1].message == exact_message);
+	}
+
+	struct nested_value
+	{
+		const freelan::logger& logger;
+	};
+
+	std::ostream& operator<<(std::ostream& os, const nested_value& value)
+	{
+		value.logger(freelan::LL_INFORMATION) << "nested";
+
+		return os << "value";
+	}
+
+	void test_logger_stream()
+	{
+		std::vector<std::string> messages;
+
+		const freelan::logger logger([&messages](log_level, const std::string& message, const freelan::logger::timestamp_type&) {
+			messages.push_back(message);
+		}, freelan::LL_INFORMATION);
+
+		logger(freelan::LL_INFORMATION) << "first " << 1;
+		logger(freelan::LL_INFORMATION) << "second " << 2;
+		logger(freelan::LL_DEBUG) << "ignored";
+
+		// A message logged while formatting another one does not garble it.
+		const nested_value value = { logger };
+		logger(freelan::LL_INFORMATION) << "outer " << value;
+
+		freelan::log_rate_limiter limiter(1);
+		logger(freelan::LL_INFORMATION, limiter) << "limited";
+		logger(freelan::LL_INFORMATION, limiter) << "limited";
+
+		CHECK(messages.size() == 5);
+		CHECK(messages[0] == "first 1");
+		CHECK(messages[1] == "second 2");
+		CHECK(messages[2] == "nested");
+		CHECK(messages[3] == "outer value");
+		CHECK(messages[4] == "limited");
+	}
+}
+
+int main()
+{
+	test_wraparound();
+	test_full_queue();
+	test_concurrent_producers();
+	test_truncation();
+	test_logger_stream();
+
+	return check_result("log_queue");
+}
@@ -0,0 +1,233 @@
+/**
+ * \file mac_table.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief The MAC table tests.
+ */
+
+#include <freelan/mac_table.hpp>
+
+#include "check.hpp"
+
+namespace
+{
+	typedef freelan::mac_table<unsigned int> mac_table_type;
+	typedef mac_table_type::ethernet_address_type ethernet_address_type;
+	typedef mac_table_type::time_type time_type;
+	typedef mac_table_type::duration_type duration_type;
+
+	// A table of 4 entries has 8 slots.
+	const size_t ENTRIES = 4;
+	const unsigned int SLOT_BITS = 3;
+	const size_t SLOTS = static_cast<size_t>(1) << SLOT_BITS;
+
+	ethernet_address_type make_address(uint8_t byte4, uint8_t byte5)
+	{
+		const ethernet_address_type address = {{ 0x02, 0x00, 0x5e, 0x10, byte4, byte5 }};
+
+		return address;
+	}
+
+	// The home slot of an address in the table, so that we can build collision chains.
+	size_t home_slot(const ethernet_address_type& address)
+	{
+		return freelan::hash_ethernet_address(address, SLOT_BITS);
+	}
+
+	// Get the count-th address (starting at 0) whose home slot is slot.
+	ethernet_address_type address_for_slot(size_t slot, unsigned int count)
+	{
+		for (unsigned int i = 0; i < 0x10000; ++i)
+		{
+			const ethernet_address_type address = make_address(static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i & 0xff));
+
+			if ((home_slot(address) == slot) && (count-- == 0))
+			{
+				return address;
+			}
+		}
+
+		return ethernet_address_type();
+	}
+
+	bool has_value(mac_table_type& table, const ethernet_address_type& address, unsigned int value, const time_type& now)
+	{
+		const unsigned int* result = table.find(address, now);
+
+		return result && (*result == value);
+	}
+
+	void test_collision_chain()
+	{
+		const time_type now = boost::posix_time::microsec_clock::universal_time();
+
+		// The first three addresses share the home slot 2, the last one has its home slot within their chain.
+		const ethernet_address_type a = address_for_slot(2, 0);
+		const ethernet_address_type b = address_for_slot(2, 1);
+		const ethernet_address_type c = address_for_slot(2, 2);
+		const ethernet_address_type d = address_for_slot(3, 0);
+
+		mac_table_type table(ENTRIES, duration_type());
+
+		CHECK(table.max_entries() == ENTRIES);
+
+		// Slots: 2 -> a, 3 -> b, 4 -> c, 5 -> d.
+		table.learn(a, 1, now);
+		table.learn(b, 2, now);
+		table.learn(c, 3, now);
+		table.learn(d, 4, now);
+
+		CHECK(table.size() == 4);
+
+		// Erasing the head of the chain must shift the others back.
+		CHECK(table.erase(a));
+		CHECK(!table.erase(a));
+		CHECK(!table.find(a, now));
+		CHECK(has_value(table, b, 2, now));
+		CHECK(has_value(table, c, 3, now));
+		CHECK(has_value(table, d, 4, now));
+
+		// Erasing from the middle of the chain too.
+		CHECK(table.erase(c));
+		CHECK(has_value(table, b, 2, now));
+		CHECK(has_value(table, d, 4, now));
+		CHECK(table.size() == 2);
+
+		// An absent address that collides is not found.
+		CHECK(!table.erase(address_for_slot(2, 3)));
+	}
+
+	void test_collision_chain_wrap_around()
+	{
+		const time_type now = boost::posix_time::microsec_clock::universal_time();
+
+		// The last slot overflows on the first slots.
+		const ethernet_address_type a = address_for_slot(SLOTS - 1, 0);
+		const ethernet_address_type b = address_for_slot(SLOTS - 1, 1);
+		const ethernet_address_type c = address_for_slot(SLOTS - 1, 2);
+		const ethernet_address_type d = address_for_slot(0, 0);
+
+		mac_table_type table(ENTRIES, duration_type());
+
+		// Slots: 7 -> a, 0 -> d. d is in its home slot and must not move back across the end of the slot array.
+		table.learn(a, 1, now);
+		table.learn(d, 4, now);
+
+		CHECK(table.erase(a));
+		CHECK(has_value(table, d, 4, now));
+		CHECK(table.erase(d));
+		CHECK(table.size() == 0);
+
+		// Slots: 7 -> a, 0 -> b, 1 -> d, 2 -> c.
+		table.learn(a, 1, now);
+		table.learn(b, 2, now);
+		table.learn(d, 4, now);
+		table.learn(c, 3, now);
+
+		// b, d and c must all move back across the end of the slot array: 7 -> b, 0 -> d, 1 -> c.
+		CHECK(table.erase(a));
+		CHECK(has_value(table, b, 2, now));
+		CHECK(has_value(table, c, 3, now));
+		CHECK(has_value(table, d, 4, now));
+
+		// c must move back to slot 0, before its home slot: 7 -> b, 0 -> c.
+		CHECK(table.erase(d));
+		CHECK(has_value(table, b, 2, now));
+		CHECK(has_value(table, c, 3, now));
+
+		// And to its home slot.
+		CHECK(table.erase(b));
+		CHECK(has_value(table, c, 3, now));
+		CHECK(table.size() == 1);
+
+		CHECK(table.erase(c));
+		CHECK(table.size() == 0);
+	}
+
+	void test_expiry()
+	{
+		const time_type now = boost::posix_time::microsec_clock::universal_time();
+		const ethernet_address_type a = make_address(0x00, 0x01);
+		const ethernet_address_type b = make_address(0x00, 0x02);
+		const ethernet_address_type c = make_address(0x00, 0x03);
+
+		mac_table_type table(ENTRIES, boost::posix_time::seconds(10));
+
+		// Expired entries are purged by find.
+		table.learn(a, 1, now);
+
+		CHECK(has_value(table, a, 1, now + boost::posix_time::seconds(10)));
+		CHECK(!table.find(a, now + boost::posix_time::seconds(11)));
+		CHECK(table.size() == 0);
+
+		// Expired entries are purged by learn, starting from the least recently learned one.
+		table.learn(a, 1, now);
+		table.learn(b, 2, now + boost::posix_time::seconds(5));
+		table.learn(c, 3, now + boost::posix_time::seconds(12));
+
+		CHECK(table.size() == 2);
+		CHECK(has_value(table, b, 2, now + boost::posix_time::seconds(12)));
+		CHECK(has_value(table, c, 3, now + boost::posix_time::seconds(12)));
+
+		// Learning an address again refreshes it.
+		table.learn(b, 4, now + boost::posix_time::seconds(14));
+
+		CHECK(has_value(table, b, 4, now + boost::posix_time::seconds(23)));
+		CHECK(!table.find(c, now + boost::posix_time::seconds(23)));
+
+		// A null aging time disables aging.
+		table.set_aging_time(duration_type());
+
+		CHECK(has_value(table, b, 4, now + boost::posix_time::hours(24)));
+	}
+
+	void test_eviction_order()
+	{
+		const time_type now = boost::posix_time::microsec_clock::universal_time();
+		const ethernet_address_type a = make_address(0x00, 0x01);
+		const ethernet_address_type b = make_address(0x00, 0x02);
+		const ethernet_address_type c = make_address(0x00, 0x03);
+		const ethernet_address_type d = make_address(0x00, 0x04);
+		const ethernet_address_type e = make_address(0x00, 0x05);
+
+		mac_table_type table(3, duration_type());
+
+		table.learn(a, 1, now);
+		table.learn(b, 2, now);
+		table.learn(c, 3, now);
+
+		// Learning a again makes b the least recently learned entry.
+		table.learn(a, 10, now);
+		table.learn(d, 4, now);
+
+		CHECK(table.size() == 3);
+		CHECK(!table.find(b, now));
+		CHECK(has_value(table, a, 10, now));
+		CHECK(has_value(table, c, 3, now));
+		CHECK(has_value(table, d, 4, now));
+
+		// Finding an address does not refresh it.
+		table.learn(e, 5, now);
+
+		CHECK(!table.find(c, now));
+		CHECK(has_value(table, a, 10, now));
+		CHECK(has_value(table, d, 4, now));
+		CHECK(has_value(table, e, 5, now));
+
+		table.learn(b, 2, now);
+
+		CHECK(!table.find(a, now));
+		CHECK(has_value(table, d, 4, now));
+		CHECK(has_value(table, e, 5, now));
+		CHECK(has_value(table, b, 2, now));
+	}
+}
+
+int main()
+{
+	test_collision_chain();
+	test_collision_chain_wrap_around();
+	test_expiry();
+	test_eviction_order();
+
+	return check_result("mac_table");
+}
@@ -0,0 +1,161 @@
+/**
+ * \file route_trie.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief The route trie tests.
+ */
+
+#include <freelan/route_trie.hpp>
+
+#include <boost/asio/ip/address_v4.hpp>
+#include <boost/asio/ip/address_v6.hpp>
+
+#include "check.hpp"
+
+using boost::asio::ip::address_v4;
+using boost::asio::ip::address_v6;
+
+namespace
+{
+	typedef freelan::route_trie<address_v4, unsigned int> ipv4_trie;
+	typedef freelan::route_trie<address_v6, unsigned int> ipv6_trie;
+
+	bool any_value(unsigned int)
+	{
+		return true;
+	}
+
+	boost::optional<unsigned int> find(const ipv4_trie& trie, const char* address)
+	{
+		return trie.find(address_v4::from_string(address), &any_value);
+	}
+
+	void test_longest_prefix_match()
+	{
+		ipv4_trie trie;
+
+		CHECK(!find(trie, "10.0.0.1"));
+
+		trie.insert(address_v4::from_string("0.0.0.0"), 0, 1);
+		trie.insert(address_v4::from_string("10.0.0.0"), 8, 2);
+		trie.insert(address_v4::from_string("10.1.0.0"), 16, 3);
+		trie.insert(address_v4::from_string("10.1.2.3"), 32, 4);
+
+		// Bits beyond the prefix length are ignored.
+		trie.insert(address_v4::from_string("192.168.1.255"), 24, 5);
+
+		CHECK(find(trie, "8.8.8.8") == 1u);
+		CHECK(find(trie, "10.2.0.1") == 2u);
+		CHECK(find(trie, "10.1.9.9") == 3u);
+		CHECK(find(trie, "10.1.2.3") == 4u);
+		CHECK(find(trie, "10.1.2.4") == 3u);
+		CHECK(find(trie, "192.168.1.1") == 5u);
+		CHECK(find(trie, "192.168.2.1") == 1u);
+	}
+
+	void test_predicate()
+	{
+		ipv4_trie trie;
+
+		trie.insert(address_v4::from_string("10.0.0.0"), 8, 1);
+		trie.insert(address_v4::from_string("10.1.0.0"), 16, 3);
+		trie.insert(address_v4::from_string("10.1.0.0"), 16, 2);
+
+		const address_v4 address = address_v4::from_string("10.1.0.1");
+
+		// The values of a prefix are tried in ascending order.
+		CHECK(trie.find(address, &any_value) == 2u);
+		CHECK(trie.find(address, [](unsigned int value) { return value != 2; }) == 3u);
+
+		// When all the values of a prefix are rejected, shorter prefixes are tried.
+		CHECK(trie.find(address, [](unsigned int value) { return value == 1; }) == 1u);
+		CHECK(!trie.find(address, [](unsigned int) { return false; }));
+	}
+
+	void test_erase()
+	{
+		ipv4_trie trie;
+
+		trie.insert(address_v4::from_string("10.0.0.0"), 8, 1);
+		trie.insert(address_v4::from_string("10.1.0.0"), 16, 2);
+		trie.insert(address_v4::from_string("10.1.0.0"), 16, 3);
+		trie.insert(address_v4::from_string("10.128.0.0"), 16, 4);
+
+		CHECK(!trie.erase(address_v4::from_string("10.1.0.0"), 16, 5));
+		CHECK(!trie.erase(address_v4::from_string("10.1.0.0"), 24, 2));
+		CHECK(!trie.erase(address_v4::from_string("10.2.0.0"), 16, 2));
+
+		CHECK(trie.erase(address_v4::from_string("10.1.0.0"), 16, 2));
+		CHECK(!trie.erase(address_v4::from_string("10.1.0.0"), 16, 2));
+		CHECK(find(trie, "10.1.0.1") == 3u);
+
+		CHECK(trie.erase(address_v4::from_string("10.1.0.0"), 16, 3));
+		CHECK(find(trie, "10.1.0.1") == 1u);
+		CHECK(find(trie, "10.128.0.1") == 4u);
+
+		// Erasing the branching prefix keeps its descendants reachable.
+		CHECK(trie.erase(address_v4::from_string("10.0.0.0"), 8, 1));
+		CHECK(!find(trie, "10.1.0.1"));
+		CHECK(find(trie, "10.128.0.1") == 4u);
+
+		CHECK(trie.erase(address_v4::from_string("10.128.0.0"), 16, 4));
+		CHECK(!find(trie, "10.128.0.1"));
+
+		trie.insert(address_v4::from_string("10.0.0.0"), 8, 1);
+		CHECK(find(trie, "10.1.0.1") == 1u);
+	}
+
+	void test_copies_share_nodes()
+	{
+		ipv4_trie original;
+
+		original.insert(address_v4::from_string("10.0.0.0"), 8, 1);
+		original.insert(address_v4::from_string("10.1.0.0"), 16, 2);
+		original.insert(address_v4::from_string("172.16.0.0"), 12, 3);
+
+		ipv4_trie copy = original;
+
+		copy.insert(address_v4::from_string("10.1.2.0"), 24, 4);
+		CHECK(copy.erase(address_v4::from_string("10.1.0.0"), 16, 2));
+		CHECK(copy.erase(address_v4::from_string("172.16.0.0"), 12, 3));
+
+		// Changing the copy leaves the original untouched.
+		CHECK(find(original, "10.1.2.1") == 2u);
+		CHECK(find(original, "10.1.3.1") == 2u);
+		CHECK(find(original, "172.16.0.1") == 3u);
+
+		CHECK(find(copy, "10.1.2.1") == 4u);
+		CHECK(find(copy, "10.1.3.1") == 1u);
+		CHECK(!find(copy, "172.16.0.1"));
+
+		// And the other way around.
+		original.clear();
+
+		CHECK(!find(original, "10.1.2.1"));
+		CHECK(find(copy, "10.1.2.1") == 4u);
+	}
+
+	void test_ipv6()
+	{
+		ipv6_trie trie;
+
+		trie.insert(address_v6::from_string("fe80::"), 10, 1);
+		trie.insert(address_v6::from_string("fe80::1"), 128, 2);
+		trie.insert(address_v6::from_string("2001:db8::"), 32, 3);
+
+		CHECK(trie.find(address_v6::from_string("fe80::1"), &any_value) == 2u);
+		CHECK(trie.find(address_v6::from_string("fe80::2"), &any_value) == 1u);
+		CHECK(trie.find(address_v6::from_string("2001:db8::1"), &any_value) == 3u);
+		CHECK(!trie.find(address_v6::from_string("2001:db9::1"), &any_value));
+	}
+}
+
+int main()
+{
+	test_longest_prefix_match();
+	test_predicate();
+	test_erase();
+	test_copies_share_nodes();
+	test_ipv6();
+
+	return check_result("route_trie");
+}
@@ -0,0 +1,151 @@
+/**
+ * \file sharded_mac_table.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief The sharded MAC table tests.
+ */
+
+#include <freelan/sharded_mac_table.hpp>
+
+#include <set>
+#include <vector>
+
+#include "check.hpp"
+
+namespace
+{
+	typedef freelan::sharded_mac_table<unsigned int> mac_table_type;
+	typedef mac_table_type::ethernet_address_type ethernet_address_type;
+
+	ethernet_address_type make_address(uint8_t byte4, uint8_t byte5)
+	{
+		const ethernet_address_type address = {{ 0x02, 0x00, 0x5e, 0x10, byte4, byte5 }};
+
+		return address;
+	}
+
+	// Get the count-th address (starting at 0) that lives in a shard.
+	ethernet_address_type address_in_shard(size_t index, unsigned int count)
+	{
+		for (unsigned int i = 0; i < 0x10000; ++i)
+		{
+			const ethernet_address_type address = make_address(static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i & 0xff));
+
+			if ((mac_table_type::shard_index(address) == index) && (count-- == 0))
+			{
+				return address;
+			}
+		}
+
+		return ethernet_address_type();
+	}
+
+	void test_shard_index()
+	{
+		CHECK(mac_table_type::SHARD_COUNT == 16);
+
+		// All the bytes are used.
+		{
+			std::set<size_t> indexes;
+
+			for (unsigned int i = 0; i < 256; ++i)
+			{
+				ethernet_address_type address = make_address(0x12, 0x34);
+				address[0] = static_cast<uint8_t>(i);
+
+				indexes.insert(mac_table_type::shard_index(address));
+			}
+
+			CHECK(indexes.size() == mac_table_type::SHARD_COUNT);
+		}
+
+		// Consecutive addresses of a same vendor are spread evenly over the shards.
+		const unsigned int address_count = 4096;
+		const unsigned int slot_bits = 12;
+		std::vector<unsigned int> counts(mac_table_type::SHARD_COUNT);
+		std::vector<std::set<size_t> > slots(mac_table_type::SHARD_COUNT);
+
+		for (unsigned int i = 0; i < address_count; ++i)
+		{
+			const ethernet_address_type address = make_address(static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i & 0xff));
+			const size_t index = mac_table_type::shard_index(address);
+
+			CHECK(index < mac_table_type::SHARD_COUNT);
+
+			++counts[index];
+			slots[index].insert(freelan::hash_ethernet_address(address, slot_bits));
+		}
+
+		const unsigned int average = address_count / mac_table_type::SHARD_COUNT;
+
+		for (size_t index = 0; index < mac_table_type::SHARD_COUNT; ++index)
+		{
+			CHECK((counts[index] > average * 3 / 4) && (counts[index] < average * 5 / 4));
+
+			// The addresses of a shard must be spread over all the slots of its table, and thus seldom share a home slot.
+			CHECK(slots[index].size() > counts[index] * 7 / 8);
+		}
+	}
+
+	void test_shards()
+	{
+		mac_table_type table(mac_table_type::SHARD_COUNT * 2, boost::posix_time::time_duration());
+		const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+		// The maximum entry count is split between the shards, rounding up.
+		CHECK(table.shard(make_address(0, 0)).table.max_entries() == 2);
+		CHECK(mac_table_type(1, boost::posix_time::time_duration()).shard(make_address(0, 0)).table.max_entries() == 1);
+		CHECK(mac_table_type(33, boost::posix_time::time_duration()).shard(make_address(0, 0)).table.max_entries() == 3);
+
+		// Addresses in the same shard share a shard.
+		CHECK(&table.shard(address_in_shard(0, 0)) == &table.shard(address_in_shard(0, 1)));
+		CHECK(&table.shard(address_in_shard(0, 0)) != &table.shard(address_in_shard(1, 0)));
+
+		for (unsigned int i = 0; i < mac_table_type::SHARD_COUNT; ++i)
+		{
+			const ethernet_address_type address = address_in_shard(i, 0);
+			mac_table_type::shard_type& shard = table.shard(address);
+			boost::mutex::scoped_lock lock(shard.mutex);
+
+			shard.table.learn(address, i, now);
+		}
+
+		// Filling one shard evicts its least recently learned address only.
+		{
+			const ethernet_address_type address = address_in_shard(0, 1);
+			const ethernet_address_type other_address = address_in_shard(0, 2);
+
+			mac_table_type::shard_type& shard = table.shard(address);
+
+			CHECK(&shard == &table.shard(address_in_shard(0, 0)));
+			CHECK(&shard == &table.shard(other_address));
+
+			boost::mutex::scoped_lock lock(shard.mutex);
+
+			shard.table.learn(address, 100, now);
+			shard.table.learn(other_address, 200, now);
+
+			CHECK(!shard.table.find(address_in_shard(0, 0), now));
+			CHECK(*shard.table.find(address, now) == 100);
+			CHECK(*shard.table.find(other_address, now) == 200);
+		}
+
+		for (unsigned int i = 1; i < mac_table_type::SHARD_COUNT; ++i)
+		{
+			const ethernet_address_type address = address_in_shard(i, 0);
+			mac_table_type::shard_type& shard = table.shard(address);
+			boost::mutex::scoped_lock lock(shard.mutex);
+
+			const unsigned int* value = shard.table.find(address, now);
+
+			CHECK(value && (*value == i));
+		}
+	}
+}
+
+int main()
+{
+	test_shard_index();
+	test_shards();
+
+	return check_result("sharded_mac_table");
+}
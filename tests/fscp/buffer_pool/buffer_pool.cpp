@@ -0,0 +1,224 @@
+/**
+ * \file buffer_pool.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief The buffer pool tests.
+ */
+
+#include <fscp/buffer_pool.hpp>
+
+#include <boost/thread.hpp>
+#include <boost/thread/barrier.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "check.hpp"
+
+using fscp::buffer_pool;
+using boost::asio::buffer_cast;
+
+namespace
+{
+	const size_t BLOCK_SIZE = 1500;
+	const size_t BLOCK_COUNT = 4;
+
+	void test_block_reuse()
+	{
+		buffer_pool pool(BLOCK_SIZE, BLOCK_COUNT);
+
+		uint8_t* const first = pool.allocate();
+		CHECK(pool.is_pool_block(first));
+
+		pool.deallocate(first);
+
+		// The last released block is the first one to be handed out again.
+		uint8_t* const second = pool.allocate();
+		CHECK(second == first);
+
+		pool.deallocate(second);
+
+		{
+			const buffer_pool::shared_buffer_type buffer = pool.allocate_shared_buffer();
+
+			CHECK(buffer_size(buffer) == BLOCK_SIZE);
+			CHECK(buffer_cast<uint8_t*>(buffer) == first);
+		}
+
+		// Shared buffers give their block back when released.
+		uint8_t* const third = pool.allocate();
+		CHECK(third == first);
+
+		pool.deallocate(third);
+	}
+
+	void test_heap_fallback()
+	{
+		buffer_pool pool(BLOCK_SIZE, BLOCK_COUNT);
+		std::vector<uint8_t*> blocks;
+
+		for (size_t i = 0; i < BLOCK_COUNT; ++i)
+		{
+			blocks.push_back(pool.allocate());
+			CHECK(pool.is_pool_block(blocks.back()));
+		}
+
+		CHECK(std::set<uint8_t*>(blocks.begin(), blocks.end()).size() == BLOCK_COUNT);
+
+		// The pool is exhausted: the next blocks come from the heap, and are still usable.
+		uint8_t* const heap_block = pool.allocate();
+		CHECK(!pool.is_pool_block(heap_block));
+		std::fill(heap_block, heap_block + BLOCK_SIZE, 0xff);
+
+		pool.deallocate(heap_block);
+
+		for (uint8_t* block : blocks)
+		{
+			pool.deallocate(block);
+		}
+
+		// Releasing a heap block must not make it a pool block.
+		blocks.clear();
+
+		for (size_t i = 0; i < BLOCK_COUNT; ++i)
+		{
+			blocks.push_back(pool.allocate());
+			CHECK(pool.is_pool_block(blocks.back()));
+		}
+
+		for (uint8_t* block : blocks)
+		{
+			pool.deallocate(block);
+		}
+	}
+
+	void test_thread_cache()
+	{
+		buffer_pool pool(BLOCK_SIZE, BLOCK_COUNT);
+		boost::barrier allocated(2);
+		boost::barrier checked(2);
+
+		// The first allocation of a thread moves a batch of free blocks to its cache: here, all of them.
+		boost::thread thread([&pool, &allocated, &checked] () {
+			uint8_t* const block = pool.allocate();
+			pool.deallocate(block);
+
+			allocated.wait();
+			checked.wait();
+		});
+
+		allocated.wait();
+
+		uint8_t* const block = pool.allocate();
+		CHECK(!pool.is_pool_block(block));
+		pool.deallocate(block);
+
+		checked.wait();
+		thread.join();
+
+		// The thread exited: its cached blocks went back to the shared stack.
+		std::vector<uint8_t*> blocks;
+
+		for (size_t i = 0; i < BLOCK_COUNT; ++i)
+		{
+			blocks.push_back(pool.allocate());
+			CHECK(pool.is_pool_block(blocks.back()));
+		}
+
+		for (uint8_t* _block : blocks)
+		{
+			pool.deallocate(_block);
+		}
+	}
+
+	void test_pool_rebuilt_at_same_address()
+	{
+		// This is what happens when the server is closed and opened again.
+		boost::aligned_storage<sizeof(buffer_pool), boost::alignment_of<buffer_pool>::value>::type storage;
+		buffer_pool* pool = new (&storage) buffer_pool(BLOCK_SIZE, BLOCK_COUNT);
+		boost::barrier cached(2);
+		boost::barrier rebuilt(2);
+		bool is_pool_block = false;
+
+		boost::thread thread([&pool, &cached, &rebuilt, &is_pool_block] () {
+			pool->deallocate(pool->allocate());
+
+			cached.wait();
+			rebuilt.wait();
+
+			// The cache of this thread still refers to the previous pool: its blocks must not be handed out.
+			uint8_t* const block = pool->allocate();
+			is_pool_block = pool->is_pool_block(block);
+			pool->deallocate(block);
+		});
+
+		cached.wait();
+
+		pool->~buffer_pool();
+		pool = new (&storage) buffer_pool(BLOCK_SIZE, BLOCK_COUNT);
+
+		rebuilt.wait();
+		thread.join();
+
+		CHECK(is_pool_block);
+
+		pool->~buffer_pool();
+	}
+
+	void test_concurrent_use()
+	{
+		const size_t block_count = 4 * buffer_pool::thread_cache_batch_size;
+		buffer_pool pool(BLOCK_SIZE, block_count);
+		boost::thread_group threads;
+
+		// Blocks are allocated by a thread and released by another, as they are between the socket and the tap adapter.
+		std::vector<buffer_pool::shared_buffer_type> handed_over(1000);
+		boost::mutex mutex;
+
+		for (size_t t = 0; t < 4; ++t)
+		{
+			threads.create_thread([&pool, &handed_over, &mutex, t] () {
+				for (size_t i = 0; i < 100000; ++i)
+				{
+					buffer_pool::shared_buffer_type buffer = pool.allocate_shared_buffer();
+					buffer_cast<uint8_t*>(buffer)[0] = static_cast<uint8_t>(t);
+
+					boost::mutex::scoped_lock lock(mutex);
+					std::swap(buffer, handed_over[(i * 7 + t) % handed_over.size()]);
+				}
+			});
+		}
+
+		threads.join_all();
+		handed_over.clear();
+
+		// All the blocks were given back to the pool.
+		std::set<uint8_t*> blocks;
+
+		for (size_t i = 0; i < block_count; ++i)
+		{
+			uint8_t* const block = pool.allocate();
+			CHECK(pool.is_pool_block(block));
+			blocks.insert(block);
+		}
+
+		CHECK(blocks.size() == block_count);
+
+		for (uint8_t* block : blocks)
+		{
+			pool.deallocate(block);
+		}
+	}
+}
+
+int main()
+{
+	test_block_reuse();
+	test_heap_fallback();
+	test_thread_cache();
+	test_pool_rebuilt_at_same_address();
+	test_concurrent_use();
+
+	return check_result("buffer_pool");
+}
@@ -0,0 +1,257 @@
+/**
+ * \file timer_wheel.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief The timer wheel tests.
+ */
+
+#include <fscp/timer_wheel.hpp>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "check.hpp"
+
+using fscp::timer_wheel;
+using boost::posix_time::microseconds;
+using boost::posix_time::milliseconds;
+using boost::posix_time::seconds;
+
+namespace
+{
+	// Runs an io_service in a thread of its own, as the server does.
+	class service_thread
+	{
+		public:
+
+			service_thread() :
+				m_io_service(),
+				m_work(new boost::asio::io_service::work(m_io_service)),
+				m_thread([this] () { m_io_service.run(); })
+			{
+			}
+
+			~service_thread()
+			{
+				m_work.reset();
+				m_io_service.stop();
+				m_thread.join();
+			}
+
+			boost::asio::io_service& io_service()
+			{
+				return m_io_service;
+			}
+
+		private:
+
+			boost::asio::io_service m_io_service;
+			boost::scoped_ptr<boost::asio::io_service::work> m_work;
+			boost::thread m_thread;
+	};
+
+	struct expiration_type
+	{
+		unsigned int label;
+		boost::system::error_code ec;
+		boost::posix_time::time_duration elapsed;
+	};
+
+	// Records the handler calls, in order.
+	class recorder
+	{
+		public:
+
+			recorder() :
+				m_start(boost::posix_time::microsec_clock::universal_time())
+			{
+			}
+
+			timer_wheel::handler_type handler(unsigned int label)
+			{
+				return [this, label] (const boost::system::error_code& ec) {
+					boost::mutex::scoped_lock lock(m_mutex);
+
+					const expiration_type expiration = { label, ec, boost::posix_time::microsec_clock::universal_time() - m_start };
+					m_expirations.push_back(expiration);
+					m_condition.notify_all();
+				};
+			}
+
+			std::vector<expiration_type> wait_for(size_t count, const boost::posix_time::time_duration& timeout)
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+
+				const boost::system_time deadline = boost::get_system_time() + timeout;
+
+				while ((m_expirations.size() < count) && m_condition.timed_wait(lock, deadline))
+				{
+				}
+
+				return m_expirations;
+			}
+
+		private:
+
+			const boost::posix_time::ptime m_start;
+			boost::mutex m_mutex;
+			boost::condition_variable m_condition;
+			std::vector<expiration_type> m_expirations;
+	};
+
+	void test_levels()
+	{
+		const boost::posix_time::time_duration tick = microseconds(100);
+		const unsigned int level_size = timer_wheel::SLOT_COUNT;
+
+		// Timers on the first level, right across the boundaries of the second and the third levels, and deep in the third level so that it cascades twice.
+		const unsigned int ticks[] = { 3, level_size - 1, level_size, level_size + 1, 200, level_size * level_size - 1, level_size * level_size, 5000 };
+		const size_t count = sizeof(ticks) / sizeof(ticks[0]);
+
+		service_thread service;
+		timer_wheel wheel(service.io_service(), tick);
+		recorder expirations;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			wheel.async_wait(tick * static_cast<int>(ticks[i]), expirations.handler(ticks[i]));
+		}
+
+		const std::vector<expiration_type> result = expirations.wait_for(count, seconds(5));
+
+		CHECK(result.size() == count);
+		CHECK(wheel.size() == 0);
+
+		std::vector<unsigned int> expected(ticks, ticks + count);
+		std::sort(expected.begin(), expected.end());
+
+		for (size_t i = 0; i < result.size(); ++i)
+		{
+			// The timers expire in order, never early.
+			CHECK(result[i].label == expected[i]);
+			CHECK(!result[i].ec);
+			CHECK(result[i].elapsed >= tick * static_cast<int>(result[i].label));
+		}
+	}
+
+	void test_cancel_and_rearm()
+	{
+		service_thread service;
+		timer_wheel wheel(service.io_service(), milliseconds(1));
+		recorder expirations;
+
+		// The wheel is armed for the revolution of the first level, then for an earlier tick.
+		const timer_wheel::timer_id_type long_timer = wheel.async_wait(seconds(10), expirations.handler(1));
+		const timer_wheel::timer_id_type short_timer = wheel.async_wait(milliseconds(5), expirations.handler(2));
+
+		std::vector<expiration_type> result = expirations.wait_for(1, seconds(1));
+
+		CHECK(result.size() == 1);
+		CHECK(result[0].label == 2);
+		CHECK(!result[0].ec);
+		CHECK(result[0].elapsed < milliseconds(500));
+
+		CHECK(!wheel.cancel(short_timer));
+		CHECK(wheel.cancel(long_timer));
+		CHECK(!wheel.cancel(long_timer));
+		CHECK(wheel.size() == 0);
+
+		result = expirations.wait_for(2, seconds(1));
+
+		CHECK(result.size() == 2);
+		CHECK(result[1].label == 1);
+		CHECK(result[1].ec == boost::asio::error::operation_aborted);
+
+		// The wheel keeps working once empty.
+		wheel.async_wait(milliseconds(70), expirations.handler(3));
+		wheel.async_wait(seconds(10), expirations.handler(4));
+		wheel.async_wait(seconds(10), expirations.handler(5));
+
+		result = expirations.wait_for(3, seconds(1));
+
+		CHECK(result.size() == 3);
+		CHECK(result[2].label == 3);
+		CHECK(!result[2].ec);
+
+		CHECK(wheel.cancel_all() == 2);
+		CHECK(wheel.size() == 0);
+
+		result = expirations.wait_for(5, seconds(1));
+
+		CHECK(result.size() == 5);
+		CHECK(result[3].ec == boost::asio::error::operation_aborted);
+		CHECK(result[4].ec == boost::asio::error::operation_aborted);
+	}
+
+	void test_beyond_top_level()
+	{
+		// With the shortest tick, the wheel spans about 16.8 seconds.
+		const boost::posix_time::time_duration tick = microseconds(1);
+		const boost::posix_time::time_duration span = tick * (1 << (timer_wheel::SLOT_BITS * timer_wheel::LEVEL_COUNT));
+		const boost::posix_time::time_duration timeout = span + milliseconds(200);
+
+		service_thread service;
+		timer_wheel wheel(service.io_service(), tick);
+		recorder expirations;
+
+		wheel.async_wait(timeout, expirations.handler(1));
+		wheel.async_wait(milliseconds(10), expirations.handler(2));
+
+		// The parked timer is inserted again as the wheel turns: it must neither be lost nor expire early.
+		const std::vector<expiration_type> result = expirations.wait_for(2, timeout + seconds(5));
+
+		CHECK(result.size() == 2);
+		CHECK(result[0].label == 2);
+		CHECK(result[1].label == 1);
+		CHECK(!result[1].ec);
+		CHECK(result[1].elapsed >= timeout);
+		CHECK(wheel.size() == 0);
+	}
+
+	void test_late_tick()
+	{
+		service_thread service;
+		timer_wheel wheel(service.io_service(), milliseconds(1));
+		recorder expirations;
+
+		// The io_service is busy while the timers expire: the wheel must catch up with all the ticks it missed at once.
+		service.io_service().post([] () { boost::this_thread::sleep(milliseconds(300)); });
+
+		wheel.async_wait(milliseconds(10), expirations.handler(1));
+		wheel.async_wait(milliseconds(100), expirations.handler(2));
+		wheel.async_wait(milliseconds(250), expirations.handler(3));
+		wheel.async_wait(milliseconds(600), expirations.handler(4));
+
+		std::vector<expiration_type> result = expirations.wait_for(3, seconds(2));
+
+		CHECK(result.size() == 3);
+
+		for (size_t i = 0; i < result.size(); ++i)
+		{
+			CHECK(result[i].label == i + 1);
+			CHECK(!result[i].ec);
+			CHECK(result[i].elapsed >= milliseconds(300));
+		}
+
+		CHECK(wheel.size() == 1);
+
+		// The timers that are still pending are not affected.
+		result = expirations.wait_for(4, seconds(2));
+
+		CHECK(result.size() == 4);
+		CHECK(result[3].label == 4);
+		CHECK(result[3].elapsed >= milliseconds(600));
+	}
+}
+
+int main()
+{
+	test_levels();
+	test_cancel_and_rearm();
+	test_late_tick();
+	test_beyond_top_level();
+
+	return check_result("timer_wheel");
+}
@@ -0,0 +1,134 @@
+/**
+ * \file worker_pool.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief The worker pool tests.
+ */
+
+#include <fscp/worker_pool.hpp>
+
+#include <boost/thread/future.hpp>
+
+#include <stdexcept>
+#include <string>
+
+#include "check.hpp"
+
+using fscp::worker_pool;
+
+namespace
+{
+	void throw_runtime_error()
+	{
+		throw std::runtime_error("task failed");
+	}
+
+	void throw_integer()
+	{
+		throw 42;
+	}
+
+	void test_thread_count()
+	{
+		CHECK(worker_pool::get_thread_count(3) == 3);
+		CHECK(worker_pool::get_thread_count(0) >= 1);
+
+		worker_pool pool(2, 4);
+
+		CHECK(pool.thread_count() == 2);
+		CHECK(pool.max_queue_depth() == 4);
+	}
+
+	void test_failing_tasks()
+	{
+		boost::promise<std::string> message_promise;
+		boost::promise<bool> unknown_promise;
+
+		{
+			worker_pool pool(1, 4);
+
+			const bool posted = pool.post(&throw_runtime_error, [&message_promise](std::exception_ptr error) {
+				try
+				{
+					std::rethrow_exception(error);
+				}
+				catch (const std::exception& ex)
+				{
+					message_promise.set_value(ex.what());
+				}
+			});
+
+			CHECK(posted);
+
+			// Exceptions that don't derive from std::exception are reported too.
+			CHECK(pool.post(&throw_integer, [&unknown_promise](std::exception_ptr error) {
+				unknown_promise.set_value(!!error);
+			}));
+
+			// Without an error handler, the failure is only counted.
+			CHECK(pool.post(&throw_runtime_error));
+
+			CHECK(message_promise.get_future().get() == "task failed");
+			CHECK(unknown_promise.get_future().get());
+
+			// The destructor runs the queued tasks.
+		}
+	}
+
+	void test_statistics()
+	{
+		worker_pool pool(1, 2);
+		boost::promise<void> started;
+		boost::promise<void> release;
+		boost::shared_future<void> released = release.get_future().share();
+
+		// The first task holds the only worker until it is released.
+		CHECK(pool.post([&started, released]() {
+			started.set_value();
+			released.wait();
+		}));
+
+		started.get_future().wait();
+
+		CHECK(pool.post(&throw_runtime_error));
+
+		// The queue is full: this one is rejected and its error handler is never called.
+		bool error_handler_called = false;
+
+		CHECK(!pool.post(&throw_runtime_error, [&error_handler_called](std::exception_ptr) {
+			error_handler_called = true;
+		}));
+
+		fscp::worker_pool_statistics_type statistics = pool.statistics();
+
+		CHECK(statistics.queue_depth == 2);
+		CHECK(statistics.peak_queue_depth == 2);
+		CHECK(statistics.rejected == 1);
+
+		release.set_value();
+
+		boost::promise<void> done;
+		boost::unique_future<void> done_future = done.get_future();
+
+		while (!pool.post([&done]() { done.set_value(); })) {}
+
+		done_future.wait();
+
+		// The queue depth is decreased after the task returns.
+		while (pool.statistics().queue_depth != 0) {}
+
+		statistics = pool.statistics();
+
+		CHECK(statistics.completed == 3);
+		CHECK(statistics.failed == 1);
+		CHECK(!error_handler_called);
+	}
+}
+
+int main()
+{
+	test_thread_count();
+	test_failing_tasks();
+	test_statistics();
+
+	return check_result("worker_pool");
+}